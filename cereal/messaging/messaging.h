@@ -1,5 +1,6 @@
 #pragma once
 #include <cstddef>
+#include <cstring>
 #include <map>
 #include <string>
 #include <vector>
@@ -92,9 +93,27 @@ private:
   std::map<std::string, SubMessage *> services_;
 };
 
+// Preallocated, reusable first segment for a MessageBuilder. Keep one per message type that is sent every frame:
+// building into it doesn't touch the heap, and single segment messages serialize without a copy.
+class MessageArena {
+public:
+  MessageArena(size_t segment_words) : buf_(kj::heapArray<capnp::word>(segment_words + 1)) {
+    // capnp requires a zeroed first segment, MallocMessageBuilder zeroes what it used on destruction
+    memset(buf_.begin(), 0, buf_.size() * sizeof(capnp::word));
+  }
+  // the first word is reserved for the segment table of the flat message
+  inline kj::ArrayPtr<capnp::word> segment() { return buf_.slice(1, buf_.size()); }
+
+private:
+  kj::Array<capnp::word> buf_;
+  kj::Array<capnp::word> flat_;
+  friend class MessageBuilder;
+};
+
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  MessageBuilder(MessageArena &arena) : capnp::MallocMessageBuilder(arena.segment()), arena_(&arena) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -107,12 +126,46 @@ public:
   }
 
   kj::ArrayPtr<capnp::byte> toBytes() {
-    heapArray_ = capnp::messageToFlatArray(*this);
-    return heapArray_.asBytes();
+    auto segments = getSegmentsForOutput();
+    if (arena_ == nullptr) {
+      heapArray_ = capnp::messageToFlatArray(segments);
+      return heapArray_.asBytes();
+    }
+
+    if (segments.size() == 1 && segments[0].begin() == arena_->segment().begin()) {
+      // the message fit the arena, the segment table goes into the reserved word right in front of it
+      uint32_t *table = (uint32_t *)arena_->buf_.begin();
+      table[0] = 0;
+      table[1] = segments[0].size();
+      return kj::arrayPtr((capnp::byte *)table, (segments[0].size() + 1) * sizeof(capnp::word));
+    }
+
+    // multiple segments (e.g. referenced external data), gather them into the arena's reusable flat buffer
+    const size_t table_words = (segments.size() + 2) / 2;
+    size_t total_words = table_words;
+    for (auto &seg : segments) total_words += seg.size();
+    if (arena_->flat_.size() < total_words) {
+      arena_->flat_ = kj::heapArray<capnp::word>(total_words);
+    }
+    uint32_t *table = (uint32_t *)arena_->flat_.begin();
+    table[0] = segments.size() - 1;
+    for (size_t i = 0; i < segments.size(); i++) {
+      table[i + 1] = segments[i].size();
+    }
+    if (segments.size() % 2 == 0) {
+      table[segments.size() + 1] = 0;  // padding
+    }
+    capnp::word *dst = arena_->flat_.begin() + table_words;
+    for (auto &seg : segments) {
+      memcpy(dst, seg.begin(), seg.size() * sizeof(capnp::word));
+      dst += seg.size();
+    }
+    return kj::arrayPtr((capnp::byte *)arena_->flat_.begin(), total_words * sizeof(capnp::word));
   }
 
 private:
   kj::Array<capnp::word> heapArray_;
+  MessageArena *arena_ = nullptr;
 };
 
 class PubMaster {
@@ -22,6 +22,7 @@
 #include <stdio.h>
 
 #include "msgq.h"
+#include "shm.h"
 
 void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
@@ -104,7 +105,7 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
     close(fd);
     return -1;
   }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char * mem = (char*)shm_mmap(fd, size + sizeof(msgq_header_t));
   close(fd);
 
   if (mem == NULL){
@@ -0,0 +1,139 @@
+#include "shm.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static size_t hugetlb_page_size() {
+  size_t size = 0;
+  FILE *f = fopen("/proc/meminfo", "r");
+  if (f) {
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "Hugepagesize: %zu kB", &size) == 1) break;
+    }
+    fclose(f);
+  }
+  return size * 1024;
+}
+
+static void warn_once(bool &warned, const char *msg) {
+  if (!warned) {
+    std::cout << "Warning, " << msg << ": " << strerror(errno) << std::endl;
+    warned = true;
+  }
+}
+
+const ShmPolicy &ShmPolicy::get() {
+  static const ShmPolicy policy = []() {
+    ShmPolicy p;
+    const char *huge_pages = getenv("SHM_HUGEPAGES");
+    if (huge_pages && strcmp(huge_pages, "hugetlb") == 0) {
+      p.huge_pages = HUGETLB;
+    } else if (huge_pages && strcmp(huge_pages, "thp") == 0) {
+      p.huge_pages = THP;
+    }
+    p.prefault = getenv("SHM_PREFAULT") && strcmp(getenv("SHM_PREFAULT"), "1") == 0;
+    p.lock = getenv("SHM_MLOCK") && strcmp(getenv("SHM_MLOCK"), "1") == 0;
+    p.numa_node = getenv("SHM_NUMA_NODE") ? atoi(getenv("SHM_NUMA_NODE")) : -1;
+    return p;
+  }();
+  return policy;
+}
+
+int shm_memfd(const char *name, size_t *len) {
+#ifdef __linux__
+  if (ShmPolicy::get().huge_pages == ShmPolicy::HUGETLB) {
+    static size_t page_size = hugetlb_page_size();
+    static bool warned = false;
+    if (page_size > 0) {
+      const size_t huge_len = (*len + page_size - 1) / page_size * page_size;
+      int fd = memfd_create(name, MFD_CLOEXEC | MFD_HUGETLB);
+      if (fd >= 0 && ftruncate(fd, huge_len) == 0) {
+        // shared hugetlb mappings reserve their pages on mmap, an empty pool fails here instead of SIGBUS on first touch
+        void *addr = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED) {
+          munmap(addr, huge_len);
+          *len = huge_len;
+          return fd;
+        }
+      }
+      warn_once(warned, "no hugetlb pages for shared memory, falling back to thp");
+      if (fd >= 0) close(fd);
+    }
+  }
+
+  int fd = memfd_create(name, MFD_CLOEXEC);
+  if (fd >= 0 && ftruncate(fd, *len) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+void *shm_mmap(int fd, size_t len) {
+  const ShmPolicy &policy = ShmPolicy::get();
+  void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  // best effort, the memory works the same without any of these
+#ifdef __linux__
+  if (policy.huge_pages != ShmPolicy::NONE) {
+    // EINVAL on hugetlb files, they already are huge pages
+    madvise(addr, len, MADV_HUGEPAGE);
+  }
+  if (policy.numa_node >= 0) {
+    static bool warned = false;
+    unsigned long mask[16] = {};
+    if (policy.numa_node >= (int)(sizeof(mask) * 8)) {
+      errno = EINVAL;
+      warn_once(warned, "could not bind shared memory to NUMA node");
+    } else {
+      mask[policy.numa_node / (sizeof(unsigned long) * 8)] |= 1UL << (policy.numa_node % (sizeof(unsigned long) * 8));
+      if (syscall(SYS_mbind, addr, len, MPOL_BIND, mask, sizeof(mask) * 8 + 1, 0) != 0) {
+        warn_once(warned, "could not bind shared memory to NUMA node");
+      }
+    }
+  }
+#endif
+
+  if (policy.lock) {
+    // faults in the pages as well
+    static bool warned = false;
+    if (mlock(addr, len) != 0) {
+      warn_once(warned, "could not mlock shared memory");
+    }
+  } else if (policy.prefault) {
+#ifdef __linux__
+    if (madvise(addr, len, MADV_POPULATE_WRITE) == 0) {
+      return addr;
+    }
+#endif
+    // older kernels, touch every page. other processes may be using the memory already, so without changing it
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < len; i += page_size) {
+      __atomic_fetch_or((uint8_t *)addr + i, 0, __ATOMIC_RELAXED);
+    }
+  }
+  return addr;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+
+// allocation policy for the shared memory of msgq queues and VisionIPC buffers, from the environment:
+//   SHM_HUGEPAGES=thp      transparent huge pages (needs shmem_enabled=advise or always)
+//   SHM_HUGEPAGES=hugetlb  memfds from the hugetlb pool (VisionIPC only, falls back to thp),
+//                          msgq queues are named /dev/shm files and use thp
+//   SHM_PREFAULT=1         fault in all pages when mapping, so the first frame doesn't page fault
+//   SHM_MLOCK=1            lock the mapping in memory
+//   SHM_NUMA_NODE=n        bind the pages to NUMA node n
+struct ShmPolicy {
+  enum HugePages { NONE, THP, HUGETLB };
+
+  HugePages huge_pages = NONE;
+  bool prefault = false;
+  bool lock = false;
+  int numa_node = -1;
+
+  static const ShmPolicy &get();
+};
+
+// anonymous shared memory file of at least *len bytes, *len is rounded up to the page size
+// of the file. returns -1 on failure
+int shm_memfd(const char *name, size_t *len);
+
+// maps len bytes of fd shared and read/write with the policy applied. returns NULL on failure
+void *shm_mmap(int fd, size_t len);
@@ -0,0 +1,107 @@
+// benchmark for the shared memory allocation policies of msgq and VisionIPC
+// usage: ./shm_benchmark [NUMA node]
+// every policy runs in a forked child with its SHM_* environment, see shm.h. measures allocating a
+// camera's four yuv buffers and a msgq queue, writing the first and following frames, random reads
+// over all buffers (TLB bound) and the msgq throughput of 1MB messages
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "messaging/msgq.h"
+#include "visionipc/visionbuf.h"
+
+const int NUM_BUFS = 4;
+const size_t FRAME_SIZE = 1928 * 1208 * 3 / 2;
+
+static double millis() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void run() {
+  std::vector<uint8_t> frame(FRAME_SIZE, 0x80);
+
+  double t1 = millis();
+  VisionBuf bufs[NUM_BUFS];
+  for (auto &b : bufs) b.allocate(FRAME_SIZE);
+  double t2 = millis();
+  for (auto &b : bufs) memcpy(b.addr, frame.data(), FRAME_SIZE);
+  double t3 = millis();
+  for (auto &b : bufs) memcpy(b.addr, frame.data(), FRAME_SIZE);
+  double t4 = millis();
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<size_t> dist(0, FRAME_SIZE - 1);
+  const int reads = 4 << 20;
+  uint64_t sum = 0;
+  double t5 = millis();
+  for (int i = 0; i < reads; i++) {
+    sum += ((uint8_t *)bufs[i % NUM_BUFS].addr)[dist(gen)];
+  }
+  double t6 = millis();
+  for (auto &b : bufs) b.free();
+
+  const std::string path = "shm_benchmark_" + std::to_string(getpid());
+  msgq_queue_t pub = {}, sub = {};
+  double t7 = millis();
+  msgq_new_queue(&pub, path.c_str(), DEFAULT_SEGMENT_SIZE);
+  msgq_new_queue(&sub, path.c_str(), DEFAULT_SEGMENT_SIZE);
+  double t8 = millis();
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  const int msgs = 1000;
+  msgq_msg_t msg, recv_msg;
+  msgq_msg_init_size(&msg, 1 << 20);
+  memset(msg.data, 0x80, msg.size);
+  double t9 = millis();
+  for (int i = 0; i < msgs; i++) {
+    msgq_msg_send(&msg, &pub);
+    if (msgq_msg_recv(&recv_msg, &sub) > 0) {
+      sum += recv_msg.data[i];
+      msgq_msg_close(&recv_msg);
+    }
+  }
+  double t10 = millis();
+  msgq_msg_close(&msg);
+  msgq_close_queue(&pub);
+  msgq_close_queue(&sub);
+  unlink(("/dev/shm/" + path).c_str());
+
+  printf("  vipc alloc %6.2fms  first frame %6.2fms  frame %6.2fms  random read %5.2fns  |  msgq alloc %6.2fms  %7.1f MB/s  (%d)\n",
+         t2 - t1, (t3 - t2) / NUM_BUFS, (t4 - t3) / NUM_BUFS, (t6 - t5) * 1e6 / reads, t8 - t7, msgs / ((t10 - t9) / 1000), (int)(sum % 10));
+}
+
+int main(int argc, char **argv) {
+  std::string numa = argc > 1 ? argv[1] : "0";
+  std::vector<std::pair<const char *, std::vector<std::pair<const char *, std::string>>>> policies = {
+    {"4k pages", {}},
+    {"4k pages, prefault", {{"SHM_PREFAULT", "1"}}},
+    {"thp", {{"SHM_HUGEPAGES", "thp"}}},
+    {"thp, prefault", {{"SHM_HUGEPAGES", "thp"}, {"SHM_PREFAULT", "1"}}},
+    {"hugetlb, prefault", {{"SHM_HUGEPAGES", "hugetlb"}, {"SHM_PREFAULT", "1"}}},
+    {"thp, mlock", {{"SHM_HUGEPAGES", "thp"}, {"SHM_MLOCK", "1"}}},
+    {"thp, prefault, numa", {{"SHM_HUGEPAGES", "thp"}, {"SHM_PREFAULT", "1"}, {"SHM_NUMA_NODE", numa}}},
+  };
+
+  for (auto &[name, env] : policies) {
+    printf("%s\n", name);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      for (auto &[key, value] : env) setenv(key, value.c_str(), 1);
+      run();
+      exit(0);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return 0;
+}
@@ -60,8 +60,12 @@ services = {
   "wideRoadEncodeIdx": (True, 20., 1),
   "wideRoadCameraState": (True, 20., 20),
   "modelV2": (True, 20., 40),
+  "wideRoadModelV2": (True, 20., 40),
+  "wideRoadCameraOdometry": (True, 20., 5),
   "managerState": (True, 2., 1),
   "uploaderState": (True, 0., 1),
+  "threadLog": (True, 0.),
+  "loggerdState": (True, 1.),
 
   # debug
   "testJoystick": (False, 0.),
@@ -46,6 +46,8 @@ class VisionBuf {
   // OpenCL
   cl_mem buf_cl = nullptr;
   cl_command_queue copy_q = nullptr;
+  // the device works on the host memory of buf_cl, sync only maps and unmaps it
+  bool host_unified = false;
 
   // ion
   int handle = 0;
@@ -9,35 +9,45 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 
+#include "messaging/shm.h"
+
 std::atomic<int> offset = 0;
 
-static void *malloc_with_fd(size_t len, int *fd) {
-  char full_path[0x100];
+static void *malloc_with_fd(size_t *len, int *fd) {
+  char name[0x40];
+  snprintf(name, sizeof(name)-1, "visionbuf_%d_%d", getpid(), offset++);
 
+  // memfd with the huge page policy, a plain shm file where there are no memfds
+  *fd = shm_memfd(name, len);
+  if (*fd < 0) {
+    char full_path[0x100];
 #ifdef __APPLE__
-  snprintf(full_path, sizeof(full_path)-1, "/tmp/visionbuf_%d_%d", getpid(), offset++);
+    snprintf(full_path, sizeof(full_path)-1, "/tmp/%s", name);
 #else
-  snprintf(full_path, sizeof(full_path)-1, "/dev/shm/visionbuf_%d_%d", getpid(), offset++);
+    snprintf(full_path, sizeof(full_path)-1, "/dev/shm/%s", name);
 #endif
 
-  *fd = open(full_path, O_RDWR | O_CREAT, 0664);
-  assert(*fd >= 0);
+    *fd = open(full_path, O_RDWR | O_CREAT, 0664);
+    assert(*fd >= 0);
+
+    unlink(full_path);
 
-  unlink(full_path);
+    ftruncate(*fd, *len);
+  }
 
-  ftruncate(*fd, len);
-  void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
-  assert(addr != MAP_FAILED);
+  void *addr = shm_mmap(*fd, *len);
+  assert(addr != NULL);
 
   return addr;
 }
 
 void VisionBuf::allocate(size_t len) {
   int fd;
-  void *addr = malloc_with_fd(len, &fd);
+  size_t mmap_len = len;
+  void *addr = malloc_with_fd(&mmap_len, &fd);
 
   this->len = len;
-  this->mmap_len = len;
+  this->mmap_len = mmap_len;
   this->addr = addr;
   this->fd = fd;
 }
@@ -50,13 +60,17 @@ void VisionBuf::init_cl(cl_device_id device_id, cl_context ctx){
 
   this->buf_cl = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, this->len, this->addr, &err);
   assert(err == 0);
+
+  cl_bool unified = CL_FALSE;
+  err = clGetDeviceInfo(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+  this->host_unified = err == 0 && unified;
 }
 
 
 void VisionBuf::import(){
   assert(this->fd >= 0);
-  this->addr = mmap(NULL, this->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
-  assert(this->addr != MAP_FAILED);
+  this->addr = shm_mmap(this->fd, this->mmap_len);
+  assert(this->addr != NULL);
 }
 
 
@@ -64,7 +78,16 @@ int VisionBuf::sync(int dir) {
   int err = 0;
   if (!this->buf_cl) return 0;
 
-  if (dir == VISIONBUF_SYNC_FROM_DEVICE) {
+  if (this->host_unified) {
+    // CL_MEM_USE_HOST_PTR on a unified memory device is the shm mapping itself,
+    // mapping and unmapping hands it between host and device without copying the frame
+    const cl_map_flags flags = dir == VISIONBUF_SYNC_FROM_DEVICE ? CL_MAP_READ : CL_MAP_WRITE_INVALIDATE_REGION;
+    void *ptr = clEnqueueMapBuffer(this->copy_q, this->buf_cl, CL_TRUE, flags, 0, this->len, 0, NULL, NULL, &err);
+    if (err == 0) {
+      assert(ptr == this->addr);
+      err = clEnqueueUnmapMemObject(this->copy_q, this->buf_cl, ptr, 0, NULL, NULL);
+    }
+  } else if (dir == VISIONBUF_SYNC_FROM_DEVICE) {
     err = clEnqueueReadBuffer(this->copy_q, this->buf_cl, CL_FALSE, 0, this->len, this->addr, 0, NULL, NULL);
   } else {
     err = clEnqueueWriteBuffer(this->copy_q, this->buf_cl, CL_FALSE, 0, this->len, this->addr, 0, NULL, NULL);
@@ -87,7 +110,7 @@ int VisionBuf::free() {
     if (err != 0) return err;
   }
 
-  err = munmap(this->addr, this->len);
+  err = munmap(this->addr, this->mmap_len);
   if (err != 0) return err;
 
   err = close(this->fd);
@@ -0,0 +1,84 @@
+// benchmark for the frame receive throughput of VisionIpcClient
+// usage: ./visionipc_benchmark [frames]
+// one 1928x1208 yuv stream, the server sends a frame and waits for the client to receive it.
+// the client runs host only, with an OpenCL context syncing every frame to the device, and with the sync skipped
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "visionipc/visionipc_client.h"
+#include "visionipc/visionipc_server.h"
+
+static double millis() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char *name, std::vector<double> &times, double total) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-14s mean %6.3fms  p50 %6.3fms  p99 %6.3fms  max %7.3fms  %7.1f frames/s\n",
+         name, sum / times.size(), pct(0.5), pct(0.99), times.back(), times.size() / total * 1000);
+}
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 1000;
+
+  cl_device_id device_id = nullptr;
+  cl_context ctx = nullptr;
+  cl_platform_id platform_id = nullptr;
+  cl_uint num = 0;
+  if (clGetPlatformIDs(1, &platform_id, &num) == CL_SUCCESS && num > 0 &&
+      clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_DEFAULT, 1, &device_id, &num) == CL_SUCCESS && num > 0) {
+    ctx = clCreateContext(NULL, 1, &device_id, NULL, NULL, NULL);
+  } else {
+    device_id = nullptr;
+    printf("no OpenCL device, only benchmarking the host only client\n");
+  }
+
+  VisionIpcServer server("camerad", device_id, ctx);
+  server.create_buffers(VISION_STREAM_YUV_BACK, 4, false, 1928, 1208);
+  server.start_listener();
+
+  struct Config {
+    const char *name;
+    bool cl;
+    bool device_sync;
+  };
+  for (auto cfg : {Config{"host only", false, false}, Config{"device sync", true, true}, Config{"no device sync", true, false}}) {
+    if (cfg.cl && !device_id) continue;
+
+    VisionIpcClient client("camerad", VISION_STREAM_YUV_BACK, false, cfg.cl ? device_id : nullptr, cfg.cl ? ctx : nullptr);
+    client.device_sync = cfg.device_sync;
+    client.connect();
+    if (cfg.cl) {
+      printf("%s unified memory\n", client.buffers[0].host_unified ? "device has" : "device has no");
+    }
+
+    std::vector<double> times;
+    double start = millis();
+    for (int i = 0; i < frames; i++) {
+      VisionBuf *buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+      buf->y[i % buf->len] = i;
+      VisionIpcBufExtra extra = {};
+      extra.frame_id = i;
+
+      double t = millis();
+      server.send(buf, &extra, false);
+      VisionBuf *recv_buf = nullptr;
+      while (!recv_buf) {
+        recv_buf = client.recv(&extra);
+      }
+      times.push_back(millis() - t);
+    }
+    report(cfg.name, times, millis() - start);
+  }
+
+  if (ctx) clReleaseContext(ctx);
+  return 0;
+}
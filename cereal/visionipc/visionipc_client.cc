@@ -106,7 +106,7 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     *extra = packet->extra;
   }
 
-  if (buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
+  if (device_sync && buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
     LOGE("Failed to sync buffer");
   }
 
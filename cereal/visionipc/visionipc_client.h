@@ -23,6 +23,8 @@ private:
 
 public:
   bool connected = false;
+  // clients that only read the frames on the host (encoders, UI) can skip syncing them to the device
+  bool device_sync = true;
   int num_buffers = 0;
   VisionBuf buffers[VISIONIPC_MAX_FDS];
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
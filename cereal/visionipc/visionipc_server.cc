@@ -122,6 +122,7 @@ void VisionIpcServer::listener(){
       // Remove some private openCL/ion metadata
       bufs[i].buf_cl = 0;
       bufs[i].copy_q = 0;
+      bufs[i].host_unified = false;
       bufs[i].handle = 0;
 
       bufs[i].server_id = server_id;
@@ -236,3 +236,197 @@ void can_send(CAN_FIFOMailBox_TypeDef *to_push, uint8_t bus_number, bool skip_tx
 void can_set_forwarding(int from, int to) {
   can_forwarding[from] = to;
 }
+
+// ******************* USB framing *********************
+// version 1: every message is a 16 byte CAN_FIFOMailBox_TypeDef.
+// version 2: a stream of variable length records, cut into 64 byte usb packets. a packet is
+//   byte 0: number of stream bytes in the packet (at most 62)
+//   byte 1: offset of the first record starting in the packet, 0xFF if none does (the record continues)
+//   the stream bytes
+// so the other side can sync up again after a lost packet. a record is
+//   byte 0: bits 0-3 length, bits 4-5 bus, bit 6 returned (CAN_BUS_RET_FLAG), bit 7 extended
+//   2 bytes address, 4 if extended (little endian)
+//   2 bytes bus time
+//   the data
+// the host asks for a version with 0xfa, enumeration goes back to version 1
+#define CAN_USB_VERSION_MAX 2U
+#define CAN_USB_PACKET_SIZE 0x40U
+#define CAN_USB_PACKET_HEADER 2U
+#define CAN_USB_RECORD_MAX 15U
+#define CAN_USB_NO_START 0xFFU
+
+uint8_t can_usb_version = 1U;
+
+// record being sent to the host
+uint8_t can_usb_in_record[CAN_USB_RECORD_MAX];
+uint8_t can_usb_in_len = 0U;
+uint8_t can_usb_in_pos = 0U;
+
+// record being received from the host
+uint8_t can_usb_out_record[CAN_USB_RECORD_MAX];
+uint8_t can_usb_out_len = 0U;
+bool can_usb_out_synced = false;
+
+uint8_t can_usb_set_version(uint8_t version) {
+  ENTER_CRITICAL();
+  can_usb_version = ((version >= 1U) && (version <= CAN_USB_VERSION_MAX)) ? version : 1U;
+  can_usb_in_len = 0U;
+  can_usb_in_pos = 0U;
+  can_usb_out_len = 0U;
+  can_usb_out_synced = false;
+  EXIT_CRITICAL();
+  return can_usb_version;
+}
+
+// length of the record starting with header, 0 if it's invalid
+uint8_t can_usb_record_len(uint8_t header) {
+  uint8_t len = header & 0xFU;
+  uint8_t ret = 0U;
+  if (len <= 8U) {
+    ret = 1U + (((header & 0x80U) != 0U) ? 4U : 2U) + 2U + len;
+  }
+  return ret;
+}
+
+uint8_t can_usb_pack_record(CAN_FIFOMailBox_TypeDef *msg, uint8_t *record) {
+  uint8_t bus = GET_BUS(msg);
+  uint8_t len = MIN(GET_LEN(msg), 8U);
+  bool extended = (msg->RIR & 4U) != 0U;
+  uint32_t addr = GET_ADDR(msg);
+  uint8_t pos = 0U;
+
+  record[pos] = len | ((bus & 0x3U) << 4) | (((bus & CAN_BUS_RET_FLAG) != 0U) ? 0x40U : 0U) | (extended ? 0x80U : 0U);
+  pos += 1U;
+  for (uint8_t i = 0U; i < (extended ? 4U : 2U); i++) {
+    record[pos] = (addr >> (8U * i)) & 0xFFU;
+    pos += 1U;
+  }
+  record[pos] = (msg->RDTR >> 16) & 0xFFU;
+  record[pos + 1U] = (msg->RDTR >> 24) & 0xFFU;
+  pos += 2U;
+  for (uint8_t i = 0U; i < len; i++) {
+    record[pos] = GET_BYTE(msg, i);
+    pos += 1U;
+  }
+  return pos;
+}
+
+void can_usb_unpack_record(uint8_t *record, CAN_FIFOMailBox_TypeDef *msg) {
+  uint8_t len = record[0] & 0xFU;
+  bool extended = (record[0] & 0x80U) != 0U;
+  uint8_t pos = 1U;
+  uint32_t addr = 0U;
+
+  for (uint8_t i = 0U; i < (extended ? 4U : 2U); i++) {
+    addr |= ((uint32_t)record[pos]) << (8U * i);
+    pos += 1U;
+  }
+  msg->RIR = extended ? ((addr << 3) | 5U) : ((addr << 21) | 1U);
+  msg->RDTR = len | (((record[0] >> 4) & 0x3U) << 4);
+  pos += 2U;  // bus time isn't sent
+  uint32_t data[2] = {0U, 0U};
+  for (uint8_t i = 0U; i < len; i++) {
+    data[i / 4U] |= ((uint32_t)record[pos]) << (8U * (i % 4U));
+    pos += 1U;
+  }
+  msg->RDLR = data[0];
+  msg->RDHR = data[1];
+}
+
+// fills a usb packet with messages from can_rx_q, returns its length
+int can_usb_pack_in(uint8_t *packet, int len) {
+  int pos = 0;
+  if (can_usb_version == 1U) {
+    CAN_FIFOMailBox_TypeDef *reply = (CAN_FIFOMailBox_TypeDef *)packet;
+    int ilen = 0;
+    while ((ilen < MIN(len / 0x10, 4)) && can_pop(&can_rx_q, &reply[ilen])) {
+      ilen++;
+    }
+    pos = ilen * 0x10;
+  } else {
+    uint8_t start = CAN_USB_NO_START;
+    pos = (int)CAN_USB_PACKET_HEADER;
+    while (pos < len) {
+      if (can_usb_in_pos == can_usb_in_len) {
+        CAN_FIFOMailBox_TypeDef msg;
+        if (!can_pop(&can_rx_q, &msg)) {
+          break;
+        }
+        can_usb_in_len = can_usb_pack_record(&msg, can_usb_in_record);
+        can_usb_in_pos = 0U;
+        if (start == CAN_USB_NO_START) {
+          start = pos - (int)CAN_USB_PACKET_HEADER;
+        }
+      }
+      int n = MIN(len - pos, (int)can_usb_in_len - (int)can_usb_in_pos);
+      (void)memcpy(&packet[pos], &can_usb_in_record[can_usb_in_pos], n);
+      pos += n;
+      can_usb_in_pos += (uint8_t)n;
+    }
+    if (pos == (int)CAN_USB_PACKET_HEADER) {
+      pos = 0;
+    } else {
+      packet[0] = pos - (int)CAN_USB_PACKET_HEADER;
+      packet[1] = start;
+    }
+  }
+  return pos;
+}
+
+// sends the messages in a usb packet from the host
+void can_usb_unpack_out(uint8_t *packet, int len) {
+  if (can_usb_version == 1U) {
+    uint32_t *d32 = (uint32_t *)packet;
+    for (int dpkt = 0; dpkt < (len / 4); dpkt += 4) {
+      CAN_FIFOMailBox_TypeDef to_push;
+      to_push.RDHR = d32[dpkt + 3];
+      to_push.RDLR = d32[dpkt + 2];
+      to_push.RDTR = d32[dpkt + 1];
+      to_push.RIR = d32[dpkt];
+
+      uint8_t bus_number = (to_push.RDTR >> 4) & CAN_BUS_NUM_MASK;
+      can_send(&to_push, bus_number, false);
+    }
+  } else if (len >= (int)CAN_USB_PACKET_HEADER) {
+    int n = MIN((int)packet[0], len - (int)CAN_USB_PACKET_HEADER);
+    uint8_t *stream = &packet[CAN_USB_PACKET_HEADER];
+    uint8_t start = packet[1];
+    int pos = 0;
+
+    // the first record has to start where the last one ends
+    if (can_usb_out_synced) {
+      int expected = (can_usb_out_len > 0U) ? ((int)can_usb_record_len(can_usb_out_record[0]) - (int)can_usb_out_len) : 0;
+      if ((int)start != ((expected < n) ? expected : (int)CAN_USB_NO_START)) {
+        can_usb_out_synced = false;
+        can_send_errs += 1U;
+      }
+    }
+    if (!can_usb_out_synced) {
+      pos = (start == CAN_USB_NO_START) ? n : (int)start;
+      can_usb_out_synced = (start != CAN_USB_NO_START);
+      can_usb_out_len = 0U;
+    }
+    while (pos < n) {
+      uint8_t record_len = can_usb_record_len((can_usb_out_len > 0U) ? can_usb_out_record[0] : stream[pos]);
+      if (record_len == 0U) {
+        // lost track of the records, wait for the next start
+        can_usb_out_synced = false;
+        can_send_errs += 1U;
+        break;
+      }
+      int take = MIN(n - pos, (int)record_len - (int)can_usb_out_len);
+      (void)memcpy(&can_usb_out_record[can_usb_out_len], &stream[pos], take);
+      can_usb_out_len += (uint8_t)take;
+      pos += take;
+
+      if (can_usb_out_len == record_len) {
+        CAN_FIFOMailBox_TypeDef to_push;
+        can_usb_unpack_record(can_usb_out_record, &to_push);
+        can_usb_out_len = 0U;
+        can_send(&to_push, GET_BUS(&to_push), false);
+      }
+    }
+  } else {
+    // empty packet
+  }
+}
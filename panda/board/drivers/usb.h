@@ -23,7 +23,8 @@ typedef union _USB_Setup {
 }
 USB_Setup_TypeDef;
 
-#define MAX_CAN_MSGS_PER_BULK_TRANSFER 4U
+// 4 in version 1, up to 12 records and the end of one more in version 2
+#define MAX_CAN_MSGS_PER_BULK_TRANSFER 13U
 
 bool usb_eopf_detected = false;
 
@@ -194,12 +194,7 @@ int get_rtc_pkt(void *dat) {
 
 int usb_cb_ep1_in(void *usbdata, int len, bool hardwired) {
   UNUSED(hardwired);
-  CAN_FIFOMailBox_TypeDef *reply = (CAN_FIFOMailBox_TypeDef *)usbdata;
-  int ilen = 0;
-  while (ilen < MIN(len/0x10, 4) && can_pop(&can_rx_q, &reply[ilen])) {
-    ilen++;
-  }
-  return ilen*0x10;
+  return can_usb_pack_in((uint8_t *)usbdata, len);
 }
 
 // send on serial, first byte to select the ring
@@ -221,18 +216,7 @@ void usb_cb_ep2_out(void *usbdata, int len, bool hardwired) {
 // send on CAN
 void usb_cb_ep3_out(void *usbdata, int len, bool hardwired) {
   UNUSED(hardwired);
-  int dpkt = 0;
-  uint32_t *d32 = (uint32_t *)usbdata;
-  for (dpkt = 0; dpkt < (len / 4); dpkt += 4) {
-    CAN_FIFOMailBox_TypeDef to_push;
-    to_push.RDHR = d32[dpkt + 3];
-    to_push.RDLR = d32[dpkt + 2];
-    to_push.RDTR = d32[dpkt + 1];
-    to_push.RIR = d32[dpkt];
-
-    uint8_t bus_number = (to_push.RDTR >> 4) & CAN_BUS_NUM_MASK;
-    can_send(&to_push, bus_number, false);
-  }
+  can_usb_unpack_out((uint8_t *)usbdata, len);
 }
 
 void usb_cb_ep3_out_complete(void) {
@@ -244,6 +228,7 @@ void usb_cb_ep3_out_complete(void) {
 void usb_cb_enumeration_complete(void) {
   puts("USB enumeration complete\n");
   is_enumerated = 1;
+  (void)can_usb_set_version(1U);
 }
 
 int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired) {
@@ -633,6 +618,12 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
         UNUSED(ret);
       }
       break;
+    // **** 0xfa: set CAN usb packet version
+    // wValue = version the host wants, replies with the version used from now on
+    case 0xfa:
+      resp[0] = can_usb_set_version(MIN(setup->b.wValue.w, CAN_USB_VERSION_MAX));
+      resp_len = 1;
+      break;
     default:
       puts("NO HANDLER ");
       puth(setup->b.bRequest);
@@ -44,6 +44,11 @@ uint16_t current_safety_mode = SAFETY_SILENT;
 int16_t current_safety_param = 0;
 const safety_hooks *current_hooks = &nooutput_hooks;
 const addr_checks *current_rx_checks = &default_rx_checks;
+safety_lookup rx_lookup = {.list = NULL};
+safety_lookup tx_lookup = {.list = NULL};
+// the tx list the init of the current mode set
+const CanMsg *current_tx_msgs = NULL;
+int current_tx_msgs_len = 0;
 
 int safety_rx_hook(CAN_FIFOMailBox_TypeDef *to_push) {
   return current_hooks->rx(to_push);
@@ -76,16 +81,108 @@ void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   }
 }
 
+static uint32_t safety_lookup_hash(uint32_t addr, uint8_t bus, uint8_t len) {
+  uint32_t key = addr ^ ((uint32_t)bus << 24) ^ ((uint32_t)len << 28);
+  return (key * 2654435761U) >> (32U - SAFETY_LOOKUP_BITS);
+}
+
+static bool safety_lookup_match(const safety_lookup_msg *msg, uint32_t addr, uint8_t bus, uint8_t len) {
+  return (msg->addr == addr) && (msg->bus == bus) && (msg->len == len);
+}
+
+// starts building a lookup for list, it's not used until safety_lookup_finish
+void safety_lookup_reset(safety_lookup *lookup, int len) {
+  lookup->list = NULL;
+  lookup->len = len;
+  lookup->msgs_len = 0;
+  for (uint32_t i = 0U; i < SAFETY_LOOKUP_SLOTS; i++) {
+    lookup->slots[i] = 0U;
+  }
+}
+
+// adds a message, in the order the list is gone through. false if it doesn't fit
+bool safety_lookup_add(safety_lookup *lookup, int addr, int bus, int len, int index, int msg) {
+  bool fits = (lookup->msgs_len >= 0) && (lookup->msgs_len < (int)SAFETY_LOOKUP_MSGS) &&
+              (addr >= 0) && (bus >= 0) && (bus <= 0xFF) && (len >= 0) && (len <= 0xF) && (index <= 0xFF);
+  if (fits) {
+    safety_lookup_msg *m = &lookup->msgs[lookup->msgs_len];
+    m->addr = (uint32_t)addr;
+    m->bus = (uint8_t)bus;
+    m->len = (uint8_t)len;
+    m->index = (uint8_t)index;
+    m->msg = (uint8_t)msg;
+    lookup->msgs_len += 1;
+  } else {
+    lookup->msgs_len = -1;
+  }
+  return fits;
+}
+
+// sorts the messages by key, keeping the list's order within a key, and hashes where every key starts
+void safety_lookup_finish(safety_lookup *lookup, const void *list) {
+  for (int i = 1; i < lookup->msgs_len; i++) {
+    safety_lookup_msg m = lookup->msgs[i];
+    int j = i;
+    while ((j > 0) && ((lookup->msgs[j - 1].addr > m.addr) ||
+                       ((lookup->msgs[j - 1].addr == m.addr) && (lookup->msgs[j - 1].bus > m.bus)) ||
+                       ((lookup->msgs[j - 1].addr == m.addr) && (lookup->msgs[j - 1].bus == m.bus) && (lookup->msgs[j - 1].len > m.len)))) {
+      lookup->msgs[j] = lookup->msgs[j - 1];
+      j--;
+    }
+    lookup->msgs[j] = m;
+  }
+
+  for (int i = 0; i < lookup->msgs_len; i++) {
+    const safety_lookup_msg *m = &lookup->msgs[i];
+    if ((i == 0) || !safety_lookup_match(&lookup->msgs[i - 1], m->addr, m->bus, m->len)) {
+      // at most half full, there's always a free slot
+      uint32_t slot = safety_lookup_hash(m->addr, m->bus, m->len);
+      while (lookup->slots[slot] != 0U) {
+        slot = (slot + 1U) & (SAFETY_LOOKUP_SLOTS - 1U);
+      }
+      lookup->slots[slot] = (uint8_t)(i + 1);
+    }
+  }
+  lookup->list = list;
+}
+
+// first message with the key, -1 if there is none
+int safety_lookup_find(const safety_lookup *lookup, int addr, int bus, int len) {
+  int ret = -1;
+  if ((addr >= 0) && (bus >= 0) && (bus <= 0xFF) && (len >= 0) && (len <= 0xF)) {
+    uint32_t slot = safety_lookup_hash((uint32_t)addr, (uint8_t)bus, (uint8_t)len);
+    while (lookup->slots[slot] != 0U) {
+      int i = (int)lookup->slots[slot] - 1;
+      if (safety_lookup_match(&lookup->msgs[i], (uint32_t)addr, (uint8_t)bus, (uint8_t)len)) {
+        ret = i;
+        break;
+      }
+      slot = (slot + 1U) & (SAFETY_LOOKUP_SLOTS - 1U);
+    }
+  }
+  return ret;
+}
+
+void safety_set_tx_msgs(const CanMsg msg_list[], int len) {
+  current_tx_msgs = msg_list;
+  current_tx_msgs_len = len;
+}
+
 bool msg_allowed(CAN_FIFOMailBox_TypeDef *to_send, const CanMsg msg_list[], int len) {
   int addr = GET_ADDR(to_send);
   int bus = GET_BUS(to_send);
   int length = GET_LEN(to_send);
 
+  // set_safety_hooks built the lookup of the list init set, any other list is gone through
   bool allowed = false;
-  for (int i = 0; i < len; i++) {
-    if ((addr == msg_list[i].addr) && (bus == msg_list[i].bus) && (length == msg_list[i].len)) {
-      allowed = true;
-      break;
+  if ((tx_lookup.list == msg_list) && (tx_lookup.len == len) && (tx_lookup.msgs_len >= 0)) {
+    allowed = safety_lookup_find(&tx_lookup, addr, bus, length) != -1;
+  } else {
+    for (int i = 0; i < len; i++) {
+      if ((addr == msg_list[i].addr) && (bus == msg_list[i].bus) && (length == msg_list[i].len)) {
+        allowed = true;
+        break;
+      }
     }
   }
   return allowed;
@@ -103,24 +200,41 @@ int get_addr_check_index(CAN_FIFOMailBox_TypeDef *to_push, AddrCheckStruct addr_
   int length = GET_LEN(to_push);
 
   int index = -1;
-  for (int i = 0; i < len; i++) {
-    // if multiple msgs are allowed, determine which one is present on the bus
-    if (!addr_list[i].msg_seen) {
-      for (uint8_t j = 0U; addr_list[i].msg[j].addr != 0; j++) {
-        if ((addr == addr_list[i].msg[j].addr) && (bus == addr_list[i].msg[j].bus) &&
-              (length == addr_list[i].msg[j].len)) {
-          addr_list[i].index = j;
-          addr_list[i].msg_seen = true;
-          break;
-        }
+  if ((rx_lookup.list == addr_list) && (rx_lookup.len == len) && (rx_lookup.msgs_len >= 0)) {
+    // the messages with this key in the order of the checks, the first check that takes it gets it
+    int i = safety_lookup_find(&rx_lookup, addr, bus, length);
+    while ((i != -1) && (i < rx_lookup.msgs_len) && safety_lookup_match(&rx_lookup.msgs[i], (uint32_t)addr, (uint8_t)bus, (uint8_t)length)) {
+      AddrCheckStruct *check = &addr_list[rx_lookup.msgs[i].index];
+      if (!check->msg_seen) {
+        check->index = rx_lookup.msgs[i].msg;
+        check->msg_seen = true;
       }
+      if (check->index == (int)rx_lookup.msgs[i].msg) {
+        index = rx_lookup.msgs[i].index;
+        break;
+      }
+      i++;
     }
+  } else {
+    for (int i = 0; i < len; i++) {
+      // if multiple msgs are allowed, determine which one is present on the bus
+      if (!addr_list[i].msg_seen) {
+        for (uint8_t j = 0U; addr_list[i].msg[j].addr != 0; j++) {
+          if ((addr == addr_list[i].msg[j].addr) && (bus == addr_list[i].msg[j].bus) &&
+                (length == addr_list[i].msg[j].len)) {
+            addr_list[i].index = j;
+            addr_list[i].msg_seen = true;
+            break;
+          }
+        }
+      }
 
-    int idx = addr_list[i].index;
-    if ((addr == addr_list[i].msg[idx].addr) && (bus == addr_list[i].msg[idx].bus) &&
-        (length == addr_list[i].msg[idx].len)) {
-      index = i;
-      break;
+      int idx = addr_list[i].index;
+      if ((addr == addr_list[i].msg[idx].addr) && (bus == addr_list[i].msg[idx].bus) &&
+          (length == addr_list[i].msg[idx].len)) {
+        index = i;
+        break;
+      }
     }
   }
   return index;
@@ -293,12 +407,31 @@ int set_safety_hooks(uint16_t mode, int16_t param) {
     }
   }
   if ((set_status == 0) && (current_hooks->init != NULL)) {
+    current_tx_msgs = NULL;
+    current_tx_msgs_len = 0;
     current_rx_checks = current_hooks->init(param);
-    // reset message index and seen flags in addr struct
+
+    // the hooks can run from interrupts, they never see a lookup that's half built
+    ENTER_CRITICAL();
+    // reset message index and seen flags in addr struct, and build the lookup of the checked messages
+    safety_lookup_reset(&rx_lookup, current_rx_checks->len);
     for (int j = 0; j < current_rx_checks->len; j++) {
       current_rx_checks->check[j].index = 0;
       current_rx_checks->check[j].msg_seen = false;
+      for (int k = 0; (k < 3) && (current_rx_checks->check[j].msg[k].addr != 0); k++) {
+        const CanMsgCheck *msg = &current_rx_checks->check[j].msg[k];
+        (void)safety_lookup_add(&rx_lookup, msg->addr, msg->bus, msg->len, j, k);
+      }
+    }
+    safety_lookup_finish(&rx_lookup, current_rx_checks->check);
+
+    // and of the messages the tx hook allows
+    safety_lookup_reset(&tx_lookup, current_tx_msgs_len);
+    for (int j = 0; j < current_tx_msgs_len; j++) {
+      (void)safety_lookup_add(&tx_lookup, current_tx_msgs[j].addr, current_tx_msgs[j].bus, current_tx_msgs[j].len, j, 0);
     }
+    safety_lookup_finish(&tx_lookup, current_tx_msgs);
+    EXIT_CRITICAL();
   }
   return set_status;
 }
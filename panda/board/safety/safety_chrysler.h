@@ -196,6 +196,7 @@ static const addr_checks* chrysler_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  SET_TX_MSGS(CHRYSLER_TX_MSGS);
   return &chrysler_rx_checks;
 }
 
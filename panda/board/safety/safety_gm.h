@@ -212,6 +212,7 @@ static const addr_checks* gm_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  SET_TX_MSGS(GM_TX_MSGS);
   return &gm_rx_checks;
 }
 
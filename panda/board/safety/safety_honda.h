@@ -314,6 +314,7 @@ static const addr_checks* honda_nidec_init(int16_t param) {
   honda_alt_brake_msg = false;
   honda_bosch_long = false;
   honda_rx_checks = (addr_checks){honda_addr_checks, HONDA_ADDR_CHECKS_LEN};
+  SET_TX_MSGS(HONDA_N_TX_MSGS);
   return &honda_rx_checks;
 }
 
@@ -330,6 +331,11 @@ static const addr_checks* honda_bosch_giraffe_init(int16_t param) {
 #endif
 
   honda_rx_checks = (addr_checks){honda_addr_checks, HONDA_ADDR_CHECKS_LEN};
+  if (honda_bosch_long) {
+    SET_TX_MSGS(HONDA_BG_LONG_TX_MSGS);
+  } else {
+    SET_TX_MSGS(HONDA_BG_TX_MSGS);
+  }
   return &honda_rx_checks;
 }
 
@@ -346,6 +352,11 @@ static const addr_checks* honda_bosch_harness_init(int16_t param) {
 #endif
 
   honda_rx_checks = (addr_checks){honda_bh_addr_checks, HONDA_BH_ADDR_CHECKS_LEN};
+  if (honda_bosch_long) {
+    SET_TX_MSGS(HONDA_BH_LONG_TX_MSGS);
+  } else {
+    SET_TX_MSGS(HONDA_BH_TX_MSGS);
+  }
   return &honda_rx_checks;
 }
 
@@ -372,8 +372,10 @@ static const addr_checks* hyundai_init(int16_t param) {
 
   if (hyundai_longitudinal) {
     hyundai_rx_checks = (addr_checks){hyundai_long_addr_checks, HYUNDAI_LONG_ADDR_CHECK_LEN};
+    SET_TX_MSGS(HYUNDAI_LONG_TX_MSGS);
   } else {
     hyundai_rx_checks = (addr_checks){hyundai_addr_checks, HYUNDAI_ADDR_CHECK_LEN};
+    SET_TX_MSGS(HYUNDAI_TX_MSGS);
   }
   return &hyundai_rx_checks;
 }
@@ -387,6 +389,7 @@ static const addr_checks* hyundai_legacy_init(int16_t param) {
   hyundai_ev_gas_signal = GET_FLAG(param, HYUNDAI_PARAM_EV_GAS);
   hyundai_hybrid_gas_signal = !hyundai_ev_gas_signal && GET_FLAG(param, HYUNDAI_PARAM_HYBRID_GAS);
   hyundai_rx_checks = (addr_checks){hyundai_legacy_addr_checks, HYUNDAI_LEGACY_ADDR_CHECK_LEN};
+  SET_TX_MSGS(HYUNDAI_TX_MSGS);
   return &hyundai_rx_checks;
 }
 
@@ -188,6 +188,7 @@ static const addr_checks* mazda_init(int16_t param) {
   controls_allowed = false;
   relay_malfunction_reset();
   mazda_lkas_allowed = false;
+  SET_TX_MSGS(MAZDA_TX_MSGS);
   return &mazda_rx_checks;
 }
 
@@ -194,6 +194,7 @@ static const addr_checks* nissan_init(int16_t param) {
   controls_allowed = 0;
   nissan_alt_eps = param ? 1 : 0;
   relay_malfunction_reset();
+  SET_TX_MSGS(NISSAN_TX_MSGS);
   return &nissan_rx_checks;
 }
 
@@ -325,6 +325,7 @@ static const addr_checks* subaru_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  SET_TX_MSGS(SUBARU_TX_MSGS);
   return &subaru_rx_checks;
 }
 
@@ -340,6 +341,7 @@ static const addr_checks* subaru_legacy_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  SET_TX_MSGS(SUBARU_L_TX_MSGS);
   return &subaru_l_rx_checks;
 }
 
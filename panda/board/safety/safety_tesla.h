@@ -194,6 +194,7 @@ static const addr_checks* tesla_init(int16_t param) {
   UNUSED(param);
   controls_allowed = 0;
   relay_malfunction_reset();
+  SET_TX_MSGS(TESLA_TX_MSGS);
   return &tesla_rx_checks;
 }
 
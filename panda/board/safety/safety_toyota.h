@@ -248,6 +248,7 @@ static const addr_checks* toyota_init(int16_t param) {
   relay_malfunction_reset();
   gas_interceptor_detected = 0;
   toyota_dbc_eps_torque_factor = param;
+  SET_TX_MSGS(TOYOTA_TX_MSGS);
   return &toyota_rx_checks;
 }
 
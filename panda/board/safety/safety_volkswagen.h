@@ -127,6 +127,7 @@ static const addr_checks* volkswagen_mqb_init(int16_t param) {
   volkswagen_torque_msg = MSG_HCA_01;
   volkswagen_lane_msg = MSG_LDW_02;
   gen_crc_lookup_table(0x2F, volkswagen_crc8_lut_8h2f);
+  SET_TX_MSGS(VOLKSWAGEN_MQB_TX_MSGS);
   return &volkswagen_mqb_rx_checks;
 }
 
@@ -137,6 +138,7 @@ static const addr_checks* volkswagen_pq_init(int16_t param) {
   relay_malfunction_reset();
   volkswagen_torque_msg = MSG_HCA_1;
   volkswagen_lane_msg = MSG_LDW_1;
+  SET_TX_MSGS(VOLKSWAGEN_PQ_TX_MSGS);
   return &volkswagen_pq_rx_checks;
 }
 
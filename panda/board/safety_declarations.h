@@ -48,6 +48,28 @@ typedef struct {
   int len;
 } addr_checks;
 
+// (addr, bus, len) of the checked or allowed messages of a list, sorted, with a hash table pointing at the first
+// message of every key. a frame is found in a probe or two instead of going through the whole list
+#define SAFETY_LOOKUP_BITS 6U
+#define SAFETY_LOOKUP_SLOTS (1U << SAFETY_LOOKUP_BITS)
+#define SAFETY_LOOKUP_MSGS (SAFETY_LOOKUP_SLOTS / 2U)
+
+typedef struct {
+  uint32_t addr;
+  uint8_t bus;
+  uint8_t len;
+  uint8_t index;                     // of the addr check or in the tx list
+  uint8_t msg;                       // in the addr check's msg[]
+} safety_lookup_msg;
+
+typedef struct {
+  const void *list;                  // what it was built from, NULL while building
+  int len;
+  int msgs_len;                      // -1 if the list doesn't fit, it's gone through the old way then
+  safety_lookup_msg msgs[SAFETY_LOOKUP_MSGS];
+  uint8_t slots[SAFETY_LOOKUP_SLOTS];  // first msg of a key + 1, 0 for none
+} safety_lookup;
+
 int safety_rx_hook(CAN_FIFOMailBox_TypeDef *to_push);
 int safety_tx_hook(CAN_FIFOMailBox_TypeDef *to_send);
 int safety_tx_lin_hook(int lin_num, uint8_t *data, int len);
@@ -64,6 +86,13 @@ bool rt_rate_limit_check(int val, int val_last, const int MAX_RT_DELTA);
 float interpolate(struct lookup_t xy, float x);
 void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]);
 bool msg_allowed(CAN_FIFOMailBox_TypeDef *to_send, const CanMsg msg_list[], int len);
+void safety_set_tx_msgs(const CanMsg msg_list[], int len);
+// the init of a mode with a tx list calls this, so set_safety_hooks can build its lookup
+#define SET_TX_MSGS(msgs) safety_set_tx_msgs((msgs), (int)(sizeof(msgs) / sizeof((msgs)[0])))
+void safety_lookup_reset(safety_lookup *lookup, int len);
+bool safety_lookup_add(safety_lookup *lookup, int addr, int bus, int len, int index, int msg);
+void safety_lookup_finish(safety_lookup *lookup, const void *list);
+int safety_lookup_find(const safety_lookup *lookup, int addr, int bus, int len);
 int get_addr_check_index(CAN_FIFOMailBox_TypeDef *to_push, AddrCheckStruct addr_list[], const int len);
 void update_counter(AddrCheckStruct addr_list[], int index, uint8_t counter);
 void update_addr_timestamp(AddrCheckStruct addr_list[], int index);
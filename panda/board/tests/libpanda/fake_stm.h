@@ -0,0 +1,60 @@
+// just enough of the firmware to build the safety layer on a PC, see config.h for the real thing
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UNUSED(x) ((void)(x))
+
+// the replay runs the hooks on one thread
+#define ENTER_CRITICAL()
+#define EXIT_CRITICAL()
+
+#define MIN(a,b) \
+ ({ __typeof__ (a) _a = (a); \
+     __typeof__ (b) _b = (b); \
+   (_a < _b) ? _a : _b; })
+
+#define MAX(a,b) \
+ ({ __typeof__ (a) _a = (a); \
+     __typeof__ (b) _b = (b); \
+   (_a > _b) ? _a : _b; })
+
+#define ABS(a) \
+ ({ __typeof__ (a) _a = (a); \
+   (_a > 0) ? _a : (-_a); })
+
+#define GET_BUS(msg) (((msg)->RDTR >> 4) & 0xFF)
+#define GET_LEN(msg) ((msg)->RDTR & 0xF)
+#define GET_ADDR(msg) ((((msg)->RIR & 4) != 0) ? ((msg)->RIR >> 3) : ((msg)->RIR >> 21))
+#define GET_BYTE(msg, b) (((int)(b) > 3) ? (((msg)->RDHR >> (8U * ((unsigned int)(b) % 4U))) & 0xFFU) : (((msg)->RDLR >> (8U * (unsigned int)(b))) & 0xFFU))
+#define GET_BYTES_04(msg) ((msg)->RDLR)
+#define GET_BYTES_48(msg) ((msg)->RDHR)
+#define GET_FLAG(value, mask) (((__typeof__(mask))(value) & (mask)) == (mask))
+
+typedef struct {
+  uint32_t RIR;
+  uint32_t RDTR;
+  uint32_t RDLR;
+  uint32_t RDHR;
+} CAN_FIFOMailBox_TypeDef;
+
+// the replay sets the time of every frame
+uint32_t fake_timer_cnt = 0U;
+
+uint32_t microsecond_timer_get(void);
+uint32_t microsecond_timer_get(void) {
+  return fake_timer_cnt;
+}
+
+#define FAULT_RELAY_MALFUNCTION (1U << 0)
+uint32_t faults = 0U;
+
+void fault_occurred(uint32_t fault);
+void fault_occurred(uint32_t fault) {
+  faults |= fault;
+}
+
+void fault_recovered(uint32_t fault);
+void fault_recovered(uint32_t fault) {
+  faults &= ~fault;
+}
@@ -0,0 +1,84 @@
+import os
+import numpy as np
+
+from cffi import FFI
+
+libpanda_dir = os.path.dirname(os.path.abspath(__file__))
+libpanda_fn = os.path.join(libpanda_dir, "libpanda.so")
+
+ffi = FFI()
+ffi.cdef("""
+typedef struct {
+  uint32_t addr;
+  uint32_t ts;
+  uint8_t bus;
+  uint8_t len;
+  uint8_t tx;
+  uint8_t dat[8];
+} replay_frame;
+
+typedef struct {
+  int8_t ret;
+  int8_t fwd;
+  uint8_t controls_allowed;
+  uint32_t state;
+} replay_result;
+
+const char *safety_replay_unit(void);
+uint32_t safety_replay_state(void);
+int safety_replay_modes(uint16_t *modes, int max);
+int safety_replay_rx_msgs(uint32_t *addrs, uint8_t *buses, uint8_t *lens, int max);
+int safety_replay_tx_msgs(uint32_t *addrs, uint8_t *buses, uint8_t *lens, int max);
+int safety_replay_init(uint16_t mode, int16_t param);
+void safety_replay(const replay_frame *frames, int n, replay_result *results, uint64_t *cycles);
+uint64_t safety_replay_overhead(void);
+""")
+
+libpanda = ffi.dlopen(libpanda_fn)
+
+# same layout as the structs above
+FRAME_DTYPE = np.dtype([('addr', np.uint32), ('ts', np.uint32), ('bus', np.uint8), ('len', np.uint8),
+                        ('tx', np.uint8), ('dat', np.uint8, 8)], align=True)
+RESULT_DTYPE = np.dtype([('ret', np.int8), ('fwd', np.int8), ('controls_allowed', np.uint8),
+                         ('state', np.uint32)], align=True)
+assert FRAME_DTYPE.itemsize == ffi.sizeof("replay_frame")
+assert RESULT_DTYPE.itemsize == ffi.sizeof("replay_result")
+
+
+def unit():
+  return ffi.string(libpanda.safety_replay_unit()).decode()
+
+
+def modes():
+  n = libpanda.safety_replay_modes(ffi.NULL, 0)
+  ret = ffi.new("uint16_t[]", n)
+  libpanda.safety_replay_modes(ret, n)
+  return list(ret)
+
+
+def rx_msgs():
+  """(addr, bus, len) of the messages the current mode checks"""
+  n = libpanda.safety_replay_rx_msgs(ffi.NULL, ffi.NULL, ffi.NULL, 0)
+  addrs, buses, lens = ffi.new("uint32_t[]", n), ffi.new("uint8_t[]", n), ffi.new("uint8_t[]", n)
+  libpanda.safety_replay_rx_msgs(addrs, buses, lens, n)
+  return list(zip(addrs, buses, lens))
+
+
+def tx_msgs():
+  """(addr, bus, len) of the messages the tx hook of the current mode allows"""
+  n = libpanda.safety_replay_tx_msgs(ffi.NULL, ffi.NULL, ffi.NULL, 0)
+  addrs, buses, lens = ffi.new("uint32_t[]", n), ffi.new("uint8_t[]", n), ffi.new("uint8_t[]", n)
+  libpanda.safety_replay_tx_msgs(addrs, buses, lens, n)
+  return list(zip(addrs, buses, lens))
+
+
+def replay(mode, param, frames):
+  """runs frames (a FRAME_DTYPE array) through the hooks of mode, returns the results and the time of every frame"""
+  assert libpanda.safety_replay_init(mode, param) == 0, f"no safety mode {mode}"
+  frames = np.ascontiguousarray(frames, dtype=FRAME_DTYPE)
+  results = np.zeros(len(frames), dtype=RESULT_DTYPE)
+  cycles = np.zeros(len(frames), dtype=np.uint64)
+  libpanda.safety_replay(ffi.cast("replay_frame *", frames.ctypes.data), len(frames),
+                         ffi.cast("replay_result *", results.ctypes.data), ffi.cast("uint64_t *", cycles.ctypes.data))
+  overhead = libpanda.safety_replay_overhead()
+  return results, np.maximum(cycles, overhead) - overhead
@@ -0,0 +1,196 @@
+// the safety layer as a shared library, for replaying drives through the safety hooks on a PC
+// see safety_replay.py, the structs are declared again in libpanda_py.py
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "fake_stm.h"
+#include "safety.h"
+
+typedef struct {
+  uint32_t addr;
+  uint32_t ts;      // microsecond timer at the frame
+  uint8_t bus;
+  uint8_t len;
+  uint8_t tx;       // sendcan, goes through the tx hook instead of the fwd and rx hooks
+  uint8_t dat[8];
+} replay_frame;
+
+typedef struct {
+  int8_t ret;       // what the rx or tx hook returned
+  int8_t fwd;       // bus the fwd hook forwarded to, -1 for none
+  uint8_t controls_allowed;
+  uint32_t state;   // hash of the safety state after the frame
+} replay_result;
+
+// TSC cycles on x86, nanoseconds elsewhere
+static inline uint64_t replay_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000ULL) + (uint64_t)t.tv_nsec;
+#endif
+}
+
+const char *safety_replay_unit(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return "cycles";
+#else
+  return "ns";
+#endif
+}
+
+static uint32_t fnv(uint32_t h, const void *dat, size_t len) {
+  const uint8_t *d = (const uint8_t *)dat;
+  for (size_t i = 0U; i < len; i++) {
+    h = (h ^ d[i]) * 16777619U;
+  }
+  return h;
+}
+
+#define HASH(h, x) fnv((h), &(x), sizeof(x))
+
+// the generic safety state and the dynamic part of the rx checks
+uint32_t safety_replay_state(void) {
+  uint32_t h = 2166136261U;
+  h = HASH(h, controls_allowed);
+  h = HASH(h, relay_malfunction);
+  h = HASH(h, gas_interceptor_detected);
+  h = HASH(h, gas_interceptor_prev);
+  h = HASH(h, gas_pressed);
+  h = HASH(h, brake_pressed);
+  h = HASH(h, cruise_engaged_prev);
+  h = HASH(h, vehicle_speed);
+  h = HASH(h, vehicle_moving);
+  h = HASH(h, desired_torque_last);
+  h = HASH(h, rt_torque_last);
+  h = HASH(h, torque_meas);
+  h = HASH(h, torque_driver);
+  h = HASH(h, ts_last);
+  h = HASH(h, desired_angle_last);
+  h = HASH(h, angle_meas);
+  for (int i = 0; i < current_rx_checks->len; i++) {
+    const AddrCheckStruct *c = &current_rx_checks->check[i];
+    h = HASH(h, c->msg_seen);
+    h = HASH(h, c->index);
+    h = HASH(h, c->valid_checksum);
+    h = HASH(h, c->wrong_counters);
+    h = HASH(h, c->last_counter);
+    h = HASH(h, c->last_timestamp);
+    h = HASH(h, c->lagging);
+  }
+  return h;
+}
+
+// fills modes with the ids in the safety hook registry, returns how many there are
+int safety_replay_modes(uint16_t *modes, int max) {
+  int n = sizeof(safety_hook_registry) / sizeof(safety_hook_config);
+  for (int i = 0; i < MIN(n, max); i++) {
+    modes[i] = safety_hook_registry[i].id;
+  }
+  return n;
+}
+
+// the messages the current mode checks on rx, returns how many there are
+int safety_replay_rx_msgs(uint32_t *addrs, uint8_t *buses, uint8_t *lens, int max) {
+  int n = 0;
+  for (int i = 0; i < current_rx_checks->len; i++) {
+    for (int j = 0; (j < 3) && (current_rx_checks->check[i].msg[j].addr != 0); j++) {
+      if (n < max) {
+        addrs[n] = current_rx_checks->check[i].msg[j].addr;
+        buses[n] = current_rx_checks->check[i].msg[j].bus;
+        lens[n] = current_rx_checks->check[i].msg[j].len;
+      }
+      n++;
+    }
+  }
+  return n;
+}
+
+// the messages the tx hook of the current mode allows, returns how many there are
+int safety_replay_tx_msgs(uint32_t *addrs, uint8_t *buses, uint8_t *lens, int max) {
+  for (int i = 0; i < MIN(current_tx_msgs_len, max); i++) {
+    addrs[i] = current_tx_msgs[i].addr;
+    buses[i] = current_tx_msgs[i].bus;
+    lens[i] = current_tx_msgs[i].len;
+  }
+  return current_tx_msgs_len;
+}
+
+// sets the mode like the USB request does, with controls allowed so the tx hooks check the limits
+int safety_replay_init(uint16_t mode, int16_t param) {
+  fake_timer_cnt = 0U;
+  faults = 0U;
+  int ret = set_safety_hooks(mode, param);
+
+  // the firmware keeps these from the last mode, a replay starts from scratch
+  torque_meas = sample_t_default;
+  torque_driver = sample_t_default;
+  angle_meas = sample_t_default;
+  for (int i = 0; i < current_rx_checks->len; i++) {
+    AddrCheckStruct *c = &current_rx_checks->check[i];
+    c->valid_checksum = false;
+    c->wrong_counters = 0;
+    c->last_counter = 0U;
+    c->last_timestamp = 0U;
+    c->lagging = false;
+  }
+  controls_allowed = true;
+  return ret;
+}
+
+// runs the frames through the hooks of the current mode like the CAN interrupts do and measures each of them.
+// safety_tick runs once a second of the frames' time, outside of the measurement
+void safety_replay(const replay_frame *frames, int n, replay_result *results, uint64_t *cycles) {
+  uint32_t last_tick = (n > 0) ? frames[0].ts : 0U;
+  for (int i = 0; i < n; i++) {
+    const replay_frame *f = &frames[i];
+    fake_timer_cnt = f->ts;
+    if (get_ts_elapsed(f->ts, last_tick) >= 1000000U) {
+      safety_tick(current_rx_checks);
+      last_tick = f->ts;
+    }
+
+    CAN_FIFOMailBox_TypeDef msg;
+    msg.RIR = (f->addr >= 0x800U) ? ((f->addr << 3) | 5U) : ((f->addr << 21) | 1U);
+    msg.RDTR = MIN(f->len, 8U) | ((uint32_t)f->bus << 4);
+    msg.RDLR = f->dat[0] | (f->dat[1] << 8) | (f->dat[2] << 16) | ((uint32_t)f->dat[3] << 24);
+    msg.RDHR = f->dat[4] | (f->dat[5] << 8) | (f->dat[6] << 16) | ((uint32_t)f->dat[7] << 24);
+
+    int ret, fwd = -1;
+    uint64_t start = replay_clock();
+    if (f->tx) {
+      ret = safety_tx_hook(&msg);
+    } else {
+      fwd = safety_fwd_hook(f->bus, &msg);
+      ret = safety_rx_hook(&msg);
+    }
+    uint64_t end = replay_clock();
+
+    if (cycles != NULL) {
+      cycles[i] = end - start;
+    }
+    if (results != NULL) {
+      results[i].ret = ret;
+      results[i].fwd = fwd;
+      results[i].controls_allowed = controls_allowed;
+      results[i].state = safety_replay_state();
+    }
+  }
+}
+
+// what the measurement of nothing takes, to subtract from the cycles
+uint64_t safety_replay_overhead(void) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start = replay_clock();
+    __asm__ volatile("" ::: "memory");
+    uint64_t end = replay_clock();
+    best = MIN(best, end - start);
+  }
+  return best;
+}
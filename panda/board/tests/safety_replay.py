@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Replays the can and sendcan of drives through the safety hooks of every safety mode, built for the PC by
+tests/libpanda (scons --test), and shows what a frame costs in the fwd and rx hooks and in the tx hook.
+
+  safety_replay.py rlog.bz2 [rlog.bz2 ...]    frames from logs, the mode of the drive is replayed with its param
+  safety_replay.py --random 100000            random frames on the addresses every mode checks and sends
+
+--save writes the stats to compare later runs against with --baseline, a mode whose mean or p99 got slower than
+--tolerance is a regression. --budget flags every frame over that many cycles. --results/--compare store and check
+what the hooks returned and the safety state after every frame, for changes that mustn't change the behavior.
+The exit code is 1 if anything was flagged.
+"""
+import argparse
+import json
+import sys
+
+import numpy as np
+
+from panda.board.tests.libpanda import libpanda_py
+
+SAFETY_NAMES = {
+  0: "silent", 1: "hondaNidec", 2: "toyota", 3: "elm327", 4: "gm", 5: "hondaBoschGiraffe", 6: "ford", 8: "hyundai",
+  9: "chrysler", 10: "tesla", 11: "subaru", 13: "mazda", 14: "nissan", 15: "volkswagen", 17: "allOutput", 18: "gmAscm",
+  19: "noOutput", 20: "hondaBoschHarness", 21: "volkswagenPq", 22: "subaruLegacy", 23: "hyundaiLegacy",
+  24: "hyundaiCommunity",
+}
+
+
+def load_logs(fns):
+  """the frames of the logs and the safety configs of the drives in them"""
+  from tools.lib.logreader import LogReader
+
+  rows, configs = [], set()
+  for fn in fns:
+    for msg in LogReader(fn):
+      which = msg.which()
+      if which == 'carParams':
+        for cfg in msg.carParams.safetyConfigs:
+          configs.add((cfg.safetyModel.raw, cfg.safetyParam))
+      elif which in ('can', 'sendcan'):
+        ts = (msg.logMonoTime // 1000) & 0xFFFFFFFF
+        for c in getattr(msg, which):
+          # the returned messages never went through the rx hook
+          if which == 'can' and c.src >= 128:
+            continue
+          dat = bytes(c.dat)[:8]
+          rows.append((c.address, ts, c.src, len(dat), which == 'sendcan', np.frombuffer(dat.ljust(8, b'\0'), np.uint8)))
+  return np.array(rows, dtype=libpanda_py.FRAME_DTYPE), configs
+
+
+def near_misses(msgs):
+  """the messages one off in the address, the bus or the length, that the tx hook has to block"""
+  near = set()
+  for a, b, l in msgs:
+    near |= {(a + 1, b, l), (max(a - 1, 0), b, l), (a, (b + 1) % 3, l), (a, b, max(l - 1, 0)), (a, b, min(l + 1, 8))}
+  return sorted(near - set(msgs))
+
+
+def random_frames(n, mode, param, seed=0):
+  """frames at 100Hz on the checked addresses and random ones, a fifth of them sent. half of the sent ones are
+  on the tx list of the mode, the other half near misses of it and random ones"""
+  rng = np.random.default_rng(seed)
+  libpanda_py.libpanda.safety_replay_init(mode, param)
+  rand = [(int(a), int(b), 8) for a, b in zip(rng.integers(0, 0x800, 32), rng.integers(0, 3, 32))]
+  rx = libpanda_py.rx_msgs() + rand
+  allowed = libpanda_py.tx_msgs()
+  blocked = near_misses(allowed) + rand
+
+  frames = np.zeros(n, dtype=libpanda_py.FRAME_DTYPE)
+  tx = rng.random(n) < 0.2
+  on_list = tx & (rng.random(n) < 0.5) if allowed else np.zeros(n, dtype=bool)
+  picks = [rx[p] for p in rng.integers(0, len(rx), n)]
+  for sel, msgs in ((tx & ~on_list, blocked), (on_list, allowed)):
+    idx = np.flatnonzero(sel)
+    for i, p in zip(idx, rng.integers(0, max(len(msgs), 1), len(idx))):
+      picks[i] = msgs[p]
+  frames['addr'] = [p[0] for p in picks]
+  frames['bus'] = [p[1] for p in picks]
+  frames['len'] = [p[2] for p in picks]
+  frames['ts'] = np.arange(n, dtype=np.uint32) * (10000 // max(len(rx), 1))
+  frames['tx'] = tx
+  frames['dat'] = rng.integers(0, 256, (n, 8))
+  return frames
+
+
+def replay(mode, param, frames, runs):
+  """the results and the fastest time of every frame over runs replays"""
+  results, cycles = libpanda_py.replay(mode, param, frames)
+  for _ in range(runs - 1):
+    r, c = libpanda_py.replay(mode, param, frames)
+    assert np.array_equal(r, results), "replay isn't deterministic"
+    cycles = np.minimum(cycles, c)
+  return results, cycles
+
+
+def stats(cycles):
+  if len(cycles) == 0:
+    return None
+  return {
+    "frames": int(len(cycles)),
+    "mean": float(np.mean(cycles)),
+    "p50": float(np.percentile(cycles, 50)),
+    "p99": float(np.percentile(cycles, 99)),
+    "max": int(np.max(cycles)),
+  }
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument("logs", nargs="*")
+  parser.add_argument("--random", type=int, default=0, help="replay this many random frames instead of logs")
+  parser.add_argument("--mode", type=int, action="append", help="only these safety modes")
+  parser.add_argument("--param", type=int, default=0, help="param of the modes without one from the logs")
+  parser.add_argument("--runs", type=int, default=3, help="the fastest of this many replays counts")
+  parser.add_argument("--save", help="write the stats to this json")
+  parser.add_argument("--baseline", help="flag the modes that got slower than in this json")
+  parser.add_argument("--tolerance", type=float, default=0.2, help="allowed slowdown against the baseline")
+  parser.add_argument("--budget", type=float, help="flag frames over this many cycles")
+  parser.add_argument("--results", help="write the hook results and the safety state of every frame to this npz")
+  parser.add_argument("--compare", help="flag every frame that differs from the results in this npz")
+  args = parser.parse_args()
+
+  if not args.logs and not args.random:
+    parser.error("replay logs or --random frames")
+
+  frames, configs = load_logs(args.logs) if args.logs else (None, set())
+  modes = args.mode if args.mode else libpanda_py.modes()
+  configs = {(m, p) for m, p in configs if m in modes} | {(m, args.param) for m in modes if m not in {c[0] for c in configs}}
+
+  baseline = json.load(open(args.baseline)) if args.baseline else {}
+  expected = np.load(args.compare) if args.compare else {}
+  unit = libpanda_py.unit()
+  out, saved_results, flagged = {}, {}, []
+
+  print(f"{'mode':<24} {'hook':<4} {'frames':>8} {'mean':>8} {'p50':>8} {'p99':>8} {'max':>8}  ({unit} per frame)")
+  for mode, param in sorted(configs):
+    name = f"{SAFETY_NAMES.get(mode, mode)}/{param}"
+    f = frames if frames is not None else random_frames(args.random, mode, param)
+    results, cycles = replay(mode, param, f, args.runs)
+    saved_results[name] = results
+
+    out[name] = {}
+    for hook, sel in (("rx", ~f['tx'].astype(bool)), ("tx", f['tx'].astype(bool))):
+      s = stats(cycles[sel])
+      if s is None:
+        continue
+      out[name][hook] = s
+      line = f"{name:<24} {hook:<4} {s['frames']:>8} {s['mean']:>8.1f} {s['p50']:>8.1f} {s['p99']:>8.1f} {s['max']:>8}"
+
+      base = baseline.get(name, {}).get(hook)
+      if base is not None:
+        slower = [k for k in ("mean", "p99") if s[k] > base[k] * (1 + args.tolerance)]
+        if slower:
+          line += "  REGRESSION " + ", ".join(f"{k} {base[k]:.1f} -> {s[k]:.1f}" for k in slower)
+          flagged.append(f"{name} {hook} slower")
+      if args.budget is not None and s['max'] > args.budget:
+        over = int(np.sum(cycles[sel] > args.budget))
+        line += f"  {over} OVER BUDGET"
+        flagged.append(f"{name} {hook} over budget")
+      print(line)
+
+    if name in expected:
+      diff = np.flatnonzero(expected[name] != results)
+      if len(diff):
+        print(f"{name}: {len(diff)} frames differ, first at {diff[0]}: {expected[name][diff[0]]} != {results[diff[0]]}")
+        flagged.append(f"{name} differs")
+
+  if args.save:
+    with open(args.save, "w") as f:
+      json.dump(out, f, indent=2)
+  if args.results:
+    np.savez(args.results, **saved_results)
+
+  if flagged:
+    print("\nflagged: " + "; ".join(flagged))
+    return 1
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -203,6 +203,13 @@ class Panda(object):
     assert(self._handle is not None)
     print("connected")
 
+    # can_recv and can_send_many use the 16 byte messages, boardd may have left the panda on newer ones
+    if claim and not self.wifi and not self.bootstub:
+      try:
+        self._handle.controlRead(Panda.REQUEST_IN, 0xfa, 1, 0, 1)
+      except Exception:
+        pass
+
   def reset(self, enter_bootstub=False, enter_bootloader=False):
     # reset
     try:
@@ -203,7 +203,13 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
   post_code += f"ekf_init({name});\n"
 
   # merge code blocks
-  header += "}"
+  header += "}\n\n"
+
+  # compile time dimensions for EKFSymFixed
+  max_zdim = max(h_sym.shape[0] for h_sym, _, _, _, _ in obs_eqs)
+  header += f"#define {name.upper()}_DIM {dim_x}\n"
+  header += f"#define {name.upper()}_EDIM {dim_err}\n"
+  header += f"#define {name.upper()}_MAX_ZDIM {max_zdim}\n"
   code = "\n".join([pre_code, code, open(os.path.join(TEMPLATE_DIR, "ekf_c.c")).read(), post_code])
 
   # write to file
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "ekf_sym.h"
+#include "logger/logger.h"
+
+namespace EKFS {
+
+// EKFSym with the state and observation dimensions fixed at compile time, the generated
+// <name>.h defines them as <NAME>_DIM, <NAME>_EDIM and <NAME>_MAX_ZDIM. the rewind history
+// is a ring buffer allocated up front, so predict and predict_and_update_batch never touch the heap.
+// no MSCKF augmentation and no extra args, observations are batches of up to MAX_BATCH.
+template <int DIM, int EDIM, int MAX_ZDIM, int MAX_BATCH = 1>
+class EKFSymFixed {
+public:
+  typedef Eigen::Matrix<double, DIM, 1> VectorX;
+  typedef Eigen::Matrix<double, EDIM, EDIM, Eigen::RowMajor> MatrixP;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, Eigen::ColMajor, MAX_ZDIM, 1> VectorZ;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor, MAX_ZDIM, MAX_ZDIM> MatrixR;
+
+  EKFSymFixed(const std::string &name, const MatrixP &Q, const VectorX &x_initial, const MatrixP &P_initial,
+              std::vector<int> quaternion_idxs = std::vector<int>(), double max_rewind_age = 1.0)
+      : ekf(ekf_lookup(name)), Q(Q), quaternion_idxs(quaternion_idxs), max_rewind_age(max_rewind_age),
+        history(new Checkpoint[REWIND_TO_KEEP]), rewound(new Observation[REWIND_TO_KEEP]) {
+    assert(ekf);
+    init_state(x_initial, P_initial, NAN);
+  }
+
+  void init_state(const VectorX &state, const MatrixP &covs, double filter_time) {
+    x = state;
+    P = covs;
+    this->filter_time = filter_time;
+    reset_rewind();
+  }
+
+  const VectorX &state() const { return x; }
+  const MatrixP &covs() const { return P; }
+  void set_filter_time(double t) { filter_time = t; }
+  double get_filter_time() const { return filter_time; }
+  void set_global(const std::string &global_var, double val) { ekf->sets.at(global_var)(val); }
+  extra_routine_t get_extra_routine(const std::string &routine) const { return ekf->extra_routines.at(routine); }
+  void reset_rewind() { history_start = history_size = 0; }
+
+  void normalize_quaternions() {
+    for (int idx : quaternion_idxs) {
+      x.template segment<4>(idx).normalize();
+    }
+  }
+
+  void predict(double t) {
+    // initialize time
+    if (std::isnan(filter_time)) {
+      filter_time = t;
+    }
+
+    double dt = t - filter_time;
+    assert(dt >= 0.0);
+
+    ekf->predict(x.data(), P.data(), Q.data(), dt);
+    normalize_quaternions();
+    filter_time = t;
+  }
+
+  // n observations of the same kind, false if t is too old to rewind to
+  bool predict_and_update_batch(double t, int kind, const VectorZ *z, const MatrixR *R, int n) {
+    assert(n > 0 && n <= MAX_BATCH);
+
+    int n_rewound = 0;
+    if (!std::isnan(filter_time) && t < filter_time) {
+      if (history_size == 0 || t < checkpoint_at(0).t || t < checkpoint_at(history_size - 1).t - max_rewind_age) {
+        LOGD("observation too old at %f with filter at %f, ignoring!", t, filter_time);
+        return false;
+      }
+      n_rewound = rewind(t);
+    }
+
+    observation.t = t;
+    observation.kind = kind;
+    observation.n = n;
+    for (int i = 0; i < n; i++) {
+      assert(z[i].rows() == R[i].rows() && R[i].rows() == R[i].cols());
+      observation.z[i] = z[i];
+      observation.R[i] = R[i];
+    }
+    predict_and_update_batch(observation);
+
+    // fast forward through the observations that came after t
+    for (int i = 0; i < n_rewound; i++) {
+      predict_and_update_batch(rewound[i]);
+    }
+    return true;
+  }
+
+  template <typename DerivedZ, typename DerivedR>
+  bool predict_and_update(double t, int kind, const Eigen::MatrixBase<DerivedZ> &z, const Eigen::MatrixBase<DerivedR> &R) {
+    VectorZ zi = z;
+    MatrixR Ri = R;
+    return predict_and_update_batch(t, kind, &zi, &Ri, 1);
+  }
+
+private:
+  struct Observation {
+    double t;
+    int kind;
+    int n;
+    VectorZ z[MAX_BATCH];
+    MatrixR R[MAX_BATCH];
+  };
+
+  struct Checkpoint {
+    double t;
+    VectorX x;
+    MatrixP P;
+    Observation obs;
+  };
+
+  Checkpoint &checkpoint_at(int i) { return history[(history_start + i) % REWIND_TO_KEEP]; }
+
+  void predict_and_update_batch(const Observation &obs) {
+    predict(obs.t);
+    for (int i = 0; i < obs.n; i++) {
+      // the update writes y over z, keep the observation for rewinding
+      VectorZ y = obs.z[i];
+      ekf->updates.at(obs.kind)(x.data(), P.data(), y.data(), const_cast<double *>(obs.R[i].data()), extra_args);
+      normalize_quaternions();
+    }
+    checkpoint(obs);
+  }
+
+  void checkpoint(const Observation &obs) {
+    // only keep a certain number around
+    if (history_size == REWIND_TO_KEEP) {
+      history_start = (history_start + 1) % REWIND_TO_KEEP;
+      history_size--;
+    }
+    Checkpoint &c = checkpoint_at(history_size++);
+    c.t = filter_time;
+    c.x = x;
+    c.P = P;
+    c.obs = obs;
+  }
+
+  // drops the checkpoints after t and returns how many observations were moved to rewound
+  int rewind(double t) {
+    int n = 0;
+    while (checkpoint_at(history_size - 1).t > t) {
+      history_size--;
+      n++;
+    }
+    // the dropped checkpoints are overwritten by the fast forward, copy their observations out first
+    for (int i = 0; i < n; i++) {
+      rewound[i] = checkpoint_at(history_size + i).obs;
+    }
+
+    // set the state to the time right before that
+    const Checkpoint &c = checkpoint_at(history_size - 1);
+    filter_time = c.t;
+    x = c.x;
+    P = c.P;
+    return n;
+  }
+
+  // stuct with linked sympy generated functions
+  const EKF *ekf = NULL;
+
+  VectorX x;  // state
+  MatrixP P;  // covs
+  MatrixP Q;  // process noise
+  double filter_time;
+  std::vector<int> quaternion_idxs;
+  double extra_args[1] = {};
+
+  // rewind stuff
+  double max_rewind_age;
+  std::unique_ptr<Checkpoint[]> history;
+  int history_start = 0;
+  int history_size = 0;
+  std::unique_ptr<Observation[]> rewound;
+  Observation observation;
+};
+
+}
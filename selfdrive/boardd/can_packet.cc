@@ -0,0 +1,160 @@
+#include "selfdrive/boardd/can_packet.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const int STREAM_SIZE = CAN_USB_PACKET_SIZE - CAN_USB_PACKET_HEADER;
+
+// length of the record starting with header, 0 if it's invalid
+static inline int record_size(uint8_t header) {
+  const int len = header & 0xF;
+  return len <= 8 ? 1 + ((header & 0x80) ? 4 : 2) + 2 + len : 0;
+}
+
+static inline int pack_record(const can_frame &f, uint8_t *rec) {
+  const bool extended = f.address >= 0x800;
+  const int len = std::min<int>(f.len, 8);
+  int pos = 0;
+  rec[pos++] = len | ((f.src & 0x3) << 4) | ((f.src & 0x80) ? 0x40 : 0) | (extended ? 0x80 : 0);
+  for (int i = 0; i < (extended ? 4 : 2); i++) {
+    rec[pos++] = f.address >> (8 * i);
+  }
+  rec[pos++] = f.busTime;
+  rec[pos++] = f.busTime >> 8;
+  memcpy(&rec[pos], f.dat, len);
+  return pos + len;
+}
+
+static inline void unpack_record(const uint8_t *rec, can_frame &f) {
+  const bool extended = rec[0] & 0x80;
+  int pos = 1;
+  f.address = rec[pos] | (rec[pos + 1] << 8);
+  if (extended) {
+    f.address |= (rec[pos + 2] << 16) | ((uint32_t)rec[pos + 3] << 24);
+  }
+  pos += extended ? 4 : 2;
+  f.busTime = rec[pos] | (rec[pos + 1] << 8);
+  f.src = ((rec[0] >> 4) & 0x3) | ((rec[0] & 0x40) ? 0x80 : 0);
+  f.len = rec[0] & 0xF;
+  memcpy(f.dat, &rec[pos + 2], f.len);
+}
+
+void can_pack(int version, const can_frame *frames, int count, std::vector<uint8_t> &out) {
+  if (version == 1) {
+    size_t pos = out.size();
+    out.resize(pos + count * 0x10);
+    for (int i = 0; i < count; i++, pos += 0x10) {
+      const can_frame &f = frames[i];
+      uint32_t d[4] = {};
+      d[0] = f.address >= 0x800 ? (f.address << 3) | 5 : (f.address << 21) | 1;
+      d[1] = std::min<int>(f.len, 8) | (f.src << 4) | (f.busTime << 16);
+      memcpy(&d[2], f.dat, std::min<int>(f.len, 8));
+      memcpy(&out[pos], d, sizeof(d));
+    }
+    return;
+  }
+
+  size_t packet = out.size();
+  out.resize(packet + CAN_USB_PACKET_HEADER);
+  int n = 0, start = CAN_USB_NO_START;
+  uint8_t rec[CAN_USB_RECORD_MAX];
+  for (int i = 0; i < count; i++) {
+    const int size = pack_record(frames[i], rec);
+    for (int done = 0; done < size;) {
+      if (n == STREAM_SIZE) {
+        out[packet] = n;
+        out[packet + 1] = start;
+        packet = out.size();
+        out.resize(packet + CAN_USB_PACKET_HEADER);
+        n = 0;
+        start = CAN_USB_NO_START;
+      }
+      if (done == 0 && start == CAN_USB_NO_START) start = n;
+      const int take = std::min(size - done, STREAM_SIZE - n);
+      out.insert(out.end(), rec + done, rec + done + take);
+      done += take;
+      n += take;
+    }
+  }
+  if (n > 0) {
+    out[packet] = n;
+    out[packet + 1] = start;
+  } else {
+    out.resize(packet);
+  }
+}
+
+bool CanUnpacker::unpack(const uint8_t *data, int size, std::vector<can_frame> &out) {
+  if (version == 1) {
+    const int count = size / 0x10;
+    out.reserve(out.size() + count);
+    for (int i = 0; i < count; i++) {
+      uint32_t d[4];
+      memcpy(d, &data[i * 0x10], sizeof(d));
+      can_frame &f = out.emplace_back();
+      f.address = (d[0] & 4) ? d[0] >> 3 : d[0] >> 21;
+      f.busTime = d[1] >> 16;
+      f.src = (d[1] >> 4) & 0xff;
+      f.len = std::min<uint32_t>(d[1] & 0xF, 8);
+      memcpy(f.dat, &d[2], sizeof(f.dat));
+    }
+    return size % 0x10 == 0;
+  }
+
+  // every packet but the last one of a transfer is full
+  bool ok = true;
+  for (int pos = 0; pos < size; pos += CAN_USB_PACKET_SIZE) {
+    ok &= unpack_packet(&data[pos], std::min(size - pos, CAN_USB_PACKET_SIZE), out);
+  }
+  return ok;
+}
+
+bool CanUnpacker::unpack_packet(const uint8_t *packet, int size, std::vector<can_frame> &out) {
+  const int n = size >= CAN_USB_PACKET_HEADER ? packet[0] : 0;
+  const int start = size >= CAN_USB_PACKET_HEADER ? packet[1] : CAN_USB_NO_START;
+  if (size < CAN_USB_PACKET_HEADER || n > size - CAN_USB_PACKET_HEADER || (start != CAN_USB_NO_START && start >= n)) {
+    synced = false;
+    return false;
+  }
+  const uint8_t *stream = &packet[CAN_USB_PACKET_HEADER];
+
+  // the first record has to start where the last one ends
+  bool ok = true;
+  if (synced) {
+    const int expected = record_len > 0 ? record_size(record[0]) - record_len : 0;
+    if (start != (expected < n ? expected : CAN_USB_NO_START)) {
+      synced = false;
+      ok = false;
+    }
+  }
+  int pos = 0;
+  if (!synced) {
+    record_len = 0;
+    if (start == CAN_USB_NO_START) return ok;
+    pos = start;
+    synced = true;
+  }
+
+  while (pos < n) {
+    const int rsize = record_size(record_len > 0 ? record[0] : stream[pos]);
+    if (rsize == 0) {
+      synced = false;
+      return false;
+    }
+    if (record_len == 0 && pos + rsize <= n) {
+      unpack_record(&stream[pos], out.emplace_back());
+      pos += rsize;
+      continue;
+    }
+    // continues in the next packet
+    const int take = std::min(rsize - record_len, n - pos);
+    memcpy(&record[record_len], &stream[pos], take);
+    record_len += take;
+    pos += take;
+    if (record_len == rsize) {
+      unpack_record(record, out.emplace_back());
+      record_len = 0;
+    }
+  }
+  return ok;
+}
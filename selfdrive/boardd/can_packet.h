@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// the usb framing of CAN messages, copied from panda/board/drivers/can_common.h.
+// version 1 packs every message in 16 bytes, version 2 is a stream of variable length records cut into
+// 64 byte usb packets that start with the number of stream bytes in them and where the first record starts
+#define CAN_PACKET_VERSION 2
+#define CAN_USB_PACKET_SIZE 0x40
+#define CAN_USB_PACKET_HEADER 2
+#define CAN_USB_RECORD_MAX 15
+#define CAN_USB_NO_START 0xFF
+
+struct can_frame {
+  uint32_t address;
+  uint16_t busTime;
+  uint8_t src;
+  uint8_t len;
+  uint8_t dat[8];
+};
+
+// appends the bulk transfer for frames
+void can_pack(int version, const can_frame *frames, int count, std::vector<uint8_t> &out);
+
+// parses bulk transfers, keeping a record that continues in the next one
+class CanUnpacker {
+ public:
+  CanUnpacker(int version = 1) : version(version) {}
+  void set_version(int v) {
+    version = v;
+    record_len = 0;
+    synced = false;
+  }
+  int get_version() const { return version; }
+
+  // appends the frames in data, false if some of it didn't make sense. the frames after it are still
+  // parsed once the records can be found again
+  bool unpack(const uint8_t *data, int size, std::vector<can_frame> &out);
+
+ private:
+  bool unpack_packet(const uint8_t *packet, int size, std::vector<can_frame> &out);
+
+  int version;
+  uint8_t record[CAN_USB_RECORD_MAX];
+  int record_len = 0;
+  bool synced = false;
+};
@@ -81,6 +81,10 @@ Panda::Panda(std::string serial) {
   has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
             (hw_type == cereal::PandaState::PandaType::DOS);
 
+  // older firmware doesn't reply and stays on version 1
+  can_packet_version = set_can_packet_version(CAN_PACKET_VERSION);
+  LOGW("CAN packet version %d", can_packet_version);
+
   return;
 
 fail:
@@ -339,37 +343,45 @@ void Panda::set_usb_power_mode(cereal::PeripheralState::UsbPowerMode power_mode)
   usb_write(0xe6, (uint16_t)power_mode, 0);
 }
 
+int Panda::set_can_packet_version(int version) {
+  uint8_t ret = 0;
+  int len = usb_read(0xfa, version, 0, &ret, 1);
+  version = (len == 1 && ret >= 1) ? ret : 1;
+
+  // drop what was packed before the change
+  unsigned char buf[RECV_SIZE];
+  usb_bulk_read(0x81, buf, RECV_SIZE, 1);
+  unpacker.set_version(version);
+  return version;
+}
+
 void Panda::send_heartbeat() {
   usb_write(0xf3, 1, 0);
 }
 
 void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
   const int msg_count = can_data_list.size();
-  const int buf_size = msg_count*0x10;
-
-  if (send.size() < buf_size) {
-    send.resize(buf_size);
-  }
-
+  send_frames.resize(msg_count);
   for (int i = 0; i < msg_count; i++) {
     auto cmsg = can_data_list[i];
-    if (cmsg.getAddress() >= 0x800) { // extended
-      send[i*4] = (cmsg.getAddress() << 3) | 5;
-    } else { // normal
-      send[i*4] = (cmsg.getAddress() << 21) | 1;
-    }
     auto can_data = cmsg.getDat();
     assert(can_data.size() <= 8);
-    send[i*4+1] = can_data.size() | (cmsg.getSrc() << 4);
-    memcpy(&send[i*4+2], can_data.begin(), can_data.size());
+    can_frame &f = send_frames[i];
+    f.address = cmsg.getAddress();
+    f.busTime = 0;
+    f.src = cmsg.getSrc();
+    f.len = can_data.size();
+    memcpy(f.dat, can_data.begin(), can_data.size());
   }
 
-  usb_bulk_write(3, (unsigned char*)send.data(), buf_size, 5);
+  send.clear();
+  can_pack(can_packet_version, send_frames.data(), msg_count, send);
+  usb_bulk_write(3, send.data(), send.size(), 5);
 }
 
 int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
-  uint32_t data[RECV_SIZE/4];
-  int recv = usb_bulk_read(0x81, (unsigned char*)data, RECV_SIZE);
+  uint8_t data[RECV_SIZE];
+  int recv = usb_bulk_read(0x81, data, RECV_SIZE);
 
   // Not sure if this can happen
   if (recv < 0) recv = 0;
@@ -378,26 +390,23 @@ int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
     LOGW("Receive buffer full");
   }
 
-  size_t num_msg = recv / 0x10;
+  recv_frames.clear();
+  if (!unpacker.unpack(data, recv, recv_frames)) {
+    LOGE_100("invalid CAN packet of %d bytes", recv);
+  }
+
   MessageBuilder msg;
   auto evt = msg.initEvent();
   evt.setValid(comms_healthy);
 
   // populate message
-  auto canData = evt.initCan(num_msg);
-  for (int i = 0; i < num_msg; i++) {
-    if (data[i*4] & 4) {
-      // extended
-      canData[i].setAddress(data[i*4] >> 3);
-      //printf("got extended: %x\n", data[i*4] >> 3);
-    } else {
-      // normal
-      canData[i].setAddress(data[i*4] >> 21);
-    }
-    canData[i].setBusTime(data[i*4+1] >> 16);
-    int len = data[i*4+1]&0xF;
-    canData[i].setDat(kj::arrayPtr((uint8_t*)&data[i*4+2], len));
-    canData[i].setSrc((data[i*4+1] >> 4) & 0xff);
+  auto canData = evt.initCan(recv_frames.size());
+  for (int i = 0; i < recv_frames.size(); i++) {
+    const can_frame &f = recv_frames[i];
+    canData[i].setAddress(f.address);
+    canData[i].setBusTime(f.busTime);
+    canData[i].setDat(kj::arrayPtr(f.dat, f.len));
+    canData[i].setSrc(f.src);
   }
   out_buf = capnp::messageToFlatArray(msg);
   return recv;
@@ -11,6 +11,7 @@
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/boardd/can_packet.h"
 
 // double the FIFO size
 #define RECV_SIZE (0x1000)
@@ -45,7 +46,9 @@ class Panda {
   libusb_context *ctx = NULL;
   libusb_device_handle *dev_handle = NULL;
   std::mutex usb_lock;
-  std::vector<uint32_t> send;
+  std::vector<can_frame> send_frames, recv_frames;
+  std::vector<uint8_t> send;
+  CanUnpacker unpacker;
   void handle_usb_issue(int err, const char func[]);
   void cleanup();
 
@@ -58,6 +61,7 @@ class Panda {
   std::atomic<bool> comms_healthy = true;
   cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::UNKNOWN;
   bool has_rtc = false;
+  int can_packet_version = 1;
 
   // Static functions
   static std::vector<std::string> list();
@@ -83,6 +87,7 @@ class Panda {
   std::optional<std::string> get_serial();
   void set_power_saving(bool power_saving);
   void set_usb_power_mode(cereal::PeripheralState::UsbPowerMode power_mode);
+  int set_can_packet_version(int version);
   void send_heartbeat();
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
   int can_receive(kj::Array<capnp::word>& out_buf);
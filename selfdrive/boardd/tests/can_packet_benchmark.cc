@@ -0,0 +1,66 @@
+// benchmark for the usb CAN framing
+// usage: ./can_packet_benchmark [frames per transfer] [transfers]
+// packs and unpacks transfers like boardd does with both packet versions, shows the time per frame
+// and how many bytes go over usb per frame
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "selfdrive/boardd/can_packet.h"
+#include "selfdrive/common/timing.h"
+
+static void report(const char *name, std::vector<double> &times, int frames) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("  %-8s mean %7.2fus  p50 %7.2fus  p99 %7.2fus  max %7.2fus  %6.1f ns/frame\n",
+         name, sum / times.size() * 1e3, pct(0.5) * 1e3, pct(0.99) * 1e3, times.back() * 1e3,
+         sum / times.size() / frames * 1e6);
+}
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 64;
+  const int transfers = argc > 2 ? atoi(argv[2]) : 10000;
+
+  // mostly 11 bit addresses with 8 bytes, like on the car's buses
+  std::mt19937 rng(0);
+  std::vector<can_frame> msgs(frames);
+  for (auto &f : msgs) {
+    f = {};
+    f.address = rng() % 16 ? rng() % 0x800 : 0x18daf100 + rng() % 0x100;
+    f.busTime = rng();
+    f.src = rng() % 3;
+    f.len = rng() % 4 ? 8 : rng() % 8;
+    for (int i = 0; i < f.len; i++) f.dat[i] = rng();
+  }
+
+  for (int version : {1, 2}) {
+    std::vector<uint8_t> data;
+    std::vector<can_frame> out;
+    std::vector<double> pack_times, unpack_times;
+    CanUnpacker unpacker(version);
+    for (int i = 0; i < transfers; i++) {
+      data.clear();
+      out.clear();
+      double t = millis_since_boot();
+      can_pack(version, msgs.data(), msgs.size(), data);
+      pack_times.push_back(millis_since_boot() - t);
+
+      t = millis_since_boot();
+      unpacker.unpack(data.data(), data.size(), out);
+      unpack_times.push_back(millis_since_boot() - t);
+      if (out.size() != msgs.size()) {
+        printf("version %d lost frames\n", version);
+        return 1;
+      }
+    }
+    printf("version %d, %d frames per transfer, %.2f bytes per frame\n", version, frames, (double)data.size() / frames);
+    report("pack", pack_times, frames);
+    report("unpack", unpack_times, frames);
+  }
+  return 0;
+}
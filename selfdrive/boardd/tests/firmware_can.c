@@ -0,0 +1,76 @@
+// the usb framing of the panda firmware, drivers/can_common.h, built for the PC to test can_packet against.
+// the rest of the firmware the file needs is stubbed out, messages sent to a bus end up in its tx queue
+#include <string.h>
+
+#include "panda/board/tests/libpanda/fake_stm.h"
+
+bool can_init(uint8_t can_number) {
+  UNUSED(can_number);
+  return true;
+}
+
+void process_can(uint8_t can_number) {
+  UNUSED(can_number);
+}
+
+void usb_cb_ep3_out_complete(void) {}
+
+int safety_tx_hook(CAN_FIFOMailBox_TypeDef *to_send) {
+  UNUSED(to_send);
+  return 1;
+}
+
+bool bitbang_gmlan(CAN_FIFOMailBox_TypeDef *to_bang) {
+  UNUSED(to_bang);
+  return false;
+}
+
+#include "panda/board/drivers/can_common.h"
+
+#include "selfdrive/boardd/tests/firmware_can.h"
+
+void firmware_can_reset(uint8_t version) {
+  (void)can_usb_set_version(version);
+  can_clear(&can_rx_q);
+  for (uint8_t i = 0U; i < BUS_MAX; i++) {
+    can_clear(can_queues[i]);
+  }
+  can_send_errs = 0U;
+  can_fwd_errs = 0U;
+}
+
+bool firmware_can_rx(uint32_t addr, uint16_t bus_time, uint8_t bus, uint8_t len, const uint8_t *dat) {
+  CAN_FIFOMailBox_TypeDef msg;
+  uint32_t data[2] = {0U, 0U};
+  (void)memcpy(data, dat, MIN(len, 8U));
+  // like the CAN interrupt pushes it
+  msg.RIR = (addr >= 0x800U) ? ((addr << 3) | 5U) : ((addr << 21) | 1U);
+  msg.RDTR = len | ((uint32_t)bus << 4) | ((uint32_t)bus_time << 16);
+  msg.RDLR = data[0];
+  msg.RDHR = data[1];
+  return can_push(&can_rx_q, &msg);
+}
+
+int firmware_can_pack_in(uint8_t *packet, int len) {
+  return can_usb_pack_in(packet, len);
+}
+
+void firmware_can_unpack_out(uint8_t *packet, int len) {
+  can_usb_unpack_out(packet, len);
+}
+
+bool firmware_can_tx(uint8_t bus, uint32_t *addr, uint8_t *len, uint8_t *dat) {
+  CAN_FIFOMailBox_TypeDef msg;
+  bool ret = can_pop(can_queues[bus], &msg);
+  if (ret) {
+    uint32_t data[2] = {msg.RDLR, msg.RDHR};
+    *addr = GET_ADDR(&msg);
+    *len = GET_LEN(&msg);
+    (void)memcpy(dat, data, 8U);
+  }
+  return ret;
+}
+
+uint32_t firmware_can_errs(void) {
+  return can_send_errs + can_fwd_errs;
+}
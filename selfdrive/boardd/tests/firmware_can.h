@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// firmware_can.c, the panda's side of the usb framing
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// sets the framing version and empties the queues
+void firmware_can_reset(uint8_t version);
+// a message received on a bus, for the host to read. false if the rx queue is full
+bool firmware_can_rx(uint32_t addr, uint16_t bus_time, uint8_t bus, uint8_t len, const uint8_t *dat);
+// can_usb_pack_in, the next usb packet to the host
+int firmware_can_pack_in(uint8_t *packet, int len);
+// can_usb_unpack_out, a usb packet from the host
+void firmware_can_unpack_out(uint8_t *packet, int len);
+// the next message the host sent to a bus, false if there's none
+bool firmware_can_tx(uint8_t bus, uint32_t *addr, uint8_t *len, uint8_t *dat);
+// what can_usb_unpack_out and the tx queues dropped
+uint32_t firmware_can_errs(void);
+
+#ifdef __cplusplus
+}
+#endif
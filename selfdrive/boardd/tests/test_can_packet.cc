@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/boardd/can_packet.h"
+#include "selfdrive/boardd/tests/firmware_can.h"
+
+static std::mt19937 rng(1234);
+
+static std::vector<can_frame> random_frames(int count) {
+  std::vector<can_frame> frames(count);
+  for (auto &f : frames) {
+    f = {};
+    f.address = rng() % 2 ? rng() % 0x800 : 0x800 + rng() % (0x20000000 - 0x800);
+    f.busTime = rng();
+    f.src = (rng() % 3) | (rng() % 4 == 0 ? 0x80 : 0);
+    f.len = rng() % 9;
+    for (int i = 0; i < f.len; i++) f.dat[i] = rng();
+  }
+  return frames;
+}
+
+static bool operator==(const can_frame &a, const can_frame &b) {
+  return a.address == b.address && a.busTime == b.busTime && a.src == b.src && a.len == b.len &&
+         std::equal(a.dat, a.dat + a.len, b.dat);
+}
+
+// cuts a transfer into reads of whole usb packets, like libusb returns them
+static std::vector<std::vector<uint8_t>> random_reads(const std::vector<uint8_t> &transfer) {
+  std::vector<std::vector<uint8_t>> reads;
+  for (size_t pos = 0; pos < transfer.size();) {
+    size_t n = std::min(transfer.size() - pos, (rng() % 4 + 1) * (size_t)CAN_USB_PACKET_SIZE);
+    reads.emplace_back(transfer.begin() + pos, transfer.begin() + pos + n);
+    pos += n;
+  }
+  return reads;
+}
+
+TEST_CASE("version 1 round trip") {
+  auto frames = random_frames(1000);
+  std::vector<uint8_t> data;
+  can_pack(1, frames.data(), frames.size(), data);
+  REQUIRE(data.size() == frames.size() * 0x10);
+
+  CanUnpacker unpacker(1);
+  std::vector<can_frame> out;
+  REQUIRE(unpacker.unpack(data.data(), data.size(), out));
+  REQUIRE(out == frames);
+}
+
+TEST_CASE("version 2 round trip") {
+  CanUnpacker unpacker(2);
+  std::vector<can_frame> sent, out;
+  size_t v1_size = 0, v2_size = 0;
+  for (int i = 0; i < 1000; i++) {
+    auto frames = random_frames(rng() % 64);
+    std::vector<uint8_t> transfer;
+    can_pack(2, frames.data(), frames.size(), transfer);
+    // only the last packet of a transfer is short
+    for (size_t pos = 0; pos + CAN_USB_PACKET_SIZE < transfer.size(); pos += CAN_USB_PACKET_SIZE) {
+      REQUIRE(transfer[pos] == CAN_USB_PACKET_SIZE - CAN_USB_PACKET_HEADER);
+    }
+    for (auto &read : random_reads(transfer)) {
+      REQUIRE(unpacker.unpack(read.data(), read.size(), out));
+    }
+    sent.insert(sent.end(), frames.begin(), frames.end());
+    v1_size += frames.size() * 0x10;
+    v2_size += transfer.size();
+  }
+  REQUIRE(out == sent);
+  REQUIRE(v2_size < v1_size);
+}
+
+TEST_CASE("version 2 syncs up after a lost packet") {
+  CanUnpacker unpacker(2);
+  for (int i = 0; i < 1000; i++) {
+    auto lost = random_frames(rng() % 32 + 8);
+    auto frames = random_frames(rng() % 32);
+    std::vector<uint8_t> first, second;
+    can_pack(2, lost.data(), lost.size(), first);
+    can_pack(2, frames.data(), frames.size(), second);
+
+    // drop a packet, the frames in it and the ones cut by it are gone
+    const size_t packets = (first.size() + CAN_USB_PACKET_SIZE - 1) / CAN_USB_PACKET_SIZE;
+    const size_t drop = rng() % packets * CAN_USB_PACKET_SIZE;
+    first.erase(first.begin() + drop, first.begin() + std::min(first.size(), drop + CAN_USB_PACKET_SIZE));
+
+    std::vector<can_frame> out;
+    for (auto &read : random_reads(first)) {
+      unpacker.unpack(read.data(), read.size(), out);
+    }
+    REQUIRE(out.size() < lost.size());
+
+    // everything after it is there again, a record cut by the lost packet can still show up as an error
+    out.clear();
+    for (auto &read : random_reads(second)) {
+      unpacker.unpack(read.data(), read.size(), out);
+    }
+    REQUIRE(out == frames);
+  }
+}
+
+TEST_CASE("version 2 skips garbage") {
+  CanUnpacker unpacker(2);
+  for (int i = 0; i < 1000; i++) {
+    std::vector<uint8_t> garbage(rng() % 256);
+    for (auto &b : garbage) b = rng();
+    std::vector<can_frame> out;
+    unpacker.unpack(garbage.data(), garbage.size(), out);
+
+    auto frames = random_frames(rng() % 32);
+    std::vector<uint8_t> transfer;
+    can_pack(2, frames.data(), frames.size(), transfer);
+    out.clear();
+    unpacker.unpack(transfer.data(), transfer.size(), out);
+    REQUIRE(out == frames);
+  }
+}
+
+// reads a transfer from the firmware like boardd does: usb packets until a short one, or until the read is full
+static std::vector<uint8_t> firmware_transfer() {
+  std::vector<uint8_t> transfer;
+  const size_t max_size = (rng() % 16 + 1) * CAN_USB_PACKET_SIZE;
+  int len = CAN_USB_PACKET_SIZE;
+  while (len == CAN_USB_PACKET_SIZE && transfer.size() < max_size) {
+    uint8_t packet[CAN_USB_PACKET_SIZE];
+    len = firmware_can_pack_in(packet, CAN_USB_PACKET_SIZE);
+    transfer.insert(transfer.end(), packet, packet + len);
+  }
+  return transfer;
+}
+
+TEST_CASE("CanUnpacker reads what the firmware packs") {
+  const int version = GENERATE(1, 2);
+  firmware_can_reset(version);
+  CanUnpacker unpacker(version);
+  std::vector<can_frame> sent, out;
+  for (int i = 0; i < 1000; i++) {
+    auto frames = random_frames(rng() % 64);
+    for (auto &f : frames) {
+      REQUIRE(firmware_can_rx(f.address, f.busTime, f.src, f.len, f.dat));
+    }
+    for (auto transfer = firmware_transfer(); !transfer.empty(); transfer = firmware_transfer()) {
+      for (auto &read : random_reads(transfer)) {
+        REQUIRE(unpacker.unpack(read.data(), read.size(), out));
+      }
+    }
+    sent.insert(sent.end(), frames.begin(), frames.end());
+  }
+  REQUIRE(out == sent);
+}
+
+TEST_CASE("the firmware sends what can_pack packs") {
+  const int version = GENERATE(1, 2);
+  firmware_can_reset(version);
+  for (int i = 0; i < 1000; i++) {
+    // the bus time and the returned flag aren't sent, the bus is one with a tx queue
+    auto frames = random_frames(rng() % 64);
+    for (auto &f : frames) {
+      f.busTime = 0;
+      f.src = rng() % 3;
+    }
+    std::vector<uint8_t> transfer;
+    can_pack(version, frames.data(), frames.size(), transfer);
+    // the firmware gets it one usb packet at a time
+    for (size_t pos = 0; pos < transfer.size(); pos += CAN_USB_PACKET_SIZE) {
+      firmware_can_unpack_out(&transfer[pos], std::min(transfer.size() - pos, (size_t)CAN_USB_PACKET_SIZE));
+    }
+
+    for (uint8_t bus = 0; bus < 3; bus++) {
+      std::vector<can_frame> expected, received;
+      std::copy_if(frames.begin(), frames.end(), std::back_inserter(expected), [=](auto &f) { return f.src == bus; });
+      can_frame f = {};
+      f.src = bus;
+      while (firmware_can_tx(bus, &f.address, &f.len, f.dat)) {
+        received.push_back(f);
+      }
+      REQUIRE(received == expected);
+    }
+  }
+  REQUIRE(firmware_can_errs() == 0);
+}
@@ -4,13 +4,12 @@
 
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <chrono>
 #include <thread>
 
-#include "libyuv.h"
 #include <jpeglib.h>
 
-#include "selfdrive/camerad/imgproc/utils.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
@@ -44,6 +43,12 @@ static cl_program build_debayer_program(cl_device_id device_id, cl_context conte
   return cl_program_from_file(context, device_id, cl_file, args);
 }
 
+static ThreadPool *cpu_processing_pool() {
+  // shared by all cameras, CAMERAD_CPU_THREADS=0 uses every core
+  static ThreadPool pool(util::getenv("CAMERAD_CPU_THREADS", 0));
+  return &pool;
+}
+
 void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s, VisionIpcServer * v, int frame_cnt, VisionStreamType rgb_type, VisionStreamType yuv_type, release_cb release_callback) {
   vipc_server = v;
   this->rgb_type = rgb_type;
@@ -53,6 +58,7 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   const CameraInfo *ci = &s->ci;
   camera_state = s;
   frame_buf_count = frame_cnt;
+  assert(frame_buf_count <= FRAME_QUEUE_SIZE);
 
   // RAW frame
   const int frame_size = ci->frame_height * ci->frame_stride;
@@ -79,14 +85,24 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   rgb_stride = vipc_server->get_buffer(rgb_type)->stride;
 
   vipc_server->create_buffers(yuv_type, YUV_COUNT, false, rgb_width, rgb_height);
+  stats.init(rgb_width, rgb_height);
 
-  if (ci->bayer) {
+  if (env_cpu_processing) {
+    if (ci->bayer) {
+      debayer_cpu = std::make_unique<DebayerCPU>(ci->frame_width, ci->frame_height, ci->frame_stride,
+                                                 rgb_width, rgb_height, rgb_stride, ci->bayer_flip, ci->hdr,
+                                                 s->camera_num, Hardware::TICI(), cpu_processing_pool());
+    }
+    rgb2yuv_cpu = std::make_unique<Rgb2YuvCPU>(rgb_width, rgb_height, rgb_stride, cpu_processing_pool());
+  } else if (ci->bayer) {
     cl_program prg_debayer = build_debayer_program(device_id, context, ci, this, s);
     krnl_debayer = CL_CHECK_ERR(clCreateKernel(prg_debayer, "debayer10", &err));
     CL_CHECK(clReleaseProgram(prg_debayer));
   }
 
-  rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
+  if (!env_cpu_processing) {
+    rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
+  }
 
 #ifdef __APPLE__
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
@@ -106,7 +122,7 @@ CameraBuf::~CameraBuf() {
 }
 
 bool CameraBuf::acquire() {
-  if (!safe_queue.try_pop(cur_buf_idx, 1)) return false;
+  if (!frame_queue.try_pop(cur_buf_idx, 1)) return false;
 
   if (camera_bufs_metadata[cur_buf_idx].frame_id == -1) {
     LOGE("no frame data? wtf");
@@ -117,6 +133,10 @@ bool CameraBuf::acquire() {
   cur_frame_data = camera_bufs_metadata[cur_buf_idx];
   cur_rgb_buf = vipc_server->get_buffer(rgb_type);
 
+  if (env_cpu_processing) {
+    return acquire_cpu();
+  }
+
   cl_event debayer_event;
   cl_mem camrabuf_cl = camera_bufs[cur_buf_idx].buf_cl;
   if (camera_state->ci.bayer) {
@@ -162,6 +182,38 @@ bool CameraBuf::acquire() {
   return true;
 }
 
+bool CameraBuf::acquire_cpu() {
+  // everything happens on the host copies, so there is nothing to sync from the device when sending
+  const uint8_t *frame = (const uint8_t *)camera_bufs[cur_buf_idx].addr;
+  uint8_t *rgb = (uint8_t *)cur_rgb_buf->addr;
+  if (camera_state->ci.bayer) {
+    float digital_gain = 1.0;
+#ifndef QCOM2
+    digital_gain = camera_state->digital_gain;
+    if ((int)digital_gain == 0) {
+      digital_gain = 1.0;
+    }
+#endif
+    debayer_cpu->debayer(frame, rgb, digital_gain);
+  } else {
+    assert(rgb_stride == camera_state->ci.frame_stride);
+    memcpy(rgb, frame, cur_rgb_buf->len);
+  }
+
+  cur_yuv_buf = vipc_server->get_buffer(yuv_type);
+  rgb2yuv_cpu->convert(rgb, (uint8_t *)cur_yuv_buf->addr);
+
+  VisionIpcBufExtra extra = {
+                        cur_frame_data.frame_id,
+                        cur_frame_data.timestamp_sof,
+                        cur_frame_data.timestamp_eof,
+  };
+  vipc_server->send(cur_rgb_buf, &extra, false);
+  vipc_server->send(cur_yuv_buf, &extra, false);
+
+  return true;
+}
+
 void CameraBuf::release() {
   if (release_callback) {
     release_callback((void*)camera_state, cur_buf_idx);
@@ -169,7 +221,9 @@ void CameraBuf::release() {
 }
 
 void CameraBuf::queue(size_t buf_idx) {
-  safe_queue.push(buf_idx);
+  if (!frame_queue.push(buf_idx)) {
+    LOGW_100("frame queue full, dropping buffer %zu", buf_idx);
+  }
 }
 
 // common functions
@@ -209,30 +263,27 @@ kj::Array<uint8_t> get_frame_image(const CameraBuf *b) {
   uint8_t *resized_dat = frame_image.begin();
   int goff = x_min*3 + y_min*b->rgb_stride;
   for (int r=0;r<new_height;r++) {
+    const uint8_t *src = &dat[goff+r*b->rgb_stride*scale];
+    uint8_t *dst = &resized_dat[r*new_width*3];
+    if (scale == 1) {
+      memcpy(dst, src, new_width*3);
+      continue;
+    }
     for (int c=0;c<new_width;c++) {
-      memcpy(&resized_dat[(r*new_width+c)*3], &dat[goff+r*b->rgb_stride*scale+c*3*scale], 3*sizeof(uint8_t));
+      dst[c*3+0] = src[c*3*scale+0];
+      dst[c*3+1] = src[c*3*scale+1];
+      dst[c*3+2] = src[c*3*scale+2];
     }
   }
   return kj::mv(frame_image);
 }
 
-static kj::Array<capnp::byte> yuv420_to_jpeg(const CameraBuf *b, int thumbnail_width, int thumbnail_height) {
-  // make the buffer big enough. jpeg_write_raw_data requires 16-pixels aligned height to be used.
-  std::unique_ptr<uint8[]> buf(new uint8_t[(thumbnail_width * ((thumbnail_height + 15) & ~15) * 3) / 2]);
-  uint8_t *y_plane = buf.get();
+static kj::Array<capnp::byte> yuv420_to_jpeg(const CameraBuf *b) {
+  // the downscaled planes come from the frame stats pass
+  const int thumbnail_width = b->stats.thumbnail_width, thumbnail_height = b->stats.thumbnail_height;
+  uint8_t *y_plane = (uint8_t *)b->stats.thumbnail.data();
   uint8_t *u_plane = y_plane + thumbnail_width * thumbnail_height;
   uint8_t *v_plane = u_plane + (thumbnail_width * thumbnail_height) / 4;
-  {
-    int result = libyuv::I420Scale(
-        b->cur_yuv_buf->y, b->rgb_width, b->cur_yuv_buf->u, b->rgb_width / 2, b->cur_yuv_buf->v, b->rgb_width / 2,
-        b->rgb_width, b->rgb_height,
-        y_plane, thumbnail_width, u_plane, thumbnail_width / 2, v_plane, thumbnail_width / 2,
-        thumbnail_width, thumbnail_height, libyuv::kFilterNone);
-    if (result != 0) {
-      LOGE("Generate YUV thumbnail failed.");
-      return {};
-    }
-  }
 
   struct jpeg_compress_struct cinfo;
   struct jpeg_error_mgr jerr;
@@ -285,7 +336,7 @@ static kj::Array<capnp::byte> yuv420_to_jpeg(const CameraBuf *b, int thumbnail_w
 }
 
 static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
-  auto thumbnail = yuv420_to_jpeg(b, b->rgb_width / 4, b->rgb_height / 4);
+  auto thumbnail = yuv420_to_jpeg(b);
   if (thumbnail.size() == 0) return;
 
   MessageBuilder msg;
@@ -297,32 +348,13 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   pm->send("thumbnail", msg);
 }
 
-float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
-  int lum_med;
-  uint32_t lum_binning[256] = {0};
-  const uint8_t *pix_ptr = b->cur_yuv_buf->y;
-
-  unsigned int lum_total = 0;
-  for (int y = y_start; y < y_end; y += y_skip) {
-    for (int x = x_start; x < x_end; x += x_skip) {
-      uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
-      lum_binning[lum]++;
-      lum_total += 1;
-    }
+float set_exposure_target(CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
+  // the stats pass already built the histogram for this frame, unless the rect changed since the last one
+  const ExposureRect rect = {x_start, x_end, x_skip, y_start, y_end, y_skip};
+  if (!(rect == b->stats.exposure_rect)) {
+    b->stats.update_histogram(b->cur_yuv_buf->y, rect);
   }
-
-
-  // Find mean lumimance value
-  unsigned int lum_cur = 0;
-  for (lum_med = 255; lum_med >= 0; lum_med--) {
-    lum_cur += lum_binning[lum_med];
-
-    if (lum_cur >= lum_total / 2) {
-      break;
-    }
-  }
-
-  return lum_med / 256.0;
+  return b->stats.exposure_median();
 }
 
 extern ExitHandler do_exit;
@@ -342,10 +374,13 @@ void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thre
   while (!do_exit) {
     if (!cs->buf.acquire()) continue;
 
+    const bool thumbnail = cs == &(cameras->road_cam) && cameras->pm && cnt % 100 == 3;
+    VisionBuf *yuv = cs->buf.cur_yuv_buf;
+    cs->buf.stats.update(yuv->y, yuv->u, yuv->v, thumbnail, cnt);
+
     callback(cameras, cs, cnt);
 
-    if (cs == &(cameras->road_cam) && cameras->pm && cnt % 100 == 3) {
-      // this takes 10ms???
+    if (thumbnail) {
       publish_thumbnail(cameras->pm, &(cs->buf));
     }
     cs->buf.release();
@@ -360,14 +395,13 @@ std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, pro
 
 static void driver_cam_auto_exposure(CameraState *c, SubMaster &sm) {
   static const bool is_rhd = Params().getBool("IsRHD");
-  struct ExpRect {int x1, x2, x_skip, y1, y2, y_skip;};
-  const CameraBuf *b = &c->buf;
+  CameraBuf *b = &c->buf;
 
   int x_offset = 0, y_offset = 0;
   int frame_width = b->rgb_width, frame_height = b->rgb_height;
 
 
-  ExpRect def_rect;
+  ExposureRect def_rect;
   if (Hardware::TICI()) {
     x_offset = 630, y_offset = 156;
     frame_width = 668, frame_height = frame_width / 1.33;
@@ -377,7 +411,7 @@ static void driver_cam_auto_exposure(CameraState *c, SubMaster &sm) {
                 b->rgb_height / 3, b->rgb_height, 1};
   }
 
-  static ExpRect rect = def_rect;
+  static ExposureRect rect = def_rect;
   // use driver face crop for AE
   if (Hardware::EON() && sm.updated("driverState")) {
     if (auto state = sm["driverState"].getDriverState(); state.getFaceProb() > 0.4) {
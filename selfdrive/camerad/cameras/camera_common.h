@@ -9,6 +9,8 @@
 #include "cereal/visionipc/visionbuf.h"
 #include "cereal/visionipc/visionipc.h"
 #include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/camerad/cameras/debayer_cpu.h"
+#include "selfdrive/camerad/imgproc/utils.h"
 #include "selfdrive/camerad/transforms/rgb_to_yuv.h"
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/queue.h"
@@ -37,6 +39,8 @@ enum CameraType {
 const bool env_send_driver = getenv("SEND_DRIVER") != NULL;
 const bool env_send_road = getenv("SEND_ROAD") != NULL;
 const bool env_send_wide_road = getenv("SEND_WIDE_ROAD") != NULL;
+// debayer and convert to yuv on the CPU instead of with OpenCL kernels
+const bool env_cpu_processing = getenv("CAMERAD_CPU") != NULL;
 
 typedef void (*release_cb)(void *cookie, int buf_idx);
 
@@ -102,16 +106,23 @@ private:
   cl_kernel krnl_debayer;
 
   std::unique_ptr<Rgb2Yuv> rgb2yuv;
+  std::unique_ptr<DebayerCPU> debayer_cpu;
+  std::unique_ptr<Rgb2YuvCPU> rgb2yuv_cpu;
 
   VisionStreamType rgb_type, yuv_type;
 
   int cur_buf_idx;
 
-  SafeQueue<int> safe_queue;
+  // buffer indices from the sensor thread to the processing thread. fits all the buffers, only cameras
+  // reusing a buffer before it's released can drop one
+  static constexpr int FRAME_QUEUE_SIZE = 32;
+  BlockingSPSCQueue<int, FRAME_QUEUE_SIZE> frame_queue;
 
   int frame_buf_count;
   release_cb release_callback;
 
+  bool acquire_cpu();
+
 public:
   cl_command_queue q;
   FrameMetadata cur_frame_data;
@@ -122,6 +133,7 @@ public:
   int rgb_width, rgb_height, rgb_stride;
 
   mat3 yuv_transform;
+  FrameStats stats;
 
   CameraBuf() = default;
   ~CameraBuf();
@@ -135,7 +147,7 @@ typedef void (*process_thread_cb)(MultiCameraState *s, CameraState *c, int cnt);
 
 void fill_frame_data(cereal::FrameData::Builder &framed, const FrameMetadata &frame_data);
 kj::Array<uint8_t> get_frame_image(const CameraBuf *b);
-float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip);
+float set_exposure_target(CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip);
 std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback);
 void common_process_driver_camera(SubMaster *sm, PubMaster *pm, CameraState *c, int cnt);
 
@@ -227,7 +227,7 @@ void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_i
     s->stats_bufs[i].allocate(0xb80);
   }
   std::fill_n(s->lapres, std::size(s->lapres), 16160);
-  s->lap_conv = new LapConv(device_id, ctx, s->road_cam.buf.rgb_width, s->road_cam.buf.rgb_height, 3);
+  s->road_cam.buf.stats.lap_rois = std::size(s->lapres);
 }
 
 static void set_exposure(CameraState *s, float exposure_frac, float gain_frac) {
@@ -1092,9 +1092,9 @@ void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
 
 // called by processing_thread
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
-  const CameraBuf *b = &c->buf;
-  const int roi_id = cnt % std::size(s->lapres);  // rolling roi
-  s->lapres[roi_id] = s->lap_conv->Update(b->q, (uint8_t *)b->cur_rgb_buf->addr, roi_id);
+  CameraBuf *b = &c->buf;
+  // the stats pass computes one rolling roi per frame
+  s->lapres[b->stats.lap_roi_id] = b->stats.lap_score;
   setup_self_recover(c, &s->lapres[0], std::size(s->lapres));
 
   MessageBuilder msg;
@@ -1200,7 +1200,6 @@ void cameras_close(MultiCameraState *s) {
     s->stats_bufs[i].free();
   }
 
-  delete s->lap_conv;
   delete s->sm;
   delete s->pm;
 }
@@ -100,7 +100,6 @@ typedef struct MultiCameraState {
 
   SubMaster *sm;
   PubMaster *pm;
-  LapConv *lap_conv;
 } MultiCameraState;
 
 void actuator_move(CameraState *s, uint16_t target);
@@ -1,6 +1,7 @@
 #include "selfdrive/camerad/cameras/camera_replay.h"
 
 #include <cassert>
+#include <cstring>
 #include <thread>
 
 #include "selfdrive/common/clutil.h"
@@ -57,7 +58,9 @@ void run_camera(CameraState *s) {
     if (s->frame->get(stream_frame_id++, rgb_buf.get(), nullptr)) {
       s->buf.camera_bufs_metadata[buf_idx] = {.frame_id = frame_id};
       auto &buf = s->buf.camera_bufs[buf_idx];
-      CL_CHECK(clEnqueueWriteBuffer(buf.copy_q, buf.buf_cl, CL_TRUE, 0, s->frame->getRGBSize(), rgb_buf.get(), 0, NULL, NULL));
+      // fill the host copy too, CAMERAD_CPU reads it directly
+      memcpy(buf.addr, rgb_buf.get(), s->frame->getRGBSize());
+      buf.sync(VISIONBUF_SYNC_TO_DEVICE);
       s->buf.queue(buf_idx);
       ++frame_id;
       buf_idx = (buf_idx + 1) % FRAME_BUF_COUNT;
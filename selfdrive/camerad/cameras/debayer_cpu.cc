@@ -0,0 +1,283 @@
+#include "selfdrive/camerad/cameras/debayer_cpu.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// the math below mirrors debayer.cl and real_debayer.cl, keep them in sync
+
+static inline uint8_t to_uchar_sat(float x) {
+  // matches convert_uchar_sat: round toward zero, NaN goes to 0
+  return x > 0.0f ? (x < 255.0f ? (uint8_t)x : 255) : 0;
+}
+
+DebayerCPU::DebayerCPU(int frame_width, int frame_height, int frame_stride, int rgb_width, int rgb_height, int rgb_stride,
+                       int bayer_flip, bool hdr, int camera_num, bool real_debayer, ThreadPool *pool)
+    : frame_width(frame_width), frame_height(frame_height), frame_stride(frame_stride),
+      rgb_width(rgb_width), rgb_height(rgb_height), rgb_stride(rgb_stride),
+      bayer_flip(bayer_flip), hdr(hdr), camera_num(camera_num), real_debayer(real_debayer), pool(pool) {
+  assert(rgb_stride >= rgb_width * 3);
+  if (real_debayer) {
+    assert(rgb_width == frame_width && rgb_height == frame_height);
+  }
+
+  // same values as the dpcm_lookup table in debayer.cl: five groups of steps, each followed by its negation
+  const int groups[][3] = {{0, 1, 32}, {935, 16, 32}, {419, 8, 64}, {161, 4, 64}, {32, 2, 64}};
+  for (auto [base, step, n] : groups) {
+    for (int sign : {1, -1}) {
+      for (int i = 0; i < n; i++) dpcm_lookup.push_back(sign * (base + step * i));
+    }
+  }
+  assert(dpcm_lookup.size() == 512);
+}
+
+void DebayerCPU::debayer(const uint8_t *in, uint8_t *out, float digital_gain) {
+  auto rows = [=](int start, int end) {
+    real_debayer ? real_debayer_rows(in, out, start, end) : debayer_rows(in, out, digital_gain, start, end);
+  };
+  if (pool) {
+    pool->parallel_for(rgb_height, rows);
+  } else {
+    rows(0, rgb_height);
+  }
+}
+
+// debayer.cl
+
+static const float color_correction[3][3] = {
+  // Matrix from WBraw -> sRGBD65 (normalized)
+  { 1.62393627, -0.2092988,  0.00119886},
+  {-0.45734315,  1.5534676, -0.59296798},
+  {-0.16659312, -0.3441688,  1.59176912},
+};
+
+static inline float srgb_gamma(float p) {
+  return p <= 0.0031308f ? p * 12.92f : (1.0f + 0.055f) * powf(p, 1 / 2.4f) - 0.055f;
+}
+
+void DebayerCPU::debayer_rows(const uint8_t *in, uint8_t *out, float digital_gain, int row_start, int row_end) {
+  const float black_level = 56.0f;
+  const float fake_f = 700.0f;
+  const float scale = digital_gain / (hdr ? (16384.0f - black_level) : (1024.0f - black_level));
+  const float white_balance[3] = {0.4609375, 1.0, 0.546875};
+
+  for (int oy = row_start; oy < row_end; oy++) {
+    const uint8_t *row0 = &in[(oy * 2) * frame_stride];
+    const uint8_t *row1 = &in[(oy * 2 + 1) * frame_stride];
+    uint8_t *out_row = &out[oy * rgb_stride];
+    uint32_t pint_last[4] = {};
+
+    for (int ox = 0; ox < rgb_width; ox += 2) {
+      const int ix = (ox / 2) * 5;
+      const uint8_t ex1 = row0[ix + 4], ex2 = row1[ix + 4];
+
+      // vignetting correction is per 2 pixels, like the kernel
+      const float r = (oy - rgb_height / 2) * (oy - rgb_height / 2) + (ox - rgb_width / 2) * (ox - rgb_width / 2);
+      const float lil_a = 1.0f + r / (fake_f * fake_f);
+      const float gain = lil_a * lil_a * scale;
+
+      for (int px = 0; px < 2 && ox + px < rgb_width; px++) {
+        const int c = px * 2;
+        uint32_t pint[4] = {
+          ((uint32_t)row0[ix + c] << 2) + ((ex1 >> (c * 2)) & 3),
+          ((uint32_t)row0[ix + c + 1] << 2) + ((ex1 >> (c * 2 + 2)) & 3),
+          ((uint32_t)row1[ix + c] << 2) + ((ex2 >> (c * 2)) & 3),
+          ((uint32_t)row1[ix + c + 1] << 2) + ((ex2 >> (c * 2 + 2)) & 3),
+        };
+
+        if (hdr) {
+          // decompress HDR
+          for (int i = 0; i < 4; i++) {
+            if (ox == 0 && px == 0) {
+              pint[i] = (pint[i] << 4) | 8;
+            } else if (pint[i] < 0x200) {
+              pint[i] = pint_last[i] + dpcm_lookup[pint[i]];
+            } else {
+              uint32_t r2 = ((pint[i] - 0x200) << 5) | 0xF;
+              pint[i] = r2 + (r2 <= pint_last[i] ? 1 : 0);
+            }
+            pint_last[i] = pint[i];
+          }
+        }
+
+        float p[4];
+        for (int i = 0; i < 4; i++) {
+          p[i] = (pint[i] - black_level) * gain;
+        }
+
+        // use both green channels
+        float rgb[3];
+        switch (bayer_flip) {
+          case 3: rgb[0] = p[3]; rgb[1] = (p[1] + p[2]) / 2.0f; rgb[2] = p[0]; break;
+          case 2: rgb[0] = p[2]; rgb[1] = (p[0] + p[3]) / 2.0f; rgb[2] = p[1]; break;
+          case 1: rgb[0] = p[1]; rgb[1] = (p[0] + p[3]) / 2.0f; rgb[2] = p[2]; break;
+          default: rgb[0] = p[0]; rgb[1] = (p[1] + p[2]) / 2.0f; rgb[2] = p[3]; break;
+        }
+
+        // white balance of daylight, then fix up the colors
+        float corrected[3] = {};
+        for (int i = 0; i < 3; i++) {
+          const float x = std::clamp(rgb[i] / white_balance[i], 0.0f, 1.0f);
+          for (int j = 0; j < 3; j++) corrected[j] += x * color_correction[i][j];
+        }
+
+        // output BGR
+        uint8_t *dst = &out_row[(ox + px) * 3];
+        for (int i = 0; i < 3; i++) {
+          const float v = hdr ? srgb_gamma(corrected[2 - i]) : corrected[2 - i];
+          dst[i] = to_uchar_sat(v * 255.0f);
+        }
+      }
+    }
+  }
+}
+
+// real_debayer.cl
+
+static const float real_black_level = 42.0;
+
+static const float real_color_correction[3][3] = {
+  // post wb CCM
+  {1.82717181, -0.31231438, 0.07307673},
+  {-0.5743977, 1.36858544, -0.53183455},
+  {-0.25277411, -0.05627105, 1.45875782},
+};
+
+// tone mapping params
+static const float cpk = 0.75;
+static const float cpb = 0.125;
+static const float cpx = 0.01;
+
+// mf() from real_debayer.cl with the constant factors folded and the branches turned into selects,
+// so the tone mapping loop vectorizes. below and above cp the curve is
+// (rk * (x-cp) * k) / (1 +- rk * (x-cp)) + cpk*cp + cpb, with a different k on each side
+static const float mf_rk = 9 - 100 * cpx;
+static const float mf_k_hi = (1 - (cpk * cpx + cpb)) * (1 + 1 / (mf_rk * (1 - cpx)));
+static const float mf_k_lo = (cpk * cpx + cpb) * (1 + 1 / (mf_rk * cpx));
+static const float mf_offset = cpk * cpx + cpb;
+
+static inline float mf(float x) {
+  const float t = mf_rk * (x - cpx);
+  const float ret = (t * (x > cpx ? mf_k_hi : mf_k_lo)) / (1 + fabsf(t)) + mf_offset;
+  return x == cpx ? x : ret;
+}
+
+static inline float phi(float x) {
+  // detection funtion
+  return 2 - x;
+}
+
+void DebayerCPU::unpack_row(const uint8_t *in, int gy, float *row) {
+  // parse 10bit, 4 pixels per 5 bytes
+  const uint8_t *src = &in[gy * frame_stride];
+  for (int gx = 0; gx < frame_width; gx += 4) {
+    const uint8_t *block = &src[5 * (gx / 4)];
+    for (int i = 0; i < 4 && gx + i < frame_width; i++) {
+      const uint32_t v = ((uint32_t)block[i] << 2) + ((block[4] >> (2 * i)) & 3);
+      // normalize
+      row[gx + i] = std::max(0.0f, v - real_black_level) * 0.00101833f;  // /= (1024.0f - black_level);
+    }
+  }
+
+  // correct vignetting
+  if (camera_num == 1) {  // fcamera
+    const int dy = gy - rgb_height / 2;
+    for (int gx = 0; gx < frame_width; gx++) {
+      const int dx = gx - rgb_width / 2;
+      const float r = dx * dx + dy * dy;
+      const float s = r < 62500 ? 1.0f + 0.0000008f * r
+                    : r < 490000 ? 0.9625f + 0.0000014f * r
+                    : r < 1102500 ? 1.26434f + 0.0000000000016f * r * r
+                    : 0.53503625f + 0.0000000000022f * r * r;
+      row[gx] *= s;
+    }
+  }
+
+  // the kernel calls clamp(0, 1, pv) with the arguments swapped, which only bounds from above
+  for (int gx = 0; gx < frame_width; gx++) {
+    row[gx] = std::min(1.0f, row[gx]);
+  }
+}
+
+// a simplified version of https://opensignalprocessingjournal.com/contents/volumes/V6/TOSIGPJ-6-1/TOSIGPJ-6-1.pdf
+template <bool x_even, bool y_even>
+static inline void interpolate(const float *up, const float *cur, const float *down, int x, float *r, float *g, float *b) {
+  const float pv = cur[x];
+  const float d1 = up[x - 1], d2 = up[x + 1], d3 = down[x - 1], d4 = down[x + 1];
+  const float n1 = up[x], n2 = cur[x + 1], n3 = down[x], n4 = cur[x - 1];
+
+  if (x_even == y_even) {
+    // G1(R) on even rows, G2(B) on odd rows
+    const float k1 = phi(fabsf(d1 - pv) + fabsf(d2 - pv));
+    const float k2 = phi(fabsf(d2 - pv) + fabsf(d4 - pv));
+    const float k3 = phi(fabsf(d3 - pv) + fabsf(d4 - pv));
+    const float k4 = phi(fabsf(d1 - pv) + fabsf(d3 - pv));
+    const float horizontal = (k2 * n2 + k4 * n4) / (k2 + k4);
+    const float vertical = (k1 * n1 + k3 * n3) / (k1 + k3);
+    *g = pv;
+    *r = y_even ? horizontal : vertical;
+    *b = y_even ? vertical : horizontal;
+  } else {
+    // B on odd rows, R on even rows
+    const float k1 = phi(fabsf(d1 - d3) + fabsf(d2 - d4));
+    const float k2 = phi(fabsf(n1 - n4) + fabsf(n2 - n3));
+    const float k3 = phi(fabsf(d1 - d2) + fabsf(d3 - d4));
+    const float k4 = phi(fabsf(n1 - n2) + fabsf(n3 - n4));
+    const float green = (k1 * (n1 + n3) * 0.5f + k3 * (n2 + n4) * 0.5f) / (k1 + k3);
+    const float diagonal = (k2 * (d2 + d3) * 0.5f + k4 * (d1 + d4) * 0.5f) / (k2 + k4);
+    *g = green;
+    *r = y_even ? pv : diagonal;
+    *b = y_even ? diagonal : pv;
+  }
+}
+
+template <bool y_even>
+static void interpolate_row(const float *up, const float *cur, const float *down, int width, float *r, float *g, float *b) {
+  int x = 1;
+  for (; x + 1 < width - 1; x += 2) {
+    interpolate<false, y_even>(up, cur, down, x, &r[x], &g[x], &b[x]);
+    interpolate<true, y_even>(up, cur, down, x + 1, &r[x + 1], &g[x + 1], &b[x + 1]);
+  }
+  if (x < width - 1) {
+    interpolate<false, y_even>(up, cur, down, x, &r[x], &g[x], &b[x]);
+  }
+}
+
+void DebayerCPU::real_debayer_rows(const uint8_t *in, uint8_t *out, int row_start, int row_end) {
+  // like the kernel, the outermost pixels are left untouched
+  row_start = std::max(row_start, 1);
+  row_end = std::min(row_end, rgb_height - 1);
+  if (row_start >= row_end) return;
+
+  // three unpacked input rows rotate through the window, plus the interpolated planes of the current row
+  std::vector<float> buf(frame_width * 6);
+  float *rows[3] = {&buf[0], &buf[frame_width], &buf[frame_width * 2]};
+  float *r = &buf[frame_width * 3], *g = &buf[frame_width * 4], *b = &buf[frame_width * 5];
+  unpack_row(in, row_start - 1, rows[0]);
+  unpack_row(in, row_start, rows[1]);
+
+  for (int y = row_start; y < row_end; y++) {
+    unpack_row(in, y + 1, rows[2]);
+    if (y % 2 == 0) {
+      interpolate_row<true>(rows[0], rows[1], rows[2], frame_width, r, g, b);
+    } else {
+      interpolate_row<false>(rows[0], rows[1], rows[2], frame_width, r, g, b);
+    }
+
+    // color correct and tone map in place, then interleave as BGR. the kernel's clamp(0, 1, rgb) and
+    // clamp(0, 255, ret) have swapped arguments, so both only bound from above
+    for (int x = 1; x < rgb_width - 1; x++) {
+      const float cr = std::min(r[x], 1.0f), cg = std::min(g[x], 1.0f), cb = std::min(b[x], 1.0f);
+      r[x] = mf(cr * real_color_correction[0][0] + cg * real_color_correction[1][0] + cb * real_color_correction[2][0]);
+      g[x] = mf(cr * real_color_correction[0][1] + cg * real_color_correction[1][1] + cb * real_color_correction[2][1]);
+      b[x] = mf(cr * real_color_correction[0][2] + cg * real_color_correction[1][2] + cb * real_color_correction[2][2]);
+    }
+    uint8_t *out_row = &out[y * rgb_stride];
+    for (int x = 1; x < rgb_width - 1; x++) {
+      out_row[x * 3 + 0] = to_uchar_sat(std::min(255.0f, b[x] * 255.0f));
+      out_row[x * 3 + 1] = to_uchar_sat(std::min(255.0f, g[x] * 255.0f));
+      out_row[x * 3 + 2] = to_uchar_sat(std::min(255.0f, r[x] * 255.0f));
+    }
+    std::rotate(rows, rows + 1, rows + 3);
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "selfdrive/common/threadpool.h"
+
+// CPU versions of the debayer10 kernels, for running camerad's processing without a usable GPU.
+// real_debayer follows real_debayer.cl (tici, full resolution), otherwise debayer.cl (2x2 binning).
+// rows are split across the pool, a null pool runs everything on the calling thread
+class DebayerCPU {
+public:
+  DebayerCPU(int frame_width, int frame_height, int frame_stride, int rgb_width, int rgb_height, int rgb_stride,
+             int bayer_flip, bool hdr, int camera_num, bool real_debayer, ThreadPool *pool = nullptr);
+  void debayer(const uint8_t *in, uint8_t *out, float digital_gain);
+
+private:
+  void debayer_rows(const uint8_t *in, uint8_t *out, float digital_gain, int row_start, int row_end);
+  void real_debayer_rows(const uint8_t *in, uint8_t *out, int row_start, int row_end);
+  void unpack_row(const uint8_t *in, int gy, float *row);
+
+  const int frame_width, frame_height, frame_stride;
+  const int rgb_width, rgb_height, rgb_stride;
+  const int bayer_flip;
+  const bool hdr;
+  const int camera_num;
+  const bool real_debayer;
+  ThreadPool *pool;
+  std::vector<int> dpcm_lookup;
+};
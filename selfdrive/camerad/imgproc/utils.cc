@@ -2,36 +2,24 @@
 
 #include <algorithm>
 #include <cassert>
-#include <cstdio>
-#include <cmath>
-#include <cstring>
-
-const int16_t lapl_conv_krnl[9] = {0, 1, 0,
-                                   1, -4, 1,
-                                   0, 1, 0};
-
-// calculate score based on laplacians in one area
-uint16_t get_lapmap_one(const int16_t *lap, int x_pitch, int y_pitch) {
-  const int size = x_pitch * y_pitch;
-  // avg and max of roi
-  int16_t max = 0;
-  int sum = 0;
-  for (int i = 0; i < size; ++i) {
-    const int16_t v = lap[i];
-    sum += v;
-    if (v > max) max = v;
-  }
 
-  const int16_t mean = sum / size;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-  // var of roi
-  int var = 0;
-  for (int i = 0; i < size; ++i) {
-    var += std::pow(lap[i] - mean, 2);
-  }
+// luma has a narrower range than the gray the sharpness thresholds were tuned on
+// (b/9 + g/2 + r/3, roughly 0.94 of the input against 0.87 for luma), scale the laplacian back up
+constexpr float LAP_LUMA_SCALE = 0.944f / 0.867f;
 
-  const float fvar = (float)var / size;
-  return std::min(5 * fvar + max, (float)65535);
+// score based on the laplacians in one area: 5 * variance + max
+static uint16_t get_lapmap_one(int64_t sum, int64_t sum_sq, int16_t max, int size) {
+  const int16_t mean = sum / size;
+  // sum of (lap - mean)^2, expanded so it only needs the running sums
+  const int64_t var = sum_sq - 2 * mean * sum + (int64_t)size * mean * mean;
+  const float fvar = (float)var / size * LAP_LUMA_SCALE * LAP_LUMA_SCALE;
+  return std::min(5 * fvar + max * LAP_LUMA_SCALE, (float)65535);
 }
 
 bool is_blur(const uint16_t *lapmap, const size_t size) {
@@ -44,63 +32,190 @@ bool is_blur(const uint16_t *lapmap, const size_t size) {
   return (bad_sum > LM_PREC_THRESH);
 }
 
-static cl_program build_conv_program(cl_device_id device_id, cl_context context, int image_w, int image_h, int filter_size) {
-  char args[4096];
-  snprintf(args, sizeof(args),
-          "-cl-fast-relaxed-math -cl-denorms-are-zero "
-          "-DIMAGE_W=%d -DIMAGE_H=%d -DFLIP_RB=%d "
-          "-DFILTER_SIZE=%d -DHALF_FILTER_SIZE=%d -DTWICE_HALF_FILTER_SIZE=%d -DHALF_FILTER_SIZE_IMAGE_W=%d",
-          image_w, image_h, 1,
-          filter_size, filter_size/2, (filter_size/2)*2, (filter_size/2)*image_w);
-  return cl_program_from_file(context, device_id, "imgproc/conv.cl", args);
+void FrameStats::init(int w, int h) {
+  width = w;
+  height = h;
+  thumbnail_width = width / 4;
+  thumbnail_height = height / 4;
+  // jpeg_write_raw_data wants the height aligned to 16 rows
+  thumbnail.resize(thumbnail_width * ((thumbnail_height + 15) & ~15) * 3 / 2);
+}
+
+// four partial histograms, so consecutive pixels of the same value don't stall on one counter
+static void histogram_row(const uint8_t *row, int x1, int x2, int x_skip, uint32_t hist[4][256]) {
+  int x = x1;
+  for (; x + 3 * x_skip < x2; x += 4 * x_skip) {
+    hist[0][row[x]]++;
+    hist[1][row[x + x_skip]]++;
+    hist[2][row[x + 2 * x_skip]]++;
+    hist[3][row[x + 3 * x_skip]]++;
+  }
+  for (; x < x2; x += x_skip) {
+    hist[0][row[x]]++;
+  }
+}
+
+static void merge_histogram(const uint32_t hist[4][256], uint32_t *out) {
+  for (int i = 0; i < 256; i++) {
+    out[i] = hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+  }
+}
+
+// every 4th pixel from the 3rd, 16 at a time
+static void sample_row(const uint8_t *src, int n, uint8_t *dst) {
+  int i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 16 <= n; i += 16) {
+    vst1q_u8(&dst[i], vld4q_u8(&src[i * 4]).val[2]);
+  }
+#elif defined(__SSE2__)
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  for (; i + 16 <= n; i += 16) {
+    const __m128i *s = (const __m128i *)&src[i * 4];
+    __m128i a = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(s), 16), mask);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(s + 1), 16), mask);
+    __m128i c = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(s + 2), 16), mask);
+    __m128i d = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(s + 3), 16), mask);
+    _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = src[i * 4 + 2];
+  }
+}
+
+// laplacian of n pixels of a row, added to the running sums. 8 pixels at a time: the laplacian fits in
+// 16 bits (-1020..1020), the squares are summed in 32 bit lanes per row and in 64 bits over the roi
+static void lap_row(const uint8_t *cur, int stride, int n, int64_t &sum, int64_t &sum_sq, int16_t &max) {
+  const uint8_t *up = cur - stride, *down = cur + stride;
+  int i = 0;
+  int32_t sums[4], sqs[4];
+  int16_t maxs[8];
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int32x4_t vsum = vdupq_n_s32(0), vsq = vdupq_n_s32(0);
+  int16x8_t vmax = vdupq_n_s16(max);
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t u = vreinterpretq_s16_u16(vaddl_u8(vld1_u8(&up[i]), vld1_u8(&down[i])));
+    int16x8_t lr = vreinterpretq_s16_u16(vaddl_u8(vld1_u8(&cur[i - 1]), vld1_u8(&cur[i + 1])));
+    int16x8_t c = vreinterpretq_s16_u16(vshll_n_u8(vld1_u8(&cur[i]), 2));
+    int16x8_t lap = vsubq_s16(vaddq_s16(u, lr), c);
+    vsum = vpadalq_s16(vsum, lap);
+    vsq = vmlal_s16(vsq, vget_low_s16(lap), vget_low_s16(lap));
+    vsq = vmlal_s16(vsq, vget_high_s16(lap), vget_high_s16(lap));
+    vmax = vmaxq_s16(vmax, lap);
+  }
+  vst1q_s32(sums, vsum);
+  vst1q_s32(sqs, vsq);
+  vst1q_s16(maxs, vmax);
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+  __m128i vsum = zero, vsq = zero, vmax = _mm_set1_epi16(max);
+  for (; i + 8 <= n; i += 8) {
+    __m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&up[i]), zero);
+    __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&down[i]), zero);
+    __m128i l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&cur[i - 1]), zero);
+    __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&cur[i + 1]), zero);
+    __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&cur[i]), zero);
+    __m128i lap = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(u, d), _mm_add_epi16(l, r)), _mm_slli_epi16(c, 2));
+    vsum = _mm_add_epi32(vsum, _mm_madd_epi16(lap, ones));
+    vsq = _mm_add_epi32(vsq, _mm_madd_epi16(lap, lap));
+    vmax = _mm_max_epi16(vmax, lap);
+  }
+  _mm_storeu_si128((__m128i *)sums, vsum);
+  _mm_storeu_si128((__m128i *)sqs, vsq);
+  _mm_storeu_si128((__m128i *)maxs, vmax);
+#else
+  std::fill_n(sums, 4, 0);
+  std::fill_n(sqs, 4, 0);
+  std::fill_n(maxs, 8, max);
+#endif
+  for (int k = 0; k < 4; k++) {
+    sum += sums[k];
+    sum_sq += sqs[k];
+  }
+  max = *std::max_element(maxs, maxs + 8);
+
+  for (; i < n; i++) {
+    const int16_t lap = up[i] + down[i] + cur[i - 1] + cur[i + 1] - 4 * cur[i];
+    sum += lap;
+    sum_sq += lap * lap;
+    max = std::max(max, lap);
+  }
 }
 
-LapConv::LapConv(cl_device_id device_id, cl_context ctx, int rgb_width, int rgb_height, int filter_size)
-    : width(rgb_width / NUM_SEGMENTS_X), height(rgb_height / NUM_SEGMENTS_Y), 
-      roi_buf(width * height * 3), result_buf(width * height) {
-
-  prg = build_conv_program(device_id, ctx, width, height, filter_size);
-  krnl = CL_CHECK_ERR(clCreateKernel(prg, "rgb2gray_conv2d", &err));
-  // TODO: Removed CL_MEM_SVM_FINE_GRAIN_BUFFER, confirm it doesn't matter
-  roi_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_WRITE, roi_buf.size() * sizeof(roi_buf[0]), NULL, &err));
-  result_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_WRITE, result_buf.size() * sizeof(result_buf[0]), NULL, &err));
-  filter_cl = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                          9 * sizeof(int16_t), (void *)&lapl_conv_krnl, &err));
+void FrameStats::update(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool thumbnail_on, uint32_t cnt) {
+  const ExposureRect &r = exposure_rect;
+  const bool histogram_on = r.x_skip > 0 && r.y_skip > 0;
+  uint32_t hist[4][256] = {};
+  histogram_total = 0;
+
+  const int uv_width = width / 2;
+  const int tw = thumbnail_width, th = thumbnail_height;
+  uint8_t *ty = thumbnail.data(), *tu = ty + tw * th, *tv = tu + (tw * th) / 4;
+
+  // sharpness roi of this frame
+  const int lap_w = width / NUM_SEGMENTS_X, lap_h = height / NUM_SEGMENTS_Y;
+  int lap_x = 0, lap_y = 0;
+  if (lap_rois > 0) {
+    lap_roi_id = cnt % lap_rois;
+    lap_x = (ROI_X_MIN + lap_roi_id % (ROI_X_MAX - ROI_X_MIN + 1)) * lap_w;
+    lap_y = (ROI_Y_MIN + lap_roi_id / (ROI_X_MAX - ROI_X_MIN + 1)) * lap_h;
+    assert(lap_x > 0 && lap_x + lap_w < width && lap_y > 0 && lap_y + lap_h < height);
+  }
+  int64_t lap_sum = 0, lap_sum_sq = 0;
+  int16_t lap_max = 0;
+
+  for (int row = 0; row < height; row++) {
+    const uint8_t *y_row = &y[row * width];
+
+    if (histogram_on && row >= r.y1 && row < r.y2 && (row - r.y1) % r.y_skip == 0) {
+      histogram_row(y_row, r.x1, r.x2, r.x_skip, hist);
+      histogram_total += (r.x2 - r.x1 + r.x_skip - 1) / r.x_skip;
+    }
+
+    if (thumbnail_on) {
+      if (row % 4 == 2 && row / 4 < th) {
+        sample_row(y_row, tw, &ty[(row / 4) * tw]);
+      }
+      const int uv_row = row / 2;
+      if (row % 8 == 4 && uv_row / 4 < th / 2) {
+        sample_row(&u[uv_row * uv_width], tw / 2, &tu[(uv_row / 4) * (tw / 2)]);
+        sample_row(&v[uv_row * uv_width], tw / 2, &tv[(uv_row / 4) * (tw / 2)]);
+      }
+    }
+
+    if (lap_rois > 0 && row >= lap_y && row < lap_y + lap_h) {
+      lap_row(&y_row[lap_x], width, lap_w, lap_sum, lap_sum_sq, lap_max);
+    }
+  }
+
+  merge_histogram(hist, histogram);
+  if (lap_rois > 0) {
+    lap_score = get_lapmap_one(lap_sum, lap_sum_sq, lap_max, lap_w * lap_h);
+  }
 }
 
-LapConv::~LapConv() {
-  CL_CHECK(clReleaseMemObject(roi_cl));
-  CL_CHECK(clReleaseMemObject(result_cl));
-  CL_CHECK(clReleaseMemObject(filter_cl));
-  CL_CHECK(clReleaseKernel(krnl));
-  CL_CHECK(clReleaseProgram(prg));
+void FrameStats::update_histogram(const uint8_t *y, const ExposureRect &rect) {
+  exposure_rect = rect;
+  uint32_t hist[4][256] = {};
+  histogram_total = 0;
+  for (int row = rect.y1; row < rect.y2; row += rect.y_skip) {
+    histogram_row(&y[row * width], rect.x1, rect.x2, rect.x_skip, hist);
+    histogram_total += (rect.x2 - rect.x1 + rect.x_skip - 1) / rect.x_skip;
+  }
+  merge_histogram(hist, histogram);
 }
 
-uint16_t LapConv::Update(cl_command_queue q, const uint8_t *rgb_buf, const int roi_id) {
-  // sharpness scores
-  const int x_offset = ROI_X_MIN + roi_id % (ROI_X_MAX - ROI_X_MIN + 1);
-  const int y_offset = ROI_Y_MIN + roi_id / (ROI_X_MAX - ROI_X_MIN + 1);
-
-  const uint8_t *rgb_offset = rgb_buf + y_offset * height * FULL_STRIDE_X * 3 + x_offset * width * 3;
-  for (int i = 0; i < height; ++i) {
-    memcpy(&roi_buf[i * width * 3], &rgb_offset[i * FULL_STRIDE_X * 3], width * 3);
-  }
-
-  constexpr int local_mem_size = (CONV_LOCAL_WORKSIZE + 2 * (3 / 2)) * (CONV_LOCAL_WORKSIZE + 2 * (3 / 2)) * (3 * sizeof(uint8_t));
-  const size_t global_work_size[] = {(size_t)width, (size_t)height};
-  const size_t local_work_size[] = {CONV_LOCAL_WORKSIZE, CONV_LOCAL_WORKSIZE};
-
-  CL_CHECK(clEnqueueWriteBuffer(q, roi_cl, CL_TRUE, 0, roi_buf.size() * sizeof(roi_buf[0]), roi_buf.data(), 0, 0, 0));
-  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), (void *)&roi_cl));
-  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), (void *)&result_cl));
-  CL_CHECK(clSetKernelArg(krnl, 2, sizeof(cl_mem), (void *)&filter_cl));
-  CL_CHECK(clSetKernelArg(krnl, 3, local_mem_size, 0));
-  cl_event conv_event;
-  CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, global_work_size, local_work_size, 0, 0, &conv_event));
-  CL_CHECK(clWaitForEvents(1, &conv_event));
-  CL_CHECK(clReleaseEvent(conv_event));
-  CL_CHECK(clEnqueueReadBuffer(q, result_cl, CL_TRUE, 0,
-                               result_buf.size() * sizeof(result_buf[0]), result_buf.data(), 0, 0, 0));
-
-  return get_lapmap_one(result_buf.data(), width, height);
+float FrameStats::exposure_median() const {
+  // Find mean lumimance value
+  int lum_med;
+  unsigned int lum_cur = 0;
+  for (lum_med = 255; lum_med >= 0; lum_med--) {
+    lum_cur += histogram[lum_med];
+
+    if (lum_cur >= histogram_total / 2) {
+      break;
+    }
+  }
+  return lum_med / 256.0;
 }
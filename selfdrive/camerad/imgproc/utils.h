@@ -4,8 +4,6 @@
 #include <cstdint>
 #include <vector>
 
-#include "selfdrive/common/clutil.h"
-
 #define NUM_SEGMENTS_X 8
 #define NUM_SEGMENTS_Y 6
 
@@ -17,25 +15,39 @@
 #define LM_THRESH 120
 #define LM_PREC_THRESH 0.9 // 90 perc is blur
 
-// only apply to QCOM
-#define FULL_STRIDE_X 1280
-#define FULL_STRIDE_Y 896
-
-#define CONV_LOCAL_WORKSIZE 16
+// luma rect used for autoexposure, every x_skip'th column of every y_skip'th row in [x1, x2) x [y1, y2)
+struct ExposureRect {
+  int x1, x2, x_skip, y1, y2, y_skip;
+  bool operator==(const ExposureRect &r) const {
+    return x1 == r.x1 && x2 == r.x2 && x_skip == r.x_skip && y1 == r.y1 && y2 == r.y2 && y_skip == r.y_skip;
+  }
+};
 
-class LapConv {
+// per frame statistics shared by autoexposure, thumbnails and focus. update() gets them all
+// in one walk over the yuv frame that only touches the rows feeding one of the outputs
+class FrameStats {
 public:
-  LapConv(cl_device_id device_id, cl_context ctx, int rgb_width, int rgb_height, int filter_size);
-  ~LapConv();
-  uint16_t Update(cl_command_queue q, const uint8_t *rgb_buf, const int roi_id);
+  void init(int width, int height);
+  void update(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool thumbnail, uint32_t cnt);
+  // histogram of this frame for a rect other than the one the last update() used
+  void update_histogram(const uint8_t *y, const ExposureRect &rect);
+  float exposure_median() const;
+
+  ExposureRect exposure_rect = {};
+
+  // I420 planes at 1/4 the frame size, center sample of every 4x4 block. the height is padded to 16 rows for the jpeg encoder
+  int thumbnail_width = 0, thumbnail_height = 0;
+  std::vector<uint8_t> thumbnail;
+
+  // laplacian sharpness of one roi per frame, rolling over lap_rois rois. 0 disables it
+  int lap_rois = 0;
+  int lap_roi_id = -1;
+  uint16_t lap_score = 0;
 
 private:
-  cl_mem roi_cl, result_cl, filter_cl;
-  cl_program prg;
-  cl_kernel krnl;
-  const int width, height;
-  std::vector<uint8_t> roi_buf;
-  std::vector<int16_t> result_buf;
+  int width = 0, height = 0;
+  uint32_t histogram[256] = {};
+  uint32_t histogram_total = 0;
 };
 
 bool is_blur(const uint16_t *lapmap, const size_t size);
@@ -47,8 +47,11 @@ int main(int argc, char *argv[]) {
   int ret;
   ret = set_realtime_priority(53);
   assert(ret == 0);
-  ret = set_core_affinity({Hardware::EON() ? 2 : 6});
-  assert(ret == 0 || Params().getBool("IsOffroad")); // failure ok while offroad due to offlining cores
+  // CPU processing spreads over all cores, don't pin it
+  if (!env_cpu_processing) {
+    ret = set_core_affinity({Hardware::EON() ? 2 : 6});
+    assert(ret == 0 || Params().getBool("IsOffroad")); // failure ok while offroad due to offlining cores
+  }
 
   cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
 
@@ -0,0 +1,125 @@
+// benchmark for camerad's CPU processing path: debayer + rgb to yuv on synthetic 1928x1208 bayer frames
+// usage: ./debayer_benchmark [iterations] [threads]
+// also checks the yuv output against libyuv with the tolerance rgb_to_yuv_test uses,
+// and that splitting the work across threads doesn't change a single byte
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "libyuv.h"
+#include "selfdrive/camerad/cameras/debayer_cpu.h"
+#include "selfdrive/camerad/transforms/rgb_to_yuv.h"
+#include "selfdrive/common/timing.h"
+
+constexpr int FRAME_WIDTH = 1928;
+constexpr int FRAME_HEIGHT = 1208;
+constexpr int FRAME_STRIDE = FRAME_WIDTH * 5 / 4;  // 10 bit packed, 4 pixels in 5 bytes
+
+// libyuv's x86 version differs from ours by up to 1, see rgb_to_yuv_test.cc
+constexpr int MAXE = 1;
+
+struct Pipeline {
+  Pipeline(bool real_debayer, ThreadPool *pool)
+      : rgb_width(real_debayer ? FRAME_WIDTH : FRAME_WIDTH / 2),
+        rgb_height(real_debayer ? FRAME_HEIGHT : FRAME_HEIGHT / 2),
+        rgb_stride(rgb_width * 3),
+        debayer(FRAME_WIDTH, FRAME_HEIGHT, FRAME_STRIDE, rgb_width, rgb_height, rgb_stride, 1, false, 1, real_debayer, pool),
+        rgb2yuv(rgb_width, rgb_height, rgb_stride, pool),
+        rgb(rgb_stride * rgb_height),
+        yuv(rgb_width * rgb_height * 3 / 2) {}
+
+  const int rgb_width, rgb_height, rgb_stride;
+  DebayerCPU debayer;
+  Rgb2YuvCPU rgb2yuv;
+  std::vector<uint8_t> rgb, yuv;
+};
+
+static std::vector<uint8_t> synthetic_frame(std::mt19937 &gen) {
+  // a gradient with noise, so every branch of the interpolation gets exercised
+  std::vector<uint8_t> frame(FRAME_STRIDE * FRAME_HEIGHT);
+  std::uniform_int_distribution<int> noise(-64, 64);
+  for (int y = 0; y < FRAME_HEIGHT; y++) {
+    for (int x = 0; x < FRAME_WIDTH; x += 4) {
+      uint8_t *block = &frame[y * FRAME_STRIDE + x / 4 * 5];
+      block[4] = 0;
+      for (int i = 0; i < 4; i++) {
+        const int v = std::clamp((x + i) * 1023 / FRAME_WIDTH / 2 + y * 1023 / FRAME_HEIGHT / 2 + noise(gen), 0, 1023);
+        block[i] = v >> 2;
+        block[4] |= (v & 3) << (2 * i);
+      }
+    }
+  }
+  return frame;
+}
+
+static void report(const char *name, std::vector<double> &times) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-28s n=%zu  mean %7.2fms  p50 %7.2fms  p99 %7.2fms  max %7.2fms\n",
+         name, times.size(), sum / times.size(), pct(0.5), pct(0.99), times.back());
+}
+
+static bool check_libyuv(Pipeline &p) {
+  const int w = p.rgb_width, h = p.rgb_height;
+  std::vector<uint8_t> ref(w * h * 3 / 2);
+  libyuv::RGB24ToI420(p.rgb.data(), p.rgb_stride,
+                      &ref[0], w,
+                      &ref[w * h], w / 2,
+                      &ref[w * h + (w / 2) * (h / 2)], w / 2,
+                      w, h);
+  int max_e = 0;
+  for (size_t i = 0; i < ref.size(); i++) {
+    max_e = std::max(max_e, std::abs(ref[i] - p.yuv[i]));
+  }
+  if (max_e > MAXE) {
+    printf("  yuv differs from libyuv by up to %d\n", max_e);
+  }
+  return max_e <= MAXE;
+}
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 100;
+  const int threads = argc > 2 ? atoi(argv[2]) : 0;
+  std::mt19937 gen(1337);
+  const std::vector<uint8_t> frame = synthetic_frame(gen);
+
+  ThreadPool pool(threads);
+  bool ok = true;
+  for (bool real_debayer : {true, false}) {
+    Pipeline single(real_debayer, nullptr), multi(real_debayer, &pool);
+    printf("%s debayer, %dx%d rgb, %d threads\n", real_debayer ? "real" : "2x2", multi.rgb_width, multi.rgb_height, pool.size());
+
+    single.debayer.debayer(frame.data(), single.rgb.data(), 1.0);
+    single.rgb2yuv.convert(single.rgb.data(), single.yuv.data());
+
+    std::vector<double> debayer_times, yuv_times, total_times;
+    for (int i = 0; i < iterations; i++) {
+      double t1 = millis_since_boot();
+      multi.debayer.debayer(frame.data(), multi.rgb.data(), 1.0);
+      double t2 = millis_since_boot();
+      multi.rgb2yuv.convert(multi.rgb.data(), multi.yuv.data());
+      double t3 = millis_since_boot();
+      debayer_times.push_back(t2 - t1);
+      yuv_times.push_back(t3 - t2);
+      total_times.push_back(t3 - t1);
+    }
+    report("  debayer", debayer_times);
+    report("  rgb to yuv", yuv_times);
+    report("  total", total_times);
+
+    if (single.rgb != multi.rgb || single.yuv != multi.yuv) {
+      printf("  multithreaded output differs from single threaded\n");
+      ok = false;
+    }
+    ok = check_libyuv(multi) && ok;
+  }
+
+  printf("%s\n", ok ? "outputs match" : "outputs MISMATCH");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+// benchmark for the replay FrameReader on a one minute hevc segment
+// usage: ./framereader_benchmark [url or file] [decoder threads] [cache size]
+// sequential reads the whole segment in order like camera_replay does, random seeks anywhere in it
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/ui/replay/framereader.h"
+
+const char *DEFAULT_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/fcamera.hevc";
+
+static void report(const char *name, std::vector<double> &times) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-12s n=%zu  mean %7.2fms  p50 %7.2fms  p99 %7.2fms  max %7.2fms  total %8.1fms\n",
+         name, times.size(), sum / times.size(), pct(0.5), pct(0.99), times.back(), sum);
+}
+
+int main(int argc, char **argv) {
+  const std::string url = argc > 1 ? argv[1] : DEFAULT_URL;
+  const int threads = argc > 2 ? atoi(argv[2]) : 2;
+  const int cache_size = argc > 3 ? atoi(argv[3]) : 60;
+
+  FrameReader fr(cache_size, threads);
+  double t1 = millis_since_boot();
+  if (!fr.load(url)) {
+    printf("failed to load %s\n", url.c_str());
+    return 1;
+  }
+  printf("%s\n%dx%d, %zu frames, indexed in %.1fms, %d decoder threads, cache %d frames\n",
+         url.c_str(), fr.width, fr.height, fr.getFrameCount(), millis_since_boot() - t1, threads, cache_size);
+
+  std::vector<uint8_t> rgb(fr.getRGBSize());
+  int failed = 0;
+  auto read = [&](int idx, std::vector<double> &times) {
+    double t = millis_since_boot();
+    failed += !fr.get(idx, rgb.data(), nullptr);
+    times.push_back(millis_since_boot() - t);
+  };
+
+  std::vector<double> sequential_times;
+  for (int i = 0; i < fr.getFrameCount(); i++) {
+    read(i, sequential_times);
+  }
+  report("sequential", sequential_times);
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<int> dist(0, fr.getFrameCount() - 1);
+  std::vector<double> random_times;
+  for (int i = 0; i < 200; i++) {
+    read(dist(gen), random_times);
+  }
+  report("random", random_times);
+
+  if (failed) {
+    printf("%d frames failed to decode\n", failed);
+  }
+  return failed ? 1 : 0;
+}
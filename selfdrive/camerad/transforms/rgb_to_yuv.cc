@@ -2,6 +2,11 @@
 
 #include <cassert>
 #include <cstdio>
+#include <vector>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 
 Rgb2Yuv::Rgb2Yuv(cl_context ctx, cl_device_id device_id, int width, int height, int rgb_stride) {
   assert(width % 2 == 0 && height % 2 == 0);
@@ -34,3 +39,96 @@ void Rgb2Yuv::queue(cl_command_queue q, cl_mem rgb_cl, cl_mem yuv_cl) {
   CL_CHECK(clWaitForEvents(1, &event));
   CL_CHECK(clReleaseEvent(event));
 }
+
+// same fixed point math as rgb_to_yuv.cl. the chroma inputs are the sum of a 2x2 block halved,
+// which is why U and V shift by 8 rather than 7
+static inline uint8_t rgb_to_y(int r, int g, int b) { return (((b * 13 + g * 65 + r * 33) + 64) >> 7) + 16; }
+static inline uint8_t rgb_to_u(int r, int g, int b) { return (b * 56 - g * 37 - r * 19 + 0x8080) >> 8; }
+static inline uint8_t rgb_to_v(int r, int g, int b) { return (r * 56 - g * 47 - b * 9 + 0x8080) >> 8; }
+
+Rgb2YuvCPU::Rgb2YuvCPU(int width, int height, int rgb_stride, ThreadPool *pool)
+    : width(width), height(height), rgb_stride(rgb_stride), pool(pool) {
+  assert(width % 2 == 0 && height % 2 == 0);
+}
+
+void Rgb2YuvCPU::convert(const uint8_t *rgb, uint8_t *yuv) {
+  if (pool) {
+    pool->parallel_for(height / 2, [=](int start, int end) { convert_rows(rgb, yuv, start, end); });
+  } else {
+    convert_rows(rgb, yuv, 0, height / 2);
+  }
+}
+
+void Rgb2YuvCPU::convert_rows(const uint8_t *rgb, uint8_t *yuv, int uv_row_start, int uv_row_end) {
+  const int uv_width = width / 2;
+  uint8_t *u_plane = yuv + width * height;
+  uint8_t *v_plane = u_plane + uv_width * (height / 2);
+
+  // planar copies of one row pair, so the math below runs on contiguous arrays
+  std::vector<uint16_t> planes(width * 6);
+  uint16_t *b[2] = {&planes[0], &planes[width]};
+  uint16_t *g[2] = {&planes[width * 2], &planes[width * 3]};
+  uint16_t *r[2] = {&planes[width * 4], &planes[width * 5]};
+
+  for (int uv_row = uv_row_start; uv_row < uv_row_end; uv_row++) {
+    const uint8_t *rgb_rows[2] = {rgb + (uv_row * 2) * rgb_stride, rgb + (uv_row * 2 + 1) * rgb_stride};
+    uint8_t *y_rows[2] = {yuv + (uv_row * 2) * width, yuv + (uv_row * 2 + 1) * width};
+    uint8_t *u = u_plane + uv_row * uv_width;
+    uint8_t *v = v_plane + uv_row * uv_width;
+
+    int x = 0;
+#ifdef __ARM_NEON
+    // 16 pixels wide, vld3 deinterleaves BGR for free
+    for (; x + 16 <= width; x += 16) {
+      uint16x8_t sb = vdupq_n_u16(0), sg = vdupq_n_u16(0), sr = vdupq_n_u16(0);
+      for (int i = 0; i < 2; i++) {
+        const uint8x16x3_t bgr = vld3q_u8(rgb_rows[i] + x * 3);
+        uint16x8_t lo = vmull_u8(vget_low_u8(bgr.val[0]), vdup_n_u8(13));
+        lo = vmlal_u8(lo, vget_low_u8(bgr.val[1]), vdup_n_u8(65));
+        lo = vmlal_u8(lo, vget_low_u8(bgr.val[2]), vdup_n_u8(33));
+        uint16x8_t hi = vmull_u8(vget_high_u8(bgr.val[0]), vdup_n_u8(13));
+        hi = vmlal_u8(hi, vget_high_u8(bgr.val[1]), vdup_n_u8(65));
+        hi = vmlal_u8(hi, vget_high_u8(bgr.val[2]), vdup_n_u8(33));
+        const uint8x16_t y = vaddq_u8(vcombine_u8(vrshrn_n_u16(lo, 7), vrshrn_n_u16(hi, 7)), vdupq_n_u8(16));
+        vst1q_u8(y_rows[i] + x, y);
+
+        sb = vaddq_u16(sb, vpaddlq_u8(bgr.val[0]));
+        sg = vaddq_u16(sg, vpaddlq_u8(bgr.val[1]));
+        sr = vaddq_u16(sr, vpaddlq_u8(bgr.val[2]));
+      }
+      const uint16x8_t one = vdupq_n_u16(1);
+      const uint16x8_t ab = vshrq_n_u16(vaddq_u16(sb, one), 1);
+      const uint16x8_t ag = vshrq_n_u16(vaddq_u16(sg, one), 1);
+      const uint16x8_t ar = vshrq_n_u16(vaddq_u16(sr, one), 1);
+      // the offset keeps every partial result positive, so unsigned 16 bit is enough
+      uint16x8_t uu = vmlaq_n_u16(vdupq_n_u16(0x8080), ab, 56);
+      uu = vmlsq_n_u16(vmlsq_n_u16(uu, ag, 37), ar, 19);
+      uint16x8_t vv = vmlaq_n_u16(vdupq_n_u16(0x8080), ar, 56);
+      vv = vmlsq_n_u16(vmlsq_n_u16(vv, ag, 47), ab, 9);
+      vst1_u8(u + x / 2, vshrn_n_u16(uu, 8));
+      vst1_u8(v + x / 2, vshrn_n_u16(vv, 8));
+    }
+#endif
+    if (x == width) continue;
+
+    // generic path: deinterleave, then plain loops over the planes that the compiler vectorizes
+    const int x_start = x;
+    for (int i = 0; i < 2; i++) {
+      for (int j = x_start; j < width; j++) {
+        b[i][j] = rgb_rows[i][j * 3 + 0];
+        g[i][j] = rgb_rows[i][j * 3 + 1];
+        r[i][j] = rgb_rows[i][j * 3 + 2];
+      }
+      for (int j = x_start; j < width; j++) {
+        y_rows[i][j] = rgb_to_y(r[i][j], g[i][j], b[i][j]);
+      }
+    }
+    for (int j = x_start / 2; j < uv_width; j++) {
+      const int ab = (b[0][j * 2] + b[0][j * 2 + 1] + b[1][j * 2] + b[1][j * 2 + 1] + 1) >> 1;
+      const int ag = (g[0][j * 2] + g[0][j * 2 + 1] + g[1][j * 2] + g[1][j * 2 + 1] + 1) >> 1;
+      const int ar = (r[0][j * 2] + r[0][j * 2 + 1] + r[1][j * 2] + r[1][j * 2 + 1] + 1) >> 1;
+      u[j] = rgb_to_u(ar, ag, ab);
+      v[j] = rgb_to_v(ar, ag, ab);
+    }
+  }
+}
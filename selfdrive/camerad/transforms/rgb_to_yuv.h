@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
+
 #include "selfdrive/common/clutil.h"
+#include "selfdrive/common/threadpool.h"
 
 class Rgb2Yuv {
 public:
@@ -12,3 +15,15 @@ private:
   cl_kernel krnl;
 };
 
+
+// CPU version of the rgb_to_yuv kernel for machines without a usable GPU, the output is bit exact.
+// row pairs are split across the pool, a null pool runs everything on the calling thread
+class Rgb2YuvCPU {
+public:
+  Rgb2YuvCPU(int width, int height, int rgb_stride, ThreadPool *pool = nullptr);
+  void convert(const uint8_t *rgb, uint8_t *yuv);
+private:
+  void convert_rows(const uint8_t *rgb, uint8_t *yuv, int uv_row_start, int uv_row_end);
+  const int width, height, rgb_stride;
+  ThreadPool *pool;
+};
@@ -130,8 +130,9 @@ int main(int argc, char** argv) {
   uint8_t *rgb_frame = new uint8_t[width * height * 3];
 
 
-  RGBToYUVState rgb_to_yuv_state;
-  rgb_to_yuv_init(&rgb_to_yuv_state, context, device_id, width, height, width * 3);
+  Rgb2Yuv rgb_to_yuv_state(context, device_id, width, height, width * 3);
+  ThreadPool pool;
+  Rgb2YuvCPU rgb_to_yuv_cpu(width, height, width * 3, &pool);
 
   int frame_yuv_buf_size = width * height * 3 / 2;
   cl_mem yuv_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, frame_yuv_buf_size, (void*)NULL, &err));
@@ -139,9 +140,11 @@ int main(int argc, char** argv) {
   uint8_t *frame_yuv_ptr_y = frame_yuv_buf;
   uint8_t *frame_yuv_ptr_u = frame_yuv_buf + (width * height);
   uint8_t *frame_yuv_ptr_v = frame_yuv_ptr_u + ((width/2) * (height/2));
+  uint8_t *cpu_yuv_buf = new uint8_t[frame_yuv_buf_size];
 
   cl_mem rgb_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, width * height * 3, (void*)NULL, &err));
   int mismatched = 0;
+  int cpu_mismatched = 0;
   int counter = 0;
   srand (time(NULL));
 
@@ -161,15 +164,23 @@ int main(int argc, char** argv) {
 
     clEnqueueWriteBuffer(q, rgb_cl, CL_TRUE, 0, width * height * 3, (void *)rgb_frame, 0, NULL, NULL);
     t1 = millis_since_boot();
-    rgb_to_yuv_queue(&rgb_to_yuv_state, q, rgb_cl, yuv_cl);
+    rgb_to_yuv_state.queue(q, rgb_cl, yuv_cl);
     t2 = millis_since_boot();
 
     //printf("OpenCL: rgb to yuv: %.2fms\n", t2-t1);
+    t1 = millis_since_boot();
+    rgb_to_yuv_cpu.convert(rgb_frame, cpu_yuv_buf);
+    t2 = millis_since_boot();
+    //printf("CPU: rgb to yuv: %.2fms\n", t2-t1);
     uint8_t *yyy = (uint8_t *)clEnqueueMapBuffer(q, yuv_cl, CL_TRUE,
                                                  CL_MAP_READ, 0, frame_yuv_buf_size,
                                                  0, NULL, NULL, &err);
     if(!compare_results(frame_yuv_ptr_y, yyy, frame_yuv_buf_size, width, width, height, (uint8_t*)rgb_frame))
       mismatched++;
+    // the CPU version has to be within libyuv's tolerance and bit exact with the kernel
+    if(!compare_results(frame_yuv_ptr_y, cpu_yuv_buf, frame_yuv_buf_size, width, width, height, (uint8_t*)rgb_frame) ||
+       memcmp(yyy, cpu_yuv_buf, frame_yuv_buf_size) != 0)
+      cpu_mismatched++;
     clEnqueueUnmapMemObject(q, yuv_cl, yyy, 0, NULL, NULL);
 
     // std::this_thread::sleep_for(std::chrono::milliseconds(20));
@@ -178,13 +189,14 @@ int main(int argc, char** argv) {
 
   }
   printf("Matched: %d, Mismatched: %d\n", counter - mismatched, mismatched);
+  printf("CPU matched: %d, Mismatched: %d\n", counter - cpu_mismatched, cpu_mismatched);
 
   delete[] frame_yuv_buf;
-  rgb_to_yuv_destroy(&rgb_to_yuv_state);
+  delete[] cpu_yuv_buf;
   clReleaseContext(context);
   delete[] rgb_frame;
 
-  if (mismatched == 0)
+  if (mismatched == 0 && cpu_mismatched == 0)
     return 0;
   else
     return -1;
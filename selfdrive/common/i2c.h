@@ -1,17 +1,24 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include <sys/types.h>
 
 class I2CBus {
   private:
-    int i2c_fd;
+    int i2c_fd = -1;
+
+  protected:
+    // for fakes of the bus in tests
+    I2CBus() {}
 
   public:
     I2CBus(uint8_t bus_id);
-    ~I2CBus();
+    virtual ~I2CBus();
 
-    int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len);
-    int set_register(uint8_t device_address, uint register_address, uint8_t data);
+    virtual int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len);
+    // one transaction of any length, e.g. to drain a FIFO. SMBus block reads are limited to 32 bytes
+    virtual int read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, size_t len);
+    virtual int set_register(uint8_t device_address, uint register_address, uint8_t data);
 };
@@ -5,16 +5,30 @@
 #endif  // _GNU_SOURCE
 
 #include <dirent.h>
+#include <limits.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <set>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
@@ -158,6 +172,7 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"DongleId", PERSISTENT},
     {"DoUninstall", CLEAR_ON_MANAGER_START},
     {"EnableWideCamera", CLEAR_ON_MANAGER_START},
+    {"EnableMultiCameraModel", CLEAR_ON_MANAGER_START},
     {"EndToEndToggle", PERSISTENT},
     {"ForcePowerDown", CLEAR_ON_MANAGER_START},
     {"GitBranch", PERSISTENT},
@@ -228,15 +243,429 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"Offroad_UpdateFailed", CLEAR_ON_MANAGER_START},
 };
 
+// shared memory table, one slot per key. a reader copies the value between two loads of the slot's
+// seqlock and retries if a writer got in between, writers hold the params lock. put() still writes
+// the file first, so the files always are the durable copy and readAll() reads those
+const uint32_t PARAMS_SHM_MAGIC = 0x70726d31;
+const size_t PARAM_KEY_LEN = 64;
+const size_t PARAM_SLOT_SIZE = 1024;
+const uint32_t PARAM_NO_VALUE = UINT32_MAX;
+const uint32_t PARAM_IN_FILE = UINT32_MAX - 1;  // too large for the slot, only in the file
+
+struct ParamSlot {
+  std::atomic<uint32_t> seq;      // odd while a writer is copying the value
+  std::atomic<uint32_t> version;  // bumped on every change, the futex blocking get()s wait on
+  std::atomic<uint32_t> waiters;
+  std::atomic<uint32_t> size;
+  char key[PARAM_KEY_LEN];
+  char value[PARAM_SLOT_SIZE - PARAM_KEY_LEN - 4 * sizeof(uint32_t)];
+};
+static_assert(sizeof(ParamSlot) == PARAM_SLOT_SIZE);
+
+struct ParamsShmHeader {
+  std::atomic<uint32_t> magic;  // set once the table is filled
+  uint32_t num_slots;
+  // the directory the values are in, the table of a directory that's gone is removed
+  uint64_t key_dev, key_ino;
+  char key_path[PATH_MAX - 24];
+};
+static_assert(sizeof(ParamsShmHeader) == PATH_MAX);
+
+// the keys with a slot, sorted so every process agrees on the layout
+struct SlotLayout {
+  std::vector<std::string> keys;
+  std::unordered_map<std::string_view, int> index;
+
+  SlotLayout() {
+    for (auto &[key, type] : ::keys) {
+      if (key.size() < PARAM_KEY_LEN) keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (int i = 0; i < keys.size(); i++) {
+      index[keys[i]] = i;
+    }
+  }
+
+  // fnv-1a of the key dir and the layout, a table built by a build with other keys is another table,
+  // and so is the table of a dir that was removed and made again
+  uint64_t hash(const char *key_path, const struct stat &key_st) const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto add = [&](const char *s, size_t len) {
+      for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL;
+      }
+    };
+    add(key_path, strlen(key_path) + 1);
+    add((const char *)&key_st.st_dev, sizeof(key_st.st_dev));
+    add((const char *)&key_st.st_ino, sizeof(key_st.st_ino));
+    for (auto &key : keys) {
+      add(key.c_str(), key.size() + 1);
+    }
+    add((const char *)&PARAM_SLOT_SIZE, sizeof(PARAM_SLOT_SIZE));
+    return h;
+  }
+};
+
+const SlotLayout &slot_layout() {
+  static const SlotLayout layout;
+  return layout;
+}
+
+// lock-free, false if the value has to be read from the file
+bool read_slot(ParamSlot *s, std::string &value) {
+  for (int tries = 0; tries < 1000; tries++) {
+    uint32_t seq = s->seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint32_t size = s->size.load(std::memory_order_relaxed);
+    if (size == PARAM_IN_FILE) {
+      return false;
+    }
+    value.assign(s->value, size == PARAM_NO_VALUE ? 0 : std::min<size_t>(size, sizeof(s->value)));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->seq.load(std::memory_order_relaxed) == seq) {
+      return true;
+    }
+  }
+  // a writer died in the middle of an update, the file is still right
+  return false;
+}
+
+// with the params lock held, a nullptr value removes it
+void write_slot(ParamSlot *s, const char *value, size_t size) {
+  // stays odd if the last writer died halfway
+  uint32_t seq = s->seq.load(std::memory_order_relaxed) | 1;
+  s->seq.store(seq, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (!value) {
+    s->size.store(PARAM_NO_VALUE, std::memory_order_relaxed);
+  } else if (size <= sizeof(s->value)) {
+    memcpy(s->value, value, size);
+    s->size.store(size, std::memory_order_relaxed);
+  } else {
+    s->size.store(PARAM_IN_FILE, std::memory_order_relaxed);
+  }
+  s->seq.store(seq + 1, std::memory_order_release);
+
+  s->version.fetch_add(1);
+#ifdef __linux__
+  if (s->waiters.load() > 0) {
+    syscall(SYS_futex, &s->version, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+#endif
+}
+
+// returns when version changed, on a signal or after timeout_ms
+void wait_slot(ParamSlot *s, uint32_t version, int timeout_ms) {
+#ifdef __linux__
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  s->waiters.fetch_add(1);
+  syscall(SYS_futex, &s->version, FUTEX_WAIT, version, &ts, NULL, 0);
+  s->waiters.fetch_sub(1);
+#else
+  util::sleep_for(timeout_ms);
+#endif
+}
+
+ParamSlot *table_slots(void *shm) {
+  return (ParamSlot *)((ParamsShmHeader *)shm + 1);
+}
+
+// nullptr and errno ENOENT if there's no table yet, any other errno if there's one that can't be used
+void *map_table(const std::string &path, size_t size) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDWR | O_CLOEXEC));
+  if (fd < 0) {
+    return nullptr;
+  }
+  void *shm = nullptr;
+  int err = EINVAL;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    err = errno;
+  } else if (st.st_size == size) {
+    shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+      shm = nullptr;
+      err = errno;
+    }
+  }
+  close(fd);
+
+  if (shm && ((ParamsShmHeader *)shm)->magic.load() != PARAMS_SHM_MAGIC) {
+    munmap(shm, size);
+    shm = nullptr;
+    err = EINVAL;
+  }
+  if (!shm) {
+    errno = err;
+  }
+  return shm;
+}
+
+// with the params lock held. brings the slots up to date with the files, for a new table, and for a table
+// that missed changes to the files made without Params (by hand, or a restore)
+void sync_table(ParamSlot *slots, const std::string &params_path) {
+  const SlotLayout &layout = slot_layout();
+  for (int i = 0; i < layout.keys.size(); i++) {
+    ParamSlot *s = &slots[i];
+    std::string fn = params_path + "/d/" + layout.keys[i];
+    std::string value = util::read_file(fn);
+    const bool exists = !value.empty() || util::file_exists(fn);
+    const uint32_t size = s->size.load(std::memory_order_relaxed);
+    bool same;
+    if (!exists) {
+      same = size == PARAM_NO_VALUE;
+    } else if (value.size() > sizeof(s->value)) {
+      same = size == PARAM_IN_FILE;
+    } else {
+      same = size == value.size() && memcmp(s->value, value.data(), size) == 0;
+    }
+    if (!same) {
+      write_slot(s, exists ? value.data() : nullptr, value.size());
+    }
+  }
+}
+
+// every params dir gets a table, the ones of the dirs that are gone are removed when a table is created
+void remove_stale_tables() {
+  DIR *d = opendir("/dev/shm");
+  if (!d) {
+    return;
+  }
+  while (struct dirent *de = readdir(d)) {
+    if (strncmp(de->d_name, "params_", 7) != 0) continue;
+
+    std::string path = std::string("/dev/shm/") + de->d_name;
+    int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) continue;
+    struct stat st;
+    void *shm = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(ParamsShmHeader)) {
+      shm = mmap(NULL, sizeof(ParamsShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (!shm || shm == MAP_FAILED) continue;
+
+    // the half built ones don't have the magic yet
+    const ParamsShmHeader *header = (const ParamsShmHeader *)shm;
+    if (header->magic.load() == PARAMS_SHM_MAGIC && strnlen(header->key_path, sizeof(header->key_path)) < sizeof(header->key_path)) {
+      struct stat key_st;
+      const bool gone = stat(header->key_path, &key_st) != 0 ? (errno == ENOENT || errno == ENOTDIR)
+                                                             : (key_st.st_dev != header->key_dev || key_st.st_ino != header->key_ino);
+      if (gone) {
+        unlink(path.c_str());
+      }
+    }
+    munmap(shm, sizeof(ParamsShmHeader));
+  }
+  closedir(d);
+}
+
+// with the params lock held. filled from the files under a temporary name and renamed into place
+void *create_table(const std::string &path, size_t size, const std::string &params_path,
+                   const char *key_path, const struct stat &key_st) {
+  mkdir("/dev/shm", 0777);
+  std::string tmp_path = path + ".XXXXXX";
+  int fd = mkostemp((char *)tmp_path.c_str(), O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  void *shm = nullptr;
+  if (ftruncate(fd, size) == 0) {
+    shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) shm = nullptr;
+  }
+  close(fd);
+
+  if (shm) {
+    // the new pages are zeroed, so are all the counters
+    const SlotLayout &layout = slot_layout();
+    ParamsShmHeader *header = (ParamsShmHeader *)shm;
+    ParamSlot *slots = table_slots(shm);
+    for (int i = 0; i < layout.keys.size(); i++) {
+      strcpy(slots[i].key, layout.keys[i].c_str());
+    }
+    sync_table(slots, params_path);
+    header->num_slots = layout.keys.size();
+    header->key_dev = key_st.st_dev;
+    header->key_ino = key_st.st_ino;
+    strcpy(header->key_path, key_path);
+    header->magic = PARAMS_SHM_MAGIC;
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+      munmap(shm, size);
+      shm = nullptr;
+    }
+  }
+  if (!shm) {
+    unlink(tmp_path.c_str());
+  }
+  return shm;
+}
+
+// fsyncs the values put within PARAMS_FSYNC_MS in a background thread, so a burst of puts
+// doesn't block on two fsyncs each and shares one of the directory
+class ParamsFlusher {
+public:
+  // nullptr when every put fsyncs itself
+  static ParamsFlusher *get() {
+    static const int delay_ms = util::getenv("PARAMS_FSYNC_MS", 100);
+    if (delay_ms <= 0) {
+      return nullptr;
+    }
+
+    static std::mutex instance_lock;
+    std::lock_guard lk(instance_lock);
+    // a forked child doesn't have the parent's thread, the parent fsyncs what it put itself
+    if (!instance || instance_pid != getpid()) {
+      if (!instance) {
+        atexit([] {
+          if (instance && instance_pid == getpid()) instance->flush();
+        });
+      }
+      // never deleted, the thread runs until exit
+      instance = new ParamsFlusher(delay_ms);
+      instance_pid = getpid();
+    }
+    return instance;
+  }
+
+  // fd is the renamed value file or -1, it gets fsynced and closed, and then its directory fsynced
+  void add(const std::string &dir, int fd) {
+    std::lock_guard lk(lock);
+    pending.push_back({dir, fd});
+    cv.notify_one();
+  }
+
+  void flush() {
+    std::lock_guard flk(flush_lock);
+    std::vector<std::pair<std::string, int>> batch;
+    {
+      std::lock_guard lk(lock);
+      batch.swap(pending);
+    }
+
+    std::set<std::string> dirs;
+    for (auto &[dir, fd] : batch) {
+      if (fd >= 0) {
+        if (fsync(fd) < 0) {
+          LOGE("Failed to fsync param in %s, errno=%d", dir.c_str(), errno);
+        }
+        close(fd);
+      }
+      dirs.insert(dir);
+    }
+    for (auto &dir : dirs) {
+      if (fsync_dir(dir.c_str()) < 0) {
+        LOGE("Failed to fsync %s, errno=%d", dir.c_str(), errno);
+      }
+    }
+  }
+
+private:
+  ParamsFlusher(int delay_ms) : delay_ms(delay_ms) {
+    std::thread([this] { run(); }).detach();
+  }
+
+  void run() {
+    while (true) {
+      {
+        std::unique_lock lk(lock);
+        cv.wait(lk, [this] { return !pending.empty(); });
+      }
+      // let the burst finish
+      util::sleep_for(delay_ms);
+      flush();
+    }
+  }
+
+  static inline ParamsFlusher *instance = nullptr;
+  static inline pid_t instance_pid = 0;
+
+  const int delay_ms;
+  std::mutex lock, flush_lock;
+  std::condition_variable cv;
+  std::vector<std::pair<std::string, int>> pending;
+};
+
 } // namespace
 
+class ParamsTable {
+public:
+  // maps the table of params_path, the first process builds it from the files.
+  // nullptr without shared memory
+  static ParamsTable *open(const std::string &params_path) {
+#ifdef __linux__
+    static const bool enabled = util::getenv("PARAMS_SHM", 1) != 0;
+    if (!enabled) {
+      return nullptr;
+    }
+
+    static std::mutex lock;
+    static std::map<std::string, ParamsTable *> tables;
+    std::lock_guard lk(lock);
+    if (auto it = tables.find(params_path); it != tables.end()) {
+      return it->second;
+    }
+
+    // named after the directory <params_path>/d links to, a new params dir gets a new table
+    char key_path[PATH_MAX];
+    struct stat key_st;
+    if (!realpath((params_path + "/d").c_str(), key_path) || stat(key_path, &key_st) != 0 ||
+        strlen(key_path) >= sizeof(ParamsShmHeader::key_path)) {
+      return nullptr;
+    }
+    const SlotLayout &layout = slot_layout();
+    const std::string shm_path = util::string_format("/dev/shm/params_%016llx", (unsigned long long)layout.hash(key_path, key_st));
+    const size_t size = sizeof(ParamsShmHeader) + layout.keys.size() * sizeof(ParamSlot);
+
+    FileLock file_lock(params_path + "/.lock", LOCK_EX);
+    std::lock_guard<FileLock> flk(file_lock);
+    void *shm = map_table(shm_path, size);
+    if (shm) {
+      // the files might have changed while no process had the table open
+      sync_table(table_slots(shm), params_path);
+    } else if (errno == ENOENT) {
+      remove_stale_tables();
+      shm = create_table(shm_path, size, params_path, key_path, key_st);
+    }
+    // any other error, e.g. a table of another user, means no table rather than one the others don't see
+    if (!shm) {
+      LOGW("no shared memory params table for %s, errno=%d", params_path.c_str(), errno);
+      return nullptr;
+    }
+
+    // kept mapped until exit
+    ParamsTable *table = new ParamsTable;
+    table->slots = table_slots(shm);
+    tables[params_path] = table;
+    return table;
+#else
+    return nullptr;
+#endif
+  }
+
+  ParamSlot *slot(const char *key) {
+    auto &index = slot_layout().index;
+    auto it = index.find(key);
+    return it != index.end() ? &slots[it->second] : nullptr;
+  }
+
+private:
+  ParamSlot *slots = nullptr;
+};
+
 Params::Params() : params_path(Path::params()) {
   static std::once_flag once_flag;
   std::call_once(once_flag, ensure_params_path, params_path);
+  table = ParamsTable::open(params_path);
 }
 
 Params::Params(const std::string &path) : params_path(path) {
   ensure_params_path(params_path);
+  table = ParamsTable::open(params_path);
 }
 
 bool Params::checkKey(const std::string &key) {
@@ -254,8 +683,11 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   // 3) fsync() the temp file
   // 4) rename the temp file to the real name
   // 5) fsync() the containing directory
+  // with the flusher 3) and 5) happen in the background, after the rename. the value is in the
+  // file right away, only a power loss within PARAMS_FSYNC_MS can lose it
+  ParamsFlusher *flusher = ParamsFlusher::get();
   std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
-  int tmp_fd = mkstemp((char*)tmp_path.c_str());
+  int tmp_fd = mkostemp((char*)tmp_path.c_str(), O_CLOEXEC);
   if (tmp_fd < 0) return -1;
 
   int result = -1;
@@ -268,7 +700,7 @@ int Params::put(const char* key, const char* value, size_t value_size) {
     }
 
     // fsync to force persist the changes.
-    if ((result = fsync(tmp_fd)) < 0) break;
+    if (!flusher && (result = fsync(tmp_fd)) < 0) break;
 
     FileLock file_lock(params_path + "/.lock", LOCK_EX);
     std::lock_guard<FileLock> lk(file_lock);
@@ -277,12 +709,21 @@ int Params::put(const char* key, const char* value, size_t value_size) {
     std::string path = params_path + "/d/" + std::string(key);
     if ((result = rename(tmp_path.c_str(), path.c_str())) < 0) break;
 
+    if (ParamSlot *slot = table ? table->slot(key) : nullptr) {
+      write_slot(slot, value, value_size);
+    }
+
     // fsync parent directory
     path = params_path + "/d";
-    result = fsync_dir(path.c_str());
+    if (flusher) {
+      flusher->add(path, tmp_fd);
+      tmp_fd = -1;
+    } else {
+      result = fsync_dir(path.c_str());
+    }
   } while (false);
 
-  close(tmp_fd);
+  if (tmp_fd >= 0) close(tmp_fd);
   ::unlink(tmp_path.c_str());
   return result;
 }
@@ -296,15 +737,30 @@ int Params::remove(const char *key) {
   if (result != 0) {
     return result;
   }
+  if (ParamSlot *slot = table ? table->slot(key) : nullptr) {
+    write_slot(slot, nullptr, 0);
+  }
   // fsync parent directory
   path = params_path + "/d";
+  if (ParamsFlusher *flusher = ParamsFlusher::get()) {
+    flusher->add(path, -1);
+    return 0;
+  }
   return fsync_dir(path.c_str());
 }
 
 std::string Params::get(const char *key, bool block) {
-  std::string path = params_path + "/d/" + key;
+  ParamSlot *slot = table ? table->slot(key) : nullptr;
+  auto read = [&](std::string &value) {
+    if (!slot || !read_slot(slot, value)) {
+      value = util::read_file(params_path + "/d/" + key);
+    }
+  };
+
   if (!block) {
-    return util::read_file(path);
+    std::string value;
+    read(value);
+    return value;
   } else {
     // blocking read until successful
     params_do_exit = 0;
@@ -313,10 +769,17 @@ std::string Params::get(const char *key, bool block) {
 
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(path); !value.empty()) {
+      // before reading, a put in between doesn't wait
+      uint32_t version = slot ? slot->version.load() : 0;
+      if (read(value); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      if (slot) {
+        // woken up by the put, the timeout is for the signals
+        wait_slot(slot, version, 100);
+      } else {
+        util::sleep_for(100);  // 0.1 s
+      }
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -341,11 +804,19 @@ void Params::clearAll(ParamKeyType key_type) {
   for (auto &[key, type] : keys) {
     if (type & key_type) {
       path = params_path + "/d/" + key;
-      unlink(path.c_str());
+      if (unlink(path.c_str()) == 0) {
+        if (ParamSlot *slot = table ? table->slot(key.c_str()) : nullptr) {
+          write_slot(slot, nullptr, 0);
+        }
+      }
     }
   }
 
   // fsync parent directory
   path = params_path + "/d";
-  fsync_dir(path.c_str());
+  if (ParamsFlusher *flusher = ParamsFlusher::get()) {
+    flusher->add(path, -1);
+  } else {
+    fsync_dir(path.c_str());
+  }
 }
@@ -15,6 +15,14 @@ enum ParamKeyType {
   ALL = 0xFFFFFFFF
 };
 
+class ParamsTable;
+
+// values are files in <params_path>/d, mirrored in a shared memory table (see params.cc) that get() reads
+// without a syscall. the table is used by every process or none: PARAMS_SHM=0 turns it off, and only
+// works when set for all processes using the same params path. files changed without Params (by hand, or
+// restored) are copied into the table by the next process that opens it, the ones running don't see them before.
+// PARAMS_FSYNC_MS=n fsyncs the values put within n ms (default 100) together in the background,
+// 0 fsyncs every put before it returns
 class Params {
 public:
   Params();
@@ -34,6 +42,7 @@ public:
   std::map<std::string, std::string> readAll();
 
   // helpers for reading values
+  // block waits until the key has a value, or SIGINT/SIGTERM
   std::string get(const char *key, bool block = false);
 
   inline std::string get(const std::string &key, bool block = false) {
@@ -81,4 +90,5 @@ public:
 
 private:
   const std::string params_path;
+  ParamsTable *table = nullptr;
 };
@@ -1,8 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <queue>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 template <class T>
 class SafeQueue {
@@ -50,3 +62,199 @@ private:
   std::condition_variable cv;
   std::queue<T> q;
 };
+
+// bounded lock-free ring for one producer and one consumer thread. Size is a power of two
+template <class T, size_t Size>
+class SPSCQueue {
+  static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+public:
+  using value_type = T;
+
+  // false if full
+  bool try_push(const T &v) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h - cached_tail == Size) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (h - cached_tail == Size) return false;
+    }
+    buf[h & (Size - 1)] = v;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T &v) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t == cached_head) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (t == cached_head) return false;
+    }
+    v = buf[t & (Size - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+private:
+  // each side only reads the other's index when its cached copy says full or empty
+  alignas(64) std::atomic<size_t> head = 0;
+  size_t cached_tail = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+  size_t cached_head = 0;
+  alignas(64) T buf[Size];
+};
+
+// bounded lock-free queue for any number of producers and consumers, every cell has a sequence number
+// telling whose turn it is (Vyukov's MPMC queue). Size is a power of two
+template <class T, size_t Size>
+class MPMCQueue {
+  static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+public:
+  using value_type = T;
+
+  MPMCQueue() {
+    for (size_t i = 0; i < Size; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // false if full
+  bool try_push(const T &v) {
+    size_t pos = push_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & (Size - 1)];
+      const intptr_t diff = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (diff == 0) {
+        if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = push_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = v;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T &v) {
+    size_t pos = pop_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & (Size - 1)];
+      const intptr_t diff = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = pop_pos.load(std::memory_order_relaxed);
+      }
+    }
+    v = cell->value;
+    cell->seq.store(pos + Size, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    const size_t pop = pop_pos.load(std::memory_order_acquire);
+    const size_t push = push_pos.load(std::memory_order_acquire);
+    return push > pop ? push - pop : 0;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  alignas(64) std::atomic<size_t> push_pos = 0;
+  alignas(64) std::atomic<size_t> pop_pos = 0;
+  alignas(64) Cell cells[Size];
+};
+
+// SafeQueue's interface over a lock-free queue. a consumer only sleeps, on a futex, when the queue is
+// empty, and a push only makes the wake syscall when one does
+template <class Queue>
+class BlockingQueue {
+public:
+  using T = typename Queue::value_type;
+
+  // false if full
+  bool push(const T &v) {
+    if (!q.try_push(v)) return false;
+    // orders the push before reading waiters, pairs with the one in wait()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) > 0) {
+      // release, a consumer that reads the new seq also sees the push
+      futex_seq.fetch_add(1, std::memory_order_release);
+      wake();
+    }
+    return true;
+  }
+
+  T pop() {
+    T v;
+    while (!try_pop(v, INT_MAX)) {}
+    return v;
+  }
+
+  bool try_pop(T &v, int timeout_ms = 0) {
+    if (q.try_pop(v)) return true;
+    if (timeout_ms <= 0) return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ret = false;
+    while (true) {
+      // read before trying, a push in between changes it and the wait returns right away.
+      // acquire, so the try_pop after it can't be reordered before it on weakly ordered cpus
+      const uint32_t seq = futex_seq.load(std::memory_order_acquire);
+      if ((ret = q.try_pop(v))) break;
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) break;
+      wait(seq, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count());
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return ret;
+  }
+
+  bool empty() const {
+    return q.size() == 0;
+  }
+
+  size_t size() const {
+    return q.size();
+  }
+
+private:
+  void wait(uint32_t seq, int64_t timeout_ns) {
+#ifdef __linux__
+    struct timespec ts = {(time_t)(timeout_ns / 1000000000), (long)(timeout_ns % 1000000000)};
+    syscall(SYS_futex, &futex_seq, FUTEX_WAIT_PRIVATE, seq, &ts, NULL, 0);
+#else
+    std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<int64_t>(timeout_ns, 1000000)));
+#endif
+  }
+
+  void wake() {
+#ifdef __linux__
+    syscall(SYS_futex, &futex_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+  }
+
+  Queue q;
+  alignas(64) std::atomic<uint32_t> futex_seq = 0;
+  std::atomic<int> waiters = 0;
+};
+
+template <class T, size_t Size>
+using BlockingSPSCQueue = BlockingQueue<SPSCQueue<T, Size>>;
+
+template <class T, size_t Size>
+using BlockingMPMCQueue = BlockingQueue<MPMCQueue<T, Size>>;
@@ -4,10 +4,22 @@
 
 #include "selfdrive/common/swaglog.h"
 
+#include <pthread.h>
+#include <unistd.h>
+
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdarg>
 #include <cstring>
+#include <ctime>
+#include <iterator>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include "json11.hpp"
@@ -16,32 +28,72 @@
 #include "selfdrive/common/version.h"
 #include "selfdrive/hardware/hw.h"
 
+// a log call formats its message into a record in the calling thread's ring and returns, a background
+// thread drains the rings, does the json and sends it to logmessaged. a full ring drops the record and
+// counts it, it never blocks, errors included: they only wake the drain thread. messages that don't fit
+// a record are the only ones allocating. what's left in the rings is sent at exit, the log calls after are
+// dropped. a fatal signal waits for the drain thread to send the crashing thread's ring, so an error right
+// before a crash isn't lost
+const int LOG_RING_SIZE = 128;
+const size_t LOG_RECORD_SIZE = 256;
+const int LOG_DRAIN_MS = 10;
+const int LOG_FLUSH_TIMEOUT_MS = 100;
+const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+struct LogRecord {
+  double created;
+  const char *filename;  // __FILE__ and __func__, static
+  const char *func;
+  char *long_msg;        // heap copy of a message longer than msg
+  int levelnum;
+  int lineno;
+  char msg[LOG_RECORD_SIZE - 4 * sizeof(void *) - 2 * sizeof(int)];
+};
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE);
+
+// single producer, single consumer
+struct LogRing {
+  alignas(64) std::atomic<uint32_t> head = 0;  // written by the logging thread
+  alignas(64) std::atomic<uint32_t> tail = 0;  // written by the drain thread
+  std::atomic<uint32_t> dropped = 0;
+  std::atomic<bool> closed = false;            // the thread exited, freed once drained
+  LogRecord records[LOG_RING_SIZE];
+};
+
 class LogState {
  public:
-  LogState() = default;
-  ~LogState();
-  std::mutex lock;
-  bool inited;
+  std::mutex lock;  // everything below, never taken by a log call after the thread's first one
+  std::atomic<bool> inited = false;
+  std::atomic<bool> running = false;  // the socket and the drain thread, not in a forked child until it logs
   json11::Json::object ctx_j;
+  bool ctx_changed = false;
+  std::vector<LogRing *> rings;
   void *zctx;
   void *sock;
   int print_level;
+
+  std::thread *drain_thread = nullptr;
+  std::mutex wake_lock;
+  std::condition_variable wake_cv;
+  bool wake = false;
+  std::atomic<bool> do_exit = false;  // stopped at exit, the log calls after return right away
 };
 
-LogState::~LogState() {
-  zmq_close(sock);
-  zmq_ctx_destroy(zctx);
-}
+static LogState s;
+static pthread_key_t ring_key;
+static thread_local LogRing *thread_ring = nullptr;
+static struct sigaction prev_fatal_actions[std::size(fatal_signals)];
 
-static LogState s = {};
+static void drain_thread();
 
 static void cloudlog_bind_locked(const char* k, const char* v) {
   s.ctx_j[k] = v;
+  s.ctx_changed = true;
 }
 
-static void cloudlog_init() {
-  if (s.inited) return;
-  s.ctx_j = json11::Json::object {};
+// the socket and the drain thread, started again by a forked child
+static void cloudlog_start() {
+  if (s.running) return;
   s.zctx = zmq_ctx_new();
   s.sock = zmq_socket(s.zctx, ZMQ_PUSH);
 
@@ -50,6 +102,50 @@ static void cloudlog_init() {
 
   zmq_connect(s.sock, "ipc:///tmp/logmessage");
 
+  s.drain_thread = new std::thread(drain_thread);
+  s.running = true;
+}
+
+// stops the drain thread once it sent what's left, and closes the socket. before the static destructors,
+// threads still logging then don't touch the state anymore
+static void cloudlog_exit() {
+  std::thread *t = nullptr;
+  {
+    std::lock_guard lk(s.lock);
+    std::swap(t, s.drain_thread);
+    s.do_exit = true;
+  }
+  if (t) {
+    s.wake_cv.notify_one();
+    t->join();
+    delete t;
+  }
+  if (s.running) {
+    zmq_close(s.sock);
+    zmq_ctx_destroy(s.zctx);
+  }
+}
+
+// waits for the drain thread, still running, to send the crashing thread's ring, then dies of the signal
+// with the action there was before. no locks, the thread may be holding one
+static void fatal_signal_handler(int sig) {
+  if (LogRing *ring = thread_ring; ring && s.running && !s.do_exit) {
+    const uint32_t head = ring->head.load(std::memory_order_acquire);
+    const struct timespec ms = {0, 1000 * 1000};
+    for (int i = 0; i < LOG_FLUSH_TIMEOUT_MS && ring->tail.load(std::memory_order_acquire) != head; i++) {
+      nanosleep(&ms, nullptr);
+    }
+  }
+  for (size_t i = 0; i < std::size(fatal_signals); i++) {
+    if (fatal_signals[i] == sig) sigaction(sig, &prev_fatal_actions[i], nullptr);
+  }
+  raise(sig);
+}
+
+static void cloudlog_init() {
+  if (s.inited) return;
+  s.ctx_j = json11::Json::object {};
+
   s.print_level = CLOUDLOG_WARNING;
   const char* print_level = getenv("LOGPRINT");
   if (print_level) {
@@ -79,41 +175,173 @@ static void cloudlog_init() {
     cloudlog_bind_locked("device", "pc");
   }
 
+  static std::once_flag once;
+  std::call_once(once, [] {
+    // marks the ring of an exiting thread
+    pthread_key_create(&ring_key, [](void *ring) { ((LogRing *)ring)->closed = true; });
+    // a forked child keeps the parent's context, but starts its own socket and drain thread when it logs.
+    // only the forking thread exists in the child, and what the parent hadn't sent yet is the parent's
+    // to send. the long messages of those records are leaked, the parent may have been freeing them
+    pthread_atfork(nullptr, nullptr, [] {
+      new (&s.lock) std::mutex();
+      new (&s.wake_lock) std::mutex();
+      new (&s.wake_cv) std::condition_variable();
+      for (LogRing *ring : s.rings) {
+        if (ring != thread_ring) delete ring;
+      }
+      if (thread_ring) {
+        thread_ring->tail = thread_ring->head.load();
+        thread_ring->dropped = 0;
+      }
+      s.rings = thread_ring ? std::vector<LogRing *>{thread_ring} : std::vector<LogRing *>{};
+      s.drain_thread = nullptr;
+      s.wake = false;
+      s.do_exit = false;
+      s.zctx = s.sock = nullptr;
+      s.ctx_changed = true;
+      s.running = false;
+    });
+    // the handlers are kept by a forked child, like the context
+    atexit(cloudlog_exit);
+    for (size_t i = 0; i < std::size(fatal_signals); i++) {
+      // only where nothing else handles the signal
+      if (sigaction(fatal_signals[i], nullptr, &prev_fatal_actions[i]) == 0 &&
+          prev_fatal_actions[i].sa_handler == SIG_DFL) {
+        struct sigaction sa = {};
+        sa.sa_handler = fatal_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        sigaction(fatal_signals[i], &sa, nullptr);
+      }
+    }
+  });
+
   s.inited = true;
 }
 
-void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
-  std::lock_guard lk(s.lock);
-  cloudlog_init();
+static LogRing *get_thread_ring() {
+  if (!thread_ring) {
+    std::lock_guard lk(s.lock);
+    cloudlog_init();
+    cloudlog_start();
+    thread_ring = new LogRing;
+    pthread_setspecific(ring_key, thread_ring);
+    s.rings.push_back(thread_ring);
+  } else if (!s.running) {
+    // forked
+    std::lock_guard lk(s.lock);
+    cloudlog_start();
+  }
+  return thread_ring;
+}
+
+static void send(const json11::Json::object &ctx, int levelnum, const char *filename, int lineno,
+                 const char *func, const char *msg, double created) {
   if (levelnum >= s.print_level) {
     printf("%s: %s\n", filename, msg);
   }
-  char levelnum_c = levelnum;
-  zmq_send(s.sock, (levelnum_c + log_s).c_str(), log_s.length() + 1, ZMQ_NOBLOCK);
+
+  json11::Json log_j = json11::Json::object {
+    {"msg", msg},
+    {"ctx", ctx},
+    {"levelnum", levelnum},
+    {"filename", filename},
+    {"lineno", lineno},
+    {"funcname", func},
+    {"created", created}
+  };
+  std::string log_s = (char)levelnum + log_j.dump();
+  zmq_send(s.sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
+}
+
+static void drain_thread() {
+  set_thread_name("swaglog");
+  json11::Json::object ctx;
+  std::vector<LogRing *> rings;
+
+  while (true) {
+    bool exiting = s.do_exit;
+    uint32_t dropped = 0;
+    {
+      std::lock_guard lk(s.lock);
+      if (s.ctx_changed) {
+        ctx = s.ctx_j;
+        s.ctx_changed = false;
+      }
+      // free the rings of exited threads, their last records were drained the time before
+      for (auto it = s.rings.begin(); it != s.rings.end();) {
+        LogRing *ring = *it;
+        if (ring->closed && ring->tail == ring->head) {
+          dropped += ring->dropped;
+          delete ring;
+          it = s.rings.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      rings = s.rings;
+    }
+
+    for (LogRing *ring : rings) {
+      uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+      const uint32_t head = ring->head.load(std::memory_order_acquire);
+      for (; tail != head; tail++) {
+        LogRecord &r = ring->records[tail % LOG_RING_SIZE];
+        send(ctx, r.levelnum, r.filename, r.lineno, r.func, r.long_msg ? r.long_msg : r.msg, r.created);
+        free(r.long_msg);
+      }
+      ring->tail.store(tail, std::memory_order_release);
+      dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    if (dropped > 0) {
+      std::string msg = util::string_format("swaglog: %u messages dropped", dropped);
+      send(ctx, CLOUDLOG_WARNING, __FILE__, __LINE__, __func__, msg.c_str(), seconds_since_epoch());
+    }
+    if (exiting) break;
+
+    std::unique_lock lk(s.wake_lock);
+    s.wake_cv.wait_for(lk, std::chrono::milliseconds(LOG_DRAIN_MS), [] { return s.wake || s.do_exit; });
+    s.wake = false;
+  }
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
-  char* msg_buf = nullptr;
+  if (s.do_exit) return;
+
+  LogRing *ring = get_thread_ring();
+  const uint32_t head = ring->head.load(std::memory_order_relaxed);
+  const uint32_t queued = head - ring->tail.load(std::memory_order_acquire);
+  if (queued == LOG_RING_SIZE) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  LogRecord &r = ring->records[head % LOG_RING_SIZE];
   va_list args;
   va_start(args, fmt);
-  vasprintf(&msg_buf, fmt, args);
+  int len = vsnprintf(r.msg, sizeof(r.msg), fmt, args);
   va_end(args);
+  if (len < 0) return;
 
-  if (!msg_buf) return;
+  r.long_msg = nullptr;
+  if (len >= (int)sizeof(r.msg)) {
+    va_start(args, fmt);
+    int ret = vasprintf(&r.long_msg, fmt, args);
+    va_end(args);
+    if (ret < 0) r.long_msg = nullptr;
+  }
+  r.created = seconds_since_epoch();
+  r.filename = filename;
+  r.func = func;
+  r.levelnum = levelnum;
+  r.lineno = lineno;
+  ring->head.store(head + 1, std::memory_order_release);
 
-  json11::Json log_j = json11::Json::object {
-    {"msg", msg_buf},
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  std::string log_s = log_j.dump();
-  log(levelnum, filename, lineno, func, msg_buf, log_s);
-  free(msg_buf);
+  if (levelnum >= CLOUDLOG_ERROR || queued == LOG_RING_SIZE / 2) {
+    // errors go out without waiting for the next drain, and so does a ring filling up
+    s.wake_cv.notify_one();
+  }
 }
 
 void cloudlog_bind(const char* k, const char* v) {
@@ -0,0 +1,132 @@
+// benchmark for the params latency, the file backend against the shared memory table
+// usage: ./params_benchmark [iterations]
+// every backend runs in a forked child with its PARAMS_* environment on a new params dir in /tmp.
+// get of a small value and of one too large for the table, a put, a burst of 20 puts, and how long
+// a blocking get takes to return after the put
+
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+static void report(const char *name, std::vector<double> &times) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("  %-12s mean %9.2fus  p50 %9.2fus  p99 %9.2fus  max %9.2fus\n",
+         name, 1e3 * sum / times.size(), 1e3 * pct(0.5), 1e3 * pct(0.99), 1e3 * times.back());
+}
+
+static std::set<std::string> shm_tables() {
+  std::set<std::string> ret;
+  if (DIR *d = opendir("/dev/shm")) {
+    while (struct dirent *de = readdir(d)) {
+      if (strncmp(de->d_name, "params_", 7) == 0) ret.insert(de->d_name);
+    }
+    closedir(d);
+  }
+  return ret;
+}
+
+static void run(const std::string &path, int iterations) {
+  Params params(path);
+  params.put("CarParams", std::string(16 * 1024, 'x'));
+  params.putBool("IsMetric", true);
+
+  std::vector<double> get_small, get_large, put, burst, wake;
+  for (int i = 0; i < iterations; i++) {
+    double t1 = millis_since_boot();
+    params.getBool("IsMetric");
+    double t2 = millis_since_boot();
+    params.get("CarParams");
+    double t3 = millis_since_boot();
+    params.put("LastAthenaPingTime", std::to_string(i));
+    double t4 = millis_since_boot();
+    get_small.push_back(t2 - t1);
+    get_large.push_back(t3 - t2);
+    put.push_back(t4 - t3);
+  }
+
+  const char *burst_keys[] = {
+    "jvePilot.carState.accEco", "jvePilot.settings.accEco.speedAheadLevel1", "jvePilot.settings.accEco.speedAheadLevel2",
+    "jvePilot.settings.autoFollow", "jvePilot.settings.autoFollow.speed1-2Bars", "jvePilot.settings.autoFollow.speed2-3Bars",
+    "jvePilot.settings.autoFollow.speed3-4Bars", "jvePilot.settings.autoResume", "jvePilot.settings.disableOnGas",
+    "jvePilot.settings.audioAlertOnSteeringLoss", "jvePilot.settings.deviceOffset", "jvePilot.settings.reverseAccSpeedChange",
+    "jvePilot.settings.slowInCurves", "jvePilot.settings.slowInCurves.speedRatio", "jvePilot.settings.slowInCurves.speedDropOff",
+    "jvePilot.settings.slowInCurves.speedDropOffAngle", "CompletedTrainingVersion", "HasAcceptedTerms", "OpenpilotEnabledToggle",
+    "CommunityFeaturesToggle",
+  };
+  for (int i = 0; i < std::max(1, iterations / 20); i++) {
+    double t = millis_since_boot();
+    for (const char *key : burst_keys) params.put(key, std::to_string(i));
+    burst.push_back(millis_since_boot() - t);
+  }
+
+  for (int i = 0; i < 20; i++) {
+    params.remove("DongleId");
+    double woken = 0;
+    std::thread waiter([&] {
+      params.get("DongleId", true);
+      woken = millis_since_boot();
+    });
+    util::sleep_for(5);
+    double t = millis_since_boot();
+    params.put("DongleId", "0123456789abcdef");
+    waiter.join();
+    wake.push_back(woken - t);
+  }
+
+  report("get", get_small);
+  report("get large", get_large);
+  report("put", put);
+  report("20 puts", burst);
+  report("wake", wake);
+}
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  std::vector<std::pair<const char *, std::vector<std::pair<const char *, const char *>>>> backends = {
+    {"file", {{"PARAMS_SHM", "0"}, {"PARAMS_FSYNC_MS", "0"}}},
+    {"shm", {{"PARAMS_SHM", "1"}, {"PARAMS_FSYNC_MS", "0"}}},
+    {"shm, batched fsync", {{"PARAMS_SHM", "1"}, {"PARAMS_FSYNC_MS", "100"}}},
+  };
+
+  const std::set<std::string> tables = shm_tables();
+  for (auto &[name, env] : backends) {
+    char path[] = "/tmp/params_benchmark_XXXXXX";
+    if (!mkdtemp(path)) {
+      perror("mkdtemp");
+      return 1;
+    }
+
+    printf("%s\n", name);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      for (auto &[key, value] : env) setenv(key, value, 1);
+      run(path, iterations);
+      exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    system(util::string_format("rm -rf %s", path).c_str());
+  }
+
+  // the tables the children left behind
+  for (auto &table : shm_tables()) {
+    if (tables.find(table) == tables.end()) unlink(("/dev/shm/" + table).c_str());
+  }
+  return 0;
+}
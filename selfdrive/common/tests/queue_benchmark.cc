@@ -0,0 +1,96 @@
+// benchmark for the queues in queue.h against SafeQueue
+// usage: ./queue_benchmark [items]
+// "paced": one producer pushes a timestamp every 50us like a frame hand-off, the consumer blocks in
+// try_pop, latency is from push to pop. "burst": producers push as fast as they can (retrying when
+// full) and consumers pop with a timeout, 1:1 for the single producer queues and 4:4 for the others
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/common/timing.h"
+
+static void report(const char *name, std::vector<double> &times, double total_ms) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("  %-22s mean %8.2fus  p50 %8.2fus  p99 %8.2fus  max %9.2fus  %6.2f Mitems/s\n",
+         name, 1e-3 * sum / times.size(), 1e-3 * pct(0.5), 1e-3 * pct(0.99), 1e-3 * times.back(),
+         times.size() / total_ms / 1e3);
+}
+
+// SafeQueue can't be full
+static bool push(SafeQueue<uint64_t> &q, uint64_t v) {
+  q.push(v);
+  return true;
+}
+
+template <class Queue>
+static bool push(Queue &q, uint64_t v) {
+  return q.push(v);
+}
+
+template <class Queue>
+static void run(const char *name, int producers, int consumers, int items, int pace_us) {
+  Queue q;
+  std::vector<std::vector<double>> times(consumers);
+  std::atomic<int> popped = 0;
+
+  double start = millis_since_boot();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < items / producers; i++) {
+        while (!push(q, nanos_since_boot())) {
+          std::this_thread::yield();
+        }
+        if (pace_us > 0) {
+          uint64_t until = nanos_since_boot() + pace_us * 1000;
+          while (nanos_since_boot() < until) {}
+        }
+      }
+    });
+  }
+  const int total = items / producers * producers;
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&, c] {
+      uint64_t v;
+      while (popped < total) {
+        if (q.try_pop(v, 1)) {
+          times[c].push_back(nanos_since_boot() - v);
+          popped++;
+        }
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  double total_ms = millis_since_boot() - start;
+
+  std::vector<double> all;
+  for (auto &t : times) all.insert(all.end(), t.begin(), t.end());
+  report(name, all, total_ms);
+}
+
+int main(int argc, char **argv) {
+  const int items = argc > 1 ? atoi(argv[1]) : 200000;
+
+  printf("paced, 1 producer, 1 consumer\n");
+  run<SafeQueue<uint64_t>>("SafeQueue", 1, 1, items / 20, 50);
+  run<BlockingSPSCQueue<uint64_t, 32>>("BlockingSPSCQueue", 1, 1, items / 20, 50);
+  run<BlockingMPMCQueue<uint64_t, 32>>("BlockingMPMCQueue", 1, 1, items / 20, 50);
+
+  printf("burst, 1 producer, 1 consumer\n");
+  run<SafeQueue<uint64_t>>("SafeQueue", 1, 1, items, 0);
+  run<BlockingSPSCQueue<uint64_t, 1024>>("BlockingSPSCQueue", 1, 1, items, 0);
+  run<BlockingMPMCQueue<uint64_t, 1024>>("BlockingMPMCQueue", 1, 1, items, 0);
+
+  printf("burst, 4 producers, 4 consumers\n");
+  run<SafeQueue<uint64_t>>("SafeQueue", 4, 4, items, 0);
+  run<BlockingMPMCQueue<uint64_t, 1024>>("BlockingMPMCQueue", 4, 4, items, 0);
+  return 0;
+}
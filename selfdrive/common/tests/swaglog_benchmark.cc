@@ -0,0 +1,134 @@
+// benchmark for the latency of a log call with threads logging at the same time
+// usage: ./swaglog_benchmark [messages per thread]
+// 1 to 8 threads each log in bursts of 8 messages per ms, with cloudlog and with what cloudlog did before:
+// vasprintf, the json and zmq_send under a global lock. binds ipc:///tmp/logmessage to count what arrives,
+// so don't run it next to logmessaged
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zmq.h>
+#include "json11.hpp"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+static void report(const char *name, std::vector<double> &times) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("  %-10s mean %8.2fus  p50 %8.2fus  p99 %8.2fus  max %9.2fus",
+         name, 1e-3 * sum / times.size(), 1e-3 * pct(0.5), 1e-3 * pct(0.99), 1e-3 * times.back());
+}
+
+// cloudlog_e before the rings
+static struct {
+  std::mutex lock;
+  json11::Json::object ctx_j = json11::Json::object{{"version", "0.0"}, {"device", "pc"}, {"dirty", true}};
+  void *sock;
+} ref;
+
+static void ref_cloudlog(int levelnum, const char *filename, int lineno, const char *func, const char *fmt, ...) {
+  char *msg_buf = nullptr;
+  va_list args;
+  va_start(args, fmt);
+  vasprintf(&msg_buf, fmt, args);
+  va_end(args);
+  if (!msg_buf) return;
+
+  json11::Json log_j = json11::Json::object {
+    {"msg", msg_buf},
+    {"ctx", ref.ctx_j},
+    {"levelnum", levelnum},
+    {"filename", filename},
+    {"lineno", lineno},
+    {"funcname", func},
+    {"created", seconds_since_epoch()}
+  };
+  std::string log_s = log_j.dump();
+  std::lock_guard lk(ref.lock);
+  char levelnum_c = levelnum;
+  zmq_send(ref.sock, (levelnum_c + log_s).c_str(), log_s.length() + 1, ZMQ_NOBLOCK);
+  free(msg_buf);
+}
+
+// messages received, and the drops swaglog reported
+static std::pair<int, int> receive(void *pull) {
+  util::sleep_for(200);
+  int received = 0, dropped = 0;
+  char buf[4096];
+  int len;
+  while ((len = zmq_recv(pull, buf, sizeof(buf) - 1, ZMQ_DONTWAIT)) >= 0) {
+    buf[std::min<int>(len, sizeof(buf) - 1)] = '\0';
+    unsigned int n = 0;
+    const char *p = strstr(buf, "swaglog: ");
+    if (p && sscanf(p, "swaglog: %u messages dropped", &n) == 1) {
+      dropped += n;
+    } else {
+      received++;
+    }
+  }
+  return {received, dropped};
+}
+
+int main(int argc, char **argv) {
+  const int messages = argc > 1 ? atoi(argv[1]) : 20000;
+
+  void *zctx = zmq_ctx_new();
+  void *pull = zmq_socket(zctx, ZMQ_PULL);
+  int hwm = 0;
+  zmq_setsockopt(pull, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+  if (zmq_bind(pull, "ipc:///tmp/logmessage") != 0) {
+    printf("could not bind ipc:///tmp/logmessage, not counting the messages\n");
+  }
+  ref.sock = zmq_socket(zctx, ZMQ_PUSH);
+  zmq_setsockopt(ref.sock, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  zmq_connect(ref.sock, "ipc:///tmp/logmessage");
+
+  // starts the drain thread
+  LOGD("swaglog_benchmark");
+  receive(pull);
+
+  for (int threads : {1, 2, 4, 8}) {
+    printf("%d threads, %d messages each\n", threads, messages);
+    for (bool locked : {true, false}) {
+      std::vector<std::vector<double>> times(threads);
+      std::vector<std::thread> workers;
+      for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+          for (int i = 0; i < messages; i++) {
+            uint64_t t1 = nanos_since_boot();
+            if (locked) {
+              ref_cloudlog(CLOUDLOG_DEBUG, __FILE__, __LINE__, __func__, "thread %d message %d, %f", t, i, 0.5 * i);
+            } else {
+              LOGD("thread %d message %d, %f", t, i, 0.5 * i);
+            }
+            times[t].push_back(nanos_since_boot() - t1);
+            if (i % 8 == 7) util::sleep_for(1);
+          }
+        });
+      }
+      for (auto &w : workers) w.join();
+
+      std::vector<double> all;
+      for (auto &t : times) all.insert(all.end(), t.begin(), t.end());
+      report(locked ? "locked" : "ring", all);
+      auto [received, dropped] = receive(pull);
+      printf("  received %d, %d dropped\n", received, dropped);
+    }
+  }
+
+  zmq_close(ref.sock);
+  zmq_close(pull);
+  zmq_ctx_destroy(zctx);
+  return 0;
+}
@@ -0,0 +1,190 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+static std::set<std::string> shm_tables() {
+  std::set<std::string> ret;
+  if (DIR *d = opendir("/dev/shm")) {
+    while (struct dirent *de = readdir(d)) {
+      if (strncmp(de->d_name, "params_", 7) == 0) ret.insert(std::string("/dev/shm/") + de->d_name);
+    }
+    closedir(d);
+  }
+  return ret;
+}
+
+// a new params dir in /tmp, removed with the tables made while it existed
+struct ParamsDir {
+  std::string path;
+  const std::set<std::string> tables = shm_tables();
+
+  ParamsDir() {
+    char tmp[] = "/tmp/test_params_XXXXXX";
+    REQUIRE(mkdtemp(tmp));
+    path = tmp;
+  }
+  ~ParamsDir() {
+    system(util::string_format("rm -rf %s", path.c_str()).c_str());
+    for (auto &table : shm_tables()) {
+      if (tables.find(table) == tables.end()) unlink(table.c_str());
+    }
+  }
+  // the tables made since
+  std::set<std::string> new_tables() const {
+    std::set<std::string> ret;
+    for (auto &table : shm_tables()) {
+      if (tables.find(table) == tables.end()) ret.insert(table);
+    }
+    return ret;
+  }
+};
+
+// runs f in a child process, true if it returned true
+template <typename F>
+static bool in_child(F f) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(f() ? 0 : 1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+TEST_CASE("Params are seen by the other instances and processes") {
+  ParamsDir dir;
+  Params params(dir.path), other(dir.path);
+
+  REQUIRE(params.put("DongleId", "0123456789abcdef") == 0);
+  REQUIRE(other.get("DongleId") == "0123456789abcdef");
+  REQUIRE(in_child([&] { return Params(dir.path).get("DongleId") == "0123456789abcdef"; }));
+  REQUIRE(util::read_file(params.getParamPath("DongleId")) == "0123456789abcdef");
+
+  REQUIRE(in_child([&] { return Params(dir.path).put("DongleId", "fedcba9876543210") == 0; }));
+  REQUIRE(params.get("DongleId") == "fedcba9876543210");
+
+  // an empty value is a value
+  REQUIRE(other.put("GitDiff", "") == 0);
+  REQUIRE(util::file_exists(params.getParamPath("GitDiff")));
+  REQUIRE(params.get("GitDiff") == "");
+
+  REQUIRE(other.remove("DongleId") == 0);
+  REQUIRE(params.get("DongleId") == "");
+  REQUIRE_FALSE(util::file_exists(params.getParamPath("DongleId")));
+  REQUIRE(in_child([&] { return Params(dir.path).get("DongleId") == ""; }));
+
+  params.putBool("IsMetric", true);
+  params.put("CarVin", "1C4RJFAG0FC625797");
+  params.put("AthenadPid", "123");
+  other.clearAll(CLEAR_ON_MANAGER_START);
+  REQUIRE(params.get("CarVin") == "");
+  REQUIRE(params.get("IsMetric") == "1");
+  REQUIRE(in_child([&] { return Params(dir.path).get("CarVin") == "" && Params(dir.path).getBool("IsMetric"); }));
+  REQUIRE(params.readAll() == std::map<std::string, std::string>{{"AthenadPid", "123"}, {"GitDiff", ""}, {"IsMetric", "1"}});
+}
+
+TEST_CASE("a blocking get returns the value put") {
+  ParamsDir dir;
+  Params params(dir.path);
+
+  double fastest = 1e9;
+  for (int i = 0; i < 5; i++) {
+    params.remove("DongleId");
+    std::string value;
+    double woken = 0;
+    std::thread waiter([&] {
+      value = params.get("DongleId", true);
+      woken = millis_since_boot();
+    });
+    util::sleep_for(20);
+    const double put = millis_since_boot();
+    REQUIRE(in_child([&] { return Params(dir.path).put("DongleId", std::to_string(i)) == 0; }));
+    waiter.join();
+    REQUIRE(value == std::to_string(i));
+    fastest = std::min(fastest, woken - put);
+  }
+  // woken by the put, not by polling every 100ms
+  REQUIRE(fastest < 50);
+}
+
+TEST_CASE("values too large for the table are read from the file") {
+  ParamsDir dir;
+  Params params(dir.path), other(dir.path);
+
+  const std::string large(16 * 1024, 'x');
+  REQUIRE(params.put("CarParams", large) == 0);
+  REQUIRE(other.get("CarParams") == large);
+  REQUIRE(in_child([&] { return Params(dir.path).get("CarParams") == large; }));
+
+  // and a small one goes back into the table
+  REQUIRE(params.put("CarParams", "small") == 0);
+  REQUIRE(other.get("CarParams") == "small");
+  REQUIRE(params.put("CarParams", large) == 0);
+  REQUIRE(other.get("CarParams") == large);
+  REQUIRE(other.remove("CarParams") == 0);
+  REQUIRE(params.get("CarParams") == "");
+}
+
+TEST_CASE("the table of a params dir") {
+  ParamsDir dir;
+  Params params(dir.path);
+  REQUIRE(params.put("DongleId", "0123456789abcdef") == 0);
+  REQUIRE(params.putBool("IsMetric", true) == 0);
+  REQUIRE(dir.new_tables().size() == 1);
+  const std::string table = *dir.new_tables().begin();
+
+  SECTION("picks up files changed without Params when it's opened") {
+    std::ofstream(params.getParamPath("DongleId")) << "restored";
+    std::ofstream(params.getParamPath("GitBranch")) << "release2";
+    unlink(params.getParamPath("IsMetric").c_str());
+    // another path to the same dir, opened like a new process would
+    Params reopened(dir.path + "/.");
+    REQUIRE(reopened.get("DongleId") == "restored");
+    REQUIRE(params.get("DongleId") == "restored");
+    REQUIRE(params.get("GitBranch") == "release2");
+    REQUIRE(params.get("IsMetric") == "");
+    REQUIRE(dir.new_tables() == std::set<std::string>{table});
+  }
+
+  SECTION("isn't replaced when it can't be used") {
+    struct stat before, after;
+    REQUIRE(stat(table.c_str(), &before) == 0);
+    // not a table anymore, the mapping of this process stays valid
+    int fd = open(table.c_str(), O_WRONLY);
+    const uint32_t magic = 0;
+    REQUIRE(pwrite(fd, &magic, sizeof(magic), 0) == sizeof(magic));
+    close(fd);
+    REQUIRE(params.put("GitBranch", "release2") == 0);
+    // left alone, the values are read from the files
+    Params reopened(dir.path + "/.");
+    REQUIRE(reopened.get("GitBranch") == "release2");
+    REQUIRE(reopened.put("GitCommit", "abc") == 0);
+    REQUIRE(reopened.get("GitCommit") == "abc");
+    REQUIRE(stat(table.c_str(), &after) == 0);
+    REQUIRE(before.st_ino == after.st_ino);
+  }
+
+  SECTION("is removed once the dir is gone") {
+    system(util::string_format("rm -rf %s", dir.path.c_str()).c_str());
+    ParamsDir next;
+    Params(next.path).put("DongleId", "0123456789abcdef");
+    REQUIRE(shm_tables().count(table) == 0);
+    REQUIRE(next.new_tables().size() == 1);
+  }
+}
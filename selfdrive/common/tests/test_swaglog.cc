@@ -0,0 +1,209 @@
+#define CATCH_CONFIG_MAIN
+// the handlers of catch would be installed before the ones of swaglog, which only handles what nothing else does
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+#include "catch2/catch.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zmq.h>
+#include "json11.hpp"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/common/version.h"
+
+const char *SWAGLOG_ADDR = "ipc:///tmp/logmessage";
+
+// stands in for logmessaged. bound once, for the test and the children it forks, and never freed:
+// a forked child exits with it
+class LogReceiver {
+ public:
+  LogReceiver() {
+    zctx = zmq_ctx_new();
+    sock = zmq_socket(zctx, ZMQ_PULL);
+    int timeout = 10;
+    zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    REQUIRE(zmq_bind(sock, SWAGLOG_ADDR) == 0);
+    thread = std::thread([this] {
+      std::vector<char> buf(1024 * 1024);
+      while (true) {
+        int len = zmq_recv(sock, buf.data(), buf.size(), 0);
+        if (len <= 0) continue;
+        std::string err;
+        auto msg = json11::Json::parse(std::string(buf.data() + 1, std::min((size_t)len, buf.size()) - 1), err);
+        std::lock_guard lk(lock);
+        msgs.push_back(msg);
+        levels.push_back(buf[0]);
+      }
+    });
+    thread.detach();
+  }
+
+  // forgets the messages received so far
+  void clear() {
+    std::lock_guard lk(lock);
+    msgs.clear();
+    levels.clear();
+  }
+
+  // waits for the messages starting with prefix until there are count of them and the ones dropped, or a timeout
+  std::vector<json11::Json> wait(const std::string &prefix, size_t count, uint32_t *dropped = nullptr) {
+    std::vector<json11::Json> ret;
+    for (double start = millis_since_boot(); millis_since_boot() - start < 5000; util::sleep_for(10)) {
+      ret.clear();
+      uint32_t n_dropped = 0;
+      {
+        std::lock_guard lk(lock);
+        for (size_t i = 0; i < msgs.size(); i++) {
+          const std::string &msg = msgs[i]["msg"].string_value();
+          if (msg.rfind(prefix, 0) == 0) {
+            REQUIRE(levels[i] == msgs[i]["levelnum"].int_value());
+            ret.push_back(msgs[i]);
+          } else if (uint32_t n; sscanf(msg.c_str(), "swaglog: %u messages dropped", &n) == 1) {
+            n_dropped += n;
+          }
+        }
+      }
+      if (dropped) *dropped = n_dropped;
+      if (ret.size() + n_dropped >= count) break;
+    }
+    return ret;
+  }
+
+ private:
+  void *zctx, *sock;
+  std::thread thread;
+  std::mutex lock;
+  std::vector<json11::Json> msgs;
+  std::vector<char> levels;
+};
+
+static LogReceiver &receiver() {
+  static LogReceiver *r = new LogReceiver;
+  return *r;
+}
+
+// the numbers after prefix, in the order received
+static std::vector<int> numbers(const std::vector<json11::Json> &msgs, const std::string &prefix) {
+  std::vector<int> ret;
+  for (auto &msg : msgs) {
+    ret.push_back(std::stoi(msg["msg"].string_value().substr(prefix.size())));
+  }
+  return ret;
+}
+
+static std::vector<int> range(int n) {
+  std::vector<int> ret(n);
+  for (int i = 0; i < n; i++) ret[i] = i;
+  return ret;
+}
+
+TEST_CASE("messages are sent in order, with the context") {
+  receiver();
+  cloudlog_bind("test", "swaglog");
+
+  const int THREADS = 4, MSGS = 100;  // less than a ring, none dropped
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < MSGS; i++) {
+        cloudlog(CLOUDLOG_DEBUG + (i % 5) * 10, "thread %d: %d", t, i);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  for (int t = 0; t < THREADS; t++) {
+    const std::string prefix = util::string_format("thread %d: ", t);
+    auto msgs = receiver().wait(prefix, MSGS);
+    REQUIRE(numbers(msgs, prefix) == range(MSGS));
+    for (int i = 0; i < MSGS; i++) {
+      REQUIRE(msgs[i]["levelnum"].int_value() == CLOUDLOG_DEBUG + (i % 5) * 10);
+      REQUIRE(msgs[i]["filename"].string_value() == __FILE__);
+      REQUIRE(msgs[i]["funcname"].string_value() == "operator()");
+      REQUIRE(msgs[i]["created"].number_value() > 0);
+      REQUIRE(msgs[i]["ctx"]["version"].string_value() == COMMA_VERSION);
+      REQUIRE(msgs[i]["ctx"]["test"].string_value() == "swaglog");
+    }
+  }
+}
+
+TEST_CASE("messages longer than a record are sent whole") {
+  receiver();
+  for (size_t len : {200, 255, 256, 10000, 100000}) {
+    const std::string msg = "long " + std::string(len, 'x');
+    LOG("%s", msg.c_str());
+    auto msgs = receiver().wait(msg, 1);
+    REQUIRE(msgs.size() == 1);
+    REQUIRE(msgs[0]["msg"].string_value() == msg);
+  }
+}
+
+TEST_CASE("a full ring drops the messages and counts them, errors too") {
+  receiver();
+  for (int level : {CLOUDLOG_INFO, CLOUDLOG_ERROR}) {
+    INFO(level);
+    receiver().clear();
+    const std::string prefix = util::string_format("drop %d: ", level);
+    // errors are printed, fewer of them
+    const int MSGS = level == CLOUDLOG_ERROR ? 1000 : 100000;
+    double slowest = 0;
+    std::thread([&] {
+      for (int i = 0; i < MSGS; i++) {
+        const double start = millis_since_boot();
+        cloudlog(level, "%s%d", prefix.c_str(), i);
+        slowest = std::max(slowest, millis_since_boot() - start);
+      }
+    }).join();
+
+    uint32_t dropped = 0;
+    auto msgs = receiver().wait(prefix, MSGS, &dropped);
+    REQUIRE(dropped > 0);
+    REQUIRE(msgs.size() + dropped == (size_t)MSGS);
+    auto sent = numbers(msgs, prefix);
+    REQUIRE(std::is_sorted(sent.begin(), sent.end()));
+    // none waits for the drain thread
+    REQUIRE(slowest < 50);
+  }
+}
+
+TEST_CASE("what's left is sent at exit") {
+  receiver();
+  const std::string prefix = "exit: ";
+  pid_t pid = fork();
+  if (pid == 0) {
+    for (int i = 0; i < 100; i++) LOG("%s%d", prefix.c_str(), i);
+    exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(numbers(receiver().wait(prefix, 100), prefix) == range(100));
+}
+
+TEST_CASE("an error right before a crash is sent") {
+  receiver();
+  const std::string prefix = "crash: ";
+  pid_t pid = fork();
+  if (pid == 0) {
+    for (int i = 0; i < 10; i++) LOG("%s%d", prefix.c_str(), i);
+    LOGE("%s%d", prefix.c_str(), 10);
+    abort();
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  // and it still dies of the signal
+  REQUIRE(WIFSIGNALED(status));
+  REQUIRE(WTERMSIG(status) == SIGABRT);
+  REQUIRE(numbers(receiver().wait(prefix, 11), prefix) == range(11));
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads. run() queues a task, parallel_for() splits a range
+// across the workers and the calling thread and returns once every chunk is done.
+class ThreadPool {
+public:
+  ThreadPool(int num_threads = 0) {
+    if (num_threads <= 0) {
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // the caller works on parallel_for() too, so one less worker
+    for (int i = 0; i < num_threads - 1; i++) {
+      workers.emplace_back([this] { worker(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::unique_lock lk(m);
+      exit = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers) t.join();
+  }
+
+  int size() const { return workers.size() + 1; }
+
+  void run(std::function<void()> task) {
+    {
+      std::unique_lock lk(m);
+      tasks.push(std::move(task));
+    }
+    cv.notify_one();
+  }
+
+  // calls fn(begin, end) on chunks of [0, n), at most one chunk per thread
+  void parallel_for(int n, const std::function<void(int, int)> &fn) {
+    const int chunks = std::min(n, size());
+    if (chunks <= 1) {
+      if (n > 0) fn(0, n);
+      return;
+    }
+
+    int remaining = chunks - 1;
+    std::mutex done_m;
+    std::condition_variable done_cv;
+    for (int i = 1; i < chunks; i++) {
+      run([&, i] {
+        fn(n * i / chunks, n * (i + 1) / chunks);
+        // decrement under the lock, the waiter owns done_m and done_cv and returns as soon as it sees zero
+        std::unique_lock lk(done_m);
+        if (--remaining == 0) done_cv.notify_one();
+      });
+    }
+    fn(0, n / chunks);
+
+    std::unique_lock lk(done_m);
+    done_cv.wait(lk, [&] { return remaining == 0; });
+  }
+
+private:
+  void worker() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lk(m);
+        cv.wait(lk, [this] { return exit || !tasks.empty(); });
+        if (tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+
+  std::mutex m;
+  std::condition_variable cv;
+  std::queue<std::function<void()>> tasks;
+  std::vector<std::thread> workers;
+  bool exit = false;
+};
@@ -0,0 +1,122 @@
+// benchmark for the radard track clustering, hclust_fast from scratch against cluster_points_centroid_seeded
+// usage: ./cluster_benchmark [frames per track count]
+// synthetic radar frames at 20Hz with 16-64 tracks, a few reflections per car that move a little every frame,
+// tracks now and then disappear and get replaced. the clusters have to match hclust_fast's exactly
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+
+extern "C" {
+#include "fastcluster.h"
+}
+
+const double DIST = 2.5 * 2.5;
+
+struct Track {
+  long long id;
+  double d, y, v;
+};
+
+static void report(const char *name, std::vector<double> &times) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("  %-10s mean %6.2fus  p50 %6.2fus  p99 %6.2fus  max %7.2fus\n",
+         name, 1e3 * sum / times.size(), 1e3 * pct(0.5), 1e3 * pct(0.99), 1e3 * times.back());
+}
+
+// what cluster_points_centroid did before, new condensed matrix and full dendrogram every call
+static void hclust_reference(int n, int m, double *pts, double dist, int *idx) {
+  if (n == 1) {
+    idx[0] = 0;
+    return;
+  }
+  double *pdist = new double[n * (n - 1) / 2];
+  int *merge = new int[2 * (n - 1)];
+  double *height = new double[n - 1];
+  hclust_pdist(n, m, pts, pdist);
+  hclust_fast(n, pdist, HCLUST_METHOD_CENTROID, merge, height);
+  cutree_cdist(n, merge, height, dist, idx);
+  delete[] pdist;
+  delete[] merge;
+  delete[] height;
+}
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 2000;
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  int mismatches = 0;
+
+  for (int n : {16, 32, 48, 64}) {
+    long long next_id = 0;
+    auto new_car = [&](std::vector<Track> &tracks, int reflections) {
+      const double d = 5 + 145 * uniform(gen), y = 2 * 3.7 * (int)(3 * uniform(gen) - 1), v = 5 * noise(gen);
+      for (int i = 0; i < reflections; i++) {
+        tracks.push_back({next_id++, d + 2 * noise(gen), y + 0.8 * noise(gen), v + 0.3 * noise(gen)});
+      }
+    };
+    std::vector<Track> tracks;
+    while ((int)tracks.size() < n) new_car(tracks, std::min<int>(n - tracks.size(), 1 + 3 * uniform(gen)));
+
+    cluster_state *state = cluster_state_new();
+    cluster_state *stateless = cluster_state_new();
+    std::vector<double> pts(n * 3);
+    std::vector<long long> ids(n);
+    std::vector<int> ref(n), seeded(n), unseeded(n);
+    std::vector<double> ref_times, unseeded_times, seeded_times;
+
+    for (int f = 0; f < frames; f++) {
+      for (auto &t : tracks) {
+        t.d = std::max(0.0, t.d + 0.05 * t.v + 0.05 * noise(gen));
+        t.y += 0.02 * noise(gen);
+        t.v += 0.05 * noise(gen);
+      }
+      if (uniform(gen) < 0.1) {
+        tracks.erase(tracks.begin() + (int)(tracks.size() * uniform(gen)));
+        new_car(tracks, 1);
+      }
+
+      // sorted by id and keyed like radard
+      std::sort(tracks.begin(), tracks.end(), [](auto &a, auto &b) { return a.id < b.id; });
+      for (int i = 0; i < n; i++) {
+        pts[i * 3 + 0] = tracks[i].d;
+        pts[i * 3 + 1] = tracks[i].y * 2;
+        pts[i * 3 + 2] = tracks[i].v;
+        ids[i] = tracks[i].id;
+      }
+
+      double t1 = millis_since_boot();
+      hclust_reference(n, 3, pts.data(), DIST, ref.data());
+      double t2 = millis_since_boot();
+      cluster_points_centroid_seeded(stateless, n, 3, pts.data(), NULL, DIST, unseeded.data());
+      double t3 = millis_since_boot();
+      cluster_points_centroid_seeded(state, n, 3, pts.data(), ids.data(), DIST, seeded.data());
+      double t4 = millis_since_boot();
+
+      ref_times.push_back(t2 - t1);
+      unseeded_times.push_back(t3 - t2);
+      seeded_times.push_back(t4 - t3);
+      mismatches += (ref != unseeded) + (ref != seeded);
+    }
+
+    printf("%d tracks, %d frames\n", n, frames);
+    report("hclust", ref_times);
+    report("unseeded", unseeded_times);
+    report("seeded", seeded_times);
+    cluster_state_free(state);
+    cluster_state_free(stateless);
+  }
+
+  if (mismatches) {
+    printf("%d frames clustered differently than hclust_fast\n", mismatches);
+  }
+  return mismatches ? 1 : 0;
+}
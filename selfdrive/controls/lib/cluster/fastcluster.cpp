@@ -11,6 +11,8 @@
 #include <vector>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
 
 
 extern "C" {
@@ -23,6 +25,222 @@ bool fc_isnan(double x) { return false; }
 #include "fastcluster_dm.cpp"
 #include "fastcluster_R_dm.cpp"
 
+// buffers and previous frame of cluster_points_centroid_seeded, the vectors only ever grow
+struct cluster_state {
+  // current frame, per point index
+  std::vector<int> prev_pos, cluster, label;
+  // current frame, per sorted position
+  std::vector<int> order, group, local;
+  // scratch for cluster_group
+  std::vector<double> coords, D, mindist;
+  std::vector<int> n_nghbr, members;
+  std::vector<char> active;
+
+  // previous frame, per sorted position
+  int prev_n = 0, prev_m = 0;
+  double prev_dist = 0;
+  bool prev_ids_valid = false;
+  std::vector<long long> prev_ids;
+  std::vector<double> prev_pts;
+  std::vector<int> prev_group, prev_local, slot;
+  // open addressing id -> previous position
+  std::vector<long long> table_ids;
+  std::vector<int> table_pos;
+  int table_mask = 0;
+
+  void resize(int n, int m) {
+    if ((int)order.size() < n) {
+      for (auto v : {&prev_pos, &cluster, &label, &order, &group, &local, &n_nghbr, &members}) v->resize(n);
+      active.resize(n);
+      mindist.resize(n);
+    }
+    if ((int)coords.size() < n * m) coords.resize(n * m);
+  }
+
+  static size_t hash(long long id) {
+    return (size_t)((unsigned long long)id * 0x9E3779B97F4A7C15ULL >> 32);
+  }
+
+  int lookup(long long id) const {
+    for (size_t h = hash(id) & table_mask;; h = (h + 1) & table_mask) {
+      if (table_pos[h] < 0) return -1;
+      if (table_ids[h] == id) return table_pos[h];
+    }
+  }
+
+  // true and the previous clusters in local if the group at a is the same as last frame
+  bool unchanged(int a, int g, int m, const double* pts, const long long* ids) {
+    const int r = prev_pos[order[a]];
+    if (r < 0 || prev_group[r] != g) return false;
+    for (int i = 0; i < g; i++) {
+      const int p = order[a + i];
+      if (prev_ids[r + i] != ids[p] || memcmp(&prev_pts[(r + i) * m], &pts[p * m], m * sizeof(double)) != 0) {
+        return false;
+      }
+    }
+    std::copy_n(&prev_local[r], g, &local[a]);
+    return true;
+  }
+
+  // centroid linkage of the g points at sorted position a, stopped at the first merge at dist or more.
+  // same steps as generic_linkage<METHOD_METR_CENTROID> with a linear scan instead of the heap,
+  // local gets the row every point ended up in
+  void cluster_group(int a, int g, int m, const double* pts, double dist) {
+    if ((int)D.size() < g * g) D.resize(g * g);
+    double* const c = &coords[0];
+    double* const d = &D[0];
+    for (int k = 0; k < m; k++) {
+      for (int i = 0; i < g; i++) c[k * g + i] = pts[order[a + i] * m + k];
+    }
+
+    // upper triangle of the squared distances, row by row and coordinate by coordinate so the inner loop vectorizes
+    for (int i = 0; i < g - 1; i++) {
+      double* __restrict row = d + i * g;
+      std::fill(row + i + 1, row + g, 0.0);
+      for (int k = 0; k < m; k++) {
+        const double* __restrict x = c + k * g;
+        const double xi = x[i];
+        for (int j = i + 1; j < g; j++) {
+          const double e = x[j] - xi;
+          row[j] += e * e;
+        }
+      }
+    }
+
+    auto Dg = [&](int r, int col) -> double& { return d[r * g + col]; };
+    int* const nn = &n_nghbr[0];
+    double* const md = &mindist[0];
+    int* const rep = &local[a];
+    for (int i = 0; i < g; i++) {
+      rep[i] = i;
+      members[i] = 1;
+      active[i] = 1;
+    }
+    for (int i = 0; i < g - 1; i++) {
+      md[i] = std::numeric_limits<double>::infinity();
+      nn[i] = i + 1;
+      for (int j = i + 1; j < g; j++) {
+        if (Dg(i, j) < md[i]) {
+          md[i] = Dg(i, j);
+          nn[i] = j;
+        }
+      }
+    }
+
+    auto argmin = [&]() {
+      int best = -1;
+      for (int i = 0; i < g - 1; i++) {
+        if (active[i] && (best < 0 || md[i] < md[best])) best = i;
+      }
+      return best;
+    };
+
+    for (int step = 0; step < g - 1; step++) {
+      int idx1 = argmin();
+      while (md[idx1] < Dg(idx1, nn[idx1])) {
+        // the lower bound is stale, recompute the row minimum
+        int j = idx1 + 1;
+        while (!active[j]) j++;
+        nn[idx1] = j;
+        double min = Dg(idx1, j);
+        for (j++; j < g; j++) {
+          if (active[j] && Dg(idx1, j) < min) {
+            min = Dg(idx1, j);
+            nn[idx1] = j;
+          }
+        }
+        md[idx1] = min;
+        idx1 = argmin();
+      }
+      if (md[idx1] >= dist) break;
+
+      const int idx2 = nn[idx1];
+      const double size1 = members[idx1], size2 = members[idx2];
+      members[idx2] += members[idx1];
+      active[idx1] = 0;
+      for (int i = 0; i < g; i++) {
+        if (rep[i] == idx1) rep[i] = idx2;
+      }
+
+      const double s = size1 / (size1 + size2);
+      const double t = size2 / (size1 + size2);
+      const double stc = s * t * md[idx1];
+      int j = 0;
+      for (; j < idx1; j++) {
+        if (!active[j]) continue;
+        f_centroid(&Dg(j, idx2), Dg(j, idx1), stc, s, t);
+        if (Dg(j, idx2) < md[j]) {
+          md[j] = Dg(j, idx2);
+          nn[j] = idx2;
+        } else if (nn[j] == idx1) {
+          nn[j] = idx2;
+        }
+      }
+      for (j = idx1 + 1; j < idx2; j++) {
+        if (!active[j]) continue;
+        f_centroid(&Dg(j, idx2), Dg(idx1, j), stc, s, t);
+        if (Dg(j, idx2) < md[j]) {
+          md[j] = Dg(j, idx2);
+          nn[j] = idx2;
+        }
+      }
+      if (idx2 < g - 1) {
+        j = idx2 + 1;
+        while (!active[j]) j++;
+        nn[idx2] = j;
+        f_centroid(&Dg(idx2, j), Dg(idx1, j), stc, s, t);
+        double min = Dg(idx2, j);
+        for (j++; j < g; j++) {
+          if (!active[j]) continue;
+          f_centroid(&Dg(idx2, j), Dg(idx1, j), stc, s, t);
+          if (Dg(idx2, j) < min) {
+            min = Dg(idx2, j);
+            nn[idx2] = j;
+          }
+        }
+        md[idx2] = min;
+      }
+    }
+  }
+
+  void save(int n, int m, const double* pts, const long long* ids, double dist) {
+    prev_n = n;
+    prev_m = m;
+    prev_dist = dist;
+    prev_ids_valid = ids != NULL;
+    if ((int)prev_group.size() < n) {
+      prev_ids.resize(n);
+      prev_group.resize(n);
+      prev_local.resize(n);
+      slot.resize(n);
+    }
+    if ((int)prev_pts.size() < n * m) prev_pts.resize(n * m);
+    std::copy_n(&group[0], n, &prev_group[0]);
+    std::copy_n(&local[0], n, &prev_local[0]);
+    for (int i = 0; i < n; i++) {
+      std::copy_n(&pts[order[i] * m], m, &prev_pts[i * m]);
+    }
+    if (!prev_ids_valid) return;
+
+    int size = 1;
+    while (size < 2 * n) size *= 2;
+    if ((int)table_pos.size() < size) {
+      table_ids.resize(size);
+      table_pos.resize(size);
+    }
+    table_mask = size - 1;
+    std::fill_n(&table_pos[0], size, -1);
+    for (int i = 0; i < n; i++) {
+      const long long id = ids[order[i]];
+      prev_ids[i] = id;
+      size_t h = hash(id) & table_mask;
+      while (table_pos[h] >= 0) h = (h + 1) & table_mask;
+      table_ids[h] = id;
+      table_pos[h] = i;
+    }
+  }
+};
+
 extern "C" {
 //
 // Assigns cluster labels (0, ..., nclust-1) to the n points such
@@ -203,16 +421,110 @@ extern "C" {
   }
 
   void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx) {
-    double* pdist = new double[n * (n - 1) / 2];
-    int* merge = new int[2 * (n - 1)];
-    double* height = new double[n - 1];
+    static thread_local cluster_state s;
+    cluster_points_centroid_seeded(&s, n, m, pts, NULL, dist, idx);
+  }
+
+  cluster_state* cluster_state_new(void) {
+    return new cluster_state;
+  }
+
+  void cluster_state_free(cluster_state* s) {
+    delete s;
+  }
+
+  int cluster_points_centroid_seeded(cluster_state* s, int n, int m, const double* pts, const long long* ids, double dist, int* idx) {
+    if (n <= 0) {
+      s->prev_n = 0;
+      return 0;
+    }
+    s->resize(n, m);
+    const bool seeded = ids != NULL && s->prev_ids_valid && s->prev_m == m && s->prev_n > 0;
+
+    // previous position of every point, -1 for new points
+    int* prev_pos = &s->prev_pos[0];
+    for (int i = 0; i < n; i++) {
+      prev_pos[i] = seeded ? s->lookup(ids[i]) : -1;
+    }
+
+    // seed the order with the previous frame's, new points go last
+    int* order = &s->order[0];
+    int k = 0;
+    if (seeded) {
+      int* slot = &s->slot[0];
+      std::fill_n(slot, s->prev_n, -1);
+      for (int i = 0; i < n; i++) {
+        if (prev_pos[i] >= 0 && slot[prev_pos[i]] < 0) {
+          slot[prev_pos[i]] = i;
+        } else {
+          prev_pos[i] = -1;
+        }
+      }
+      for (int j = 0; j < s->prev_n; j++) {
+        if (slot[j] >= 0) order[k++] = slot[j];
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      if (prev_pos[i] < 0) order[k++] = i;
+    }
+
+    // insertion sort along the first coordinate, close to linear for a seeded order
+    for (int i = 1; i < n; i++) {
+      const int p = order[i];
+      const double x = pts[p * m];
+      int j = i - 1;
+      for (; j >= 0 && pts[order[j] * m] > x; j--) {
+        order[j + 1] = order[j];
+      }
+      order[j + 1] = p;
+    }
+
+    int* cluster = &s->cluster[0];
+    int* group = &s->group[0];
+    for (int a = 0; a < n;) {
+      int b = a + 1;
+      while (b < n) {
+        const double gap = pts[order[b] * m] - pts[order[b - 1] * m];
+        if (gap * gap >= dist) break;
+        b++;
+      }
+      // index order within the group, so the distance updates round like hclust_fast's
+      std::sort(order + a, order + b);
+
+      const int g = b - a;
+      group[a] = g;
+      for (int i = a + 1; i < b; i++) group[i] = 0;
+      if (g == 1) {
+        s->local[a] = 0;
+      } else if (!(seeded && s->prev_dist == dist && s->unchanged(a, g, m, pts, ids))) {
+        s->cluster_group(a, g, m, pts, dist);
+      }
+      for (int i = a; i < b; i++) {
+        cluster[order[i]] = a + s->local[i];
+      }
+      a = b;
+    }
 
-    hclust_pdist(n, m, pts, pdist);
-    hclust_fast(n, pdist, HCLUST_METHOD_CENTROID, merge, height);
-    cutree_cdist(n, merge, height, dist, idx);
+    // number the clusters by their first point like cutree_k
+    int* label = &s->label[0];
+    std::fill_n(label, n, -1);
+    int nclust = 0;
+    for (int i = 0; i < n; i++) {
+      if (label[cluster[i]] < 0) label[cluster[i]] = nclust++;
+      idx[i] = label[cluster[i]];
+    }
 
-    delete[] pdist;
-    delete[] merge;
-    delete[] height;
+    s->save(n, m, pts, ids, dist);
+    return nclust;
+  }
+
+  void cluster_points_centroid_batch(cluster_state* s, int frames, const int* n, int m, const double* pts, const long long* ids,
+                                     double dist, int* idx, int* nclust) {
+    for (int f = 0; f < frames; f++) {
+      nclust[f] = cluster_points_centroid_seeded(s, n[f], m, pts, ids, dist, idx);
+      pts += n[f] * m;
+      idx += n[f];
+      if (ids != NULL) ids += n[f];
+    }
   }
 }
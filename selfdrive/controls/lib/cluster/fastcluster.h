@@ -73,5 +73,43 @@ enum hclust_fast_methods {
 void hclust_pdist(int n, int m, double* pts, double* out);
 void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx);
 
+//
+// Centroid clustering that keeps its buffers and the previous frame between
+// calls, for clustering the radar tracks every radard cycle.
+//
+// Gives the same clusters as cluster_points_centroid: the points are sorted
+// along the first coordinate and split wherever the gap between neighbours is
+// at least the cutoff distance, centroids never merge across such a gap.
+// Every group is clustered on its own with the centroid algorithm from
+// fastcluster_dm.cpp. With ids the sort is seeded with the previous frame's
+// order and a group whose ids and coordinates did not change reuses its
+// previous clusters.
+//
+typedef struct cluster_state cluster_state;
+cluster_state* cluster_state_new(void);
+void cluster_state_free(cluster_state* s);
+
+//
+// Input arguments:
+//   s     = state from cluster_state_new
+//   n     = number of observables
+//   m     = dimension of observable
+//   pts   = n x m points
+//   ids   = n unique ids identifying the points across frames, or NULL
+//   dist  = cutoff cluster distance (squared euclidian, as for cluster_points_centroid)
+// Output arguments:
+//   idx   = allocated integer array of size n for the labels, numbered like cutree_cdist
+// Return code:
+//   number of clusters
+//
+int cluster_points_centroid_seeded(cluster_state* s, int n, int m, const double* pts, const long long* ids, double dist, int* idx);
+
+//
+// Clusters consecutive frames, frame i has n[i] points. pts, ids and idx are
+// the concatenated per frame arrays, nclust receives the number of clusters of every frame.
+//
+void cluster_points_centroid_batch(cluster_state* s, int frames, const int* n, int m, const double* pts, const long long* ids,
+                                   double dist, int* idx, int* nclust);
+
 
 #endif
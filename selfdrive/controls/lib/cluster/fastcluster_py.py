@@ -13,6 +13,13 @@ int hclust_fast(int n, double* distmat, int method, int* merge, double* height);
 void cutree_cdist(int n, const int* merge, double* height, double cdist, int* labels);
 void hclust_pdist(int n, int m, double* pts, double* out);
 void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx);
+
+typedef struct cluster_state cluster_state;
+cluster_state* cluster_state_new(void);
+void cluster_state_free(cluster_state* s);
+int cluster_points_centroid_seeded(cluster_state* s, int n, int m, const double* pts, const long long* ids, double dist, int* idx);
+void cluster_points_centroid_batch(cluster_state* s, int frames, const int* n, int m, const double* pts, const long long* ids,
+                                   double dist, int* idx, int* nclust);
 """)
 
 hclust = ffi.dlopen(cluster_fn)
@@ -26,3 +33,33 @@ def cluster_points_centroid(pts, dist):
   labels_ptr = ffi.new("int[]", n)
   hclust.cluster_points_centroid(n, m, pts_ptr, dist**2, labels_ptr)
   return list(labels_ptr)
+
+
+class ClusterState():
+  """Keeps the buffers and the previous frame between calls, ids identify the points across frames"""
+  def __init__(self):
+    self.state = ffi.gc(hclust.cluster_state_new(), hclust.cluster_state_free)
+
+  def cluster_points_centroid(self, pts, ids, dist):
+    pts = np.ascontiguousarray(pts, dtype=np.float64)
+    ids = np.ascontiguousarray(ids, dtype=np.int64)
+    n, m = pts.shape
+
+    labels_ptr = ffi.new("int[]", n)
+    hclust.cluster_points_centroid_seeded(self.state, n, m, ffi.cast("double *", pts.ctypes.data),
+                                          ffi.cast("long long *", ids.ctypes.data), dist**2, labels_ptr)
+    return list(labels_ptr)
+
+  def cluster_points_centroid_batch(self, frames, dist):
+    """frames is a list of (pts, ids), returns the labels of every frame"""
+    n = [len(ids) for _, ids in frames]
+    pts = np.ascontiguousarray(np.concatenate([np.reshape(p, (k, -1)) for (p, _), k in zip(frames, n)]), dtype=np.float64)
+    ids = np.ascontiguousarray(np.concatenate([i for _, i in frames]), dtype=np.int64)
+
+    labels_ptr = ffi.new("int[]", len(ids))
+    nclust_ptr = ffi.new("int[]", len(frames))
+    hclust.cluster_points_centroid_batch(self.state, len(frames), n, pts.shape[1], ffi.cast("double *", pts.ctypes.data),
+                                         ffi.cast("long long *", ids.ctypes.data), dist**2, labels_ptr, nclust_ptr)
+    labels = list(labels_ptr)
+    offsets = np.cumsum([0] + n)
+    return [labels[offsets[i]:offsets[i + 1]] for i in range(len(frames))]
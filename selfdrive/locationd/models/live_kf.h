@@ -7,8 +7,9 @@
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Dense>
 
+#include "generated/live.h"
 #include "generated/live_kf_constants.h"
-#include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
 
 #define EARTH_GM 3.986005e14  // m^3/s^2 (gravitational constant * mass of earth)
 
@@ -19,6 +20,8 @@ Eigen::Map<MatrixXdr> get_mapmat(MatrixXdr& mat);
 std::vector<Eigen::Map<Eigen::VectorXd>> get_vec_mapvec(std::vector<Eigen::VectorXd>& vec_vec);
 std::vector<Eigen::Map<MatrixXdr>> get_vec_mapmat(std::vector<MatrixXdr>& mat_vec);
 
+typedef EKFSymFixed<LIVE_DIM, LIVE_EDIM, LIVE_MAX_ZDIM> LiveEKF;
+
 class LiveKalman {
 public:
   LiveKalman();
@@ -30,12 +33,10 @@ public:
   Eigen::VectorXd get_x();
   MatrixXdr get_P();
   double get_filter_time();
-  std::vector<MatrixXdr> get_R(int kind, int n);
 
-  std::optional<Estimate> predict_and_observe(double t, int kind, std::vector<Eigen::VectorXd> meas, std::vector<MatrixXdr> R = {});
-  std::optional<Estimate> predict_and_update_odo_speed(std::vector<Eigen::VectorXd> speed, double t, int kind);
-  std::optional<Estimate> predict_and_update_odo_trans(std::vector<Eigen::VectorXd> trans, double t, int kind);
-  std::optional<Estimate> predict_and_update_odo_rot(std::vector<Eigen::VectorXd> rot, double t, int kind);
+  // these don't allocate, the IMU observations come in at sensor rate
+  bool predict_and_observe(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &meas);
+  bool predict_and_observe(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &meas, const Eigen::Ref<const MatrixXdr> &R);
 
   Eigen::VectorXd get_initial_x();
   MatrixXdr get_initial_P();
@@ -45,7 +46,7 @@ public:
 private:
   std::string name = "live";
 
-  std::shared_ptr<EKFSym> filter;
+  std::unique_ptr<LiveEKF> filter;
 
   int dim_state;
   int dim_state_err;
@@ -0,0 +1,135 @@
+// benchmark for the live kalman filter, dynamic EKFSym against the fixed size EKFSymFixed LiveKalman uses
+// usage: ./ekf_benchmark [decompressed rlog]
+// replays the gyro and accel observations of the log's sensorEvents like Localizer::handle_sensors,
+// without a log a synthetic 100Hz IMU stream with jittered, sometimes out of order timestamps is used
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/models/live_kf.h"
+#include "selfdrive/sensord/sensors/constants.h"
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct ImuObservation {
+  double t;
+  int kind;
+  Eigen::Vector3d meas;
+};
+
+static std::vector<ImuObservation> read_log(const char *fn) {
+  std::vector<ImuObservation> obs;
+  std::string data = util::read_file(fn);
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+  kj::ArrayPtr<const capnp::word> remaining = words.asPtr();
+  while (remaining.size() > 0) {
+    capnp::FlatArrayMessageReader reader(remaining);
+    remaining = kj::arrayPtr(reader.getEnd(), remaining.end());
+    cereal::Event::Reader event = reader.getRoot<cereal::Event>();
+    if (!event.isSensorEvents()) continue;
+
+    for (auto sensor_reading : event.getSensorEvents()) {
+      if (sensor_reading.getTimestamp() == 0 || sensor_reading.getSource() == cereal::SensorEventData::SensorSource::BMX055) {
+        continue;
+      }
+      const double t = 1e-9 * sensor_reading.getTimestamp();
+      if (sensor_reading.getSensor() == SENSOR_GYRO_UNCALIBRATED && sensor_reading.getType() == SENSOR_TYPE_GYROSCOPE_UNCALIBRATED) {
+        auto v = sensor_reading.getGyroUncalibrated().getV();
+        obs.push_back({t, OBSERVATION_PHONE_GYRO, Eigen::Vector3d(-v[2], -v[1], -v[0])});
+      } else if (sensor_reading.getSensor() == SENSOR_ACCELEROMETER && sensor_reading.getType() == SENSOR_TYPE_ACCELEROMETER) {
+        auto v = sensor_reading.getAcceleration().getV();
+        obs.push_back({t, OBSERVATION_PHONE_ACCEL, Eigen::Vector3d(-v[2], -v[1], -v[0])});
+      }
+    }
+  }
+  return obs;
+}
+
+static std::vector<ImuObservation> synthetic_log(int seconds) {
+  std::vector<ImuObservation> obs;
+  std::mt19937 gen(0);
+  std::normal_distribution<double> noise(0.0, 0.05), jitter(0.0, 0.002);
+  for (int i = 0; i < seconds * 100; i++) {
+    const double t = 1000.0 + i * 0.01;
+    obs.push_back({t + jitter(gen), OBSERVATION_PHONE_GYRO, Eigen::Vector3d(noise(gen), noise(gen), 0.1 + noise(gen))});
+    obs.push_back({t + jitter(gen), OBSERVATION_PHONE_ACCEL, Eigen::Vector3d(9.81 + noise(gen), noise(gen), noise(gen))});
+  }
+  return obs;
+}
+
+static void report(const char *name, std::vector<double> &times, uint64_t allocs) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-10s n=%zu  mean %6.1fus  p50 %6.1fus  p99 %6.1fus  max %7.1fus  %.2f allocations per observation\n",
+         name, times.size(), 1e3 * sum / times.size(), 1e3 * pct(0.5), 1e3 * pct(0.99), 1e3 * times.back(),
+         (double)allocs / times.size());
+}
+
+int main(int argc, char **argv) {
+  std::vector<ImuObservation> obs = argc > 1 ? read_log(argv[1]) : synthetic_log(60);
+  printf("%zu imu observations\n", obs.size());
+
+  // the same setup LiveKalman used with the dynamic filter
+  Eigen::VectorXd initial_x = live_initial_x;
+  MatrixXdr initial_P = live_initial_P_diag.asDiagonal();
+  MatrixXdr Q = live_Q_diag.asDiagonal();
+  std::unordered_map<int, MatrixXdr> obs_noise;
+  for (auto &[kind, noise] : live_obs_noise_diag) {
+    obs_noise[kind] = noise.asDiagonal();
+  }
+  EKFSym dynamic("live", get_mapmat(Q), get_mapvec(initial_x), get_mapmat(initial_P), LIVE_DIM, LIVE_EDIM,
+                 0, 0, 0, std::vector<int>(), std::vector<int>{3}, std::vector<std::string>(), 0.2);
+  LiveKalman fixed;
+
+  std::vector<double> dynamic_times, fixed_times;
+  uint64_t dynamic_allocs = 0, fixed_allocs = 0;
+  double max_diff = 0;
+  for (auto &o : obs) {
+    Eigen::VectorXd meas = o.meas;
+    MatrixXdr R = obs_noise.at(o.kind);
+    std::vector<Eigen::Map<Eigen::VectorXd>> z = {get_mapvec(meas)};
+    std::vector<Eigen::Map<MatrixXdr>> Rs = {get_mapmat(R)};
+
+    uint64_t a = allocations;
+    double t1 = millis_since_boot();
+    dynamic.predict_and_update_batch(o.t, o.kind, z, Rs);
+    double t2 = millis_since_boot();
+    dynamic_allocs += allocations - a;
+
+    a = allocations;
+    double t3 = millis_since_boot();
+    fixed.predict_and_observe(o.t, o.kind, o.meas);
+    double t4 = millis_since_boot();
+    fixed_allocs += allocations - a;
+
+    dynamic_times.push_back(t2 - t1);
+    fixed_times.push_back(t4 - t3);
+    max_diff = std::max(max_diff, (dynamic.state() - fixed.get_x()).cwiseAbs().maxCoeff());
+  }
+
+  report("dynamic", dynamic_times, dynamic_allocs);
+  report("fixed", fixed_times, fixed_allocs);
+  printf("max state difference %g\n", max_diff);
+  return max_diff < 1e-6 ? 0 : 1;
+}
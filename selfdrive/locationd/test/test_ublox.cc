@@ -0,0 +1,216 @@
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/locationd/test/ublox_kaitai.h"
+#include "selfdrive/locationd/ublox_msg.h"
+
+struct Output {
+  std::string service;
+  std::string event;
+};
+
+static std::string event_str(const std::string &service, capnp::MessageReader &reader) {
+  auto event = reader.getRoot<cereal::Event>();
+  auto str = service == "gpsLocationExternal" ? event.getGpsLocationExternal().toString() : event.getUbloxGnss().toString();
+  return str.flatten().cStr();
+}
+
+// feeds the stream in random chunks like ubloxd gets it from ubloxRaw
+template <typename Parser, typename Gen>
+static std::vector<Output> parse(Parser &parser, const std::string &stream, Gen gen) {
+  std::mt19937 rng(1);
+  std::vector<Output> out;
+  size_t pos = 0;
+  while (pos < stream.size()) {
+    size_t len = std::min<size_t>(stream.size() - pos, std::uniform_int_distribution<size_t>(1, 300)(rng));
+    const uint8_t *data = (const uint8_t *)stream.data() + pos;
+    size_t bytes_consumed = 0;
+    while (bytes_consumed < len) {
+      size_t bytes_consumed_this_time = 0;
+      if (parser.add_data(data + bytes_consumed, len - bytes_consumed, bytes_consumed_this_time)) {
+        gen(out);
+        parser.reset();
+      }
+      bytes_consumed += bytes_consumed_this_time;
+    }
+    pos += len;
+  }
+  return out;
+}
+
+static void compare(const std::string &stream) {
+  auto parser = std::make_unique<UbloxMsgParser>();
+  MessageArena arena(UBLOX_ARENA_WORDS);
+  auto out = parse(*parser, stream, [&](std::vector<Output> &msgs) {
+    MessageBuilder msg(arena);
+    if (const char *service = parser->gen_msg(msg)) {
+      auto bytes = msg.toBytes();
+      kj::Array<capnp::word> words = kj::heapArray<capnp::word>(bytes.size() / sizeof(capnp::word));
+      memcpy(words.begin(), bytes.begin(), bytes.size());
+      capnp::FlatArrayMessageReader reader(words);
+      msgs.push_back({service, event_str(service, reader)});
+    }
+  });
+
+  auto ref_parser = std::make_unique<KaitaiUbloxMsgParser>();
+  auto ref_out = parse(*ref_parser, stream, [&](std::vector<Output> &msgs) {
+    try {
+      auto msg = ref_parser->gen_msg();
+      if (msg.second.size() > 0) {
+        capnp::FlatArrayMessageReader reader(msg.second);
+        msgs.push_back({msg.first, event_str(msg.first, reader)});
+      }
+    } catch (const std::exception &e) {
+    }
+  });
+
+  REQUIRE(out.size() == ref_out.size());
+  for (size_t i = 0; i < out.size(); i++) {
+    REQUIRE(out[i].service == ref_out[i].service);
+    REQUIRE(out[i].event == ref_out[i].event);
+  }
+}
+
+class UbxGenerator {
+public:
+  std::string msg(uint16_t msg_type, const std::string &payload, bool corrupt = false) {
+    std::string m = "\xb5\x62"s;
+    m.push_back(msg_type >> 8);
+    m.push_back(msg_type & 0xff);
+    m.push_back(payload.size() & 0xff);
+    m.push_back(payload.size() >> 8);
+    m = ublox::ubx_add_checksum(m + payload);
+    if (corrupt) m[m.size() - 1 - rng() % 2] ^= 1 + rng() % 255;
+    return m;
+  }
+
+  std::string bytes(size_t n) {
+    std::string s(n, 0);
+    for (auto &c : s) c = rng();
+    return s;
+  }
+
+  // 10 words of 24 bits plus parity, with the preamble and subframe id set
+  std::string gps_subframe(uint8_t sv_id, int subframe_id, bool valid_preamble) {
+    std::string data = bytes(ublox::GPS_SUBFRAME_SIZE);
+    data[0] = valid_preamble ? ublox::GPS_TLM_PREAMBLE : 0x8a;
+    data[5] = (data[5] & ~0x1c) | (subframe_id << 2);
+    if (subframe_id == 4 && rng() % 2) {
+      data[6] = (1 << 6) | 56;  // ionosphere page
+    }
+    std::string payload = {0 /* GPS */, (char)sv_id, 0, 0, 10, 0, 2, 0};
+    for (int i = 0; i < 10; i++) {
+      uint32_t word = ((uint8_t)data[i * 3] << 16 | (uint8_t)data[i * 3 + 1] << 8 | (uint8_t)data[i * 3 + 2]) << 6 | (rng() & 0x3f);
+      payload += std::string((char *)&word, sizeof(word));
+    }
+    return payload;
+  }
+
+  // a receiver's output, every type ubloxd decodes with random contents and a few others
+  std::string stream(int n, bool garbage) {
+    std::string s;
+    int subframe_id[4] = {1, 1, 1, 1};
+    for (int i = 0; i < n; i++) {
+      bool corrupt = garbage && rng() % 20 == 0;
+      switch (rng() % 7) {
+        case 0:
+          s += msg(0x0107, bytes(sizeof(ublox::nav_pvt_t)), corrupt);
+          break;
+        case 1: {
+          std::string payload = bytes(sizeof(ublox::rxm_rawx_t));
+          payload[11] = rng() % 40;
+          s += msg(0x0215, payload + bytes(payload[11] * sizeof(ublox::rxm_rawx_meas_t)), corrupt);
+          break;
+        }
+        case 2:
+        case 3: {
+          int sv = rng() % 4;
+          s += msg(0x0213, gps_subframe(sv + 1, subframe_id[sv], rng() % 50 != 0), corrupt);
+          subframe_id[sv] = rng() % 10 == 0 ? 1 : subframe_id[sv] % 5 + 1;
+          break;
+        }
+        case 4:
+          s += msg(0x0a09, bytes(sizeof(ublox::mon_hw_t)), corrupt);
+          break;
+        case 5: {
+          std::string payload = bytes(sizeof(ublox::mon_hw2_t));
+          const uint8_t sources[] = {ublox::CONFIG_SOURCE_FLASH, ublox::CONFIG_SOURCE_OTP, ublox::CONFIG_SOURCE_CONFIG_PINS, ublox::CONFIG_SOURCE_ROM, 0};
+          payload[4] = sources[rng() % 5];
+          s += msg(0x0a0b, payload, corrupt);
+          break;
+        }
+        default:
+          // other messages of the receiver, and GLONASS subframes
+          s += rng() % 2 ? msg(0x0135, bytes(rng() % 200), corrupt) : msg(0x0213, "\x06\x01\x00\x00\x00\x00\x02\x00"s, corrupt);
+          break;
+      }
+      if (garbage && rng() % 10 == 0) {
+        s += rng() % 2 ? bytes(rng() % 20) : "\xb5\x62"s + bytes(rng() % 10);
+      }
+    }
+    return s;
+  }
+
+  std::mt19937 rng{0};
+};
+
+TEST_CASE("UbloxMsgParser decodes like the kaitai parser") {
+  UbxGenerator gen;
+  std::string stream = gen.stream(2000, false);
+  compare(stream);
+
+  // every message made it through, and the ephemerides were completed
+  auto parser = std::make_unique<UbloxMsgParser>();
+  MessageArena arena(UBLOX_ARENA_WORDS);
+  int ephemerides = 0;
+  parse(*parser, stream, [&](std::vector<Output> &msgs) {
+    MessageBuilder msg(arena);
+    if (parser->gen_msg(msg)) {
+      auto event = msg.getRoot<cereal::Event>();
+      ephemerides += event.isUbloxGnss() && event.getUbloxGnss().isEphemeris();
+    }
+  });
+  REQUIRE(ephemerides > 10);
+}
+
+TEST_CASE("UbloxMsgParser resyncs like the kaitai parser") {
+  UbxGenerator gen;
+  for (int i = 0; i < 20; i++) {
+    compare(gen.stream(500, true));
+  }
+}
+
+TEST_CASE("UbloxMsgParser survives random bytes") {
+  UbxGenerator gen;
+  for (int i = 0; i < 20; i++) {
+    compare(gen.bytes(1 << 16));
+  }
+}
+
+TEST_CASE("UbloxMsgParser drops truncated messages") {
+  UbxGenerator gen;
+  auto parser = std::make_unique<UbloxMsgParser>();
+  MessageArena arena(UBLOX_ARENA_WORDS);
+  // a byte short, and a measurement report of 3 measurements with 2 of them
+  std::string rawx = gen.bytes(sizeof(ublox::rxm_rawx_t) + 2 * sizeof(ublox::rxm_rawx_meas_t));
+  rawx[11] = 3;
+  std::vector<std::string> msgs = {
+    gen.msg(0x0107, gen.bytes(sizeof(ublox::nav_pvt_t) - 1)),
+    gen.msg(0x0215, rawx),
+    gen.msg(0x0a09, gen.bytes(sizeof(ublox::mon_hw_t) - 1)),
+    gen.msg(0x0a0b, gen.bytes(sizeof(ublox::mon_hw2_t) - 1)),
+  };
+  for (auto &m : msgs) {
+    int parsed = 0;
+    parse(*parser, m, [&](std::vector<Output> &) {
+      MessageBuilder msg(arena);
+      REQUIRE(parser->gen_msg(msg) == nullptr);
+      parsed++;
+    });
+    REQUIRE(parsed == 1);
+  }
+}
@@ -0,0 +1,168 @@
+// benchmark for ubloxd's UBX parser, UbloxMsgParser against the kaitai struct parser it replaced
+// usage: ./ublox_benchmark [decompressed rlog]
+// replays the log's ubloxRaw messages like ubloxd: parse, build the event and serialize it. without a log
+// a synthetic 10Hz receiver output with a 30 satellite measurement report every epoch is used
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/test/ublox_kaitai.h"
+#include "selfdrive/locationd/ublox_msg.h"
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static std::vector<std::string> read_log(const char *fn) {
+  std::vector<std::string> raw;
+  std::string data = util::read_file(fn);
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+  kj::ArrayPtr<const capnp::word> remaining = words.asPtr();
+  while (remaining.size() > 0) {
+    capnp::FlatArrayMessageReader reader(remaining);
+    remaining = kj::arrayPtr(reader.getEnd(), remaining.end());
+    cereal::Event::Reader event = reader.getRoot<cereal::Event>();
+    if (event.isUbloxRaw()) {
+      auto ubloxRaw = event.getUbloxRaw();
+      raw.emplace_back((const char *)ubloxRaw.begin(), ubloxRaw.size());
+    }
+  }
+  return raw;
+}
+
+static std::string ubx_msg(uint16_t msg_type, const std::string &payload) {
+  std::string m = {(char)ublox::PREAMBLE1, (char)ublox::PREAMBLE2, (char)(msg_type >> 8), (char)(msg_type & 0xff),
+                   (char)(payload.size() & 0xff), (char)(payload.size() >> 8)};
+  return ublox::ubx_add_checksum(m + payload);
+}
+
+static std::vector<std::string> synthetic_log(int seconds) {
+  std::mt19937 gen(0);
+  auto bytes = [&](size_t n) {
+    std::string s(n, 0);
+    for (auto &c : s) c = gen();
+    return s;
+  };
+
+  std::string stream;
+  for (int epoch = 0; epoch < seconds * 10; epoch++) {
+    stream += ubx_msg(0x0107, bytes(sizeof(ublox::nav_pvt_t)));
+    std::string rawx = bytes(sizeof(ublox::rxm_rawx_t));
+    rawx[11] = 30;
+    stream += ubx_msg(0x0215, rawx + bytes(30 * sizeof(ublox::rxm_rawx_meas_t)));
+    if (epoch % 10 == 0) {
+      stream += ubx_msg(0x0a09, bytes(sizeof(ublox::mon_hw_t)));
+      stream += ubx_msg(0x0a0b, bytes(sizeof(ublox::mon_hw2_t)));
+    }
+    // a subframe every 6s for each of 8 GPS satellites
+    if (epoch % 60 == 0) {
+      for (int sv = 1; sv <= 8; sv++) {
+        std::string sfrbx = {0, (char)sv, 0, 0, 10, 0, 2, 0};
+        for (int i = 0; i < 10; i++) {
+          uint32_t word = (i == 0 ? 0x8b0000 : gen() & 0xffffff) << 6;
+          if (i == 1) word = (word & ~(0x7 << 8)) | ((epoch / 60 % 5 + 1) << 8);
+          sfrbx += std::string((char *)&word, sizeof(word));
+        }
+        stream += ubx_msg(0x0213, sfrbx);
+      }
+    }
+  }
+
+  // boardd publishes what it read from the receiver, up to 256 bytes at a time
+  std::vector<std::string> raw;
+  for (size_t pos = 0; pos < stream.size(); pos += 256) {
+    raw.push_back(stream.substr(pos, 256));
+  }
+  return raw;
+}
+
+static void report(const char *name, std::vector<double> &times, uint64_t allocs, int msgs) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-8s mean %6.2fus  p50 %6.2fus  p99 %6.2fus  max %7.2fus  %d events  %.2f allocations per event\n",
+         name, 1e3 * sum / times.size(), 1e3 * pct(0.5), 1e3 * pct(0.99), 1e3 * times.back(), msgs, (double)allocs / std::max(msgs, 1));
+}
+
+template <typename Parser, typename Gen>
+static int parse(Parser &parser, const std::string &raw, Gen gen) {
+  int msgs = 0;
+  const uint8_t *data = (const uint8_t *)raw.data();
+  size_t bytes_consumed = 0;
+  while (bytes_consumed < raw.size()) {
+    size_t bytes_consumed_this_time = 0;
+    if (parser.add_data(data + bytes_consumed, raw.size() - bytes_consumed, bytes_consumed_this_time)) {
+      msgs += gen();
+      parser.reset();
+    }
+    bytes_consumed += bytes_consumed_this_time;
+  }
+  return msgs;
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> raw = argc > 1 ? read_log(argv[1]) : synthetic_log(600);
+  printf("%zu ubloxRaw messages\n", raw.size());
+
+  auto parser = std::make_unique<UbloxMsgParser>();
+  auto kaitai_parser = std::make_unique<KaitaiUbloxMsgParser>();
+  MessageArena arena(UBLOX_ARENA_WORDS);
+
+  std::vector<double> times, kaitai_times;
+  uint64_t allocs = 0, kaitai_allocs = 0;
+  int msgs = 0, kaitai_msgs = 0;
+  size_t sent_bytes = 0;
+  for (auto &r : raw) {
+    uint64_t a = allocations;
+    double t1 = millis_since_boot();
+    msgs += parse(*parser, r, [&]() {
+      MessageBuilder msg(arena);
+      if (!parser->gen_msg(msg)) return 0;
+      sent_bytes += msg.toBytes().size();
+      return 1;
+    });
+    double t2 = millis_since_boot();
+    allocs += allocations - a;
+
+    a = allocations;
+    double t3 = millis_since_boot();
+    kaitai_msgs += parse(*kaitai_parser, r, [&]() {
+      try {
+        auto msg = kaitai_parser->gen_msg();
+        sent_bytes += msg.second.asBytes().size();
+        return msg.second.size() > 0 ? 1 : 0;
+      } catch (const std::exception &e) {
+        return 0;
+      }
+    });
+    double t4 = millis_since_boot();
+    kaitai_allocs += allocations - a;
+
+    times.push_back(t2 - t1);
+    kaitai_times.push_back(t4 - t3);
+  }
+
+  printf("time per ubloxRaw message (%zu bytes sent)\n", sent_bytes);
+  report("kaitai", kaitai_times, kaitai_allocs, kaitai_msgs);
+  report("ubx", times, allocs, msgs);
+  return msgs == kaitai_msgs ? 0 : 1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// the kaitai struct parser ubloxd used before UbloxMsgParser, the reference of its test and benchmark.
+// unchanged but for the needed bytes of messages longer than 65527 bytes, which overflowed
+
+#include <string>
+#include <unordered_map>
+
+#include "selfdrive/locationd/generated/gps.h"
+#include "selfdrive/locationd/generated/ubx.h"
+#include "selfdrive/locationd/ublox_msg.h"
+
+class KaitaiUbloxMsgParser {
+  public:
+    bool add_data(const uint8_t *incoming_data, uint32_t incoming_data_len, size_t &bytes_consumed);
+    inline void reset() {bytes_in_parse_buf = 0;}
+    inline int needed_bytes();
+    inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
+
+    std::pair<std::string, kj::Array<capnp::word>> gen_msg();
+    kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
+    kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
+    kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
+    kj::Array<capnp::word> gen_mon_hw(ubx_t::mon_hw_t *msg);
+    kj::Array<capnp::word> gen_mon_hw2(ubx_t::mon_hw2_t *msg);
+
+  private:
+    inline bool valid_cheksum();
+    inline bool valid();
+    inline bool valid_so_far();
+
+    std::unordered_map<int, std::unordered_map<int, std::string>> gps_subframes;
+
+    size_t bytes_in_parse_buf = 0;
+    uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE + ublox::UBLOX_CHECKSUM_SIZE];
+
+};
@@ -4,13 +4,10 @@
 #include <cstdint>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <ctime>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/util.h"
-#include "selfdrive/locationd/generated/gps.h"
-#include "selfdrive/locationd/generated/ubx.h"
 
 using namespace std::string_literals;
 
@@ -46,6 +43,133 @@ namespace ublox {
     uint32_t tAccNs;
   } __attribute__((packed));
 
+  // UBX payloads as they are on the wire (little-endian), read in place from the parse buffer
+
+  struct nav_pvt_t {
+    uint32_t i_tow;
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t min;
+    uint8_t sec;
+    uint8_t valid;
+    uint32_t t_acc;
+    int32_t nano;
+    uint8_t fix_type;
+    uint8_t flags;
+    uint8_t flags2;
+    uint8_t num_sv;
+    int32_t lon;
+    int32_t lat;
+    int32_t height;
+    int32_t h_msl;
+    uint32_t h_acc;
+    uint32_t v_acc;
+    int32_t vel_n;
+    int32_t vel_e;
+    int32_t vel_d;
+    int32_t g_speed;
+    int32_t head_mot;
+    int32_t s_acc;
+    uint32_t head_acc;
+    uint16_t p_dop;
+    uint8_t flags3;
+    uint8_t reserved1[5];
+    int32_t head_veh;
+    int16_t mag_dec;
+    uint16_t mag_acc;
+  } __attribute__((packed));
+
+  // followed by num_meas rxm_rawx_meas_t
+  struct rxm_rawx_t {
+    double rcv_tow;
+    uint16_t week;
+    int8_t leap_s;
+    uint8_t num_meas;
+    uint8_t rec_stat;
+    uint8_t reserved1[3];
+  } __attribute__((packed));
+
+  struct rxm_rawx_meas_t {
+    double pr_mes;
+    double cp_mes;
+    float do_mes;
+    uint8_t gnss_id;
+    uint8_t sv_id;
+    uint8_t reserved2;
+    uint8_t freq_id;
+    uint16_t lock_time;
+    uint8_t cno;
+    uint8_t pr_stdev;
+    uint8_t cp_stdev;
+    uint8_t do_stdev;
+    uint8_t trk_stat;
+    uint8_t reserved3;
+  } __attribute__((packed));
+
+  // followed by num_words uint32_t
+  struct rxm_sfrbx_t {
+    uint8_t gnss_id;
+    uint8_t sv_id;
+    uint8_t reserved1;
+    uint8_t freq_id;
+    uint8_t num_words;
+    uint8_t reserved2;
+    uint8_t version;
+    uint8_t reserved3;
+  } __attribute__((packed));
+
+  struct mon_hw_t {
+    uint32_t pin_sel;
+    uint32_t pin_bank;
+    uint32_t pin_dir;
+    uint32_t pin_val;
+    uint16_t noise_per_ms;
+    uint16_t agc_cnt;
+    uint8_t a_status;
+    uint8_t a_power;
+    uint8_t flags;
+    uint8_t reserved1;
+    uint32_t used_mask;
+    uint8_t vp[17];
+    uint8_t jam_ind;
+    uint8_t reserved2[2];
+    uint32_t pin_irq;
+    uint32_t pull_h;
+    uint32_t pull_l;
+  } __attribute__((packed));
+
+  struct mon_hw2_t {
+    int8_t ofs_i;
+    uint8_t mag_i;
+    int8_t ofs_q;
+    uint8_t mag_q;
+    uint8_t cfg_source;
+    uint8_t reserved1[3];
+    uint32_t low_lev_cfg;
+    uint8_t reserved2[8];
+    uint32_t post_status;
+    uint8_t reserved3[4];
+  } __attribute__((packed));
+
+  const uint8_t GNSS_TYPE_GPS = 0;
+
+  const uint8_t CONFIG_SOURCE_FLASH = 102;
+  const uint8_t CONFIG_SOURCE_OTP = 111;
+  const uint8_t CONFIG_SOURCE_CONFIG_PINS = 112;
+  const uint8_t CONFIG_SOURCE_ROM = 113;
+
+  // GPS navigation message subframes are 10 words of 24 bits, without the parity
+  const int GPS_SUBFRAME_SIZE = 30;
+  const uint8_t GPS_TLM_PREAMBLE = 0x8b;
+
+  // the last subframes 1-5 of a satellite, the ephemeris is sent once all of them are in
+  struct gps_subframes_t {
+    uint8_t received;  // bitmask of the stored subframe ids
+    uint8_t data[5][GPS_SUBFRAME_SIZE];
+  };
+
   inline std::string ubx_add_checksum(const std::string &msg) {
     assert(msg.size() > 2);
 
@@ -88,29 +212,39 @@ namespace ublox {
   }
 }
 
+// Streaming UBX parser. add_data is fed the raw bytes in chunks of any size, the checksum is updated as they come in.
+// Once it returns true gen_msg decodes the message in place and builds its event, then reset() starts the next one.
+// Nothing is allocated per message, build into a MessageBuilder on a MessageArena of UBLOX_ARENA_WORDS.
 class UbloxMsgParser {
   public:
     bool add_data(const uint8_t *incoming_data, uint32_t incoming_data_len, size_t &bytes_consumed);
-    inline void reset() {bytes_in_parse_buf = 0;}
+    inline void reset() {bytes_in_parse_buf = 0; ck_a = ck_b = 0;}
     inline int needed_bytes();
     inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
 
-    std::pair<std::string, kj::Array<capnp::word>> gen_msg();
-    kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
-    kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
-    kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
-    kj::Array<capnp::word> gen_mon_hw(ubx_t::mon_hw_t *msg);
-    kj::Array<capnp::word> gen_mon_hw2(ubx_t::mon_hw2_t *msg);
+    // builds the event of the parsed message, returns the service to send it on or nullptr if there is nothing to send
+    const char *gen_msg(MessageBuilder &msg);
+    bool gen_nav_pvt(MessageBuilder &msg, const uint8_t *payload);
+    bool gen_rxm_sfrbx(MessageBuilder &msg, const uint8_t *payload);
+    bool gen_rxm_rawx(MessageBuilder &msg, const uint8_t *payload);
+    bool gen_mon_hw(MessageBuilder &msg, const uint8_t *payload);
+    bool gen_mon_hw2(MessageBuilder &msg, const uint8_t *payload);
 
   private:
+    inline void update_checksum(size_t from);
     inline bool valid_cheksum();
     inline bool valid();
     inline bool valid_so_far();
 
-    std::unordered_map<int, std::unordered_map<int, std::string>> gps_subframes;
+    // by GPS sv id
+    ublox::gps_subframes_t gps_subframes[256] = {};
 
+    uint8_t ck_a = 0, ck_b = 0;
     size_t bytes_in_parse_buf = 0;
-    uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE];
+    uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE + ublox::UBLOX_CHECKSUM_SIZE];
 
 };
 
+// fits a measurement report of all tracked satellites
+const size_t UBLOX_ARENA_WORDS = 2048;
+
@@ -0,0 +1,217 @@
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+
+#include "selfdrive/loggerd/av_encoder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+#include "libyuv.h"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+AvEncoder::AvEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale, bool write)
+  : filename(filename), width(width), height(height), fps(fps), bitrate(bitrate), write(write), remuxing(!h265), downscale(downscale) {
+  // ffmpeg's own hevc encoders are hardware ones or missing and it has no h264 one, so without a
+  // working x265/x264 it's lossless FFVHUFF like before, which every ffmpeg build has
+  codec = avcodec_find_encoder_by_name(h265 ? "libx265" : "libx264");
+  AVCodecContext *test_ctx = codec ? open_codec(false) : nullptr;
+  if (!test_ctx) {
+    LOGW("encoder %s: can't open %s, falling back to ffvhuff", filename, h265 ? "libx265" : "libx264");
+    codec = avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
+    lossless = true;
+    remuxing = true;
+  }
+  avcodec_free_context(&test_ctx);
+  assert(codec);
+  LOGD("encoder %s using %s", filename, codec->name);
+
+  frame = av_frame_alloc();
+  assert(frame);
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = width;
+  frame->height = height;
+  frame->linesize[0] = width;
+  frame->linesize[1] = width/2;
+  frame->linesize[2] = width/2;
+
+  pkt = av_packet_alloc();
+  assert(pkt);
+
+  if (downscale) {
+    scaled.resize(width * height * 3 / 2);
+  }
+}
+
+AvEncoder::~AvEncoder() {
+  encoder_close();
+  av_packet_free(&pkt);
+  av_frame_free(&frame);
+}
+
+// a context set up for the camera, nullptr if the codec doesn't open with it
+AVCodecContext *AvEncoder::open_codec(bool global_header) {
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  assert(ctx);
+  ctx->width = width;
+  ctx->height = height;
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  ctx->time_base = (AVRational){ 1, fps };
+  ctx->framerate = (AVRational){ fps, 1 };
+  ctx->bit_rate = bitrate;
+  ctx->rc_max_rate = bitrate;
+  ctx->rc_buffer_size = bitrate;
+  ctx->gop_size = fps;
+  ctx->max_b_frames = 0;  // frames come out in order, the segment id is the input index
+  // frame threading, x264 only slices when FF_THREAD_SLICE is the only type
+  ctx->thread_count = util::getenv("LOGGERD_ENCODER_THREADS", 0);
+  ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (global_header) {
+    ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  AVDictionary *opts = NULL;
+  if (!lossless) {
+    av_dict_set(&opts, "preset", util::getenv("LOGGERD_ENCODER_PRESET", "ultrafast").c_str(), 0);
+  }
+  int err = avcodec_open2(ctx, codec, &opts);
+  av_dict_free(&opts);
+  if (err < 0) {
+    avcodec_free_context(&ctx);
+  }
+  return ctx;
+}
+
+// takes everything the encoder has ready, false on an error
+bool AvEncoder::write_packets() {
+  while (true) {
+    int err = avcodec_receive_packet(codec_ctx, pkt);
+    if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) return true;
+    if (err < 0) return false;
+
+    if (of) {
+      // x265 repeats the parameter sets before every keyframe, so every file can be decoded on its own
+      fwrite(pkt->data, pkt->size, 1, of);
+    } else {
+      av_packet_rescale_ts(pkt, codec_ctx->time_base, out_stream->time_base);
+      pkt->stream_index = 0;
+      err = av_write_frame(ofmt_ctx, pkt);
+      if (err < 0) { LOGW("ts encoder write issue"); }
+    }
+    av_packet_unref(pkt);
+  }
+}
+
+void AvEncoder::encoder_open(const char* path) {
+  // ffvhuff only goes into matroska
+  vid_path = util::string_format(lossless ? "%s/%s.mkv" : "%s/%s", path, filename);
+  LOGD("encoder_open %s remuxing:%d", vid_path.c_str(), remuxing);
+
+  if (write) {
+    if (remuxing) {
+      avformat_alloc_output_context2(&ofmt_ctx, NULL, NULL, vid_path.c_str());
+      assert(ofmt_ctx);
+    }
+
+    // a new context per segment, so the segment starts with a keyframe and the frames still
+    // in the encoder at the rotation end up in the old one
+    codec_ctx = open_codec(remuxing && (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER));
+    assert(codec_ctx);
+
+    if (remuxing) {
+      out_stream = avformat_new_stream(ofmt_ctx, NULL);
+      assert(out_stream);
+      out_stream->time_base = codec_ctx->time_base;
+      int err = avcodec_parameters_from_context(out_stream->codecpar, codec_ctx);
+      assert(err >= 0);
+
+      err = avio_open(&ofmt_ctx->pb, vid_path.c_str(), AVIO_FLAG_WRITE);
+      assert(err >= 0);
+      err = avformat_write_header(ofmt_ctx, NULL);
+      assert(err >= 0);
+    } else {
+      of = fopen(vid_path.c_str(), "wb");
+      assert(of);
+    }
+  }
+
+  // create camera lock file
+  lock_path = util::string_format("%s/%s.lock", path, filename);
+  int lock_fd = HANDLE_EINTR(open(lock_path.c_str(), O_RDWR | O_CREAT, 0664));
+  assert(lock_fd >= 0);
+  close(lock_fd);
+
+  is_open = true;
+  counter = 0;
+}
+
+void AvEncoder::encoder_close() {
+  if (!is_open) return;
+
+  if (codec_ctx) {
+    // drain the frames still in the encoder
+    if (avcodec_send_frame(codec_ctx, NULL) < 0 || !write_packets()) {
+      LOGE("encoder flush error %s", vid_path.c_str());
+    }
+    avcodec_free_context(&codec_ctx);
+  }
+
+  if (ofmt_ctx) {
+    av_write_trailer(ofmt_ctx);
+    avio_closep(&ofmt_ctx->pb);
+    avformat_free_context(ofmt_ctx);
+    ofmt_ctx = nullptr;
+    out_stream = nullptr;
+  }
+  if (of) {
+    fclose(of);
+    of = nullptr;
+  }
+
+  unlink(lock_path.c_str());
+  is_open = false;
+}
+
+int AvEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                            int in_width, int in_height, uint64_t ts) {
+  if (!is_open) return -1;
+  // not recorded, only the index is logged
+  if (!write) return counter++;
+
+  if (downscale) {
+    uint8_t *y = scaled.data(), *u = y + width * height, *v = u + width * height / 4;
+    libyuv::I420Scale(y_ptr, in_width,
+                      u_ptr, in_width/2,
+                      v_ptr, in_width/2,
+                      in_width, in_height,
+                      y, width,
+                      u, width/2,
+                      v, width/2,
+                      width, height,
+                      libyuv::kFilterNone);
+    y_ptr = y;
+    u_ptr = u;
+    v_ptr = v;
+  }
+
+  frame->data[0] = (uint8_t *)y_ptr;
+  frame->data[1] = (uint8_t *)u_ptr;
+  frame->data[2] = (uint8_t *)v_ptr;
+  frame->pts = counter;
+
+  int err = avcodec_send_frame(codec_ctx, frame);
+  if (err < 0 || !write_packets()) {
+    LOGE("encoding error %s", vid_path.c_str());
+    return -1;
+  }
+  return counter++;
+}
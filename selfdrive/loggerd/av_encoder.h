@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "selfdrive/loggerd/encoder.h"
+
+// AvEncoder, lossy software encoder using libavcodec for the PCs without OMX.
+// hevc is written as a raw stream like the OMX encoder does, h264 is muxed into the container of the filename.
+// when libx265/libx264 can't be opened it records lossless FFVHUFF into <filename>.mkv instead.
+// LOGGERD_ENCODER_THREADS (default 0, as many as libavcodec likes) and LOGGERD_ENCODER_PRESET (default ultrafast)
+class AvEncoder : public VideoEncoder {
+public:
+  AvEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale, bool write = true);
+  ~AvEncoder();
+  int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                   int in_width, int in_height, uint64_t ts);
+  void encoder_open(const char* path);
+  void encoder_close();
+
+private:
+  AVCodecContext *open_codec(bool global_header);
+  bool write_packets();
+
+  const char* filename;
+  int width, height, fps, bitrate;
+  bool write;
+  bool remuxing;
+  bool lossless = false;
+  bool is_open = false;
+  int counter = 0;
+  std::string vid_path, lock_path;
+
+  const AVCodec *codec = nullptr;
+  AVCodecContext *codec_ctx = nullptr;
+  AVFrame *frame = nullptr;
+  AVPacket *pkt = nullptr;
+
+  FILE *of = nullptr;
+  AVFormatContext *ofmt_ctx = nullptr;
+  AVStream *out_stream = nullptr;
+
+  bool downscale;
+  std::vector<uint8_t> scaled;
+};
@@ -5,13 +5,16 @@
 
 #include <cassert>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <streambuf>
 #ifdef QCOM
 #include <cutils/properties.h>
@@ -19,6 +22,7 @@
 
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/threadpool.h"
 #include "selfdrive/common/version.h"
 
 // ***** logging helpers *****
@@ -125,11 +129,6 @@ std::string logger_get_route_name() {
   return route_name;
 }
 
-void log_init_data(LoggerState *s) {
-  auto bytes = s->init_data.asBytes();
-  logger_log(s, bytes.begin(), bytes.size(), s->has_qlog);
-}
-
 
 static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
   MessageBuilder msg;
@@ -141,32 +140,73 @@ static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
   lh_log(h, bytes.begin(), bytes.size(), true);
 }
 
+// ***** background io *****
+
+// opening the next segment ahead of the rotation and closing the files of finished ones, the
+// bzip2 flush of the last block takes a while. one thread, so the tasks run in order
+static ThreadPool &io_pool() {
+  static ThreadPool pool(2);
+  return pool;
+}
+
+static std::mutex io_lock;
+static std::condition_variable io_cv;
+static int io_pending = 0;
+
+static void io_run(std::function<void()> task) {
+  {
+    std::lock_guard lk(io_lock);
+    io_pending++;
+  }
+  io_pool().run([task = std::move(task)] {
+    task();
+    std::lock_guard lk(io_lock);
+    if (--io_pending == 0) io_cv.notify_all();
+  });
+}
+
+static void io_wait() {
+  std::unique_lock lk(io_lock);
+  io_cv.wait(lk, [] { return io_pending == 0; });
+}
+
 // ***** logging functions *****
 
 void logger_init(LoggerState *s, const char* log_name, bool has_qlog) {
   pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->prepare_cond, NULL);
 
   s->part = -1;
   s->has_qlog = has_qlog;
   s->route_name = logger_get_route_name();
   snprintf(s->log_name, sizeof(s->log_name), "%s", log_name);
   s->init_data = logger_build_init_data();
+  for (auto &h : s->handles) {
+    pthread_mutex_init(&h.lock, NULL);
+  }
+  s->next_handle = NULL;
+  s->preparing = false;
 }
 
-static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
+// opens the files of a segment and writes the init data, not locked by s->lock but for taking a handle
+static LoggerHandle* logger_open(LoggerState *s, const char* root_path, int part, SentinelType start_type) {
   int err;
 
   LoggerHandle *h = NULL;
-  for (int i=0; i<LOGGER_MAX_HANDLES; i++) {
+  pthread_mutex_lock(&s->lock);
+  for (int i=0; i<LOGGER_MAX_HANDLES && !h; i++) {
+    pthread_mutex_lock(&s->handles[i].lock);
     if (s->handles[i].refcnt == 0) {
       h = &s->handles[i];
-      break;
+      h->refcnt++;
     }
+    pthread_mutex_unlock(&s->handles[i].lock);
   }
+  pthread_mutex_unlock(&s->lock);
   assert(h);
 
   snprintf(h->segment_path, sizeof(h->segment_path),
-          "%s/%s--%d", root_path, s->route_name.c_str(), s->part);
+          "%s/%s--%d", root_path, s->route_name.c_str(), part);
 
   snprintf(h->log_path, sizeof(h->log_path), "%s/%s.bz2", h->segment_path, s->log_name);
   snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.bz2", h->segment_path);
@@ -175,10 +215,13 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   h->exit_signal = 0;
 
   err = logger_mkpath(h->log_path);
-  if (err) return NULL;
-
-  FILE* lock_file = fopen(h->lock_path, "wb");
-  if (lock_file == NULL) return NULL;
+  FILE* lock_file = err ? NULL : fopen(h->lock_path, "wb");
+  if (lock_file == NULL) {
+    pthread_mutex_lock(&h->lock);
+    h->refcnt--;
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+  }
   fclose(lock_file);
 
   h->log = std::make_unique<BZFile>(h->log_path);
@@ -186,42 +229,82 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
     h->q_log = std::make_unique<BZFile>(h->qlog_path);
   }
 
-  pthread_mutex_init(&h->lock, NULL);
-  h->refcnt++;
+  // write beggining of log metadata
+  auto bytes = s->init_data.asBytes();
+  lh_log(h, bytes.begin(), bytes.size(), s->has_qlog);
+  lh_log_sentinel(h, start_type);
   return h;
 }
 
+// removes a segment opened ahead that isn't going to be used
+static void lh_discard(LoggerHandle* h) {
+  pthread_mutex_lock(&h->lock);
+  h->log.reset(nullptr);
+  h->q_log.reset(nullptr);
+  unlink(h->log_path);
+  unlink(h->qlog_path);
+  unlink(h->lock_path);
+  rmdir(h->segment_path);
+  h->refcnt = 0;
+  pthread_mutex_unlock(&h->lock);
+}
+
+static void logger_prepare(LoggerState *s, const std::string &root_path, int part) {
+  LoggerHandle* h = logger_open(s, root_path.c_str(), part, SentinelType::START_OF_SEGMENT);
+  if (!h) {
+    LOGE("failed to open segment %d ahead", part);
+  }
+
+  pthread_mutex_lock(&s->lock);
+  s->next_handle = h;
+  s->preparing = false;
+  pthread_cond_broadcast(&s->prepare_cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
 int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part) {
   bool is_start_of_route = !s->cur_handle;
 
+  // take the segment opened ahead, waiting for it if the rotation came early
   pthread_mutex_lock(&s->lock);
+  while (s->preparing) {
+    pthread_cond_wait(&s->prepare_cond, &s->lock);
+  }
   s->part++;
+  const int part = s->part;
+  LoggerHandle* next_h = s->next_handle;
+  s->next_handle = NULL;
+  pthread_mutex_unlock(&s->lock);
 
-  LoggerHandle* next_h = logger_open(s, root_path);
+  if (next_h && util::string_format("%s/%s--%d", root_path, s->route_name.c_str(), part) != next_h->segment_path) {
+    lh_discard(next_h);
+    next_h = NULL;
+  }
   if (!next_h) {
-    pthread_mutex_unlock(&s->lock);
-    return -1;
+    next_h = logger_open(s, root_path, part, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
+    if (!next_h) return -1;
   }
 
-  if (s->cur_handle) {
-    lh_close(s->cur_handle);
-  }
+  pthread_mutex_lock(&s->lock);
+  LoggerHandle* prev_h = s->cur_handle;
   s->cur_handle = next_h;
+  s->preparing = true;
+  pthread_mutex_unlock(&s->lock);
+
+  io_run([s, root = std::string(root_path), part] { logger_prepare(s, root, part + 1); });
+
+  if (prev_h) {
+    lh_close(prev_h);
+  }
 
   if (out_segment_path) {
     snprintf(out_segment_path, out_segment_path_len, "%s", next_h->segment_path);
   }
   if (out_part) {
-    *out_part = s->part;
+    *out_part = part;
   }
-
-  pthread_mutex_unlock(&s->lock);
-
-  // write beggining of log metadata
-  log_init_data(s);
-  lh_log_sentinel(s->cur_handle, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
   return 0;
 }
 
@@ -247,12 +330,22 @@ void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog) {
 
 void logger_close(LoggerState *s, ExitHandler *exit_handler) {
   pthread_mutex_lock(&s->lock);
+  while (s->preparing) {
+    pthread_cond_wait(&s->prepare_cond, &s->lock);
+  }
+  if (s->next_handle) {
+    lh_discard(s->next_handle);
+    s->next_handle = NULL;
+  }
   if (s->cur_handle) {
     s->cur_handle->exit_signal = exit_handler && exit_handler->signal.load();
     s->cur_handle->end_sentinel_type = SentinelType::END_OF_ROUTE;
     lh_close(s->cur_handle);
   }
   pthread_mutex_unlock(&s->lock);
+
+  // the files are complete once this returns
+  io_wait();
 }
 
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog) {
@@ -276,12 +369,13 @@ void lh_close(LoggerHandle* h) {
   }
   h->refcnt--;
   if (h->refcnt == 0) {
-    h->log.reset(nullptr);
-    h->q_log.reset(nullptr);
-    unlink(h->lock_path);
-    pthread_mutex_unlock(&h->lock);
-    pthread_mutex_destroy(&h->lock);
-    return;
+    // flushed and closed in the background, the handle can be reused right away
+    std::shared_ptr<BZFile> log = std::move(h->log), q_log = std::move(h->q_log);
+    io_run([log = std::move(log), q_log = std::move(q_log), lock_path = std::string(h->lock_path)]() mutable {
+      log.reset();
+      q_log.reset();
+      unlink(lock_path.c_str());
+    });
   }
   pthread_mutex_unlock(&h->lock);
 }
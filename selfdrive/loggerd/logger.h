@@ -81,6 +81,11 @@ typedef struct LoggerState {
 
   LoggerHandle handles[LOGGER_MAX_HANDLES];
   LoggerHandle* cur_handle;
+
+  // the segment after cur_handle, opened in the background so logger_next only swaps it in
+  LoggerHandle* next_handle;
+  bool preparing;
+  pthread_cond_t prepare_cond;
 } LoggerState;
 
 int logger_mkpath(char* file_path);
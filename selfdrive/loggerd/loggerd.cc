@@ -3,6 +3,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cerrno>
@@ -11,11 +12,13 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "cereal/services.h"
@@ -23,6 +26,7 @@
 #include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/camerad/cameras/camera_common.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/queue.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
@@ -34,8 +38,8 @@
 #include "selfdrive/loggerd/omx_encoder.h"
 #define Encoder OmxEncoder
 #else
-#include "selfdrive/loggerd/raw_logger.h"
-#define Encoder RawLogger
+#include "selfdrive/loggerd/av_encoder.h"
+#define Encoder AvEncoder
 #endif
 
 namespace {
@@ -105,6 +109,8 @@ const LogCameraInfo qcam_info = {
   .frame_height = Hardware::TICI() ? 330 : 360 // keep pixel count the same?
 };
 
+struct EncoderWorker;
+
 struct LoggerdState {
   Context *ctx;
   LoggerState logger = {};
@@ -122,17 +128,119 @@ struct LoggerdState {
   std::atomic<int> encoders_ready;
   std::atomic<uint32_t> start_frame_id;
   std::atomic<uint32_t> latest_frame_id;
+
+  // for loggerdState
+  std::mutex workers_lock;
+  std::vector<EncoderWorker *> workers;
+  std::atomic<uint32_t> rotations = 0;
+  std::atomic<uint64_t> rotate_time_max_us = 0, rotate_stall_max_us = 0;
 };
 LoggerdState s;
 
+// a segment the encoders write to, closes its logger handle once the last frame in it is encoded
+struct EncoderSegment {
+  EncoderSegment(int num, const char *path, LoggerHandle *lh) : num(num), path(path), lh(lh) {}
+  ~EncoderSegment() {
+    if (lh) lh_close(lh);
+  }
+
+  const int num;
+  const std::string path;
+  LoggerHandle *const lh;
+};
+
+// a received frame, shared by the encoders of its camera. the last one done with it deletes it
+struct EncoderFrame {
+  VisionBuf *buf;
+  VisionIpcBufExtra extra;
+  double recv_tms;
+  int encode_idx;
+  std::shared_ptr<EncoderSegment> segment;
+  std::atomic<int> refs;
+
+  void release() {
+    if (--refs == 0) delete this;
+  }
+};
+
+// an encoder running on its own thread, so a slow one doesn't hold up the others or the next frame.
+// frames that don't fit in its queue are dropped
+struct EncoderWorker {
+  EncoderWorker(const LogCameraInfo &cam_info, const char *filename, Encoder *encoder, bool log_encode_idx)
+    : cam_info(cam_info), filename(filename), encoder(encoder), log_encode_idx(log_encode_idx) {}
+
+  const LogCameraInfo &cam_info;
+  const char *filename;
+  Encoder *encoder;
+  const bool log_encode_idx;
+  BlockingSPSCQueue<EncoderFrame *, 8> queue;  // nullptr stops the thread
+  std::thread thread;
+
+  // since the last loggerdState
+  std::atomic<uint32_t> frames_encoded = 0, frames_dropped = 0, max_queue_depth = 0;
+  std::atomic<uint64_t> latency_sum_us = 0, latency_max_us = 0;
+};
+
+void encoder_worker(EncoderWorker *w) {
+  set_thread_name(w->filename);
+
+  int cur_seg = -1;
+  while (true) {
+    EncoderFrame *frame = w->queue.pop();
+    if (!frame) break;
+
+    // rotate the encoder once its frames are in the new segment
+    if (frame->segment->num > cur_seg) {
+      cur_seg = frame->segment->num;
+      w->encoder->encoder_close();
+      w->encoder->encoder_open(frame->segment->path.c_str());
+    }
+
+    VisionBuf *buf = frame->buf;
+    int out_id = w->encoder->encode_frame(buf->y, buf->u, buf->v, buf->width, buf->height, frame->extra.timestamp_eof);
+    if (out_id == -1) {
+      LOGE("Failed to encode frame. frame_id: %d encode_id: %d", frame->extra.frame_id, frame->encode_idx);
+    }
+
+    // publish encode index
+    if (w->log_encode_idx && out_id != -1 && frame->segment->lh) {
+      const LogCameraInfo &cam_info = w->cam_info;
+      MessageBuilder msg;
+      // this is really ugly
+      auto eidx = cam_info.type == DriverCam ? msg.initEvent().initDriverEncodeIdx() :
+                 (cam_info.type == WideRoadCam ? msg.initEvent().initWideRoadEncodeIdx() : msg.initEvent().initRoadEncodeIdx());
+      eidx.setFrameId(frame->extra.frame_id);
+      eidx.setTimestampSof(frame->extra.timestamp_sof);
+      eidx.setTimestampEof(frame->extra.timestamp_eof);
+      if (Hardware::TICI()) {
+        eidx.setType(cereal::EncodeIndex::Type::FULL_H_E_V_C);
+      } else {
+        eidx.setType(cam_info.type == DriverCam ? cereal::EncodeIndex::Type::FRONT : cereal::EncodeIndex::Type::FULL_H_E_V_C);
+      }
+      eidx.setEncodeId(frame->encode_idx);
+      eidx.setSegmentNum(cur_seg);
+      eidx.setSegmentId(out_id);
+      auto bytes = msg.toBytes();
+      lh_log(frame->segment->lh, bytes.begin(), bytes.size(), true);
+    }
+
+    const uint64_t latency_us = (millis_since_boot() - frame->recv_tms) * 1000;
+    w->latency_sum_us += latency_us;
+    update_max_atomic(w->latency_max_us, latency_us);
+    w->frames_encoded++;
+    frame->release();
+  }
+}
+
 void encoder_thread(const LogCameraInfo &cam_info) {
   set_thread_name(cam_info.filename);
 
   int cnt = 0, cur_seg = -1;
   int encode_idx = 0;
-  LoggerHandle *lh = NULL;
-  std::vector<Encoder *> encoders;
+  std::shared_ptr<EncoderSegment> segment;
+  std::vector<EncoderWorker *> workers;
   VisionIpcClient vipc_client = VisionIpcClient("camerad", cam_info.stream_type, false);
+  vipc_client.device_sync = false;
 
   bool ready = false;
 
@@ -143,19 +251,26 @@ void encoder_thread(const LogCameraInfo &cam_info) {
     }
 
     // init encoders
-    if (encoders.empty()) {
+    if (workers.empty()) {
       VisionBuf buf_info = vipc_client.buffers[0];
       LOGD("encoder init %dx%d", buf_info.width, buf_info.height);
 
       // main encoder
-      encoders.push_back(new Encoder(cam_info.filename, buf_info.width, buf_info.height,
-                                     cam_info.fps, cam_info.bitrate, cam_info.is_h265,
-                                     cam_info.downscale, cam_info.record));
+      workers.push_back(new EncoderWorker(cam_info, cam_info.filename,
+                                          new Encoder(cam_info.filename, buf_info.width, buf_info.height,
+                                                      cam_info.fps, cam_info.bitrate, cam_info.is_h265,
+                                                      cam_info.downscale, cam_info.record), true));
       // qcamera encoder
       if (cam_info.has_qcamera) {
-        encoders.push_back(new Encoder(qcam_info.filename, qcam_info.frame_width, qcam_info.frame_height,
-                                       qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale));
+        workers.push_back(new EncoderWorker(cam_info, qcam_info.filename,
+                                            new Encoder(qcam_info.filename, qcam_info.frame_width, qcam_info.frame_height,
+                                                        qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale), false));
       }
+      for (auto w : workers) {
+        w->thread = std::thread(encoder_worker, w);
+      }
+      std::lock_guard lk(s.workers_lock);
+      s.workers.insert(s.workers.end(), workers.begin(), workers.end());
     }
 
     while (!do_exit) {
@@ -188,76 +303,78 @@ void encoder_thread(const LogCameraInfo &cam_info) {
 
       if (cam_info.trigger_rotate && (cnt >= SEGMENT_LENGTH * MAIN_FPS)) {
         // trigger rotate and wait logger rotated to new segment
+        const double t1 = millis_since_boot();
         ++s.waiting_rotate;
         std::unique_lock lk(s.rotate_lock);
         s.rotate_cv.wait(lk, [&] { return s.rotate_segment > cur_seg || do_exit; });
+        update_max_atomic(s.rotate_stall_max_us, (uint64_t)((millis_since_boot() - t1) * 1000));
       }
       if (do_exit) break;
 
-      // rotate the encoder if the logger is on a newer segment
+      // the following frames go to the newer segment, the workers rotate when they get to them
       if (s.rotate_segment > cur_seg) {
         cur_seg = s.rotate_segment;
         cnt = 0;
 
         LOGW("camera %d rotate encoder to %s", cam_info.type, s.segment_path);
-        for (auto &e : encoders) {
-          e->encoder_close();
-          e->encoder_open(s.segment_path);
-        }
-        if (lh) {
-          lh_close(lh);
-        }
-        lh = logger_get_handle(&s.logger);
+        segment = std::make_shared<EncoderSegment>(cur_seg, s.segment_path, logger_get_handle(&s.logger));
       }
 
-      // encode a frame
-      for (int i = 0; i < encoders.size(); ++i) {
-        int out_id = encoders[i]->encode_frame(buf->y, buf->u, buf->v,
-                                               buf->width, buf->height, extra.timestamp_eof);
-        
-        if (out_id == -1) {
-          LOGE("Failed to encode frame. frame_id: %d encode_id: %d", extra.frame_id, encode_idx);
-        }
-
-        // publish encode index
-        if (i == 0 && out_id != -1) {
-          MessageBuilder msg;
-          // this is really ugly
-          auto eidx = cam_info.type == DriverCam ? msg.initEvent().initDriverEncodeIdx() :
-                     (cam_info.type == WideRoadCam ? msg.initEvent().initWideRoadEncodeIdx() : msg.initEvent().initRoadEncodeIdx());
-          eidx.setFrameId(extra.frame_id);
-          eidx.setTimestampSof(extra.timestamp_sof);
-          eidx.setTimestampEof(extra.timestamp_eof);
-          if (Hardware::TICI()) {
-            eidx.setType(cereal::EncodeIndex::Type::FULL_H_E_V_C);
-          } else {
-            eidx.setType(cam_info.type == DriverCam ? cereal::EncodeIndex::Type::FRONT : cereal::EncodeIndex::Type::FULL_H_E_V_C);
-          }
-          eidx.setEncodeId(encode_idx);
-          eidx.setSegmentNum(cur_seg);
-          eidx.setSegmentId(out_id);
-          if (lh) {
-            auto bytes = msg.toBytes();
-            lh_log(lh, bytes.begin(), bytes.size(), true);
-          }
+      // hand the frame to the encoders
+      EncoderFrame *frame = new EncoderFrame{buf, extra, millis_since_boot(), encode_idx, segment};
+      frame->refs = workers.size();
+      for (auto w : workers) {
+        if (w->queue.push(frame)) {
+          update_max_atomic(w->max_queue_depth, (uint32_t)w->queue.size());
+        } else {
+          w->frames_dropped++;
+          frame->release();
         }
       }
 
       cnt++;
       encode_idx++;
     }
+  }
 
-    if (lh) {
-      lh_close(lh);
-      lh = NULL;
+  LOG("encoder destroy");
+  {
+    std::lock_guard lk(s.workers_lock);
+    for (auto w : workers) {
+      s.workers.erase(std::find(s.workers.begin(), s.workers.end(), w));
     }
   }
+  for (auto w : workers) {
+    while (!w->queue.push(nullptr)) util::sleep_for(1);
+    w->thread.join();
+    w->encoder->encoder_close();
+    delete w->encoder;
+    delete w;
+  }
+}
 
-  LOG("encoder destroy");
-  for(auto &e : encoders) {
-    e->encoder_close();
-    delete e;
+void publish_loggerd_state(PubMaster &pm) {
+  MessageBuilder msg;
+  std::lock_guard lk(s.workers_lock);
+  auto state = msg.initEvent().initLoggerdState();
+  state.setRotations(s.rotations.exchange(0));
+  state.setRotateTimeMax(s.rotate_time_max_us.exchange(0) / 1000.0);
+  state.setRotateStallMax(s.rotate_stall_max_us.exchange(0) / 1000.0);
+  auto encoders = state.initEncoders(s.workers.size());
+  for (int i = 0; i < s.workers.size(); i++) {
+    EncoderWorker *w = s.workers[i];
+    const uint32_t encoded = w->frames_encoded.exchange(0);
+    const uint64_t latency_sum_us = w->latency_sum_us.exchange(0);
+    auto e = encoders[i];
+    e.setFilename(w->filename);
+    e.setQueueDepth(w->queue.size());
+    e.setMaxQueueDepth(w->max_queue_depth.exchange(0));
+    e.setFramesEncoded(encoded);
+    e.setFramesDropped(w->frames_dropped.exchange(0));
+    e.setLatencyMean(encoded > 0 ? latency_sum_us / 1000.0 / encoded : 0);
+    e.setLatencyMax(w->latency_max_us.exchange(0) / 1000.0);
   }
+  pm.send("loggerdState", msg);
 }
 
 int clear_locks_fn(const char* fpath, const struct stat *sb, int tyupeflag) {
@@ -275,12 +392,15 @@ void clear_locks() {
 void logger_rotate() {
   {
     std::unique_lock lk(s.rotate_lock);
+    const double t1 = millis_since_boot();
     int segment = -1;
     int err = logger_next(&s.logger, LOG_ROOT.c_str(), s.segment_path, sizeof(s.segment_path), &segment);
     assert(err == 0);
     s.rotate_segment = segment;
     s.waiting_rotate = 0;
     s.last_rotate_tms = millis_since_boot();
+    s.rotations++;
+    update_max_atomic(s.rotate_time_max_us, (uint64_t)((s.last_rotate_tms - t1) * 1000));
   }
   s.rotate_cv.notify_all();
   LOGW((s.logger.part == 0) ? "logging to %s" : "rotated to %s", s.segment_path);
@@ -350,8 +470,10 @@ int main(int argc, char** argv) {
     }
   }
 
+  PubMaster pm({"loggerdState"});
   uint64_t msg_count = 0, bytes_count = 0;
   double start_ts = millis_since_boot();
+  double last_state_ts = start_ts;
   while (!do_exit) {
     // Check if all encoders are ready and start encoding at the same time
     if ((s.max_waiting > 1) && !s.encoders_synced && (s.encoders_ready == s.max_waiting)) {
@@ -381,6 +503,11 @@ int main(int argc, char** argv) {
         }
       }
     }
+
+    if (double ts = millis_since_boot(); ts - last_state_ts >= 1000) {
+      publish_loggerd_state(pm);
+      last_state_ts = ts;
+    }
   }
 
   LOGW("closing encoders");
@@ -200,6 +200,7 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
   OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &in_port));
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &in_port));
   this->in_buf_headers.resize(in_port.nBufferCountActual);
+  assert(this->in_buf_headers.size() <= OMX_QUEUE_SIZE);
 
   // setup output port
 
@@ -222,6 +223,7 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
 
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &out_port));
   this->out_buf_headers.resize(out_port.nBufferCountActual);
+  assert(this->out_buf_headers.size() <= OMX_QUEUE_SIZE);
 
   OMX_VIDEO_PARAM_BITRATETYPE bitrate_type = {0};
   bitrate_type.nSize = sizeof(bitrate_type);
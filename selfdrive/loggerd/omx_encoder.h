@@ -60,8 +60,10 @@ private:
 
   uint64_t last_t;
 
-  SafeQueue<OMX_BUFFERHEADERTYPE *> free_in;
-  SafeQueue<OMX_BUFFERHEADERTYPE *> done_out;
+  // pushed from the OMX callbacks, at least as large as the buffer counts
+  static constexpr int OMX_QUEUE_SIZE = 64;
+  BlockingMPMCQueue<OMX_BUFFERHEADERTYPE *, OMX_QUEUE_SIZE> free_in;
+  BlockingMPMCQueue<OMX_BUFFERHEADERTYPE *, OMX_QUEUE_SIZE> done_out;
 
   AVFormatContext *ofmt_ctx;
   AVCodecContext *codec_ctx;
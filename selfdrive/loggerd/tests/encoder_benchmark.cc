@@ -0,0 +1,87 @@
+// benchmark for the throughput of AvEncoder
+// usage: ./encoder_benchmark [frames] [width] [height]
+// encodes a moving test pattern like the road camera into fcamera.hevc and qcamera.ts in /tmp, with
+// 1, 2, 4 and the default number of encoder threads. a camera keeps up when it does more than 20 fps,
+// the bitrate shows if the rate control holds the camera's bitrate
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/av_encoder.h"
+
+static void report(const char *name, std::vector<double> &times, const std::string &path) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  struct stat st = {};
+  stat(path.c_str(), &st);
+  printf("  %-12s mean %7.2fms  p50 %7.2fms  p99 %7.2fms  max %7.2fms  %7.1f fps  %6.2f Mbit/s\n",
+         name, sum / times.size(), pct(0.5), pct(0.99), times.back(), times.size() / sum * 1e3,
+         st.st_size * 8 / (times.size() / 20.0) / 1e6);
+}
+
+static void run(const char *name, const char *filename, int width, int height, int out_width, int out_height,
+                int bitrate, bool h265, bool downscale, const std::vector<uint8_t> (&planes)[3], int frames, const char *path) {
+  AvEncoder encoder(filename, out_width, out_height, 20, bitrate, h265, downscale);
+  encoder.encoder_open(path);
+
+  std::vector<double> times;
+  for (int i = 0; i < frames; i++) {
+    // move the pattern by a few lines each frame
+    const int shift = (i * 4) % height;
+    double t = millis_since_boot();
+    encoder.encode_frame(&planes[0][shift * width], &planes[1][shift / 2 * width / 2], &planes[2][shift / 2 * width / 2],
+                         width, height, i * 50000000ULL);
+    times.push_back(millis_since_boot() - t);
+  }
+  double t = millis_since_boot();
+  encoder.encoder_close();
+  // the frames still in the encoder count towards the last one
+  times.back() += millis_since_boot() - t;
+
+  report(name, times, util::string_format("%s/%s", path, filename));
+}
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 200;
+  const int width = argc > 2 ? atoi(argv[2]) : 1928;
+  const int height = argc > 3 ? atoi(argv[3]) : 1208;
+
+  // twice the height, so the shifted planes stay in the buffers
+  std::vector<uint8_t> planes[3] = {std::vector<uint8_t>(width * height * 2),
+                                    std::vector<uint8_t>(width * height / 2), std::vector<uint8_t>(width * height / 2)};
+  for (int r = 0; r < 2 * height; r++) {
+    for (int c = 0; c < width; c++) {
+      planes[0][r * width + c] = (r * c / 64 + (rand() & 7)) & 0xff;
+      if (c < width / 2 && r < height) {
+        planes[1][r * width / 2 + c] = 128 + (r + c) % 31;
+        planes[2][r * width / 2 + c] = 128 - (r * c) % 17;
+      }
+    }
+  }
+
+  char path[] = "/tmp/encoder_benchmark_XXXXXX";
+  if (!mkdtemp(path)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  for (const char *threads : {"1", "2", "4", "0"}) {
+    setenv("LOGGERD_ENCODER_THREADS", threads, 1);
+    printf("%s threads, %dx%d, %d frames\n", threads[0] == '0' ? "default" : threads, width, height, frames);
+    fflush(stdout);
+    run("fcamera", "fcamera.hevc", width, height, width, height, 10000000, true, false, planes, frames, path);
+    run("qcamera", "qcamera.ts", width, height, 526, 330, 256000, false, true, planes, frames, path);
+  }
+
+  system(util::string_format("rm -rf %s", path).c_str());
+  return 0;
+}
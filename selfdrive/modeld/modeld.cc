@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <mutex>
+#include <vector>
 
 #include <eigen3/Eigen/Dense>
 
@@ -16,10 +18,10 @@
 ExitHandler do_exit;
 // globals
 bool live_calib_seen;
-mat3 cur_transform;
+mat3 cur_transform[MAX_MODEL_CAMERAS];
 std::mutex transform_lock;
 
-void calibration_thread(bool wide_camera) {
+void calibration_thread(std::vector<bool> wide_cameras) {
   set_thread_name("calibration");
   set_realtime_priority(50);
 
@@ -37,7 +39,6 @@ void calibration_thread(bool wide_camera) {
     -1.09890110e-03, 0.00000000e+00, 2.81318681e-01,
     -1.84808520e-20, 9.00738606e-04,-4.28751576e-02;
 
-  Eigen::Matrix<float, 3, 3> cam_intrinsics = Eigen::Matrix<float, 3, 3, Eigen::RowMajor>(wide_camera ? ecam_intrinsic_matrix.v : fcam_intrinsic_matrix.v);
   const mat3 yuv_transform = get_model_yuv_transform();
 
   while (!do_exit) {
@@ -49,28 +50,73 @@ void calibration_thread(bool wide_camera) {
         extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
       }
 
-      auto camera_frame_from_road_frame = cam_intrinsics * extrinsic_matrix_eigen;
-      Eigen::Matrix<float, 3, 3> camera_frame_from_ground;
-      camera_frame_from_ground.col(0) = camera_frame_from_road_frame.col(0);
-      camera_frame_from_ground.col(1) = camera_frame_from_road_frame.col(1);
-      camera_frame_from_ground.col(2) = camera_frame_from_road_frame.col(3);
-
-      auto warp_matrix = camera_frame_from_ground * ground_from_medmodel_frame;
-      mat3 transform = {};
-      for (int i=0; i<3*3; i++) {
-        transform.v[i] = warp_matrix(i / 3, i % 3);
+      // the extrinsics are shared, only the intrinsics differ between cameras
+      mat3 model_transforms[MAX_MODEL_CAMERAS];
+      for (int c = 0; c < wide_cameras.size(); c++) {
+        Eigen::Matrix<float, 3, 3> cam_intrinsics = Eigen::Matrix<float, 3, 3, Eigen::RowMajor>(wide_cameras[c] ? ecam_intrinsic_matrix.v : fcam_intrinsic_matrix.v);
+        auto camera_frame_from_road_frame = cam_intrinsics * extrinsic_matrix_eigen;
+        Eigen::Matrix<float, 3, 3> camera_frame_from_ground;
+        camera_frame_from_ground.col(0) = camera_frame_from_road_frame.col(0);
+        camera_frame_from_ground.col(1) = camera_frame_from_road_frame.col(1);
+        camera_frame_from_ground.col(2) = camera_frame_from_road_frame.col(3);
+
+        auto warp_matrix = camera_frame_from_ground * ground_from_medmodel_frame;
+        mat3 transform = {};
+        for (int i=0; i<3*3; i++) {
+          transform.v[i] = warp_matrix(i / 3, i % 3);
+        }
+        model_transforms[c] = matmul3(yuv_transform, transform);
       }
-      mat3 model_transform = matmul3(yuv_transform, transform);
       std::lock_guard lk(transform_lock);
-      cur_transform = model_transform;
+      std::copy_n(model_transforms, wide_cameras.size(), cur_transform);
       live_calib_seen = true;
     }
   }
 }
 
-void run_model(ModelState &model, VisionIpcClient &vipc_client) {
+// camerad triggers the road cameras together, so matching frames share a frame_id.
+// the first client drives the loop, the others are drained until they catch up with it.
+class FrameSync {
+public:
+  FrameSync(std::vector<VisionIpcClient *> clients) : clients(clients), bufs(clients.size()), extras(clients.size()) {}
+
+  bool recv() {
+    bufs[0] = clients[0]->recv(&extras[0]);
+    if (bufs[0] == nullptr) return false;
+
+    const uint32_t frame_id = extras[0].frame_id;
+    for (int i = 1; i < clients.size(); i++) {
+      while (bufs[i] == nullptr || extras[i].frame_id < frame_id) {
+        bufs[i] = clients[i]->recv(&extras[i]);
+        if (bufs[i] == nullptr) return false;
+      }
+      if (extras[i].frame_id != frame_id) {
+        // this stream is ahead, keep its frame for the next primary frame
+        LOGD("dropping frame %u, camera %d is at %u", frame_id, i, extras[i].frame_id);
+        return false;
+      }
+      const double eof_diff_ms = std::abs((int64_t)(extras[i].timestamp_eof - extras[0].timestamp_eof)) / 1e6;
+      if (eof_diff_ms > 10.0) {
+        LOGW_100("camera %d frame %u is %.2fms apart from the primary camera", i, frame_id, eof_diff_ms);
+      }
+    }
+    return true;
+  }
+
+  std::vector<VisionIpcClient *> clients;
+  std::vector<VisionBuf *> bufs;
+  std::vector<VisionIpcBufExtra> extras;
+};
+
+void run_model(ModelState &model, FrameSync &sync) {
+  const int num_cameras = sync.clients.size();
+
   // messaging
-  PubMaster pm({"modelV2", "cameraOdometry"});
+  std::vector<const char *> services = {"modelV2", "cameraOdometry"};
+  if (num_cameras > 1) {
+    services.insert(services.end(), {"wideRoadModelV2", "wideRoadCameraOdometry"});
+  }
+  PubMaster pm(services);
   SubMaster sm({"lateralPlan", "roadCameraState"});
 
   // setup filter to track dropped frames
@@ -81,12 +127,11 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   uint32_t run_count = 0;
 
   while (!do_exit) {
-    VisionIpcBufExtra extra = {};
-    VisionBuf *buf = vipc_client.recv(&extra);
-    if (buf == nullptr) continue;
+    if (!sync.recv()) continue;
 
+    mat3 model_transforms[MAX_MODEL_CAMERAS];
     transform_lock.lock();
-    mat3 model_transform = cur_transform;
+    std::copy_n(cur_transform, num_cameras, model_transforms);
     const bool run_model_this_iter = live_calib_seen;
     transform_lock.unlock();
 
@@ -103,13 +148,20 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
         vec_desire[desire] = 1.0;
       }
 
+      cl_mem yuv_cl[MAX_MODEL_CAMERAS];
+      for (int i = 0; i < num_cameras; i++) {
+        yuv_cl[i] = sync.bufs[i]->buf_cl;
+      }
+      const VisionBuf *buf = sync.bufs[0];
+
       double mt1 = millis_since_boot();
-      ModelDataRaw model_buf = model_eval_frame(&model, buf->buf_cl, buf->width, buf->height,
-                                                model_transform, vec_desire);
+      model_eval_frames(&model, yuv_cl, buf->width, buf->height, model_transforms, vec_desire);
       double mt2 = millis_since_boot();
+      // batched cameras share one run, every camera reports the time of the whole step
       float model_execution_time = (mt2 - mt1) / 1000.0;
 
       // tracked dropped frames
+      const VisionIpcBufExtra &extra = sync.extras[0];
       uint32_t vipc_dropped_frames = extra.frame_id - last_vipc_frame_id - 1;
       float frames_dropped = frame_dropped_filter.update((float)std::min(vipc_dropped_frames, 10U));
       if (run_count < 10) { // let frame drops warm up
@@ -119,9 +171,13 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
 
       float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
 
-      model_publish(pm, extra.frame_id, frame_id, frame_drop_ratio, model_buf, extra.timestamp_eof, model_execution_time,
-                    kj::ArrayPtr<const float>(model.output.data(), model.output.size()));
-      posenet_publish(pm, extra.frame_id, vipc_dropped_frames, model_buf, extra.timestamp_eof);
+      for (int i = 0; i < num_cameras; i++) {
+        const bool extra_camera = i > 0;
+        ModelDataRaw model_buf = model_get_outputs(&model, i);
+        model_publish(pm, extra_camera, sync.extras[i].frame_id, frame_id, frame_drop_ratio, model_buf, sync.extras[i].timestamp_eof, model_execution_time,
+                      kj::ArrayPtr<const float>(&model.output[i * NET_OUTPUT_SIZE], NET_OUTPUT_SIZE));
+        posenet_publish(pm, extra_camera, sync.extras[i].frame_id, vipc_dropped_frames, model_buf, sync.extras[i].timestamp_eof);
+      }
 
       //printf("model process: %.2fms, from last %.2fms, vipc_frame_id %u, frame_id, %u, frame_drop %.3f\n", mt2 - mt1, mt1 - last, extra.frame_id, frame_id, frame_drop_ratio);
       last = mt1;
@@ -137,10 +193,15 @@ int main(int argc, char **argv) {
   set_core_affinity({Hardware::EON() ? 2 : 7});
   assert(ret == 0);
 
-  bool wide_camera = Hardware::TICI() ? Params().getBool("EnableWideCamera") : false;
+  Params params;
+  bool wide_camera = Hardware::TICI() ? params.getBool("EnableWideCamera") : false;
+  // the multi-camera model always drives from the road camera and adds the wide camera as a second stream.
+  // tici runs a thneed model per camera, PC builds batch them through onnx
+  bool multi_camera = (Hardware::TICI() || MODEL_BATCHES_CAMERAS) && params.getBool("EnableMultiCameraModel");
+  std::vector<bool> wide_cameras = multi_camera ? std::vector<bool>{false, true} : std::vector<bool>{wide_camera};
 
   // start calibration thread
-  std::thread thread = std::thread(calibration_thread, wide_camera);
+  std::thread thread = std::thread(calibration_thread, wide_cameras);
 
   // cl init
   cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
@@ -148,20 +209,34 @@ int main(int argc, char **argv) {
 
   // init the models
   ModelState model;
-  model_init(&model, device_id, context);
+  model_init(&model, device_id, context, wide_cameras.size());
   LOGW("models loaded, modeld starting");
 
-  VisionIpcClient vipc_client = VisionIpcClient("camerad", wide_camera ? VISION_STREAM_YUV_WIDE : VISION_STREAM_YUV_BACK, true, device_id, context);
-  while (!do_exit && !vipc_client.connect(false)) {
-    util::sleep_for(100);
+  std::vector<std::unique_ptr<VisionIpcClient>> vipc_clients;
+  for (bool wide : wide_cameras) {
+    vipc_clients.push_back(std::make_unique<VisionIpcClient>("camerad", wide ? VISION_STREAM_YUV_WIDE : VISION_STREAM_YUV_BACK, true, device_id, context));
+  }
+  auto all_connected = [&]() {
+    return std::all_of(vipc_clients.begin(), vipc_clients.end(), [](auto &c) { return c->connected; });
+  };
+  while (!do_exit && !all_connected()) {
+    for (auto &c : vipc_clients) {
+      if (!c->connected) c->connect(false);
+    }
+    if (!all_connected()) util::sleep_for(100);
   }
 
   // run the models
-  // vipc_client.connected is false only when do_exit is true
-  if (vipc_client.connected) {
-    const VisionBuf *b = &vipc_client.buffers[0];
-    LOGW("connected with buffer size: %d (%d x %d)", b->len, b->width, b->height);
-    run_model(model, vipc_client);
+  // the vipc clients are only left disconnected when do_exit is true
+  if (all_connected()) {
+    std::vector<VisionIpcClient *> clients;
+    for (auto &c : vipc_clients) {
+      const VisionBuf *b = &c->buffers[0];
+      LOGW("connected with buffer size: %d (%d x %d)", b->len, b->width, b->height);
+      clients.push_back(c.get());
+    }
+    FrameSync sync(clients);
+    run_model(model, sync);
   }
 
   model_free(&model);
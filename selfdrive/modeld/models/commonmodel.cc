@@ -9,8 +9,12 @@
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/timing.h"
 
-ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
-  input_frames = std::make_unique<float[]>(buf_size);
+ModelFrame::ModelFrame(cl_device_id device_id, cl_context context, float *input_frames) {
+  if (input_frames == nullptr) {
+    input_frames_buf = std::make_unique<float[]>(buf_size);
+    input_frames = input_frames_buf.get();
+  }
+  this->input_frames = input_frames;
 
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
   y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
@@ -23,6 +27,11 @@ ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
 }
 
 float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform, cl_mem *output) {
+  queue(yuv_cl, frame_width, frame_height, transform, output);
+  return finish(output);
+}
+
+void ModelFrame::queue(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform, cl_mem *output) {
   transform_queue(&this->transform, q,
                   yuv_cl, frame_width, frame_height,
                   y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, transform);
@@ -31,17 +40,18 @@ float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, con
     loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, net_input_cl);
 
     std::memmove(&input_frames[0], &input_frames[MODEL_FRAME_SIZE], sizeof(float) * MODEL_FRAME_SIZE);
-    CL_CHECK(clEnqueueReadBuffer(q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr));
-    clFinish(q);
-    return &input_frames[0];
+    CL_CHECK(clEnqueueReadBuffer(q, net_input_cl, CL_FALSE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr));
   } else {
     loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, *output, true);
-    // NOTE: Since thneed is using a different command queue, this clFinish is needed to ensure the image is ready.
-    clFinish(q);
-    return NULL;
   }
 }
 
+float* ModelFrame::finish(cl_mem *output) {
+  // NOTE: Since thneed is using a different command queue, this clFinish is needed to ensure the image is ready.
+  clFinish(q);
+  return output == NULL ? &input_frames[0] : NULL;
+}
+
 ModelFrame::~ModelFrame() {
   transform_destroy(&transform);
   loadyuv_destroy(&loadyuv);
@@ -28,16 +28,22 @@ float sigmoid(float input);
 
 class ModelFrame {
  public:
-  ModelFrame(cl_device_id device_id, cl_context context);
+  // input_frames can point into a larger buffer shared by several frames, e.g. a batched model input
+  ModelFrame(cl_device_id device_id, cl_context context, float *input_frames = nullptr);
   ~ModelFrame();
   float* prepare(cl_mem yuv_cl, int width, int height, const mat3& transform, cl_mem *output);
 
-  const int buf_size = MODEL_FRAME_SIZE * 2;
+  // split version of prepare, queue() doesn't wait for the GPU so several frames can be in flight at once
+  void queue(cl_mem yuv_cl, int width, int height, const mat3& transform, cl_mem *output);
+  float* finish(cl_mem *output);
+
+  static constexpr int buf_size = MODEL_FRAME_SIZE * 2;
 
  private:
   Transform transform;
   LoadYUVState loadyuv;
   cl_command_queue q;
   cl_mem y_cl, u_cl, v_cl, net_input_cl;
-  std::unique_ptr<float[]> input_frames;
+  std::unique_ptr<float[]> input_frames_buf;
+  float *input_frames;
 };
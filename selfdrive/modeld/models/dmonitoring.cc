@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <cstring>
 
-#include "libyuv.h"
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/params.h"
@@ -13,11 +18,11 @@
 #define MODEL_HEIGHT 640
 #define FULL_W 852 // should get these numbers from camerad
 
+constexpr int PLANE_WIDTH = MODEL_WIDTH / 2;
+constexpr int PLANE_SIZE = (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2);
+
 void dmonitoring_init(DMonitoringModelState* s) {
   s->is_rhd = Params().getBool("IsRHD");
-  for (int x = 0; x < std::size(s->tensor); ++x) {
-    s->tensor[x] = (x - 128.f) * 0.0078125f;
-  }
 
 #ifdef USE_ONNX_MODEL
   s->m = new ONNXModel("../../models/dmonitoring_model.onnx", &s->output[0], OUTPUT_SIZE, USE_DSP_RUNTIME);
@@ -32,29 +37,42 @@ static inline T *get_buffer(std::vector<T> &buf, const size_t size) {
   return buf.data();
 }
 
-static inline auto get_yuv_buf(std::vector<uint8_t> &buf, const int width, int height) {
-  uint8_t *y = get_buffer(buf, width * height * 3 / 2);
-  uint8_t *u = y + width * height;
-  uint8_t *v = u + (width /2) * (height / 2);
-  return std::make_tuple(y, u, v);
-}
+// same sampling positions as libyuv's bilinear I420Scale
+static void init_axis_map(DMonitoringAxisMap &m, int src_offset, int src_size, int dst_offset, int dst_size, bool mirror) {
+  int64_t step, pos;
+  if (dst_size <= src_size) {
+    step = ((int64_t)src_size << 16) / dst_size;
+    pos = (step >> 1) - 32768;  // center the filter
+  } else {
+    step = dst_size > 1 ? ((int64_t)(src_size - 1) << 16) / (dst_size - 1) : 0;
+    pos = 0;
+  }
 
-struct Rect {int x, y, w, h;};
-void crop_yuv(uint8_t *raw, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v, const Rect &rect) {
-  uint8_t *raw_y = raw;
-  uint8_t *raw_u = raw_y + (width * height);
-  uint8_t *raw_v = raw_u + ((width / 2) * (height / 2));
-  for (int r = 0; r < rect.h / 2; r++) {
-    memcpy(y + 2 * r * rect.w, raw_y + (2 * r + rect.y) * width + rect.x, rect.w);
-    memcpy(y + (2 * r + 1) * rect.w, raw_y + (2 * r + rect.y + 1) * width + rect.x, rect.w);
-    memcpy(u + r * (rect.w / 2), raw_u + (r + (rect.y / 2)) * width / 2 + (rect.x / 2), rect.w / 2);
-    memcpy(v + r * (rect.w / 2), raw_v + (r + (rect.y / 2)) * width / 2 + (rect.x / 2), rect.w / 2);
+  m.dst_offset = dst_offset;
+  m.dst_size = dst_size;
+  m.src0.resize(dst_size);
+  m.src1.resize(dst_size);
+  m.frac.resize(dst_size);
+  const int64_t max_pos = (int64_t)(src_size - 1) << 16;
+  for (int i = 0; i < dst_size; i++, pos += step) {
+    const int64_t p = std::clamp<int64_t>(pos, 0, max_pos);
+    int i0 = p >> 16;
+    int i1 = std::min(i0 + 1, src_size - 1);
+    // mirroring the crop before scaling is the same as sampling it right to left
+    if (mirror) {
+      i0 = src_size - 1 - i0;
+      i1 = src_size - 1 - i1;
+    }
+    m.src0[i] = src_offset + i0;
+    m.src1[i] = src_offset + i1;
+    m.frac[i] = (p >> 8) & 0xff;
   }
 }
 
-DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height) {
+struct Rect {int x, y, w, h;};
+static void init_preprocess_map(DMonitoringPreprocessMap &map, int width, int height, bool is_rhd, bool tici) {
   Rect crop_rect;
-  if (Hardware::TICI()) {
+  if (tici) {
     const int full_width_tici = 1928;
     const int full_height_tici = 1208;
     const int adapt_width_tici = 954;
@@ -65,90 +83,157 @@ DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_
                  full_height_tici / 2 - cropped_height / 2 + y_offset_tici,
                  cropped_height / 2,
                  cropped_height};
-    if (!s->is_rhd) {
+    if (!is_rhd) {
       crop_rect.x += adapt_width_tici - crop_rect.w;
     }
 
   } else {
     const int adapt_width = 372;
     crop_rect = {0, 0, adapt_width, height};
-    if (!s->is_rhd) {
+    if (!is_rhd) {
       crop_rect.x += width - crop_rect.w;
     }
   }
 
-  int resized_width = MODEL_WIDTH;
-  int resized_height = MODEL_HEIGHT;
-
-  auto [cropped_y, cropped_u, cropped_v] = get_yuv_buf(s->cropped_buf, crop_rect.w, crop_rect.h);
-  if (!s->is_rhd) {
-    crop_yuv((uint8_t *)stream_buf, width, height, cropped_y, cropped_u, cropped_v, crop_rect);
+  // region of the model input covered by the scaled crop
+  Rect dst_rect;
+  if (tici) {
+    dst_rect = {0, 0, MODEL_WIDTH, MODEL_HEIGHT};
   } else {
-    auto [mirror_y, mirror_u, mirror_v] = get_yuv_buf(s->premirror_cropped_buf, crop_rect.w, crop_rect.h);
-    crop_yuv((uint8_t *)stream_buf, width, height, mirror_y, mirror_u, mirror_v, crop_rect);
-    libyuv::I420Mirror(mirror_y, crop_rect.w,
-                       mirror_u, crop_rect.w / 2,
-                       mirror_v, crop_rect.w / 2,
-                       cropped_y, crop_rect.w,
-                       cropped_u, crop_rect.w / 2,
-                       cropped_v, crop_rect.w / 2,
-                       crop_rect.w, crop_rect.h);
-  }
-
-  auto [resized_buf, resized_u, resized_v] = get_yuv_buf(s->resized_buf, resized_width, resized_height);
-  uint8_t *resized_y = resized_buf;
-  libyuv::FilterMode mode = libyuv::FilterModeEnum::kFilterBilinear;
-  if (Hardware::TICI()) {
-    libyuv::I420Scale(cropped_y, crop_rect.w,
-                    cropped_u, crop_rect.w / 2,
-                    cropped_v, crop_rect.w / 2,
-                    crop_rect.w, crop_rect.h,
-                    resized_y, resized_width,
-                    resized_u, resized_width / 2,
-                    resized_v, resized_width / 2,
-                    resized_width, resized_height,
-                    mode);
-  } else {
-    const int source_height = 0.7*resized_height;
-    const int extra_height = (resized_height - source_height) / 2;
-    const int extra_width = (resized_width - source_height / 2) / 2;
+    const int source_height = 0.7*MODEL_HEIGHT;
+    const int extra_height = (MODEL_HEIGHT - source_height) / 2;
+    const int extra_width = (MODEL_WIDTH - source_height / 2) / 2;
     const int source_width = source_height / 2 + extra_width;
-    libyuv::I420Scale(cropped_y, crop_rect.w,
-                    cropped_u, crop_rect.w / 2,
-                    cropped_v, crop_rect.w / 2,
-                    crop_rect.w, crop_rect.h,
-                    resized_y + extra_height * resized_width, resized_width,
-                    resized_u + extra_height / 2 * resized_width / 2, resized_width / 2,
-                    resized_v + extra_height / 2 * resized_width / 2, resized_width / 2,
-                    source_width, source_height,
-                    mode);
-  }
-
-  int yuv_buf_len = (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6; // Y|u|v -> y|y|y|y|u|v
-  float *net_input_buf = get_buffer(s->net_input_buf, yuv_buf_len);
-  // one shot conversion, O(n) anyway
-  // yuvframe2tensor, normalize
+    dst_rect = {0, extra_height, source_width, source_height};
+  }
+
+  init_axis_map(map.y_x, crop_rect.x, crop_rect.w, dst_rect.x, dst_rect.w, is_rhd);
+  init_axis_map(map.y_y, crop_rect.y, crop_rect.h, dst_rect.y, dst_rect.h, false);
+  init_axis_map(map.uv_x, crop_rect.x / 2, crop_rect.w / 2, dst_rect.x / 2, dst_rect.w / 2, is_rhd);
+  init_axis_map(map.uv_y, crop_rect.y / 2, crop_rect.h / 2, dst_rect.y / 2, dst_rect.h / 2, false);
+  map.width = width;
+  map.height = height;
+  map.is_rhd = is_rhd;
+  map.tici = tici;
+}
+
+// bilinear sample destination row dy, pixels outside the crop are black
+static inline void scale_row(const uint8_t *src, int stride, const DMonitoringAxisMap &xm, const DMonitoringAxisMap &ym,
+                             int dy, uint8_t *dst, int dst_width) {
+  dy -= ym.dst_offset;
+  if (dy < 0 || dy >= ym.dst_size) {
+    memset(dst, 0, dst_width);
+    return;
+  }
+
+  const uint8_t *row0 = src + ym.src0[dy] * stride;
+  const uint8_t *row1 = src + ym.src1[dy] * stride;
+  const uint32_t fy = ym.frac[dy];
+  memset(dst, 0, xm.dst_offset);
+  for (int i = 0; i < xm.dst_size; i++) {
+    const uint32_t fx = xm.frac[i];
+    const uint32_t top = row0[xm.src0[i]] * (256 - fx) + row0[xm.src1[i]] * fx;
+    const uint32_t bottom = row1[xm.src0[i]] * (256 - fx) + row1[xm.src1[i]] * fx;
+    dst[xm.dst_offset + i] = (top * (256 - fy) + bottom * fy + 32768) >> 16;
+  }
+  memset(dst + xm.dst_offset + xm.dst_size, 0, dst_width - xm.dst_offset - xm.dst_size);
+}
+
+// normalize to [-1, 1): (x - 128) / 128
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline void store_normalized(float *dst, uint8x8_t v) {
+  const float32x4_t scale = vdupq_n_f32(0.0078125f), offset = vdupq_n_f32(-1.f);
+  const uint16x8_t w = vmovl_u8(v);
+  vst1q_f32(dst, vmlaq_f32(offset, vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))), scale));
+  vst1q_f32(dst + 4, vmlaq_f32(offset, vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))), scale));
+}
+#elif defined(__SSE2__)
+static inline void store_normalized(float *dst, __m128i w) {
+  // w holds 8 16-bit values
+  const __m128 scale = _mm_set1_ps(0.0078125f), offset = _mm_set1_ps(1.f);
+  const __m128i zero = _mm_setzero_si128();
+  _mm_storeu_ps(dst, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero)), scale), offset));
+  _mm_storeu_ps(dst + 4, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero)), scale), offset));
+}
+#endif
+
+static inline void convert_row(const uint8_t *src, float *dst, int len) {
+  int i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 8 <= len; i += 8) {
+    store_normalized(dst + i, vld1_u8(src + i));
+  }
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    store_normalized(dst + i, _mm_unpacklo_epi8(v, zero));
+    store_normalized(dst + i + 8, _mm_unpackhi_epi8(v, zero));
+  }
+#endif
+  for (; i < len; i++) {
+    dst[i] = src[i] * 0.0078125f - 1.f;
+  }
+}
+
+// even pixels go to dst_even, odd pixels to dst_odd, len is the number of output pixels per plane
+static inline void convert_row_deinterleave(const uint8_t *src, float *dst_even, float *dst_odd, int len) {
+  int i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 8 <= len; i += 8) {
+    const uint8x8x2_t v = vld2_u8(src + 2 * i);
+    store_normalized(dst_even + i, v.val[0]);
+    store_normalized(dst_odd + i, v.val[1]);
+  }
+#elif defined(__SSE2__)
+  const __m128i mask = _mm_set1_epi16(0xff);
+  for (; i + 8 <= len; i += 8) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+    store_normalized(dst_even + i, _mm_and_si128(v, mask));
+    store_normalized(dst_odd + i, _mm_srli_epi16(v, 8));
+  }
+#endif
+  for (; i < len; i++) {
+    dst_even[i] = src[2 * i] * 0.0078125f - 1.f;
+    dst_odd[i] = src[2 * i + 1] * 0.0078125f - 1.f;
+  }
+}
+
+float *dmonitoring_preprocess(DMonitoringModelState* s, const uint8_t *stream_buf, int width, int height, bool tici) {
+  DMonitoringPreprocessMap &map = s->preprocess_map;
+  if (map.width != width || map.height != height || map.is_rhd != s->is_rhd || map.tici != tici) {
+    init_preprocess_map(map, width, height, s->is_rhd, tici);
+  }
+
+  const uint8_t *src_y = stream_buf;
+  const uint8_t *src_u = src_y + (width * height);
+  const uint8_t *src_v = src_u + ((width / 2) * (height / 2));
+
+  // Y|u|v -> y|y|y|y|u|v, one pass over the model rows.
+  // only two scaled rows are ever materialized, everything else is read straight from the frame
+  float *net_input_buf = get_buffer(s->net_input_buf, PLANE_SIZE * 6);
+  uint8_t row[2][MODEL_WIDTH];
   for (int r = 0; r < MODEL_HEIGHT/2; r++) {
-    for (int c = 0; c < MODEL_WIDTH/2; c++) {
-      // Y_ul
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (0*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r)*resized_width + 2*c]];
-      // Y_dl
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (1*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r+1)*resized_width + 2*c]];
-      // Y_ur
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (2*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r)*resized_width + 2*c+1]];
-      // Y_dr
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (3*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r+1)*resized_width + 2*c+1]];
-      // U
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (4*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_u[r*resized_width/2 + c]];
-      // V
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (5*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_v[r*resized_width/2 + c]];
-    }
+    const int offset = r * PLANE_WIDTH;
+    scale_row(src_y, width, map.y_x, map.y_y, 2*r, row[0], MODEL_WIDTH);
+    scale_row(src_y, width, map.y_x, map.y_y, 2*r + 1, row[1], MODEL_WIDTH);
+    // Y_ul, Y_ur
+    convert_row_deinterleave(row[0], &net_input_buf[0*PLANE_SIZE + offset], &net_input_buf[2*PLANE_SIZE + offset], PLANE_WIDTH);
+    // Y_dl, Y_dr
+    convert_row_deinterleave(row[1], &net_input_buf[1*PLANE_SIZE + offset], &net_input_buf[3*PLANE_SIZE + offset], PLANE_WIDTH);
+    // U
+    scale_row(src_u, width / 2, map.uv_x, map.uv_y, r, row[0], PLANE_WIDTH);
+    convert_row(row[0], &net_input_buf[4*PLANE_SIZE + offset], PLANE_WIDTH);
+    // V
+    scale_row(src_v, width / 2, map.uv_x, map.uv_y, r, row[0], PLANE_WIDTH);
+    convert_row(row[0], &net_input_buf[5*PLANE_SIZE + offset], PLANE_WIDTH);
   }
+  return net_input_buf;
+}
 
-  //printf("preprocess completed. %d \n", yuv_buf_len);
-  //FILE *dump_yuv_file = fopen("/tmp/rawdump.yuv", "wb");
-  //fwrite(resized_buf, yuv_buf_len, sizeof(uint8_t), dump_yuv_file);
-  //fclose(dump_yuv_file);
+DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height) {
+  float *net_input_buf = dmonitoring_preprocess(s, (const uint8_t *)stream_buf, width, height, Hardware::TICI());
+  int yuv_buf_len = PLANE_SIZE * 6;
 
   // *** testing ***
   // idat = np.frombuffer(open("/tmp/inputdump.yuv", "rb").read(), np.float32).reshape(6, 160, 320)
@@ -28,18 +28,30 @@ typedef struct DMonitoringResult {
   float dsp_execution_time;
 } DMonitoringResult;
 
+// source sampling positions along one axis of the crop, mirror and bilinear scale
+typedef struct DMonitoringAxisMap {
+  int dst_offset, dst_size;  // destination span that is covered by the crop, the rest is black
+  std::vector<int32_t> src0, src1;
+  std::vector<uint16_t> frac;  // weight of src1, 8 bit fixed point
+} DMonitoringAxisMap;
+
+typedef struct DMonitoringPreprocessMap {
+  int width = 0, height = 0;
+  bool is_rhd = false, tici = false;
+  DMonitoringAxisMap y_x, y_y, uv_x, uv_y;
+} DMonitoringPreprocessMap;
+
 typedef struct DMonitoringModelState {
   RunModel *m;
   bool is_rhd;
   float output[OUTPUT_SIZE];
-  std::vector<uint8_t> resized_buf;
-  std::vector<uint8_t> cropped_buf;
-  std::vector<uint8_t> premirror_cropped_buf;
+  DMonitoringPreprocessMap preprocess_map;
   std::vector<float> net_input_buf;
-  float tensor[UINT8_MAX + 1];
 } DMonitoringModelState;
 
 void dmonitoring_init(DMonitoringModelState* s);
+// crop, mirror, scale and normalize an I420 frame straight into the 6 plane model input
+float *dmonitoring_preprocess(DMonitoringModelState* s, const uint8_t *stream_buf, int width, int height, bool tici);
 DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height);
 void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred);
 void dmonitoring_free(DMonitoringModelState* s);
@@ -3,13 +3,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
 #include <eigen3/Eigen/Dense>
+#include <capnp/orphan.h>
 
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 
 constexpr float FCW_THRESHOLD_5MS2_HIGH = 0.15;
@@ -26,69 +29,148 @@ constexpr const kj::ArrayPtr<const T> to_kj_array_ptr(const std::array<T, size>
   return kj::ArrayPtr(arr.data(), arr.size());
 }
 
-void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
-  s->frame = new ModelFrame(device_id, context);
+// transpose an array of structs with `stride` floats per element into one array per channel, in a single pass
+template<size_t size, size_t channels>
+static inline void unpack_channels(const float *in, int stride, std::array<std::array<float, size>, channels> &out) {
+  for (int i = 0; i < size; i++) {
+    for (int c = 0; c < channels; c++) {
+      out[c][i] = in[i * stride + c];
+    }
+  }
+}
+
+template<size_t size, size_t channels>
+static inline void unpack_channels_exp(const float *in, int stride, std::array<std::array<float, size>, channels> &out) {
+  unpack_channels(in, stride, out);
+  for (auto &channel : out) {
+    for (auto &v : channel) v = expf(v);
+  }
+}
 
+// modelV2 is built every frame, keep its first segment around instead of growing it from the heap.
+// sized for the full message, raw predictions are referenced from the model output rather than built into it
+constexpr size_t MODEL_V2_ARENA_WORDS = 4096;
+constexpr size_t CAMERA_ODOMETRY_ARENA_WORDS = 128;
+static MessageArena model_v2_arena[MAX_MODEL_CAMERAS] = {MessageArena(MODEL_V2_ARENA_WORDS), MessageArena(MODEL_V2_ARENA_WORDS)};
+static MessageArena camera_odometry_arena[MAX_MODEL_CAMERAS] = {MessageArena(CAMERA_ODOMETRY_ARENA_WORDS), MessageArena(CAMERA_ODOMETRY_ARENA_WORDS)};
+static float last_publish_time[MAX_MODEL_CAMERAS] = {};
+
+static std::unique_ptr<RunModel> create_runner(float *output, int batch_size) {
 #ifdef USE_THNEED
-  s->m = std::make_unique<ThneedModel>("../../models/supercombo.thneed", &s->output[0], NET_OUTPUT_SIZE, USE_GPU_RUNTIME);
+  return std::make_unique<ThneedModel>("../../models/supercombo.thneed", output, NET_OUTPUT_SIZE, USE_GPU_RUNTIME);
 #elif USE_ONNX_MODEL
-  s->m = std::make_unique<ONNXModel>("../../models/supercombo.onnx", &s->output[0], NET_OUTPUT_SIZE, USE_GPU_RUNTIME);
+  return std::make_unique<ONNXModel>("../../models/supercombo.onnx", output, NET_OUTPUT_SIZE, USE_GPU_RUNTIME, -1, batch_size);
 #else
-  s->m = std::make_unique<SNPEModel>("../../models/supercombo.dlc", &s->output[0], NET_OUTPUT_SIZE, USE_GPU_RUNTIME);
+  return std::make_unique<SNPEModel>("../../models/supercombo.dlc", output, NET_OUTPUT_SIZE, USE_GPU_RUNTIME);
 #endif
+}
+
+void model_init(ModelState* s, cl_device_id device_id, cl_context context, int num_cameras) {
+  assert(num_cameras > 0 && num_cameras <= MAX_MODEL_CAMERAS);
+  s->num_cameras = num_cameras;
+  s->net_input_buf = std::make_unique<float[]>(num_cameras * ModelFrame::buf_size);
+  for (int i = 0; i < num_cameras; i++) {
+    s->frame[i] = new ModelFrame(device_id, context, &s->net_input_buf[i * ModelFrame::buf_size]);
+  }
+
+#ifdef TRAFFIC_CONVENTION
+  const int idx = Params().getBool("IsRHD") ? 1 : 0;
+  for (int i = 0; i < num_cameras; i++) {
+    s->traffic_convention[i][idx] = 1.0;
+  }
+#endif
+
+  // runners that can't batch get one instance per camera, each bound to that camera's slice of the state
+  for (int i = 0; i < num_cameras; ) {
+    auto m = create_runner(&s->output[i * NET_OUTPUT_SIZE], num_cameras - i);
 
 #ifdef TEMPORAL
-  s->m->addRecurrent(&s->output[OUTPUT_SIZE], TEMPORAL_SIZE);
+    m->addRecurrent(&s->output[i * NET_OUTPUT_SIZE + OUTPUT_SIZE], TEMPORAL_SIZE);
 #endif
 
 #ifdef DESIRE
-  s->m->addDesire(s->pulse_desire, DESIRE_LEN);
+    m->addDesire(s->pulse_desire[i], DESIRE_LEN);
 #endif
 
 #ifdef TRAFFIC_CONVENTION
-  const int idx = Params().getBool("IsRHD") ? 1 : 0;
-  s->traffic_convention[idx] = 1.0;
-  s->m->addTrafficConvention(s->traffic_convention, TRAFFIC_CONVENTION_LEN);
+    m->addTrafficConvention(s->traffic_convention[i], TRAFFIC_CONVENTION_LEN);
 #endif
+
+    i += m->getBatchSize();
+    s->m.push_back(std::move(m));
+  }
+  LOGW("model running %d camera(s) with %zu runner(s)", num_cameras, s->m.size());
 }
 
-ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
-                           const mat3 &transform, float *desire_in) {
+ModelDataRaw model_get_outputs(ModelState* s, int camera) {
+  assert(camera < s->num_cameras);
+  const float *output = &s->output[camera * NET_OUTPUT_SIZE];
+  ModelDataRaw net_outputs {
+    .plans = (ModelDataRawPlans*)&output[PLAN_IDX],
+    .lane_lines = (ModelDataRawLaneLines*)&output[LL_IDX],
+    .road_edges = (ModelDataRawRoadEdges*)&output[RE_IDX],
+    .leads = (ModelDataRawLeads*)&output[LEAD_IDX],
+    .meta = &output[DESIRE_STATE_IDX],
+    .pose = (ModelDataRawPose*)&output[POSE_IDX],
+  };
+  return net_outputs;
+}
+
+void model_eval_frames(ModelState* s, const cl_mem *yuv_cl, int width, int height,
+                       const mat3 *transforms, float *desire_in) {
 #ifdef DESIRE
   if (desire_in != NULL) {
     for (int i = 1; i < DESIRE_LEN; i++) {
       // Model decides when action is completed
       // so desire input is just a pulse triggered on rising edge
       if (desire_in[i] - s->prev_desire[i] > .99) {
-        s->pulse_desire[i] = desire_in[i];
+        s->pulse_desire[0][i] = desire_in[i];
       } else {
-        s->pulse_desire[i] = 0.0;
+        s->pulse_desire[0][i] = 0.0;
       }
       s->prev_desire[i] = desire_in[i];
     }
+    // all cameras see the same desire
+    for (int i = 1; i < s->num_cameras; i++) {
+      std::copy_n(s->pulse_desire[0], DESIRE_LEN, s->pulse_desire[i]);
+    }
   }
 #endif
 
   //for (int i = 0; i < NET_OUTPUT_SIZE; i++) { printf("%f ", s->output[i]); } printf("\n");
 
-  // if getInputBuf is not NULL, net_input_buf will be
-  auto net_input_buf = s->frame->prepare(yuv_cl, width, height, transform, static_cast<cl_mem*>(s->m->getInputBuf()));
-  s->m->execute(net_input_buf, s->frame->buf_size);
+  // queue the warp for every camera before waiting on any of them, so the frames are preprocessed together
+  // if getInputBuf is not NULL, the runner reads its input straight from that cl_mem
+  for (int i = 0, cam = 0; i < s->m.size(); i++) {
+    for (int b = 0; b < s->m[i]->getBatchSize(); b++, cam++) {
+      s->frame[cam]->queue(yuv_cl[cam], width, height, transforms[cam], static_cast<cl_mem*>(s->m[i]->getInputBuf()));
+    }
+  }
 
-  // net outputs
-  ModelDataRaw net_outputs {
-    .plans = (ModelDataRawPlans*)&s->output[PLAN_IDX],
-    .lane_lines = (ModelDataRawLaneLines*)&s->output[LL_IDX],
-    .road_edges = (ModelDataRawRoadEdges*)&s->output[RE_IDX],
-    .leads = (ModelDataRawLeads*)&s->output[LEAD_IDX],
-    .meta = &s->output[DESIRE_STATE_IDX],
-    .pose = (ModelDataRawPose*)&s->output[POSE_IDX],
-  };
-  return net_outputs;
+  for (int i = 0, cam = 0; i < s->m.size(); i++) {
+    RunModel *m = s->m[i].get();
+    cl_mem *input_cl = static_cast<cl_mem*>(m->getInputBuf());
+    float *net_input_buf = nullptr;
+    for (int b = 0; b < m->getBatchSize(); b++) {
+      float *buf = s->frame[cam + b]->finish(input_cl);
+      if (b == 0) net_input_buf = buf;
+    }
+    m->execute(net_input_buf, ModelFrame::buf_size);
+    cam += m->getBatchSize();
+  }
+}
+
+ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
+                           const mat3 &transform, float *desire_in) {
+  assert(s->num_cameras == 1);
+  model_eval_frames(s, &yuv_cl, width, height, &transform, desire_in);
+  return model_get_outputs(s, 0);
 }
 
 void model_free(ModelState* s) {
-  delete s->frame;
+  for (int i = 0; i < s->num_cameras; i++) {
+    delete s->frame[i];
+  }
 }
 
 void fill_sigmoid(const float *input, float *output, int len, int stride) {
@@ -99,30 +181,22 @@ void fill_sigmoid(const float *input, float *output, int len, int stride) {
 
 void fill_lead(cereal::ModelDataV2::LeadDataV3::Builder lead, const ModelDataRawLeads &leads, int t_idx, float prob_t) {
   std::array<float, LEAD_TRAJ_LEN> lead_t = {0.0, 2.0, 4.0, 6.0, 8.0, 10.0};
-  auto best_prediction = leads.get_best_prediction(t_idx);
+  auto &best_prediction = leads.get_best_prediction(t_idx);
   lead.setProb(sigmoid(leads.prob[t_idx]));
   lead.setProbTime(prob_t);
-  std::array<float, LEAD_TRAJ_LEN> lead_x, lead_y, lead_v, lead_a;
-  std::array<float, LEAD_TRAJ_LEN> lead_x_std, lead_y_std, lead_v_std, lead_a_std;
-  for (int i=0; i<LEAD_TRAJ_LEN; i++) {
-    lead_x[i] = best_prediction.mean[i].x;
-    lead_y[i] = best_prediction.mean[i].y;
-    lead_v[i] = best_prediction.mean[i].velocity;
-    lead_a[i] = best_prediction.mean[i].acceleration;
-    lead_x_std[i] = exp(best_prediction.std[i].x);
-    lead_y_std[i] = exp(best_prediction.std[i].y);
-    lead_v_std[i] = exp(best_prediction.std[i].velocity);
-    lead_a_std[i] = exp(best_prediction.std[i].acceleration);
-  }
+  // x, y, velocity, acceleration
+  std::array<std::array<float, LEAD_TRAJ_LEN>, LEAD_PRED_DIM> mean, std;
+  unpack_channels(&best_prediction.mean[0].x, LEAD_PRED_DIM, mean);
+  unpack_channels_exp(&best_prediction.std[0].x, LEAD_PRED_DIM, std);
   lead.setT(to_kj_array_ptr(lead_t));
-  lead.setX(to_kj_array_ptr(lead_x));
-  lead.setY(to_kj_array_ptr(lead_y));
-  lead.setV(to_kj_array_ptr(lead_v));
-  lead.setA(to_kj_array_ptr(lead_a));
-  lead.setXStd(to_kj_array_ptr(lead_x_std));
-  lead.setYStd(to_kj_array_ptr(lead_y_std));
-  lead.setVStd(to_kj_array_ptr(lead_v_std));
-  lead.setAStd(to_kj_array_ptr(lead_a_std));
+  lead.setX(to_kj_array_ptr(mean[0]));
+  lead.setY(to_kj_array_ptr(mean[1]));
+  lead.setV(to_kj_array_ptr(mean[2]));
+  lead.setA(to_kj_array_ptr(mean[3]));
+  lead.setXStd(to_kj_array_ptr(std[0]));
+  lead.setYStd(to_kj_array_ptr(std[1]));
+  lead.setVStd(to_kj_array_ptr(std[2]));
+  lead.setAStd(to_kj_array_ptr(std[3]));
 }
 
 void fill_meta(cereal::ModelDataV2::MetaData::Builder meta, const float *meta_data) {
@@ -198,59 +272,32 @@ void fill_xyzt(cereal::ModelDataV2::XYZTData::Builder xyzt, const std::array<flo
 }
 
 void fill_plan(cereal::ModelDataV2::Builder &framed, const ModelDataRawPlanPrediction &plan) {
-  std::array<float, TRAJECTORY_SIZE> pos_x, pos_y, pos_z;
-  std::array<float, TRAJECTORY_SIZE> pos_x_std, pos_y_std, pos_z_std;
-  std::array<float, TRAJECTORY_SIZE> vel_x, vel_y, vel_z;
-  std::array<float, TRAJECTORY_SIZE> rot_x, rot_y, rot_z;
-  std::array<float, TRAJECTORY_SIZE> rot_rate_x, rot_rate_y, rot_rate_z;
-
-  for(int i=0; i<TRAJECTORY_SIZE; i++) {
-    pos_x[i] = plan.mean[i].position.x;
-    pos_y[i] = plan.mean[i].position.y;
-    pos_z[i] = plan.mean[i].position.z;
-    pos_x_std[i] = exp(plan.std[i].position.x);
-    pos_y_std[i] = exp(plan.std[i].position.y);
-    pos_z_std[i] = exp(plan.std[i].position.z);
-    vel_x[i] = plan.mean[i].velocity.x;
-    vel_y[i] = plan.mean[i].velocity.y;
-    vel_z[i] = plan.mean[i].velocity.z;
-    rot_x[i] = plan.mean[i].rotation.x;
-    rot_y[i] = plan.mean[i].rotation.y;
-    rot_z[i] = plan.mean[i].rotation.z;
-    rot_rate_x[i] = plan.mean[i].rotation_rate.x;
-    rot_rate_y[i] = plan.mean[i].rotation_rate.y;
-    rot_rate_z[i] = plan.mean[i].rotation_rate.z;
-  }
-
-  fill_xyzt(framed.initPosition(), T_IDXS_FLOAT, pos_x, pos_y, pos_z, pos_x_std, pos_y_std, pos_z_std);
-  fill_xyzt(framed.initVelocity(), T_IDXS_FLOAT, vel_x, vel_y, vel_z);
-  fill_xyzt(framed.initOrientation(), T_IDXS_FLOAT, rot_x, rot_y, rot_z);
-  fill_xyzt(framed.initOrientationRate(), T_IDXS_FLOAT, rot_rate_x, rot_rate_y, rot_rate_z);
+  constexpr int stride = sizeof(ModelDataRawPlanElement) / sizeof(float);
+  // position, velocity, acceleration, rotation, rotation_rate, each xyz
+  std::array<std::array<float, TRAJECTORY_SIZE>, stride> mean;
+  std::array<std::array<float, TRAJECTORY_SIZE>, 3> pos_std;
+  unpack_channels(&plan.mean[0].position.x, stride, mean);
+  unpack_channels_exp(&plan.std[0].position.x, stride, pos_std);
+
+  fill_xyzt(framed.initPosition(), T_IDXS_FLOAT, mean[0], mean[1], mean[2], pos_std[0], pos_std[1], pos_std[2]);
+  fill_xyzt(framed.initVelocity(), T_IDXS_FLOAT, mean[3], mean[4], mean[5]);
+  fill_xyzt(framed.initOrientation(), T_IDXS_FLOAT, mean[9], mean[10], mean[11]);
+  fill_xyzt(framed.initOrientationRate(), T_IDXS_FLOAT, mean[12], mean[13], mean[14]);
 }
 
 void fill_lane_lines(cereal::ModelDataV2::Builder &framed, const std::array<float, TRAJECTORY_SIZE> &plan_t,
                      const ModelDataRawLaneLines &lanes) {
-  std::array<float, TRAJECTORY_SIZE> left_far_y, left_far_z;
-  std::array<float, TRAJECTORY_SIZE> left_near_y, left_near_z;
-  std::array<float, TRAJECTORY_SIZE> right_near_y, right_near_z;
-  std::array<float, TRAJECTORY_SIZE> right_far_y, right_far_z;
-  for (int j=0; j<TRAJECTORY_SIZE; j++) {
-    left_far_y[j] = lanes.mean.left_far[j].y;
-    left_far_z[j] = lanes.mean.left_far[j].z;
-    left_near_y[j] = lanes.mean.left_near[j].y;
-    left_near_z[j] = lanes.mean.left_near[j].z;
-    right_near_y[j] = lanes.mean.right_near[j].y;
-    right_near_z[j] = lanes.mean.right_near[j].z;
-    right_far_y[j] = lanes.mean.right_far[j].y;
-    right_far_z[j] = lanes.mean.right_far[j].z;
+  // y, z for left_far, left_near, right_near, right_far
+  const std::array<const ModelDataRawYZ *, 4> lines = {
+    lanes.mean.left_far.data(), lanes.mean.left_near.data(), lanes.mean.right_near.data(), lanes.mean.right_far.data(),
+  };
+  auto lane_lines = framed.initLaneLines(lines.size());
+  for (int i = 0; i < lines.size(); i++) {
+    std::array<std::array<float, TRAJECTORY_SIZE>, 2> yz;
+    unpack_channels(&lines[i]->y, 2, yz);
+    fill_xyzt(lane_lines[i], plan_t, X_IDXS_FLOAT, yz[0], yz[1]);
   }
 
-  auto lane_lines = framed.initLaneLines(4);
-  fill_xyzt(lane_lines[0], plan_t, X_IDXS_FLOAT, left_far_y, left_far_z);
-  fill_xyzt(lane_lines[1], plan_t, X_IDXS_FLOAT, left_near_y, left_near_z);
-  fill_xyzt(lane_lines[2], plan_t, X_IDXS_FLOAT, right_near_y, right_near_z);
-  fill_xyzt(lane_lines[3], plan_t, X_IDXS_FLOAT, right_far_y, right_far_z);
-
   framed.setLaneLineStds({
     exp(lanes.std.left_far[0].y),
     exp(lanes.std.left_near[0].y),
@@ -268,19 +315,14 @@ void fill_lane_lines(cereal::ModelDataV2::Builder &framed, const std::array<floa
 
 void fill_road_edges(cereal::ModelDataV2::Builder &framed, const std::array<float, TRAJECTORY_SIZE> &plan_t,
                      const ModelDataRawRoadEdges &edges) {
-  std::array<float, TRAJECTORY_SIZE> left_y, left_z;
-  std::array<float, TRAJECTORY_SIZE> right_y, right_z;
-  for (int j=0; j<TRAJECTORY_SIZE; j++) {
-    left_y[j] = edges.mean.left[j].y;
-    left_z[j] = edges.mean.left[j].z;
-    right_y[j] = edges.mean.right[j].y;
-    right_z[j] = edges.mean.right[j].z;
+  const std::array<const ModelDataRawYZ *, 2> lines = {edges.mean.left.data(), edges.mean.right.data()};
+  auto road_edges = framed.initRoadEdges(lines.size());
+  for (int i = 0; i < lines.size(); i++) {
+    std::array<std::array<float, TRAJECTORY_SIZE>, 2> yz;
+    unpack_channels(&lines[i]->y, 2, yz);
+    fill_xyzt(road_edges[i], plan_t, X_IDXS_FLOAT, yz[0], yz[1]);
   }
 
-  auto road_edges = framed.initRoadEdges(2);
-  fill_xyzt(road_edges[0], plan_t, X_IDXS_FLOAT, left_y, left_z);
-  fill_xyzt(road_edges[1], plan_t, X_IDXS_FLOAT, right_y, right_z);
-
   framed.setRoadEdgeStds({
     exp(edges.std.left[0].y),
     exp(edges.std.right[0].y),
@@ -325,33 +367,41 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   }
 }
 
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
+void model_publish(PubMaster &pm, bool extra_camera, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
                    const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
                    float model_execution_time, kj::ArrayPtr<const float> raw_pred) {
+  const double t1 = millis_since_boot();
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
-  auto framed = msg.initEvent().initModelV2();
+  MessageBuilder msg(model_v2_arena[extra_camera]);
+  auto event = msg.initEvent();
+  auto framed = extra_camera ? event.initWideRoadModelV2() : event.initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameAge(frame_age);
   framed.setFrameDropPerc(frame_drop * 100);
   framed.setTimestampEof(timestamp_eof);
   framed.setModelExecutionTime(model_execution_time);
+  // fill, serialize and send time of the previous frame, this one isn't done yet
+  framed.setPublishExecutionTime(last_publish_time[extra_camera]);
   if (send_raw_pred) {
-    framed.setRawPredictions(raw_pred.asBytes());
+    // reference the model output instead of copying it into the builder, it's copied once when serialized
+    auto raw = msg.getOrphanage().referenceExternalData(capnp::Data::Reader(raw_pred.asBytes().begin(), raw_pred.asBytes().size()));
+    framed.adoptRawPredictions(kj::mv(raw));
   }
   fill_model(framed, net_outputs);
-  pm.send("modelV2", msg);
+  pm.send(extra_camera ? "wideRoadModelV2" : "modelV2", msg);
+  last_publish_time[extra_camera] = (millis_since_boot() - t1) / 1000.0;
 }
 
-void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
+void posenet_publish(PubMaster &pm, bool extra_camera, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                      const ModelDataRaw &net_outputs, uint64_t timestamp_eof) {
-  MessageBuilder msg;
+  MessageBuilder msg(camera_odometry_arena[extra_camera]);
   auto v_mean = net_outputs.pose->velocity_mean;
   auto r_mean = net_outputs.pose->rotation_mean;
   auto v_std = net_outputs.pose->velocity_std;
   auto r_std = net_outputs.pose->rotation_std;
 
-  auto posenetd = msg.initEvent(vipc_dropped_frames < 1).initCameraOdometry();
+  auto event = msg.initEvent(vipc_dropped_frames < 1);
+  auto posenetd = extra_camera ? event.initWideRoadCameraOdometry() : event.initCameraOdometry();
   posenetd.setTrans({v_mean.x, v_mean.y, v_mean.z});
   posenetd.setRot({r_mean.x, r_mean.y, r_mean.z});
   posenetd.setTransStd({exp(v_std.x), exp(v_std.y), exp(v_std.z)});
@@ -360,5 +410,5 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
   posenetd.setTimestampEof(timestamp_eof);
   posenetd.setFrameId(vipc_frame_id);
 
-  pm.send("cameraOdometry", msg);
+  pm.send(extra_camera ? "wideRoadCameraOdometry" : "cameraOdometry", msg);
 }
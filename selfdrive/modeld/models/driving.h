@@ -7,6 +7,7 @@
 
 #include <array>
 #include <memory>
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/mat.h"
@@ -190,27 +191,44 @@ struct ModelDataRaw {
   const ModelDataRawPose *const pose;
 };
 
+constexpr int MAX_MODEL_CAMERAS = 2;
+// the onnx runner runs the cameras as one batch, the others run a model per camera
+#ifdef USE_ONNX_MODEL
+constexpr bool MODEL_BATCHES_CAMERAS = true;
+#else
+constexpr bool MODEL_BATCHES_CAMERAS = false;
+#endif
+
 // TODO: convert remaining arrays to std::array and update model runners
 struct ModelState {
-  ModelFrame *frame;
-  std::array<float, NET_OUTPUT_SIZE> output = {};
-  std::unique_ptr<RunModel> m;
+  int num_cameras = 1;
+  std::array<ModelFrame *, MAX_MODEL_CAMERAS> frame = {};
+  // one NET_OUTPUT_SIZE block per camera, a batched runner fills all of them in a single run
+  std::array<float, NET_OUTPUT_SIZE * MAX_MODEL_CAMERAS> output = {};
+  std::unique_ptr<float[]> net_input_buf;
+  // a single runner when the backend can batch every camera, otherwise one runner per camera
+  std::vector<std::unique_ptr<RunModel>> m;
 #ifdef DESIRE
   float prev_desire[DESIRE_LEN] = {};
-  float pulse_desire[DESIRE_LEN] = {};
+  float pulse_desire[MAX_MODEL_CAMERAS][DESIRE_LEN] = {};
 #endif
 #ifdef TRAFFIC_CONVENTION
-  float traffic_convention[TRAFFIC_CONVENTION_LEN] = {};
+  float traffic_convention[MAX_MODEL_CAMERAS][TRAFFIC_CONVENTION_LEN] = {};
 #endif
 };
 
-void model_init(ModelState* s, cl_device_id device_id, cl_context context);
+void model_init(ModelState* s, cl_device_id device_id, cl_context context, int num_cameras = 1);
 ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
                            const mat3 &transform, float *desire_in);
+// runs one synchronized frame per camera, yuv_cl and transforms have num_cameras entries
+void model_eval_frames(ModelState* s, const cl_mem *yuv_cl, int width, int height,
+                       const mat3 *transforms, float *desire_in);
+ModelDataRaw model_get_outputs(ModelState* s, int camera);
 void model_free(ModelState* s);
 void poly_fit(float *in_pts, float *in_stds, float *out);
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
+// the extra camera of a multi-camera modeld publishes to wideRoadModelV2 and wideRoadCameraOdometry
+void model_publish(PubMaster &pm, bool extra_camera, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
                    const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
                    float model_execution_time, kj::ArrayPtr<const float> raw_pred);
-void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
+void posenet_publish(PubMaster &pm, bool extra_camera, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                      const ModelDataRaw &net_outputs, uint64_t timestamp_eof);
@@ -0,0 +1,137 @@
+#include "selfdrive/modeld/runners/onnxmodel.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+// input order matches the SNPE runner: image, desire, traffic convention, recurrent state
+constexpr int INPUT_IMG_IDX = 0;
+constexpr int DESIRE_IDX = 1;
+constexpr int TRAFFIC_CONVENTION_IDX = 2;
+constexpr int RECURRENT_IDX = 3;
+
+ONNXModel::ONNXModel(const char *path, float *loutput, size_t loutput_size, int runtime, int num_threads, int batch_size)
+    : env(ORT_LOGGING_LEVEL_WARNING, "onnxmodel"),
+      memory_info(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)) {
+  output = loutput;
+  output_size = loutput_size;
+
+  // the runtime hint is ignored, everything runs on the CPU execution provider.
+  // ONNX_THREADS overrides the intra-op pool size, 0 lets onnxruntime pick one thread per physical core
+  if (num_threads < 0) {
+    num_threads = util::getenv("ONNX_THREADS", 0);
+  }
+  session_options.SetIntraOpNumThreads(num_threads);
+  session_options.SetInterOpNumThreads(1);
+  session_options.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
+  session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  // don't burn cores spinning between frames, modeld is idle most of the 50ms frame interval
+  session_options.AddConfigEntry("session.intra_op.allow_spinning", "0");
+
+  std::string model_data = util::read_file(path);
+  assert(model_data.size() > 0);
+  session = std::make_unique<Ort::Session>(env, model_data.data(), model_data.size(), session_options);
+  binding = std::make_unique<Ort::IoBinding>(*session);
+  printf("loaded model %s with size: %lu, threads: %d\n", path, model_data.size(), num_threads);
+
+  Ort::AllocatorWithDefaultOptions allocator;
+  for (size_t i = 0; i < session->GetInputCount(); i++) {
+    Input in;
+    in.name = session->GetInputNameAllocated(i, allocator).get();
+    in.shape = session->GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+    inputs.push_back(in);
+  }
+  assert(session->GetOutputCount() == 1);
+  output_name = session->GetOutputNameAllocated(0, allocator).get();
+  std::vector<int64_t> output_shape = session->GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+
+  // batching needs a dynamic leading dimension on every tensor
+  for (auto &in : inputs) {
+    if (batch_size > 1 && in.shape[0] > 0) {
+      LOGW("%s: input %s has a static batch dimension, running unbatched", path, in.name.c_str());
+      batch_size = 1;
+    }
+  }
+  this->batch_size = batch_size;
+
+  // sizes are per batch element
+  auto element_size = [=](std::vector<int64_t> &shape) {
+    size_t size = 1;
+    for (int d = 1; d < shape.size(); d++) {
+      assert(shape[d] > 0);
+      size *= shape[d];
+    }
+    shape[0] = batch_size;
+    return size;
+  };
+  for (auto &in : inputs) {
+    in.size = element_size(in.shape);
+    printf("model input %s: %d x %zu\n", in.name.c_str(), batch_size, in.size);
+  }
+  size_t model_output_size = element_size(output_shape);
+  if (output_size != 0) {
+    assert(output_size == model_output_size);
+  } else {
+    output_size = model_output_size;
+  }
+
+  // the output tensor aliases the caller's buffer, results land directly in ModelState::output
+  Ort::Value output_tensor = Ort::Value::CreateTensor<float>(memory_info, output, batch_size * output_size,
+                                                             output_shape.data(), output_shape.size());
+  binding->BindOutput(output_name.c_str(), output_tensor);
+}
+
+void ONNXModel::bindInput(int idx, float *buf, int buf_size) {
+  assert(idx < inputs.size());
+  Input &in = inputs[idx];
+  if (in.buf == buf) return;
+
+  assert(buf_size == in.size);
+  Ort::Value tensor = Ort::Value::CreateTensor<float>(memory_info, buf, batch_size * in.size, in.shape.data(), in.shape.size());
+  binding->BindInput(in.name.c_str(), tensor);
+  in.buf = buf;
+}
+
+void ONNXModel::addRecurrent(float *state, int state_size) {
+  // the recurrent state lives inside the output buffer, feed the model a snapshot
+  // so onnxruntime never reads and writes the same memory within one run
+  recurrent = state;
+  recurrent_size = state_size;
+  recurrent_input.resize(batch_size * state_size);
+  copyRecurrent();
+  bindInput(RECURRENT_IDX, recurrent_input.data(), state_size);
+}
+
+void ONNXModel::copyRecurrent() {
+  // every batch element keeps its state in its own output block
+  for (int b = 0; b < batch_size; b++) {
+    memcpy(&recurrent_input[b * recurrent_size], recurrent + b * output_size, recurrent_size * sizeof(float));
+  }
+}
+
+void ONNXModel::addDesire(float *state, int state_size) {
+  bindInput(DESIRE_IDX, state, state_size);
+}
+
+void ONNXModel::addTrafficConvention(float *state, int state_size) {
+  bindInput(TRAFFIC_CONVENTION_IDX, state, state_size);
+}
+
+void ONNXModel::execute(float *net_input_buf, int buf_size) {
+  // rebinding is only needed when the caller hands us a different buffer
+  bindInput(INPUT_IMG_IDX, net_input_buf, buf_size);
+
+  if (recurrent != nullptr) {
+    copyRecurrent();
+  }
+
+  try {
+    session->Run(run_options, *binding);
+  } catch (const Ort::Exception &e) {
+    LOGE("onnxruntime execution failed: %s", e.what());
+    memset(output, 0, batch_size * output_size * sizeof(float));
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <onnxruntime_cxx_api.h>
+
+#include "selfdrive/modeld/runners/runmodel.h"
+
+// in-process CPU runner backed by ONNX Runtime.
+// inputs and the output are bound once to caller owned buffers, execute() only rebinds when a pointer changes.
+// with batch_size > 1 every buffer holds batch_size elements back to back and one execute() runs all of them.
+class ONNXModel : public RunModel {
+public:
+  ONNXModel(const char *path, float *output, size_t output_size, int runtime, int num_threads = -1, int batch_size = 1);
+  void addRecurrent(float *state, int state_size);
+  void addDesire(float *state, int state_size);
+  void addTrafficConvention(float *state, int state_size);
+  void execute(float *net_input_buf, int buf_size);
+  int getBatchSize() { return batch_size; }
+
+private:
+  struct Input {
+    std::string name;
+    std::vector<int64_t> shape;
+    size_t size;
+    float *buf = nullptr;
+  };
+
+  void bindInput(int idx, float *buf, int buf_size);
+  void copyRecurrent();
+
+  Ort::Env env;
+  Ort::SessionOptions session_options;
+  std::unique_ptr<Ort::Session> session;
+  std::unique_ptr<Ort::IoBinding> binding;
+  Ort::MemoryInfo memory_info;
+  Ort::RunOptions run_options;
+
+  std::vector<Input> inputs;
+  std::string output_name;
+  int batch_size;
+  float *output;
+  size_t output_size;
+
+  float *recurrent = nullptr;
+  size_t recurrent_size = 0;
+  std::vector<float> recurrent_input;
+};
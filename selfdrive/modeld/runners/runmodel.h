@@ -1,4 +1,9 @@
 #pragma once
+
+#define USE_CPU_RUNTIME 0
+#define USE_GPU_RUNTIME 1
+#define USE_DSP_RUNTIME 2
+
 class RunModel {
 public:
   virtual void addRecurrent(float *state, int state_size) {}
@@ -6,5 +11,7 @@ public:
   virtual void addTrafficConvention(float *state, int state_size) {}
   virtual void execute(float *net_input_buf, int buf_size) {}
   virtual void* getInputBuf() { return nullptr; }
+  // number of independent inputs handled by one execute(), buffers hold that many elements back to back
+  virtual int getBatchSize() { return 1; }
 };
 
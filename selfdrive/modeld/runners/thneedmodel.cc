@@ -32,6 +32,8 @@ void* ThneedModel::getInputBuf() {
 
 void ThneedModel::execute(float *net_input_buf, int buf_size) {
   float *inputs[4] = {recurrent, trafficConvention, desire, net_input_buf};
+  // modeld runs one model per camera, the other one may have been loaded or run last
+  thneed->make_current();
   if (!recorded) {
     thneed->record = THNEED_RECORD;
     thneed->copy_inputs(inputs);
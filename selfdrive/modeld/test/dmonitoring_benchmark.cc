@@ -0,0 +1,45 @@
+// per-frame cost of the driver monitoring preprocessing (crop, mirror, scale, normalize)
+// usage: ./dmonitoring_benchmark [iterations]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/modeld/models/dmonitoring.h"
+
+static void run(const char *name, int width, int height, bool tici, bool is_rhd, int iterations) {
+  std::vector<uint8_t> frame(width * height * 3 / 2);
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (auto &p : frame) p = dist(gen);
+
+  DMonitoringModelState s = {};
+  s.is_rhd = is_rhd;
+  // first call builds the sampling tables
+  dmonitoring_preprocess(&s, frame.data(), width, height, tici);
+
+  std::vector<double> times;
+  for (int i = 0; i < iterations; i++) {
+    double t1 = millis_since_boot();
+    dmonitoring_preprocess(&s, frame.data(), width, height, tici);
+    times.push_back(millis_since_boot() - t1);
+  }
+
+  std::sort(times.begin(), times.end());
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-12s %s  mean %6.3fms  p50 %6.3fms  p99 %6.3fms\n", name, is_rhd ? "rhd" : "lhd",
+         sum / times.size(), times[times.size() / 2], times[std::min<size_t>(times.size() - 1, times.size() * 0.99)]);
+}
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  for (bool is_rhd : {false, true}) {
+    run("tici", 1928, 1208, true, is_rhd, iterations);
+    run("eon", 1152, 864, false, is_rhd, iterations);
+  }
+  return 0;
+}
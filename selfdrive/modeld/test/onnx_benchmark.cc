@@ -0,0 +1,89 @@
+// benchmark for the in-process ONNX runner
+// usage: ./onnx_benchmark [iterations] [threads]
+// compare "supercombo x2" against twice "supercombo x1" to see what batching the road and wide camera saves
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/modeld/runners/onnxmodel.h"
+
+// keep in sync with models/driving.h and models/dmonitoring.h
+constexpr int SUPERCOMBO_TEMPORAL_SIZE = 512;
+constexpr int SUPERCOMBO_OUTPUT_SIZE = 5960 + SUPERCOMBO_TEMPORAL_SIZE;
+constexpr int SUPERCOMBO_INPUT_SIZE = 512 * 256 * 3 / 2 * 2;
+constexpr int DMONITORING_OUTPUT_SIZE = 39;
+constexpr int DMONITORING_INPUT_SIZE = 320 * 640 * 3 / 2;
+
+static void fill_random(std::vector<float> &buf, std::mt19937 &gen) {
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  for (auto &v : buf) v = dist(gen);
+}
+
+static void report(const char *name, std::vector<double> &times) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-16s n=%zu  mean %7.2fms  p50 %7.2fms  p99 %7.2fms  max %7.2fms\n",
+         name, times.size(), sum / times.size(), pct(0.5), pct(0.99), times.back());
+}
+
+static std::vector<double> run(RunModel &model, std::vector<float> &input, int iterations) {
+  const int buf_size = input.size() / model.getBatchSize();
+  std::vector<double> times;
+  // warmup, the first few runs include allocator and kernel selection overhead
+  for (int i = 0; i < 5; i++) {
+    model.execute(input.data(), buf_size);
+  }
+  for (int i = 0; i < iterations; i++) {
+    double t1 = millis_since_boot();
+    model.execute(input.data(), buf_size);
+    times.push_back(millis_since_boot() - t1);
+  }
+  return times;
+}
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200;
+  const int threads = argc > 2 ? atoi(argv[2]) : -1;
+  std::mt19937 gen(0);
+
+  // batch 1 is the single camera case, batch 2 runs road and wide camera in one inference
+  for (int batch = 1; batch <= 2; batch++) {
+    std::vector<float> output(batch * SUPERCOMBO_OUTPUT_SIZE);
+    std::vector<float> input(batch * SUPERCOMBO_INPUT_SIZE);
+    std::vector<float> desire(batch * 8), traffic_convention(batch * 2);
+    fill_random(input, gen);
+
+    ONNXModel model("../../models/supercombo.onnx", output.data(), SUPERCOMBO_OUTPUT_SIZE, USE_GPU_RUNTIME, threads, batch);
+    if (model.getBatchSize() != batch) {
+      printf("supercombo has a static batch dimension, skipping batch %d\n", batch);
+      continue;
+    }
+    model.addRecurrent(&output[SUPERCOMBO_OUTPUT_SIZE - SUPERCOMBO_TEMPORAL_SIZE], SUPERCOMBO_TEMPORAL_SIZE);
+    model.addDesire(desire.data(), 8);
+    model.addTrafficConvention(traffic_convention.data(), 2);
+
+    auto times = run(model, input, iterations);
+    char name[32];
+    snprintf(name, sizeof(name), "supercombo x%d", batch);
+    report(name, times);
+  }
+
+  {
+    std::vector<float> output(DMONITORING_OUTPUT_SIZE);
+    std::vector<float> input(DMONITORING_INPUT_SIZE);
+    fill_random(input, gen);
+
+    ONNXModel model("../../models/dmonitoring_model.onnx", output.data(), output.size(), USE_DSP_RUNTIME, threads);
+
+    auto times = run(model, input, iterations);
+    report("dmonitoring", times);
+  }
+
+  return 0;
+}
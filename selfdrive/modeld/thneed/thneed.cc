@@ -223,6 +223,10 @@ Thneed::Thneed(bool do_clinit) {
   ram = make_unique<GPUMalloc>(0x80000, fd);
   record = THNEED_RECORD;
   timestamp = -1;
+  make_current();
+}
+
+void Thneed::make_current() {
   g_thneed = this;
 }
 
@@ -98,6 +98,10 @@ class Thneed {
     void wait();
     int optimize();
 
+    // the ioctl and OpenCL hooks are global and record into the current Thneed,
+    // with more than one in a process each makes itself current before it runs
+    void make_current();
+
     vector<cl_mem> input_clmem;
     vector<void *> inputs;
     vector<size_t> input_sizes;
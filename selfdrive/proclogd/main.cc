@@ -1,21 +1,45 @@
-
 #include <sys/resource.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 #include "selfdrive/common/util.h"
 #include "selfdrive/proclogd/proclog.h"
 
 ExitHandler do_exit;
 
+const auto PROC_LOG_PERIOD = std::chrono::seconds(2);
+const auto THREAD_LOG_FULL_PERIOD = std::chrono::seconds(10);
+
 int main(int argc, char **argv) {
   setpriority(PRIO_PROCESS, 0, -15);
 
-  PubMaster publisher({"procLog"});
+  // per thread stats in threadLog, off by default
+  const int thread_log_hz = std::clamp(util::getenv("PROCLOGD_THREAD_HZ", 0), 0, 20);
+  const auto period = thread_log_hz > 0 ? std::chrono::milliseconds(1000 / thread_log_hz) : std::chrono::milliseconds(PROC_LOG_PERIOD);
+
+  PubMaster publisher({"procLog", "threadLog"});
+  ProcSampler sampler;
+  auto next = std::chrono::steady_clock::now();
+  auto next_proc_log = next, next_full_thread_log = next;
   while (!do_exit) {
-    MessageBuilder msg;
-    buildProcLogMessage(msg);
-    publisher.send("procLog", msg);
+    if (next >= next_proc_log) {
+      MessageBuilder msg;
+      sampler.buildProcLog(msg.initEvent().initProcLog());
+      publisher.send("procLog", msg);
+      next_proc_log += PROC_LOG_PERIOD;
+    }
+    if (thread_log_hz > 0) {
+      const bool full = next >= next_full_thread_log;
+      MessageBuilder msg;
+      sampler.buildThreadLog(msg.initEvent().initThreadLog(), full);
+      publisher.send("threadLog", msg);
+      if (full) next_full_thread_log += THREAD_LOG_FULL_PERIOD;
+    }
 
-    util::sleep_for(2000);  // 2 secs
+    next += period;
+    std::this_thread::sleep_until(next);
   }
 
   return 0;
@@ -1,8 +1,13 @@
 #include "selfdrive/proclogd/proclog.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iterator>
 #include <sstream>
@@ -237,3 +242,386 @@ void buildProcLogMessage(MessageBuilder &msg) {
   buildCPUTimes(procLog);
   buildMemInfo(procLog);
 }
+
+namespace {
+
+// scanner for the space separated numbers of /proc files
+struct Scanner {
+  const char *p, *end;
+
+  inline void skipSpaces() {
+    while (p < end && *p == ' ') p++;
+  }
+  inline bool skipField() {
+    skipSpaces();
+    const char *start = p;
+    while (p < end && *p != ' ' && *p != '\n') p++;
+    return p > start;
+  }
+  inline bool skipFields(int n) {
+    for (int i = 0; i < n; i++) {
+      if (!skipField()) return false;
+    }
+    return true;
+  }
+  inline void nextLine() {
+    while (p < end && *p != '\n') p++;
+    if (p < end) p++;
+  }
+  template <typename T>
+  inline bool num(T &val) {
+    skipSpaces();
+    const bool negative = p < end && *p == '-';
+    if (negative) p++;
+    if (p == end || *p < '0' || *p > '9') return false;
+    T v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      v = v * 10 + (*p++ - '0');
+    }
+    val = negative ? -v : v;
+    return true;
+  }
+  inline bool startsWith(const char *s, size_t len) {
+    return end - p >= (ptrdiff_t)len && memcmp(p, s, len) == 0;
+  }
+};
+
+}  // namespace
+
+namespace Parser {
+
+bool parseStat(const char *buf, size_t len, ProcStat &s) {
+  // To avoid being fooled by names containing a closing paren, scan backwards.
+  const char *open_paren = (const char *)memchr(buf, '(', len);
+  const char *close_paren = (const char *)memrchr(buf, ')', len);
+  if (!open_paren || !close_paren || open_paren > close_paren) {
+    return false;
+  }
+  Scanner sc = {buf, open_paren};
+  if (!sc.num(s.pid)) return false;
+  s.name.assign(open_paren + 1, close_paren);
+
+  sc = {close_paren + 1, buf + len};
+  sc.skipSpaces();
+  if (sc.p == sc.end) return false;
+  s.state = *sc.p++;
+  return sc.num(s.ppid) && sc.skipFields(9) &&
+         sc.num(s.utime) && sc.num(s.stime) && sc.num(s.cutime) && sc.num(s.cstime) &&
+         sc.num(s.priority) && sc.num(s.nice) && sc.num(s.num_threads) && sc.skipFields(1) &&
+         sc.num(s.starttime) && sc.num(s.vms) && sc.num(s.rss) && sc.skipFields(14) &&
+         sc.num(s.processor);
+}
+
+}  // namespace Parser
+
+ProcSampler::ProcSampler() : buf(1 << 16) {
+  // one fd per process and thread, keep some for everything else
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    max_open_fds = limit.rlim_cur > 256 ? std::min<rlim_t>(limit.rlim_cur, 1 << 16) - 128 : 0;
+  }
+  proc_dir = opendir("/proc");
+  assert(proc_dir);
+}
+
+ProcSampler::~ProcSampler() {
+  for (auto &[pid, proc] : procs) {
+    closeFile(proc.fd);
+    for (auto &t : proc.threads) closeFile(t.fd);
+  }
+  closeFile(stat_fd);
+  closeFile(meminfo_fd);
+  closedir(proc_dir);
+}
+
+// reads the file from the start, through fd if it's open. the file is kept open while there are fds to spare,
+// on a read error it's closed. returns the bytes read, or -1 if the file is gone
+ssize_t ProcSampler::readFile(int &fd, const char *path, char *dst, size_t size) {
+  if (fd >= 0) {
+    ssize_t n = pread(fd, dst, size, 0);
+    if (n >= 0) return n;
+    // e.g. the process exited, or its pid got reused
+    closeFile(fd);
+  }
+  int f = open(path, O_RDONLY | O_CLOEXEC);
+  if (f < 0) return -1;
+  ssize_t n = pread(f, dst, size, 0);
+  if (n >= 0 && open_fds < max_open_fds) {
+    fd = f;
+    open_fds++;
+  } else {
+    close(f);
+  }
+  return n;
+}
+
+void ProcSampler::closeFile(int &fd) {
+  if (fd >= 0) {
+    close(fd);
+    open_fds--;
+    fd = -1;
+  }
+}
+
+// returns false if the process is gone
+bool ProcSampler::readProc(int pid, Proc &proc) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  ssize_t n = readFile(proc.fd, path, buf.data(), buf.size());
+  if (n <= 0) return false;
+
+  std::swap(prev_name, proc.stat.name);
+  const unsigned long long starttime = proc.stat.starttime;
+  if (!Parser::parseStat(buf.data(), n, proc.stat)) {
+    LOGE("failed to parse procStat :%.*s", (int)n, buf.data());
+    return false;
+  }
+  // the pid was reused
+  if (proc.extra_info && starttime != proc.stat.starttime) {
+    dropThreads(proc);
+    proc.extra_info = false;
+  }
+  // new process, or it exec'd
+  if (!proc.extra_info || proc.stat.name != prev_name) {
+    std::string proc_path = "/proc/" + std::to_string(pid);
+    proc.exe = util::readlink(proc_path + "/exe");
+    std::ifstream stream(proc_path + "/cmdline");
+    proc.cmdline = Parser::cmdline(stream);
+    proc.extra_info = true;
+  }
+  return true;
+}
+
+void ProcSampler::dropThreads(Proc &proc) {
+  for (auto &t : proc.threads) {
+    closeFile(t.fd);
+    exited_tids.push_back(t.tid);
+  }
+  proc.threads.clear();
+}
+
+void ProcSampler::buildProcLog(cereal::ProcLog::Builder procLog) {
+  // find the new processes, and forget the exited ones
+  generation++;
+  rewinddir(proc_dir);
+  while (struct dirent *de = readdir(proc_dir)) {
+    if (de->d_type != DT_DIR) continue;
+    Scanner sc = {de->d_name, de->d_name + strlen(de->d_name)};
+    int pid = 0;
+    if (sc.num(pid) && sc.p == sc.end) {
+      procs[pid].seen = generation;
+    }
+  }
+  size_t num_procs = 0;
+  for (auto it = procs.begin(); it != procs.end();) {
+    Proc &proc = it->second;
+    if (proc.seen != generation || !readProc(it->first, proc)) {
+      closeFile(proc.fd);
+      dropThreads(proc);
+      it = procs.erase(it);
+      continue;
+    }
+    num_procs++;
+    ++it;
+  }
+
+  const double jiffy = sysconf(_SC_CLK_TCK);
+  const size_t page_size = sysconf(_SC_PAGE_SIZE);
+  auto lprocs = procLog.initProcs(num_procs);
+  int i = 0;
+  for (auto &[pid, proc] : procs) {
+    auto l = lprocs[i++];
+    const ProcStat &r = proc.stat;
+    l.setPid(r.pid);
+    l.setState(r.state);
+    l.setPpid(r.ppid);
+    l.setCpuUser(r.utime / jiffy);
+    l.setCpuSystem(r.stime / jiffy);
+    l.setCpuChildrenUser(r.cutime / jiffy);
+    l.setCpuChildrenSystem(r.cstime / jiffy);
+    l.setPriority(r.priority);
+    l.setNice(r.nice);
+    l.setNumThreads(r.num_threads);
+    l.setStartTime(r.starttime / jiffy);
+    l.setMemVms(r.vms);
+    l.setMemRss((uint64_t)r.rss * page_size);
+    l.setProcessor(r.processor);
+    l.setName(r.name);
+    l.setExe(proc.exe);
+    auto lcmdline = l.initCmdline(proc.cmdline.size());
+    for (size_t j = 0; j < lcmdline.size(); j++) {
+      lcmdline.set(j, proc.cmdline[j]);
+    }
+  }
+
+  // /proc/stat, the cpu lines after the total
+  ssize_t n = readFile(stat_fd, "/proc/stat", buf.data(), buf.size());
+  CPUTime cpu_times[256];
+  int num_cpus = 0;
+  Scanner sc = {buf.data(), buf.data() + std::max<ssize_t>(n, 0)};
+  sc.nextLine();
+  while (num_cpus < (int)std::size(cpu_times) && sc.startsWith("cpu", 3)) {
+    sc.p += 3;
+    CPUTime &t = cpu_times[num_cpus];
+    if (sc.num(t.id) && sc.num(t.utime) && sc.num(t.ntime) && sc.num(t.stime) && sc.num(t.itime) &&
+        sc.num(t.iowtime) && sc.num(t.irqtime) && sc.num(t.sirqtime)) {
+      num_cpus++;
+    }
+    sc.nextLine();
+  }
+  auto log_cpu_times = procLog.initCpuTimes(num_cpus);
+  for (int i = 0; i < num_cpus; ++i) {
+    auto l = log_cpu_times[i];
+    const CPUTime &r = cpu_times[i];
+    l.setCpuNum(r.id);
+    l.setUser(r.utime / jiffy);
+    l.setNice(r.ntime / jiffy);
+    l.setSystem(r.stime / jiffy);
+    l.setIdle(r.itime / jiffy);
+    l.setIowait(r.iowtime / jiffy);
+    l.setIrq(r.irqtime / jiffy);
+    l.setSoftirq(r.sirqtime / jiffy);
+  }
+
+  // /proc/meminfo
+  n = readFile(meminfo_fd, "/proc/meminfo", buf.data(), buf.size());
+  auto mem = procLog.initMem();
+  const std::pair<const char *, void (cereal::ProcLog::Mem::Builder::*)(uint64_t)> mem_fields[] = {
+    {"MemTotal:", &cereal::ProcLog::Mem::Builder::setTotal},
+    {"MemFree:", &cereal::ProcLog::Mem::Builder::setFree},
+    {"MemAvailable:", &cereal::ProcLog::Mem::Builder::setAvailable},
+    {"Buffers:", &cereal::ProcLog::Mem::Builder::setBuffers},
+    {"Cached:", &cereal::ProcLog::Mem::Builder::setCached},
+    {"Active:", &cereal::ProcLog::Mem::Builder::setActive},
+    {"Inactive:", &cereal::ProcLog::Mem::Builder::setInactive},
+    {"Shmem:", &cereal::ProcLog::Mem::Builder::setShared},
+  };
+  sc = {buf.data(), buf.data() + std::max<ssize_t>(n, 0)};
+  while (sc.p < sc.end) {
+    for (auto &[key, set] : mem_fields) {
+      const size_t len = strlen(key);
+      uint64_t val = 0;
+      if (sc.startsWith(key, len)) {
+        sc.p += len;
+        if (sc.num(val)) (mem.*set)(val * 1024);
+        break;
+      }
+    }
+    sc.nextLine();
+  }
+}
+
+// rescans the task dir when the thread count changed, and reads the stats of all threads
+void ProcSampler::updateThreads(int pid, Proc &proc, const ProcStat &stat) {
+  char path[64];
+  // kernel threads are the only thread of their process
+  const bool kernel_thread = pid == 2 || stat.ppid == 2;
+  if (proc.threads.size() != (kernel_thread ? 1 : (size_t)stat.num_threads)) {
+    std::vector<Thread> threads;
+    threads.reserve(std::max<long>(stat.num_threads, 1));
+    if (kernel_thread) {
+      threads.push_back({.tid = pid});
+    } else {
+      snprintf(path, sizeof(path), "/proc/%d/task", pid);
+      if (DIR *d = opendir(path)) {
+        while (struct dirent *de = readdir(d)) {
+          int tid = 0;
+          Scanner sc = {de->d_name, de->d_name + strlen(de->d_name)};
+          if (sc.num(tid) && sc.p == sc.end) threads.push_back({.tid = tid});
+        }
+        closedir(d);
+      }
+      std::sort(threads.begin(), threads.end(), [](auto &a, auto &b) { return a.tid < b.tid; });
+    }
+    // keep the fds and previous stats of the threads that are still there
+    auto it = proc.threads.begin();
+    for (auto &t : threads) {
+      for (; it != proc.threads.end() && it->tid < t.tid; ++it) {
+        closeFile(it->fd);
+        exited_tids.push_back(it->tid);
+      }
+      if (it != proc.threads.end() && it->tid == t.tid) {
+        t = std::move(*it++);
+      }
+    }
+    for (; it != proc.threads.end(); ++it) {
+      closeFile(it->fd);
+      exited_tids.push_back(it->tid);
+    }
+    proc.threads = std::move(threads);
+  }
+
+  for (auto it = proc.threads.begin(); it != proc.threads.end();) {
+    Thread &t = *it;
+    std::swap(t.prev, t.stat);
+    bool ok = true;
+    if (kernel_thread) {
+      t.stat = stat;
+    } else {
+      snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, t.tid);
+      ssize_t n = readFile(t.fd, path, buf.data(), buf.size());
+      ok = n > 0 && Parser::parseStat(buf.data(), n, t.stat);
+    }
+    if (!ok) {
+      closeFile(t.fd);
+      exited_tids.push_back(t.tid);
+      it = proc.threads.erase(it);
+      continue;
+    }
+    t.renamed = !t.is_new && t.stat.name != t.prev.name;
+    ++it;
+  }
+}
+
+void ProcSampler::buildThreadLog(cereal::ThreadLog::Builder threadLog, bool full) {
+  int num_threads = 0;
+  ProcStat stat;
+  for (auto &[pid, proc] : procs) {
+    // the thread count is in the process' stat. proc.stat is left to readProc, it spots execs and reused pids with it
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    ssize_t n = readFile(proc.fd, path, buf.data(), buf.size());
+    if (n <= 0 || !Parser::parseStat(buf.data(), n, stat) || stat.starttime != proc.stat.starttime) {
+      // exited or the pid was reused, buildProcLog forgets or rereads it
+      dropThreads(proc);
+      continue;
+    }
+    updateThreads(pid, proc, stat);
+    for (auto &t : proc.threads) {
+      num_threads += full || t.is_new || t.renamed || t.stat.utime != t.prev.utime || t.stat.stime != t.prev.stime;
+    }
+  }
+
+  const double jiffy = sysconf(_SC_CLK_TCK);
+  threadLog.setFull(full);
+  auto l = threadLog.initThreads(num_threads);
+  int i = 0;
+  for (auto &[pid, proc] : procs) {
+    for (auto &t : proc.threads) {
+      const bool ran = t.stat.utime != t.prev.utime || t.stat.stime != t.prev.stime;
+      if (full || t.is_new || t.renamed || ran) {
+        l[i].setTid(t.tid);
+        l[i].setPid(pid);
+        if (full || t.is_new || t.renamed) {
+          l[i].setName(t.stat.name);
+        }
+        l[i].setState(t.stat.state);
+        l[i].setProcessor(t.stat.processor);
+        const bool total = full || t.is_new;
+        l[i].setCpuUser((t.stat.utime - (total ? 0 : t.prev.utime)) / jiffy);
+        l[i].setCpuSystem((t.stat.stime - (total ? 0 : t.prev.stime)) / jiffy);
+        i++;
+      }
+      t.is_new = false;
+    }
+  }
+
+  auto exited = threadLog.initExitedTids(exited_tids.size());
+  for (size_t j = 0; j < exited_tids.size(); j++) {
+    exited.set(j, exited_tids[j]);
+  }
+  exited_tids.clear();
+}
@@ -1,3 +1,6 @@
+#include <dirent.h>
+
+#include <map>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -30,6 +33,9 @@ namespace Parser {
 
 std::vector<int> pids();
 std::optional<ProcStat> procStat(std::string stat);
+// procStat without the allocations, for ProcSampler. parses the len bytes of a /proc/pid/stat or
+// /proc/pid/task/tid/stat into stat, returns false if they aren't one
+bool parseStat(const char *buf, size_t len, ProcStat &stat);
 std::vector<std::string> cmdline(std::istream &stream);
 std::vector<CPUTime> cpuTimes(std::istream &stream);
 std::unordered_map<std::string, uint64_t> memInfo(std::istream &stream);
@@ -37,4 +43,49 @@ const ProcCache &getProcExtraInfo(int pid, const std::string &name);
 
 };  // namespace Parser
 
+// reads everything in /proc from scratch, see ProcSampler for the incremental version proclogd uses
 void buildProcLogMessage(MessageBuilder &msg);
+
+// Incremental /proc sampler. The stat files stay open and are re-read with pread, cmdline and exe are only read for
+// new processes (or after an exec). Thread stats are sampled separately, as deltas to the previous sample.
+// Processes are found by buildProcLog, buildThreadLog only follows the threads of the ones it found.
+class ProcSampler {
+public:
+  ProcSampler();
+  ~ProcSampler();
+  void buildProcLog(cereal::ProcLog::Builder procLog);
+  // full: all threads with their names and total cpu times, instead of the ones that are new or ran since the last call
+  void buildThreadLog(cereal::ThreadLog::Builder threadLog, bool full);
+
+private:
+  struct Thread {
+    int tid;
+    int fd = -1;
+    bool is_new = true, renamed = false;
+    ProcStat stat, prev;
+  };
+  struct Proc {
+    int fd = -1;
+    bool extra_info = false;
+    uint64_t seen = 0;
+    ProcStat stat;
+    std::string exe;
+    std::vector<std::string> cmdline;
+    std::vector<Thread> threads;
+  };
+
+  ssize_t readFile(int &fd, const char *path, char *buf, size_t size);
+  void closeFile(int &fd);
+  bool readProc(int pid, Proc &proc);
+  void dropThreads(Proc &proc);
+  void updateThreads(int pid, Proc &proc, const ProcStat &stat);
+
+  std::map<int, Proc> procs;
+  std::vector<int> exited_tids;
+  uint64_t generation = 0;
+  DIR *proc_dir = nullptr;
+  int stat_fd = -1, meminfo_fd = -1;
+  int open_fds = 0, max_open_fds = 0;
+  std::vector<char> buf;
+  std::string prev_name;
+};
@@ -0,0 +1,84 @@
+// benchmark for building procLog, ProcSampler against reading /proc from scratch with buildProcLogMessage
+// usage: ./proclog_benchmark [iterations] [threads to spawn]
+// spawns idle threads to get closer to the thread count of a device, then times both and a threadLog delta
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/proclogd/proclog.h"
+
+static double cpu_millis() {
+  struct timespec t;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+static void report(const char *name, std::vector<double> &times, double cpu_time) {
+  std::sort(times.begin(), times.end());
+  auto pct = [&](double p) { return times[std::min<size_t>(times.size() - 1, times.size() * p)]; };
+  double sum = 0;
+  for (double t : times) sum += t;
+  printf("%-10s mean %7.3fms  p50 %7.3fms  p99 %7.3fms  max %7.3fms  cpu %7.3fms\n",
+         name, sum / times.size(), pct(0.5), pct(0.99), times.back(), cpu_time / times.size());
+}
+
+template <typename F>
+static void bench(const char *name, int iterations, F f) {
+  std::vector<double> times;
+  double cpu_start = cpu_millis();
+  for (int i = 0; i < iterations; i++) {
+    double t = millis_since_boot();
+    f();
+    times.push_back(millis_since_boot() - t);
+  }
+  report(name, times, cpu_millis() - cpu_start);
+}
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 100;
+  const int num_threads = argc > 2 ? atoi(argv[2]) : 200;
+
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&]() {
+      while (!stop) util::sleep_for(10);
+    });
+  }
+
+  ProcSampler sampler;
+  size_t procs = 0, reference_procs = 0, thread_log_threads = 0;
+  bench("from /proc", iterations, [&]() {
+    MessageBuilder msg;
+    buildProcLogMessage(msg);
+    reference_procs = msg.getRoot<cereal::Event>().getProcLog().getProcs().size();
+  });
+  bench("sampler", iterations, [&]() {
+    MessageBuilder msg;
+    auto procLog = msg.initEvent().initProcLog();
+    sampler.buildProcLog(procLog);
+    procs = procLog.getProcs().size();
+  });
+  {
+    MessageBuilder msg;
+    sampler.buildThreadLog(msg.initEvent().initThreadLog(), true);
+  }
+  bench("threadLog", iterations, [&]() {
+    MessageBuilder msg;
+    auto threadLog = msg.initEvent().initThreadLog();
+    sampler.buildThreadLog(threadLog, false);
+    thread_log_threads += threadLog.getThreads().size();
+  });
+  printf("%zu processes (%zu reading from scratch), %.1f threads per threadLog delta\n",
+         procs, reference_procs, (double)thread_log_threads / iterations);
+
+  stop = true;
+  for (auto &t : threads) t.join();
+  return 0;
+}
@@ -0,0 +1,232 @@
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/util.h"
+#include "selfdrive/proclogd/proclog.h"
+
+// comm names the kernel allows, with the spaces and parens that trip up parsers
+const char *const odd_names[] = {"a b", "x) (y", "))", "((", ") S 1 2", ""};
+
+static std::string stat_line(const std::string &name) {
+  return "33012 (" + name + ") S 32978 6620 6620 0 -1 4194368 2042377 0 144 0 24510 11627 0 "
+         "0 20 0 39 0 53077 830029824 62214 18446744073709551615 94257242783744 94257366235808 "
+         "140735738643248 0 0 0 0 4098 1073808632 0 0 0 17 2 0 0 2 0 0 94257370858656 94257371248232 "
+         "94257404952576 140735738648768 140735738648823 140735738648823 140735738650595 0\n";
+}
+
+static void require_same(const ProcStat &a, const ProcStat &b) {
+  REQUIRE(a.pid == b.pid);
+  REQUIRE(a.name == b.name);
+  REQUIRE(a.state == b.state);
+  REQUIRE(a.ppid == b.ppid);
+  REQUIRE(a.utime == b.utime);
+  REQUIRE(a.stime == b.stime);
+  REQUIRE(a.cutime == b.cutime);
+  REQUIRE(a.cstime == b.cstime);
+  REQUIRE(a.priority == b.priority);
+  REQUIRE(a.nice == b.nice);
+  REQUIRE(a.num_threads == b.num_threads);
+  REQUIRE(a.starttime == b.starttime);
+  REQUIRE(a.vms == b.vms);
+  REQUIRE(a.rss == b.rss);
+  REQUIRE(a.processor == b.processor);
+}
+
+static void require_same_stat(const std::string &stat) {
+  auto expected = Parser::procStat(stat);
+  REQUIRE(expected);
+  ProcStat s = {};
+  REQUIRE(Parser::parseStat(stat.data(), stat.size(), s));
+  require_same(s, *expected);
+}
+
+// a child named name that waits for a byte on the returned fd, then execs sleep
+static pid_t spawn(const char *name, int &fd) {
+  int ready[2], go[2];
+  REQUIRE(pipe(ready) == 0);
+  REQUIRE(pipe(go) == 0);
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    prctl(PR_SET_NAME, name);
+    char c = 0;
+    if (write(ready[1], &c, 1) == 1 && read(go[0], &c, 1) == 1) {
+      execlp("sleep", "sleep", "30", (char *)nullptr);
+    }
+    _exit(1);
+  }
+  char c;
+  REQUIRE(read(ready[0], &c, 1) == 1);
+  close(ready[0]);
+  close(ready[1]);
+  close(go[0]);
+  fd = go[1];
+  return pid;
+}
+
+static void stop(pid_t pid, int fd) {
+  close(fd);
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+}
+
+static std::map<int, cereal::ProcLog::Process::Reader> procs_by_pid(cereal::ProcLog::Reader procLog) {
+  std::map<int, cereal::ProcLog::Process::Reader> procs;
+  for (auto p : procLog.getProcs()) {
+    procs.emplace(p.getPid(), p);
+  }
+  return procs;
+}
+
+static std::vector<std::string> cmdline(cereal::ProcLog::Process::Reader p) {
+  std::vector<std::string> ret;
+  for (auto arg : p.getCmdline()) {
+    ret.push_back(arg.cStr());
+  }
+  return ret;
+}
+
+TEST_CASE("Parser::parseStat matches Parser::procStat") {
+  SECTION("odd names") {
+    for (auto name : odd_names) {
+      INFO(name);
+      require_same_stat(stat_line(name));
+      REQUIRE(Parser::procStat(stat_line(name))->name == name);
+    }
+  }
+  SECTION("all processes and threads") {
+    std::atomic<int> tid = 0;
+    std::atomic<bool> done = false;
+    std::thread t([&]() {
+      prctl(PR_SET_NAME, "t) (x y");
+      tid = syscall(SYS_gettid);
+      while (!done) util::sleep_for(1);
+    });
+    while (tid == 0) util::sleep_for(1);
+    for (int pid : Parser::pids()) {
+      std::string stat = util::read_file("/proc/" + std::to_string(pid) + "/stat");
+      if (!stat.empty()) {
+        INFO(stat);
+        require_same_stat(stat);
+      }
+    }
+    std::string task = util::read_file("/proc/self/task/" + std::to_string(tid) + "/stat");
+    require_same_stat(task);
+    REQUIRE(Parser::procStat(task)->name == "t) (x y");
+    done = true;
+    t.join();
+  }
+  SECTION("not a stat") {
+    for (std::string stat : {"", "33012", "33012 (name S 32978", "33012 (name) S", ")( S 1"}) {
+      INFO(stat);
+      ProcStat s = {};
+      REQUIRE_FALSE(Parser::parseStat(stat.data(), stat.size(), s));
+      REQUIRE_FALSE(Parser::procStat(stat));
+    }
+  }
+}
+
+TEST_CASE("ProcSampler matches buildProcLogMessage") {
+  std::vector<std::pair<pid_t, int>> children;
+  for (auto name : odd_names) {
+    int fd;
+    pid_t pid = spawn(name, fd);
+    children.push_back({pid, fd});
+  }
+
+  ProcSampler sampler;
+  {
+    MessageBuilder msg;
+    sampler.buildProcLog(msg.initEvent().initProcLog());
+  }
+  // the second time from the open files
+  MessageBuilder msg, expected_msg;
+  sampler.buildProcLog(msg.initEvent().initProcLog());
+  buildProcLogMessage(expected_msg);
+  auto procs = procs_by_pid(msg.getRoot<cereal::Event>().asReader().getProcLog());
+  auto expected = procs_by_pid(expected_msg.getRoot<cereal::Event>().asReader().getProcLog());
+
+  std::vector<int> pids = {getpid()};
+  for (auto &[pid, fd] : children) pids.push_back(pid);
+  for (int pid : pids) {
+    INFO(pid);
+    REQUIRE(procs.count(pid) == 1);
+    REQUIRE(expected.count(pid) == 1);
+    auto p = procs.at(pid), e = expected.at(pid);
+    REQUIRE(p.getName() == e.getName());
+    REQUIRE(p.getPpid() == e.getPpid());
+    REQUIRE(p.getNumThreads() == e.getNumThreads());
+    REQUIRE(p.getPriority() == e.getPriority());
+    REQUIRE(p.getNice() == e.getNice());
+    REQUIRE(p.getStartTime() == e.getStartTime());
+    REQUIRE(p.getExe() == e.getExe());
+    REQUIRE(cmdline(p) == cmdline(e));
+  }
+  for (size_t i = 0; i < children.size(); i++) {
+    REQUIRE(procs.at(children[i].first).getName() == odd_names[i]);
+  }
+
+  for (auto &[pid, fd] : children) stop(pid, fd);
+}
+
+TEST_CASE("ProcSampler notices an exec and an exit between threadLogs") {
+  int fd;
+  pid_t pid = spawn("x) (y", fd);
+
+  ProcSampler sampler;
+  {
+    MessageBuilder msg;
+    sampler.buildProcLog(msg.initEvent().initProcLog());
+    auto p = procs_by_pid(msg.getRoot<cereal::Event>().asReader().getProcLog()).at(pid);
+    REQUIRE(p.getName() == "x) (y");
+    REQUIRE(util::readlink("/proc/self/exe") == p.getExe().cStr());
+  }
+  {
+    MessageBuilder msg;
+    sampler.buildThreadLog(msg.initEvent().initThreadLog(), true);
+  }
+
+  // the child execs, and a threadLog is sampled before the next procLog
+  char c = 0;
+  REQUIRE(write(fd, &c, 1) == 1);
+  for (int i = 0; i < 1000 && util::read_file("/proc/" + std::to_string(pid) + "/comm") != "sleep\n"; i++) {
+    util::sleep_for(1);
+  }
+  {
+    MessageBuilder msg;
+    sampler.buildThreadLog(msg.initEvent().initThreadLog(), false);
+  }
+  {
+    MessageBuilder msg;
+    sampler.buildProcLog(msg.initEvent().initProcLog());
+    auto p = procs_by_pid(msg.getRoot<cereal::Event>().asReader().getProcLog()).at(pid);
+    REQUIRE(p.getName() == "sleep");
+    REQUIRE(cmdline(p) == std::vector<std::string>{"sleep", "30"});
+    REQUIRE(util::readlink("/proc/self/exe") != p.getExe().cStr());
+  }
+
+  // it exits, and a threadLog reports its thread gone before the next procLog
+  stop(pid, fd);
+  {
+    MessageBuilder msg;
+    auto threadLog = msg.initEvent().initThreadLog();
+    sampler.buildThreadLog(threadLog, false);
+    auto exited = threadLog.asReader().getExitedTids();
+    REQUIRE(std::find(exited.begin(), exited.end(), pid) != exited.end());
+  }
+  {
+    MessageBuilder msg;
+    sampler.buildProcLog(msg.initEvent().initProcLog());
+    REQUIRE(procs_by_pid(msg.getRoot<cereal::Event>().asReader().getProcLog()).count(pid) == 0);
+  }
+}
@@ -1,11 +1,12 @@
 #include "bmx055_accel.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 
-BMX055_Accel::BMX055_Accel(I2CBus *bus) : I2CSensor(bus) {}
+BMX055_Accel::BMX055_Accel(I2CBus *bus) : I2CSensor(bus), clock(BMX055_ACCEL_PERIOD_NS) {}
 
 int BMX055_Accel::init() {
   int ret = 0;
@@ -34,7 +35,14 @@ int BMX055_Accel::init() {
   if (ret < 0) {
     goto fail;
   }
-  ret = set_register(BMX055_ACCEL_I2C_REG_BW, BMX055_ACCEL_BW_125HZ);
+  // 125 Hz output data rate, close to the rate sensord publishes at
+  ret = set_register(BMX055_ACCEL_I2C_REG_BW, BMX055_ACCEL_BW_62_5HZ);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  // writing the FIFO config also clears it
+  ret = set_register(BMX055_ACCEL_I2C_REG_FIFO_CONFIG_1, BMX055_ACCEL_FIFO_MODE_STREAM | BMX055_ACCEL_FIFO_DATA_XYZ);
   if (ret < 0) {
     goto fail;
   }
@@ -43,11 +51,28 @@ fail:
   return ret;
 }
 
+int BMX055_Accel::read_fifo() {
+  uint64_t read_time = nanos_since_boot();
+  uint8_t status;
+  int len = read_register(BMX055_ACCEL_I2C_REG_FIFO_STATUS, &status, 1);
+  assert(len == 1);
+
+  const int frames = std::min(status & 0x7F, FIFO_MAX_FRAMES);
+  if (frames > 0) {
+    // the FIFO data register doesn't advance, a burst reads consecutive frames
+    len = read_burst(BMX055_ACCEL_I2C_REG_FIFO, fifo, frames * BMX055_ACCEL_FIFO_FRAME_SIZE);
+    assert(len == frames * BMX055_ACCEL_FIFO_FRAME_SIZE);
+  }
+
+  clock.update(read_time, frames, status & BMX055_ACCEL_FIFO_OVERRUN);
+  num_samples = frames;
+  next_sample = 0;
+  return num_samples;
+}
+
 void BMX055_Accel::get_event(cereal::SensorEventData::Builder &event) {
-  uint64_t start_time = nanos_since_boot();
-  uint8_t buffer[6];
-  int len = read_register(BMX055_ACCEL_I2C_REG_X_LSB, buffer, sizeof(buffer));
-  assert(len == 6);
+  assert(next_sample < num_samples);
+  const uint8_t *buffer = &fifo[next_sample * BMX055_ACCEL_FIFO_FRAME_SIZE];
 
   // 12 bit = +-2g
   float scale = 9.81 * 2.0f / (1 << 11);
@@ -59,11 +84,12 @@ void BMX055_Accel::get_event(cereal::SensorEventData::Builder &event) {
   event.setVersion(1);
   event.setSensor(SENSOR_ACCELEROMETER);
   event.setType(SENSOR_TYPE_ACCELEROMETER);
-  event.setTimestamp(start_time);
+  event.setTimestamp(clock.timestamp(next_sample));
 
   float xyz[] = {x, y, z};
   auto svec = event.initAcceleration();
   svec.setV(xyz);
   svec.setStatus(true);
 
+  next_sample++;
 }
@@ -9,8 +9,10 @@
 #define BMX055_ACCEL_I2C_REG_ID     0x00
 #define BMX055_ACCEL_I2C_REG_X_LSB  0x02
 #define BMX055_ACCEL_I2C_REG_TEMP   0x08
+#define BMX055_ACCEL_I2C_REG_FIFO_STATUS 0x0E
 #define BMX055_ACCEL_I2C_REG_BW     0x10
 #define BMX055_ACCEL_I2C_REG_HBW    0x13
+#define BMX055_ACCEL_I2C_REG_FIFO_CONFIG_1 0x3E
 #define BMX055_ACCEL_I2C_REG_FIFO   0x3F
 
 // Constants
@@ -28,10 +30,26 @@
 #define BMX055_ACCEL_BW_500HZ   0b01110
 #define BMX055_ACCEL_BW_1000HZ  0b01111
 
+// stream mode keeps the newest 32 frames of x, y and z
+#define BMX055_ACCEL_FIFO_MODE_STREAM   (0b10 << 6)
+#define BMX055_ACCEL_FIFO_DATA_XYZ      0b00
+#define BMX055_ACCEL_FIFO_OVERRUN       0b10000000
+#define BMX055_ACCEL_FIFO_FRAME_SIZE    6
+
+// the output data rate is twice the filter bandwidth
+#define BMX055_ACCEL_PERIOD_NS (1000000000ULL / 125)
+
 class BMX055_Accel : public I2CSensor {
   uint8_t get_device_address() {return BMX055_ACCEL_I2C_ADDR;}
+
+  uint8_t fifo[FIFO_MAX_FRAMES * BMX055_ACCEL_FIFO_FRAME_SIZE];
+  int num_samples = 0;
+  int next_sample = 0;
+  FifoClock clock;
+
 public:
   BMX055_Accel(I2CBus *bus);
   int init();
+  int read_fifo();
   void get_event(cereal::SensorEventData::Builder &event);
 };
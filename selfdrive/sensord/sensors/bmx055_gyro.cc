@@ -1,14 +1,16 @@
 #include "bmx055_gyro.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 
 #define DEG2RAD(x) ((x) * M_PI / 180.0)
 
 
-BMX055_Gyro::BMX055_Gyro(I2CBus *bus) : I2CSensor(bus) {}
+BMX055_Gyro::BMX055_Gyro(I2CBus *bus) : I2CSensor(bus), clock(BMX055_GYRO_PERIOD_NS) {}
 
 int BMX055_Gyro::init() {
   int ret = 0;
@@ -38,8 +40,8 @@ int BMX055_Gyro::init() {
     goto fail;
   }
 
-  // 116 Hz filter
-  ret = set_register(BMX055_GYRO_I2C_REG_BW, BMX055_GYRO_BW_116HZ);
+  // 32 Hz filter, 100 Hz output data rate like the rate sensord publishes at
+  ret = set_register(BMX055_GYRO_I2C_REG_BW, BMX055_GYRO_BW_32HZ);
   if (ret < 0) {
     goto fail;
   }
@@ -50,15 +52,38 @@ int BMX055_Gyro::init() {
     goto fail;
   }
 
+  // writing the FIFO config also clears it
+  ret = set_register(BMX055_GYRO_I2C_REG_FIFO_CONFIG_1, BMX055_GYRO_FIFO_MODE_STREAM | BMX055_GYRO_FIFO_DATA_XYZ);
+  if (ret < 0) {
+    goto fail;
+  }
+
 fail:
   return ret;
 }
 
+int BMX055_Gyro::read_fifo() {
+  uint64_t read_time = nanos_since_boot();
+  uint8_t status;
+  int len = read_register(BMX055_GYRO_I2C_REG_FIFO_STATUS, &status, 1);
+  assert(len == 1);
+
+  const int frames = std::min(status & 0x7F, FIFO_MAX_FRAMES);
+  if (frames > 0) {
+    // the FIFO data register doesn't advance, a burst reads consecutive frames
+    len = read_burst(BMX055_GYRO_I2C_REG_FIFO, fifo, frames * BMX055_GYRO_FIFO_FRAME_SIZE);
+    assert(len == frames * BMX055_GYRO_FIFO_FRAME_SIZE);
+  }
+
+  clock.update(read_time, frames, status & BMX055_GYRO_FIFO_OVERRUN);
+  num_samples = frames;
+  next_sample = 0;
+  return num_samples;
+}
+
 void BMX055_Gyro::get_event(cereal::SensorEventData::Builder &event) {
-  uint64_t start_time = nanos_since_boot();
-  uint8_t buffer[6];
-  int len = read_register(BMX055_GYRO_I2C_REG_RATE_X_LSB, buffer, sizeof(buffer));
-  assert(len == 6);
+  assert(next_sample < num_samples);
+  const uint8_t *buffer = &fifo[next_sample * BMX055_GYRO_FIFO_FRAME_SIZE];
 
   // 16 bit = +- 125 deg/s
   float scale = 125.0f / (1 << 15);
@@ -70,11 +95,12 @@ void BMX055_Gyro::get_event(cereal::SensorEventData::Builder &event) {
   event.setVersion(1);
   event.setSensor(SENSOR_GYRO_UNCALIBRATED);
   event.setType(SENSOR_TYPE_GYROSCOPE_UNCALIBRATED);
-  event.setTimestamp(start_time);
+  event.setTimestamp(clock.timestamp(next_sample));
 
   float xyz[] = {x, y, z};
   auto svec = event.initGyroUncalibrated();
   svec.setV(xyz);
   svec.setStatus(true);
 
+  next_sample++;
 }
@@ -8,9 +8,11 @@
 // Registers of the chip
 #define BMX055_GYRO_I2C_REG_ID         0x00
 #define BMX055_GYRO_I2C_REG_RATE_X_LSB 0x02
+#define BMX055_GYRO_I2C_REG_FIFO_STATUS 0x0E
 #define BMX055_GYRO_I2C_REG_RANGE      0x0F
 #define BMX055_GYRO_I2C_REG_BW         0x10
 #define BMX055_GYRO_I2C_REG_HBW        0x13
+#define BMX055_GYRO_I2C_REG_FIFO_CONFIG_1 0x3E
 #define BMX055_GYRO_I2C_REG_FIFO       0x3F
 
 // Constants
@@ -25,13 +27,29 @@
 #define BMX055_GYRO_RANGE_250       0b011
 #define BMX055_GYRO_RANGE_125       0b100
 
-#define BMX055_GYRO_BW_116HZ 0b0010
+#define BMX055_GYRO_BW_116HZ 0b0010  // 1000 Hz output data rate
+#define BMX055_GYRO_BW_32HZ  0b0111  // 100 Hz output data rate
+
+// stream mode keeps the newest 100 frames of x, y and z
+#define BMX055_GYRO_FIFO_MODE_STREAM   (0b10 << 6)
+#define BMX055_GYRO_FIFO_DATA_XYZ      0b00
+#define BMX055_GYRO_FIFO_OVERRUN       0b10000000
+#define BMX055_GYRO_FIFO_FRAME_SIZE    6
+
+#define BMX055_GYRO_PERIOD_NS (1000000000ULL / 100)
 
 
 class BMX055_Gyro : public I2CSensor {
   uint8_t get_device_address() {return BMX055_GYRO_I2C_ADDR;}
+
+  uint8_t fifo[FIFO_MAX_FRAMES * BMX055_GYRO_FIFO_FRAME_SIZE];
+  int num_samples = 0;
+  int next_sample = 0;
+  FifoClock clock;
+
 public:
   BMX055_Gyro(I2CBus *bus);
   int init();
+  int read_fifo();
   void get_event(cereal::SensorEventData::Builder &event);
 };
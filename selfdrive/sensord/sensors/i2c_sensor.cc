@@ -1,5 +1,7 @@
 #include "i2c_sensor.h"
 
+#include <algorithm>
+
 int16_t read_12_bit(uint8_t lsb, uint8_t msb) {
   uint16_t combined = (uint16_t(msb) << 8) | uint16_t(lsb & 0xF0);
   return int16_t(combined) / (1 << 4);
@@ -15,6 +17,22 @@ int32_t read_20_bit(uint8_t b2, uint8_t b1, uint8_t b0) {
   return int32_t(combined) / (1 << 4);
 }
 
+void FifoClock::update(uint64_t read_time, int count, bool overrun) {
+  if (count == 0) {
+    return;
+  }
+
+  uint64_t t = read_time;
+  step = period;
+  if (newest != 0 && !overrun) {
+    t = std::clamp(newest + count * period, read_time - period, read_time);
+    // never before the samples of the previous burst
+    step = std::min(period, (t - newest) / count);
+  }
+  newest = t;
+  n = count;
+}
+
 
 I2CSensor::I2CSensor(I2CBus *bus) : bus(bus) {
 }
@@ -23,6 +41,10 @@ int I2CSensor::read_register(uint register_address, uint8_t *buffer, uint8_t len
   return bus->read_register(get_device_address(), register_address, buffer, len);
 }
 
+int I2CSensor::read_burst(uint register_address, uint8_t *buffer, size_t len) {
+  return bus->read_burst(get_device_address(), register_address, buffer, len);
+}
+
 int I2CSensor::set_register(uint register_address, uint8_t data) {
   return bus->set_register(get_device_address(), register_address, data);
 }
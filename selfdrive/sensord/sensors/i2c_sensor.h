@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include "cereal/gen/cpp/log.capnp.h"
@@ -11,6 +12,27 @@ int16_t read_12_bit(uint8_t lsb, uint8_t msb);
 int16_t read_16_bit(uint8_t lsb, uint8_t msb);
 int32_t read_20_bit(uint8_t b2, uint8_t b1, uint8_t b0);
 
+// max frames drained from a FIFO per cycle, the rest is read in the next one
+#define FIFO_MAX_FRAMES 32
+
+// timestamps for the samples drained from a FIFO. the samples are kept on a grid of the
+// nominal sample period, which is pulled back whenever the newest sample of a burst would
+// fall outside of the last period before the read. the first burst and the one after an
+// overrun start a new grid at the read time
+class FifoClock {
+public:
+  FifoClock(uint64_t period_ns) : period(period_ns) {}
+  // n samples read at read_time, after an overrun samples were lost
+  void update(uint64_t read_time, int n, bool overrun = false);
+  // timestamp of the i-th sample of the last burst, the oldest first
+  uint64_t timestamp(int i) const { return newest - (n - 1 - i) * step; }
+
+private:
+  const uint64_t period;
+  uint64_t newest = 0;
+  uint64_t step = 0;
+  int n = 0;
+};
 
 class I2CSensor : public Sensor {
 private:
@@ -20,6 +42,7 @@ private:
 public:
   I2CSensor(I2CBus *bus);
   int read_register(uint register_address, uint8_t *buffer, uint8_t len);
+  int read_burst(uint register_address, uint8_t *buffer, size_t len);
   int set_register(uint register_address, uint8_t data);
   virtual int init() = 0;
   virtual void get_event(cereal::SensorEventData::Builder &event) = 0;
@@ -0,0 +1,99 @@
+#include "lsm6ds3_fifo.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+
+LSM6DS3_Fifo::LSM6DS3_Fifo(I2CBus *bus, LSM6DS3_Accel *accel, LSM6DS3_Gyro *gyro)
+  : I2CSensor(bus), accel(accel), gyro(gyro), clock(LSM6DS3_FIFO_PERIOD_NS) {}
+
+int LSM6DS3_Fifo::init() {
+  int ret = 0;
+  uint8_t buffer[1];
+
+  // chip ID and output data rates
+  ret = accel->init();
+  if (ret < 0) {
+    goto fail;
+  }
+  ret = gyro->init();
+  if (ret < 0) {
+    goto fail;
+  }
+
+  ret = read_register(LSM6DS3_FIFO_I2C_REG_ID, buffer, 1);
+  if(ret < 0) {
+    LOGE("Reading chip ID failed: %d", ret);
+    goto fail;
+  }
+  if (buffer[0] == LSM6DS3TRC_FIFO_CHIP_ID) {
+    diff_mask = 0x07FF;
+  }
+
+  // both at the full rate
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL3, (LSM6DS3_FIFO_NO_DECIMATION << 3) | LSM6DS3_FIFO_NO_DECIMATION);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  // bypass clears the FIFO, continuous overwrites the oldest samples when it is full
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, LSM6DS3_FIFO_MODE_BYPASS);
+  if (ret < 0) {
+    goto fail;
+  }
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, LSM6DS3_FIFO_ODR_104HZ | LSM6DS3_FIFO_MODE_CONTINUOUS);
+  if (ret < 0) {
+    goto fail;
+  }
+
+fail:
+  return ret;
+}
+
+int LSM6DS3_Fifo::read_fifo() {
+  uint64_t read_time = nanos_since_boot();
+  uint8_t status[4];
+  int len = read_register(LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1, status, sizeof(status));
+  assert(len == sizeof(status));
+
+  int words = ((status[1] << 8) | status[0]) & diff_mask;
+  const int pattern = ((status[3] << 8) | status[2]) & 0x3FF;
+  const bool overrun = status[1] & LSM6DS3_FIFO_STATUS2_OVER_RUN;
+
+  // after an overrun the next word can be in the middle of a frame
+  if (pattern != 0 && words >= LSM6DS3_FIFO_FRAME_WORDS - pattern) {
+    const int skip = LSM6DS3_FIFO_FRAME_WORDS - pattern;
+    len = read_burst(LSM6DS3_FIFO_I2C_REG_FIFO_DATA, fifo, skip * 2);
+    assert(len == skip * 2);
+    words -= skip;
+  } else if (pattern != 0) {
+    words = 0;
+  }
+
+  const int frames = std::min(words / LSM6DS3_FIFO_FRAME_WORDS, FIFO_MAX_FRAMES);
+  if (frames > 0) {
+    const int frame_size = LSM6DS3_FIFO_FRAME_WORDS * 2;
+    len = read_burst(LSM6DS3_FIFO_I2C_REG_FIFO_DATA, fifo, frames * frame_size);
+    assert(len == frames * frame_size);
+  }
+
+  clock.update(read_time, frames, overrun || pattern != 0);
+  num_samples = frames * 2;
+  next_sample = 0;
+  return num_samples;
+}
+
+void LSM6DS3_Fifo::get_event(cereal::SensorEventData::Builder &event) {
+  assert(next_sample < num_samples);
+  const int frame = next_sample / 2;
+  const uint8_t *data = &fifo[frame * LSM6DS3_FIFO_FRAME_WORDS * 2];
+  // gyro first
+  if (next_sample % 2 == 0) {
+    gyro->fill_event(event, data, clock.timestamp(frame));
+  } else {
+    accel->fill_event(event, data + 6, clock.timestamp(frame));
+  }
+  next_sample++;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "selfdrive/sensord/sensors/i2c_sensor.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_accel.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_gyro.h"
+
+// Address of the chip on the bus
+#define LSM6DS3_FIFO_I2C_ADDR       0x6A
+
+// Registers of the chip
+#define LSM6DS3_FIFO_I2C_REG_ID           0x0F
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL3   0x08
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5   0x0A
+#define LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1 0x3A
+#define LSM6DS3_FIFO_I2C_REG_FIFO_DATA    0x3E
+
+// Constants
+#define LSM6DS3TRC_FIFO_CHIP_ID         0x6A
+#define LSM6DS3_FIFO_NO_DECIMATION      0b001
+#define LSM6DS3_FIFO_ODR_104HZ          (0b0100 << 3)
+#define LSM6DS3_FIFO_MODE_BYPASS        0b000
+#define LSM6DS3_FIFO_MODE_CONTINUOUS    0b110
+#define LSM6DS3_FIFO_STATUS2_OVER_RUN   0b01000000
+
+// the gyro and the accelerometer share the FIFO, every frame is a gyro and an accelerometer sample
+#define LSM6DS3_FIFO_FRAME_WORDS 6
+#define LSM6DS3_FIFO_PERIOD_NS (1000000000ULL / 104)
+
+
+// the gyro and accelerometer samples of the chip's FIFO, oldest first
+class LSM6DS3_Fifo : public I2CSensor {
+  uint8_t get_device_address() {return LSM6DS3_FIFO_I2C_ADDR;}
+  LSM6DS3_Accel *accel;
+  LSM6DS3_Gyro *gyro;
+  uint16_t diff_mask = 0x0FFF;
+
+  uint8_t fifo[FIFO_MAX_FRAMES * LSM6DS3_FIFO_FRAME_WORDS * 2];
+  int num_samples = 0;
+  int next_sample = 0;
+  FifoClock clock;
+
+public:
+  LSM6DS3_Fifo(I2CBus *bus, LSM6DS3_Accel *accel, LSM6DS3_Gyro *gyro);
+  int init();
+  int read_fifo();
+  void get_event(cereal::SensorEventData::Builder &event);
+};
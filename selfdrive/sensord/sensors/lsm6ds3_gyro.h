@@ -23,4 +23,6 @@ public:
   LSM6DS3_Gyro(I2CBus *bus);
   int init();
   void get_event(cereal::SensorEventData::Builder &event);
+  // event from the 6 output bytes, from the registers or the FIFO
+  void fill_event(cereal::SensorEventData::Builder &event, const uint8_t *buffer, uint64_t timestamp);
 };
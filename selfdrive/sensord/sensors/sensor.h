@@ -6,5 +6,8 @@ class Sensor {
 public:
   virtual ~Sensor() {};
   virtual int init() = 0;
+  // sensors with a hardware FIFO drain it here in one burst and return the number of samples,
+  // get_event is then called once for each of them. the others read their sample in get_event
+  virtual int read_fifo() { return 1; }
   virtual void get_event(cereal::SensorEventData::Builder &event) = 0;
 };
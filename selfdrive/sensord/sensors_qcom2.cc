@@ -16,6 +16,7 @@
 #include "selfdrive/sensord/sensors/constants.h"
 #include "selfdrive/sensord/sensors/light_sensor.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_accel.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_fifo.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_gyro.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_temp.h"
 #include "selfdrive/sensord/sensors/mmc5603nj_magn.h"
@@ -42,6 +43,7 @@ int sensor_loop() {
 
   LSM6DS3_Accel lsm6ds3_accel(i2c_bus_imu);
   LSM6DS3_Gyro lsm6ds3_gyro(i2c_bus_imu);
+  LSM6DS3_Fifo lsm6ds3_fifo(i2c_bus_imu, &lsm6ds3_accel, &lsm6ds3_gyro);
   LSM6DS3_Temp lsm6ds3_temp(i2c_bus_imu);
 
   MMC5603NJ_Magn mmc5603nj_magn(i2c_bus_imu);
@@ -55,8 +57,8 @@ int sensor_loop() {
   sensors_init.push_back({&bmx055_magn, true});
   sensors_init.push_back({&bmx055_temp, true});
 
-  sensors_init.push_back({&lsm6ds3_accel, true});
-  sensors_init.push_back({&lsm6ds3_gyro, true});
+  // the accelerometer and gyro samples come from the FIFO
+  sensors_init.push_back({&lsm6ds3_fifo, true});
   sensors_init.push_back({&lsm6ds3_temp, true});
 
   sensors_init.push_back({&mmc5603nj_magn, false});
@@ -81,22 +83,36 @@ int sensor_loop() {
 
   PubMaster pm({"sensorEvents"});
 
+  std::vector<int> num_samples(sensors.size());
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
   while (!do_exit) {
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    // drain the FIFOs, one burst read per sensor
+    int num_events = 0;
+    for (int i = 0; i < sensors.size(); i++) {
+      num_samples[i] = sensors[i]->read_fifo();
+      num_events += num_samples[i];
+    }
 
-    const int num_events = sensors.size();
     MessageBuilder msg;
     auto sensor_events = msg.initEvent().initSensorEvents(num_events);
 
-    for (int i = 0; i < num_events; i++) {
-      auto event = sensor_events[i];
-      sensors[i]->get_event(event);
+    int n = 0;
+    for (int i = 0; i < sensors.size(); i++) {
+      for (int j = 0; j < num_samples[i]; j++) {
+        auto event = sensor_events[n++];
+        sensors[i]->get_event(event);
+      }
     }
 
     pm.send("sensorEvents", msg);
 
-    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::milliseconds(10) - (end - begin));
+    // fixed 10ms cycles, the sample timestamps come from the FIFOs
+    next += std::chrono::milliseconds(10);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
   }
   return 0;
 }
@@ -0,0 +1,71 @@
+#include "selfdrive/sensord/test/fake_i2c.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+FakeI2CBus::FakeI2CBus(const std::string &path) {
+  load(path);
+}
+
+void FakeI2CBus::load(const std::string &path) {
+  std::ifstream f(path);
+  if (!f.is_open()) {
+    throw std::runtime_error("Failed to open I2C register dump " + path);
+  }
+
+  std::string line;
+  while (std::getline(f, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    std::istringstream ss(line);
+    std::vector<std::string> tokens;
+    for (std::string token; ss >> token;) tokens.push_back(token);
+    if (tokens.size() < 3) {
+      throw std::runtime_error("Malformed I2C register dump line: " + line);
+    }
+    const bool fifo = tokens[2] == "fifo";
+
+    const uint8_t device = std::stoul(tokens[0], nullptr, 16);
+    const uint8_t reg = std::stoul(tokens[1], nullptr, 16);
+    for (int i = fifo ? 3 : 2; i < tokens.size(); i++) {
+      const uint8_t value = std::stoul(tokens[i], nullptr, 16);
+      if (fifo) {
+        fifos[{device, reg}].push_back(value);
+      } else {
+        registers[{device, reg + i - 2}] = value;
+      }
+    }
+  }
+}
+
+int FakeI2CBus::read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) {
+  return read_burst(device_address, register_address, buffer, len);
+}
+
+int FakeI2CBus::read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, size_t len) {
+  auto fifo = fifos.find({device_address, register_address});
+  if (fifo != fifos.end()) {
+    if (fifo->second.size() < len) return -1;
+    for (size_t i = 0; i < len; i++) {
+      buffer[i] = fifo->second.front();
+      fifo->second.pop_front();
+    }
+    return len;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    auto reg = registers.find({device_address, register_address + i});
+    if (reg == registers.end()) return -1;
+    buffer[i] = reg->second;
+  }
+  return len;
+}
+
+int FakeI2CBus::set_register(uint8_t device_address, uint register_address, uint8_t data) {
+  registers[{device_address, register_address}] = data;
+  return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "selfdrive/common/i2c.h"
+
+// an I2C bus backed by a register dump, to run the sensor drivers without the hardware.
+// every line of the file is a device address, a register address and the bytes of the
+// consecutive registers from there, all in hex:
+//   6a 0f 69
+// a line with "fifo" after the register queues the bytes on a FIFO data register instead,
+// reads from it pop bytes and don't advance to the next register:
+//   6a 3e fifo 01 00 02 00 03 00
+// empty lines and lines starting with # are skipped
+class FakeI2CBus : public I2CBus {
+public:
+  FakeI2CBus(const std::string &path);
+  void load(const std::string &path);
+
+  int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) override;
+  int read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, size_t len) override;
+  int set_register(uint8_t device_address, uint register_address, uint8_t data) override;
+
+  std::map<std::pair<uint8_t, uint8_t>, uint8_t> registers;
+  std::map<std::pair<uint8_t, uint8_t>, std::deque<uint8_t>> fifos;
+};
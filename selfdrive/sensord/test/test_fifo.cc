@@ -0,0 +1,152 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "capnp/message.h"
+#include "selfdrive/sensord/sensors/bmx055_accel.h"
+#include "selfdrive/sensord/sensors/bmx055_gyro.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_fifo.h"
+#include "selfdrive/sensord/test/fake_i2c.h"
+
+static std::string write_dump(const std::string &dump) {
+  char path[] = "/tmp/i2c_dump_XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  std::ofstream(path) << dump;
+  return path;
+}
+
+static std::vector<capnp::MallocMessageBuilder> get_events(Sensor &sensor, int n) {
+  std::vector<capnp::MallocMessageBuilder> msgs(n);
+  for (auto &msg : msgs) {
+    auto event = msg.initRoot<cereal::SensorEventData>();
+    sensor.get_event(event);
+  }
+  return msgs;
+}
+
+static cereal::SensorEventData::Reader event(capnp::MallocMessageBuilder &msg) {
+  return msg.getRoot<cereal::SensorEventData>().asReader();
+}
+
+TEST_CASE("LSM6DS3 FIFO frames are a gyro and an accelerometer sample") {
+  FakeI2CBus bus(write_dump(R"(
+# chip ID
+6a 0f 69
+# 12 words in the FIFO, the next one is the first of a frame
+6a 3a 0c 00 00 00
+# gyro x, y, z then accelerometer x, y, z
+6a 3e fifo 64 00 c8 00 2c 01  e8 03 18 fc d0 07
+6a 3e fifo 01 00 02 00 03 00  04 00 05 00 06 00
+)"));
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+  LSM6DS3_Fifo fifo(&bus, &accel, &gyro);
+  REQUIRE(fifo.init() == 0);
+  REQUIRE(bus.registers[{0x6a, 0x08}] == 0x09);
+  REQUIRE(bus.registers[{0x6a, 0x0a}] == 0x26);
+
+  REQUIRE(fifo.read_fifo() == 4);
+  auto msgs = get_events(fifo, 4);
+  REQUIRE(bus.fifos[{0x6a, 0x3e}].empty());
+
+  REQUIRE(event(msgs[0]).getSensor() == SENSOR_GYRO_UNCALIBRATED);
+  REQUIRE(event(msgs[1]).getSensor() == SENSOR_ACCELEROMETER);
+  REQUIRE(event(msgs[2]).getSensor() == SENSOR_GYRO_UNCALIBRATED);
+  REQUIRE(event(msgs[3]).getSensor() == SENSOR_ACCELEROMETER);
+
+  auto g = event(msgs[0]).getGyroUncalibrated().getV();
+  REQUIRE(g[0] == Approx(200 * 8.75 / 1000 * M_PI / 180));
+  REQUIRE(g[1] == Approx(-100 * 8.75 / 1000 * M_PI / 180));
+  REQUIRE(g[2] == Approx(300 * 8.75 / 1000 * M_PI / 180));
+  auto a = event(msgs[1]).getAcceleration().getV();
+  REQUIRE(a[0] == Approx(-1000 * 9.81 * 2 / (1 << 15)));
+  REQUIRE(a[1] == Approx(-1000 * 9.81 * 2 / (1 << 15)));
+  REQUIRE(a[2] == Approx(2000 * 9.81 * 2 / (1 << 15)));
+
+  // both samples of a frame at the same time, the frames one period apart
+  REQUIRE(event(msgs[0]).getTimestamp() == event(msgs[1]).getTimestamp());
+  REQUIRE(event(msgs[2]).getTimestamp() == event(msgs[3]).getTimestamp());
+  REQUIRE(event(msgs[2]).getTimestamp() - event(msgs[0]).getTimestamp() == LSM6DS3_FIFO_PERIOD_NS);
+}
+
+TEST_CASE("LSM6DS3 FIFO realigns to a frame after an overrun") {
+  FakeI2CBus bus(write_dump(R"(
+6a 0f 69
+# 8 words, overrun, the next word is the accelerometer y
+6a 3a 08 40 04 00
+6a 3e fifo 05 00 06 00
+6a 3e fifo 01 00 02 00 03 00  04 00 05 00 06 00
+)"));
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+  LSM6DS3_Fifo fifo(&bus, &accel, &gyro);
+  REQUIRE(fifo.init() == 0);
+
+  REQUIRE(fifo.read_fifo() == 2);
+  auto msgs = get_events(fifo, 2);
+  REQUIRE(bus.fifos[{0x6a, 0x3e}].empty());
+  REQUIRE(event(msgs[0]).getGyroUncalibrated().getV()[1] == Approx(-1 * 8.75 / 1000 * M_PI / 180));
+}
+
+TEST_CASE("BMX055 FIFOs") {
+  FakeI2CBus bus(write_dump(R"(
+18 00 fa
+18 0e 03
+18 3f fifo 10 00 20 00 30 00  40 00 50 00 60 00  70 00 80 00 90 00
+68 00 0f
+68 0e 82
+68 3f fifo 01 00 02 00 03 00  04 00 05 00 06 00
+)"));
+  BMX055_Accel accel(&bus);
+  REQUIRE(accel.init() == 0);
+  REQUIRE(bus.registers[{0x18, 0x3e}] == 0x80);
+  REQUIRE(accel.read_fifo() == 3);
+  auto msgs = get_events(accel, 3);
+  REQUIRE(event(msgs[2]).getAcceleration().getV()[2] == Approx(9 * 9.81 * 2 / (1 << 11)));
+  REQUIRE(event(msgs[2]).getTimestamp() - event(msgs[1]).getTimestamp() == BMX055_ACCEL_PERIOD_NS);
+
+  BMX055_Gyro gyro(&bus);
+  REQUIRE(gyro.init() == 0);
+  REQUIRE(bus.registers[{0x68, 0x3e}] == 0x80);
+  REQUIRE(gyro.read_fifo() == 2);
+  msgs = get_events(gyro, 2);
+  REQUIRE(event(msgs[1]).getGyroUncalibrated().getV()[2] == Approx(6 * 125.0 / (1 << 15) * M_PI / 180));
+  REQUIRE(bus.fifos[{0x68, 0x3f}].empty());
+}
+
+TEST_CASE("FIFO timestamps") {
+  const uint64_t ms = 1000000;
+  FifoClock clock(10 * ms);
+
+  // the first burst ends at the read
+  clock.update(1000 * ms, 3);
+  REQUIRE(clock.timestamp(0) == 980 * ms);
+  REQUIRE(clock.timestamp(2) == 1000 * ms);
+
+  // on the grid as long as the newest sample is from the last period before the read
+  clock.update(1031 * ms, 3);
+  REQUIRE(clock.timestamp(0) == 1010 * ms);
+  REQUIRE(clock.timestamp(2) == 1030 * ms);
+  clock.update(1045 * ms, 1);
+  REQUIRE(clock.timestamp(0) == 1040 * ms);
+
+  // pulled back to the read when the chip runs fast
+  clock.update(1055 * ms, 2);
+  REQUIRE(clock.timestamp(1) == 1055 * ms);
+  REQUIRE(clock.timestamp(0) > 1040 * ms);
+
+  // and forward when it runs slow
+  clock.update(1200 * ms, 2);
+  REQUIRE(clock.timestamp(0) == 1180 * ms);
+  REQUIRE(clock.timestamp(1) == 1190 * ms);
+
+  // an overrun starts over at the read
+  clock.update(1500 * ms, 2, true);
+  REQUIRE(clock.timestamp(0) == 1490 * ms);
+  REQUIRE(clock.timestamp(1) == 1500 * ms);
+}
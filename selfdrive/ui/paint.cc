@@ -292,6 +292,21 @@ void ui_draw(UIState *s, int w, int h) {
   glDisable(GL_BLEND);
 }
 
+void ui_draw_frame_stats(UIState *s, const char *text) {
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  nvgBeginFrame(s->vg, s->fb_w, s->fb_h, 1.0f);
+  const Rect rect = {bdr_s * 2, header_h, 560, 240};
+  ui_fill_rect(s->vg, rect, COLOR_BLACK_ALPHA(150), 20.);
+  nvgTextAlign(s->vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+  nvgFontFace(s->vg, "sans-regular");
+  nvgFontSize(s->vg, 40);
+  nvgFillColor(s->vg, COLOR_WHITE);
+  nvgTextBox(s->vg, rect.x + 30, rect.y + 20, rect.w - 60, text, NULL);
+  nvgEndFrame(s->vg);
+  glDisable(GL_BLEND);
+}
+
 void ui_draw_image(const UIState *s, const Rect &r, const char *name, float alpha) {
   nvgBeginPath(s->vg);
   NVGpaint imgPaint = nvgImagePattern(s->vg, r.x, r.y, r.w, r.h, 0, s->images.at(name), alpha);
@@ -376,4 +391,5 @@ void ui_resize(UIState *s, int width, int height) {
 
   nvgCurrentTransform(s->vg, s->car_space_transform);
   nvgResetTransform(s->vg);
+  s->projection_dirty = true;
 }
@@ -1,5 +1,9 @@
 #include "selfdrive/ui/qt/onroad.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
 #include <QDebug>
 
 #include "selfdrive/common/timing.h"
@@ -40,6 +44,8 @@ OnroadWindow::OnroadWindow(QWidget *parent) : QWidget(parent) {
 }
 
 void OnroadWindow::updateState(const UIState &s) {
+  nvg->updateState(s);
+
   SubMaster &sm = *(s.sm);
   QColor bgColor = bg_colors[s.status];
   if (sm.updated("controlsState")) {
@@ -185,6 +191,11 @@ void OnroadAlerts::paintEvent(QPaintEvent *event) {
   }
 }
 
+NvgWindow::NvgWindow(VisionStreamType type, QWidget* parent) : CameraViewWidget(type, true, parent),
+                                                                show_frame_stats(util::getenv("SHOW_FRAME_STATS", 0)) {
+  QObject::connect(this, &CameraViewWidget::frameUpdated, [=]() { new_frame = true; });
+}
+
 void NvgWindow::initializeGL() {
   CameraViewWidget::initializeGL();
   qInfo() << "OpenGL version:" << QString((const char*)glGetString(GL_VERSION));
@@ -197,7 +208,19 @@ void NvgWindow::initializeGL() {
   setBackgroundColor(bg_colors[STATUS_DISENGAGED]);
 }
 
+void NvgWindow::updateState(const UIState &s) {
+  // new camera frames pace the redraws and pick up the latest state. only redraw from here
+  // if the state changed and no frame was painted since the last update, the camera is
+  // stalled or not connected yet
+  scene_changed |= s.scene_changed;
+  if (scene_changed && !painted) {
+    update();
+  }
+  painted = false;
+}
+
 void NvgWindow::paintGL() {
+  const double start_t = millis_since_boot();
   CameraViewWidget::paintGL();
   ui_draw(&QUIState::ui_state, width(), height());
 
@@ -208,4 +231,43 @@ void NvgWindow::paintGL() {
     LOGW("slow frame time: %.2f", dt);
   }
   prev_draw_t = cur_draw_t;
+
+  if (show_frame_stats) {
+    updateFrameStats(cur_draw_t - start_t);
+    ui_draw_frame_stats(&QUIState::ui_state, frame_stats.text.c_str());
+  }
+  scene_changed = false;
+  painted = true;
+  new_frame = false;
+}
+
+static double cpu_millis() {
+  struct timespec t;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec * 1e-6;
+}
+
+void NvgWindow::updateFrameStats(double draw_t) {
+  auto &st = frame_stats;
+  if (st.start_t == 0) {
+    st.start_t = millis_since_boot();
+    st.cpu_start_t = cpu_millis();
+  }
+  st.paints++;
+  st.frame_paints += new_frame;
+  st.draw_t += draw_t;
+  st.max_draw_t = std::max(st.max_draw_t, draw_t);
+
+  const double t = millis_since_boot(), cpu_t = cpu_millis();
+  if (t - st.start_t >= 1000) {
+    const double secs = (t - st.start_t) / 1000;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%.1f paints/s, %.1f with a new frame\ndraw %.2fms, max %.2fms\ncpu %.0f%% of a core",
+             st.paints / secs, st.frame_paints / secs, st.draw_t / st.paints, st.max_draw_t,
+             100 * (cpu_t - st.cpu_start_t) / (t - st.start_t));
+    st = {};
+    st.start_t = t;
+    st.cpu_start_t = cpu_t;
+    st.text = buf;
+  }
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include <QStackedLayout>
 #include <QWidget>
 
@@ -29,12 +31,28 @@ class NvgWindow : public CameraViewWidget {
   Q_OBJECT
 
 public:
-  explicit NvgWindow(VisionStreamType type, QWidget* parent = 0) : CameraViewWidget(type, true, parent) {}
+  explicit NvgWindow(VisionStreamType type, QWidget* parent = 0);
+  void updateState(const UIState &s);
 
 protected:
   void paintGL() override;
   void initializeGL() override;
+  void updateFrameStats(double draw_t);
   double prev_draw_t = 0;
+
+  // redraw pacing, see updateState()
+  bool scene_changed = false;
+  bool painted = false;
+  bool new_frame = false;
+
+  // frame stats overlay, enabled with SHOW_FRAME_STATS=1
+  const bool show_frame_stats;
+  struct {
+    double start_t, cpu_start_t;
+    int paints, frame_paints;
+    double draw_t, max_draw_t;
+    std::string text;
+  } frame_stats = {};
 };
 
 // container for all onroad widgets
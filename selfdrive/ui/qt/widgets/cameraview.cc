@@ -1,5 +1,8 @@
 #include "selfdrive/ui/qt/widgets/cameraview.h"
 
+#include <cstring>
+#include <iterator>
+
 namespace {
 
 const char frame_vertex_shader[] =
@@ -24,16 +27,29 @@ const char frame_fragment_shader[] =
   "#version 300 es\n"
 #endif
   "precision mediump float;\n"
+#ifdef QCOM
   "uniform sampler2D uTexture;\n"
   "in vec4 vTexCoord;\n"
   "out vec4 colorOut;\n"
   "void main() {\n"
   "  colorOut = texture(uTexture, vTexCoord.xy);\n"
-#ifdef QCOM
   "  vec3 dz = vec3(0.0627f, 0.0627f, 0.0627f);\n"
   "  colorOut.rgb = ((vec3(1.0f, 1.0f, 1.0f) - dz) * colorOut.rgb / vec3(1.0f, 1.0f, 1.0f)) + dz;\n"
-#endif
   "}\n";
+#else
+  "uniform sampler2D uTextureY;\n"
+  "uniform sampler2D uTextureU;\n"
+  "uniform sampler2D uTextureV;\n"
+  "in vec4 vTexCoord;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  // BT.601 limited range, the inverse of camerad's rgb_to_yuv
+  "  float y = 1.164 * (texture(uTextureY, vTexCoord.xy).r - 0.0627);\n"
+  "  float u = texture(uTextureU, vTexCoord.xy).r - 0.502;\n"
+  "  float v = texture(uTextureV, vTexCoord.xy).r - 0.502;\n"
+  "  colorOut = vec4(y + 1.596 * v, y - 0.391 * u - 0.813 * v, y + 2.018 * u, 1.0);\n"
+  "}\n";
+#endif
 
 const mat4 device_transform = {{
   1.0,  0.0, 0.0, 0.0,
@@ -89,6 +105,18 @@ mat4 get_fit_view_transform(float widget_aspect_ratio, float frame_aspect_ratio)
   return frame_transform;
 }
 
+#ifndef QCOM
+// the ui shows the yuv streams outside of EON, that can map the rgb ones zero copy through ion
+VisionStreamType yuv_stream_type(VisionStreamType type) {
+  switch (type) {
+    case VISION_STREAM_RGB_BACK: return VISION_STREAM_YUV_BACK;
+    case VISION_STREAM_RGB_FRONT: return VISION_STREAM_YUV_FRONT;
+    case VISION_STREAM_RGB_WIDE: return VISION_STREAM_YUV_WIDE;
+    default: return type;
+  }
+}
+#endif
+
 } // namespace
 
 CameraViewWidget::CameraViewWidget(VisionStreamType stream_type, bool zoom, QWidget* parent) :
@@ -106,6 +134,10 @@ CameraViewWidget::~CameraViewWidget() {
     glDeleteVertexArrays(1, &frame_vao);
     glDeleteBuffers(1, &frame_vbo);
     glDeleteBuffers(1, &frame_ibo);
+#ifndef QCOM
+    glDeleteTextures(std::size(textures), textures);
+    glDeleteBuffers(std::size(pbos), pbos);
+#endif
   }
   doneCurrent();
 }
@@ -169,7 +201,12 @@ void CameraViewWidget::resizeGL(int w, int h) {
 void CameraViewWidget::setStreamType(VisionStreamType type) {
   if (!vipc_client || type != stream_type) {
     stream_type = type;
+#ifdef QCOM
     vipc_client.reset(new VisionIpcClient("camerad", stream_type, true));
+#else
+    vipc_client.reset(new VisionIpcClient("camerad", yuv_stream_type(stream_type), true));
+#endif
+    vipc_client->device_sync = false;
     updateFrameMat(width(), height());
   }
 }
@@ -217,17 +254,25 @@ void CameraViewWidget::paintGL() {
   glViewport(0, 0, width(), height());
 
   glBindVertexArray(frame_vao);
-  glActiveTexture(GL_TEXTURE0);
+  glUseProgram(program->programId());
 
+#ifdef QCOM
+  // this is handled in ion on QCOM
+  glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, texture[latest_frame->idx]->frame_tex);
-  if (!Hardware::EON()) {
-    // this is handled in ion on QCOM
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, latest_frame->width, latest_frame->height,
-                  0, GL_RGB, GL_UNSIGNED_BYTE, latest_frame->addr);
-  }
-
-  glUseProgram(program->programId());
   glUniform1i(program->uniformLocation("uTexture"), 0);
+#else
+  // paints for the overlays don't upload the same frame again
+  if (!latest_frame_uploaded) {
+    uploadFrame();
+  }
+  const char *samplers[] = {"uTextureY", "uTextureU", "uTextureV"};
+  for (int i = 0; i < std::size(textures); i++) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glUniform1i(program->uniformLocation(samplers[i]), i);
+  }
+#endif
   glUniformMatrix4fv(program->uniformLocation("uTransform"), 1, GL_TRUE, frame_mat.v);
 
   assert(glGetError() == GL_NO_ERROR);
@@ -235,8 +280,65 @@ void CameraViewWidget::paintGL() {
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, (const void *)0);
   glDisableVertexAttribArray(0);
   glBindVertexArray(0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+#ifndef QCOM
+void CameraViewWidget::initTextures() {
+  const VisionBuf &buf = vipc_client->buffers[0];
+  glDeleteTextures(std::size(textures), textures);
+  glDeleteBuffers(std::size(pbos), pbos);
+
+  // one R8 texture per I420 plane
+  glGenTextures(std::size(textures), textures);
+  for (int i = 0; i < std::size(textures); i++) {
+    const int w = i == 0 ? buf.width : buf.width / 2, h = i == 0 ? buf.height : buf.height / 2;
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+
+  // the pixel buffers live as long as the connection, a frame is copied into the next one and
+  // the planes are uploaded from it asynchronously
+  glGenBuffers(std::size(pbos), pbos);
+  for (GLuint pbo : pbos) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, buf.len, nullptr, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  assert(glGetError() == GL_NO_ERROR);
 }
 
+void CameraViewWidget::uploadFrame() {
+  const VisionBuf *buf = latest_frame;
+  pbo_idx = (pbo_idx + 1) % std::size(pbos);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[pbo_idx]);
+
+  // invalidating lets the driver hand out memory the gpu isn't reading from
+  void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, buf->len, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (dst) {
+    memcpy(dst, buf->addr, buf->len);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    const uint8_t *planes[] = {buf->y, buf->u, buf->v};
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < std::size(textures); i++) {
+      const int w = i == 0 ? buf->width : buf->width / 2, h = i == 0 ? buf->height : buf->height / 2;
+      glBindTexture(GL_TEXTURE_2D, textures[i]);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RED, GL_UNSIGNED_BYTE, (const void *)(planes[i] - buf->y));
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  }
+  // QPainter uploads its textures from client memory
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  latest_frame_uploaded = true;
+}
+#endif
+
 void CameraViewWidget::updateFrame() {
   if (!isVisible()) {
     return;
@@ -246,6 +348,7 @@ void CameraViewWidget::updateFrame() {
     makeCurrent();
     if (vipc_client->connect(false)) {
       // init vision
+#ifdef QCOM
       for (int i = 0; i < vipc_client->num_buffers; i++) {
         texture[i].reset(new EGLImageTexture(&vipc_client->buffers[i]));
 
@@ -259,6 +362,9 @@ void CameraViewWidget::updateFrame() {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
         assert(glGetError() == GL_NO_ERROR);
       }
+#else
+      initTextures();
+#endif
       latest_frame = nullptr;
       resizeGL(width(), height());
     }
@@ -269,6 +375,7 @@ void CameraViewWidget::updateFrame() {
     buf = vipc_client->recv(nullptr, 0);
     if (buf != nullptr) {
       latest_frame = buf;
+      latest_frame_uploaded = false;
       update();
       emit frameUpdated();
     }
@@ -42,9 +42,20 @@ private:
   VisionBuf *latest_frame = nullptr;
   GLuint frame_vao, frame_vbo, frame_ibo;
   mat4 frame_mat;
-  std::unique_ptr<EGLImageTexture> texture[UI_BUF_COUNT];
   QOpenGLShaderProgram *program;
 
+#ifdef QCOM
+  std::unique_ptr<EGLImageTexture> texture[UI_BUF_COUNT];
+#else
+  void initTextures();
+  void uploadFrame();
+
+  GLuint textures[3] = {};  // y, u, v
+  GLuint pbos[2] = {};
+  int pbo_idx = 0;
+  bool latest_frame_uploaded = false;
+#endif
+
   VisionStreamType stream_type;
   QColor bg = QColor("#000000");
 };
@@ -1,7 +1,9 @@
 #include "selfdrive/ui/replay/framereader.h"
 
-#include <unistd.h>
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <mutex>
 #include "libyuv.h"
 
@@ -33,134 +35,312 @@ struct AVInitializer {
   ~AVInitializer() { avformat_network_deinit(); }
 };
 
-FrameReader::FrameReader() {
-  static AVInitializer av_initializer;
-}
-
-FrameReader::~FrameReader() {
-  for (auto &f : frames_) {
-    av_free_packet(&f.pkt);
+// a demuxer and decoder for one chunk at a time. it remembers where it stopped,
+// so the chunk after the one it just decoded continues without seeking or flushing
+struct FrameReader::Decoder {
+  ~Decoder() {
+    if (frame) av_frame_free(&frame);
+    if (pkt) av_packet_free(&pkt);
+    if (ctx) avcodec_free_context(&ctx);
+    if (fmt) avformat_close_input(&fmt);
   }
-  if (pCodecCtx_) {
-    avcodec_close(pCodecCtx_);
-    avcodec_free_context(&pCodecCtx_);
+
+  bool open(const std::string &url) {
+    fmt = avformat_alloc_context();
+    fmt->probesize = 10 * 1024 * 1024;  // 10MB
+    if (avformat_open_input(&fmt, url.c_str(), NULL, NULL) != 0) return false;
+    avformat_find_stream_info(fmt, NULL);
+    stream = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (stream < 0) return false;
+    next_packet = 0;
+    if (ctx) return true;
+
+    auto par = fmt->streams[stream]->codecpar;
+    auto codec = avcodec_find_decoder(par->codec_id);
+    if (!codec) return false;
+    ctx = avcodec_alloc_context3(codec);
+    if (avcodec_parameters_to_context(ctx, par) < 0) return false;
+    // no threads inside the decoder, the reader decodes several chunks in parallel instead
+    ctx->thread_count = 1;
+    if (avcodec_open2(ctx, codec, NULL) < 0) return false;
+
+    frame = av_frame_alloc();
+    pkt = av_packet_alloc();
+    return true;
   }
-  if (pFormatCtx_) {
-    avformat_close_input(&pFormatCtx_);
+
+  // next packet of the video stream into pkt
+  int read() {
+    if (pkt_pending) {
+      pkt_pending = false;
+      return 0;
+    }
+    av_packet_unref(pkt);
+    int err;
+    while ((err = av_read_frame(fmt, pkt)) >= 0) {
+      if (pkt->stream_index == stream) return 0;
+      av_packet_unref(pkt);
+    }
+    return err;
   }
-  if (av_frame_) {
-    av_frame_free(&av_frame_);
+
+  // position the demuxer so read() returns packet idx, a keyframe, and reset the decoder
+  bool seek(int idx, const std::string &url, const std::vector<Packet> &packets) {
+    avcodec_flush_buffers(ctx);
+    next_frame = -1;
+    carry.clear();
+    if (next_packet == idx) return true;
+
+    pkt_pending = false;
+    next_packet = -1;
+    const Packet &p = packets[idx];
+    if (idx > 0 && p.pos >= 0 && av_seek_frame(fmt, stream, p.pos, AVSEEK_FLAG_BYTE) >= 0) {
+      // raw streams are parsed again from the seek position, skip what's left of the previous frame
+      for (int i = 0; i < 8 && read() >= 0; i++) {
+        if ((pkt->flags & AV_PKT_FLAG_KEY) && pkt->size == p.size) {
+          pkt_pending = true;
+          next_packet = idx;
+          return true;
+        }
+      }
+    }
+
+    // no byte seeking in this format, start over and skip to the keyframe
+    avformat_close_input(&fmt);
+    if (!open(url)) return false;
+    for (; next_packet < idx; next_packet++) {
+      if (read() < 0) return false;
+    }
+    return true;
   }
+
+  AVFormatContext *fmt = nullptr;
+  AVCodecContext *ctx = nullptr;
+  AVFrame *frame = nullptr;
+  AVPacket *pkt = nullptr;
+  bool pkt_pending = false;
+  int stream = -1;
+  int next_packet = -1;  // packet read() returns next
+  int next_frame = -1;  // first frame not handed out yet, -1 after the decoder was drained
+  std::vector<std::pair<int, YUVFrame>> carry;  // frames past the end of the last chunk
+};
+
+FrameReader::FrameReader(int cache_size, int decoder_threads)
+    : decoder_threads_(std::max(decoder_threads, 1)), prefetch_chunks_(std::max(decoder_threads - 1, 1)),
+      cache_size_(std::max(cache_size, prefetch_chunks_ + 1)) {
+  static AVInitializer av_initializer;
+}
+
+FrameReader::~FrameReader() {
+  // queued chunks see exit_ and fail their frames instead of decoding
+  exit_ = true;
+  pool_.reset();
 }
 
 bool FrameReader::load(const std::string &url) {
-  pFormatCtx_ = avformat_alloc_context();
-  pFormatCtx_->probesize = 10 * 1024 * 1024;  // 10MB
-  if (avformat_open_input(&pFormatCtx_, url.c_str(), NULL, NULL) != 0) {
+  url_ = url;
+  auto decoder = std::make_unique<Decoder>();
+  if (!decoder->open(url)) {
     printf("error loading %s\n", url.c_str());
     return false;
   }
-  avformat_find_stream_info(pFormatCtx_, NULL);
-  // av_dump_format(pFormatCtx_, 0, url.c_str(), 0);
+  width = decoder->ctx->width;
+  height = decoder->ctx->height;
 
-  auto pCodecCtxOrig = pFormatCtx_->streams[0]->codec;
-  auto pCodec = avcodec_find_decoder(pCodecCtxOrig->codec_id);
-  if (!pCodec) return false;
-
-  pCodecCtx_ = avcodec_alloc_context3(pCodec);
-  int ret = avcodec_copy_context(pCodecCtx_, pCodecCtxOrig);
-  if (ret != 0) return false;
+  // one pass over the stream, only keeping where each packet is
+  packets_.reserve(60 * 20);  // 20fps, one minute
+  int err;
+  while ((err = decoder->read()) >= 0) {
+    if (decoder->pkt->flags & AV_PKT_FLAG_KEY) {
+      keyframes_.push_back(packets_.size());
+    }
+    packets_.push_back({.pos = decoder->pkt->pos, .size = decoder->pkt->size});
+  }
+  av_packet_unref(decoder->pkt);
+  decoder->next_packet = packets_.size();
+  valid_ = (err == AVERROR_EOF) && !packets_.empty() && width > 0 && height > 0;
+  if (!valid_) return false;
 
-  pCodecCtx_->thread_count = 0;
-  pCodecCtx_->thread_type = FF_THREAD_FRAME;
-  ret = avcodec_open2(pCodecCtx_, pCodec, NULL);
-  if (ret < 0) return false;
+  // some stream seems to contian no keyframes, those are decoded from the start
+  if (keyframes_.empty() || keyframes_[0] != 0) {
+    keyframes_.insert(keyframes_.begin(), 0);
+  }
+  const int max_chunk_size = std::max(cache_size_ / (prefetch_chunks_ + 1), 1);
+  for (int i = 0; i < keyframes_.size(); i++) {
+    const int gop_end = i + 1 < keyframes_.size() ? keyframes_[i + 1] : packets_.size();
+    for (int start = keyframes_[i]; start < gop_end; start += max_chunk_size) {
+      chunks_.push_back(start);
+    }
+  }
 
-  av_frame_ = av_frame_alloc();
+  decoders_.push_back(std::move(decoder));
+  pool_ = std::make_unique<ThreadPool>(decoder_threads_ + 1);  // the pool counts the calling thread
+  return true;
+}
 
-  width = pCodecCtxOrig->width;
-  height = pCodecCtxOrig->height;
+std::shared_future<FrameReader::YUVFrame> FrameReader::get(int idx) {
+  if (!valid_ || idx < 0 || idx >= packets_.size()) {
+    std::promise<YUVFrame> failed;
+    failed.set_value(nullptr);
+    return failed.get_future().share();
+  }
 
-  frames_.reserve(60 * 20);  // 20fps, one minute
-  while (true) {
-    Frame &frame = frames_.emplace_back();
-    int err = av_read_frame(pFormatCtx_, &frame.pkt);
-    if (err < 0) {
-      frames_.pop_back();
-      valid_ = (err == AVERROR_EOF);
-      break;
+  std::unique_lock lk(mutex_);
+  const int chunk = std::upper_bound(chunks_.begin(), chunks_.end(), idx) - chunks_.begin() - 1;
+  auto it = cache_.find(idx);
+  if (it == cache_.end()) {
+    schedule(chunk);
+  } else {
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+  }
+  // the cache holds prefetch_chunks_ + 1 chunks, so prefetching never evicts idx
+  for (int i = chunk + 1; i <= chunk + prefetch_chunks_ && i < chunks_.size(); i++) {
+    if (cache_.find(chunks_[i]) == cache_.end()) {
+      schedule(i);
     }
-    // some stream seems to contian no keyframes
-    key_frames_count_ += frame.pkt.flags & AV_PKT_FLAG_KEY;
   }
-  return valid_;
+
+  return cache_.at(idx).first;
 }
 
 bool FrameReader::get(int idx, uint8_t *rgb, uint8_t *yuv) {
-  assert(rgb != nullptr);
-  if (!valid_ || idx < 0 || idx >= frames_.size()) {
-    return false;
+  YUVFrame frame = get(idx).get();
+  if (!frame) return false;
+
+  const uint8_t *y = frame->data();
+  const uint8_t *u = y + width * height;
+  const uint8_t *v = u + (width / 2) * (height / 2);
+  if (yuv) {
+    memcpy(yuv, y, getYUVSize());
+  }
+  if (rgb) {
+    libyuv::I420ToRGB24(y, width, u, width / 2, v, width / 2, rgb, width * 3, width, height);
+  }
+  return true;
+}
+
+// called with mutex_ held
+void FrameReader::schedule(int chunk) {
+  const int start = chunks_[chunk];
+  const int end = chunk + 1 < chunks_.size() ? chunks_[chunk + 1] : packets_.size();
+
+  auto promises = std::make_shared<Promises>(end - start);
+  for (int i = end - 1; i >= start; i--) {
+    auto frame = (*promises)[i - start].get_future().share();
+    auto it = cache_.find(i);
+    if (it != cache_.end()) {
+      it->second.first = frame;
+      lru_.splice(lru_.begin(), lru_, it->second.second);
+    } else {
+      lru_.push_front(i);
+      cache_.emplace(i, std::make_pair(frame, lru_.begin()));
+    }
+  }
+  // evicting a frame that's still being decoded only drops it from the cache
+  while (cache_.size() > cache_size_) {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
   }
-  return decode(idx, rgb, yuv);
+
+  pool_->run([=] { decodeChunk(start, end, promises); });
 }
 
-bool FrameReader::decode(int idx, uint8_t *rgb, uint8_t *yuv) {
-  auto get_keyframe = [=](int idx) {
-    for (int i = idx; i >= 0 && key_frames_count_ > 1; --i) {
-      if (frames_[i].pkt.flags & AV_PKT_FLAG_KEY) return i;
+void FrameReader::decodeChunk(int start, int end, std::shared_ptr<Promises> promises) {
+  std::vector<bool> done(end - start);
+  int remaining = end - start;
+  auto deliver = [&](int idx, const AVFrame *f) {
+    if (idx >= start && idx < end && !done[idx - start]) {
+      (*promises)[idx - start].set_value(copyFrame(f));
+      done[idx - start] = true;
+      remaining--;
     }
-    return idx;
   };
 
-  int from_idx = idx;
-  if (idx > 0 && !frames_[idx].decoded && !frames_[idx - 1].decoded) {
-    // find the previous keyframe
-    from_idx = get_keyframe(idx);
+  std::unique_ptr<Decoder> decoder = exit_ ? nullptr : acquireDecoder(start);
+  bool ok = decoder != nullptr;
+  if (ok && decoder->next_frame != start) {
+    const int keyframe = *(std::upper_bound(keyframes_.begin(), keyframes_.end(), start) - 1);
+    ok = decoder->seek(keyframe, url_, packets_);
   }
 
-  for (int i = from_idx; i <= idx; ++i) {
-    Frame &frame = frames_[i];
-    if ((!frame.decoded || i == idx) && !frame.failed) {
-      while (true) {
-        int ret = avcodec_decode_video2(pCodecCtx_, av_frame_, &frame.decoded, &(frame.pkt));
-        if (ret > 0 && !frame.decoded) {
-          // decode thread is still receiving the initial packets
-          usleep(0);
-        } else {
+  if (ok) {
+    auto carry = std::move(decoder->carry);
+    decoder->carry.clear();
+    for (auto &[idx, frame] : carry) {
+      if (idx < end) {
+        (*promises)[idx - start].set_value(frame);
+        done[idx - start] = true;
+        remaining--;
+      } else {
+        decoder->carry.emplace_back(idx, frame);
+      }
+    }
+
+    bool drained = false;
+    while (remaining > 0 && !exit_) {
+      if (decoder->next_packet < packets_.size()) {
+        if (decoder->read() < 0 || decoder->pkt->size != packets_[decoder->next_packet].size) {
+          ok = false;
           break;
         }
+        // frames keep the pts of their packet, so reordering and dropped frames can't shift the indices
+        decoder->pkt->pts = decoder->pkt->dts = decoder->next_packet++;
+        avcodec_send_packet(decoder->ctx, decoder->pkt);
+      } else if (!drained) {
+        avcodec_send_packet(decoder->ctx, NULL);
+        drained = true;
+      } else {
+        break;
       }
-      frame.failed = !frame.decoded;
-      if (frame.decoded && i == idx) {
-        return decodeFrame(av_frame_, rgb, yuv);
+
+      while (avcodec_receive_frame(decoder->ctx, decoder->frame) == 0) {
+        const int idx = decoder->frame->pts;
+        if (idx >= end) {
+          decoder->carry.emplace_back(idx, copyFrame(decoder->frame));
+        } else {
+          deliver(idx, decoder->frame);
+        }
       }
     }
+    decoder->next_frame = (ok && !drained && !exit_) ? end : -1;
   }
-  return false;
-}
-
-bool FrameReader::decodeFrame(AVFrame *f, uint8_t *rgb, uint8_t *yuv) {
-  uint8_t *y = yuv;
-  if (!yuv) {
-    if (yuv_buf_.empty()) {
-      yuv_buf_.resize(getYUVSize());
-    }
-    y = yuv_buf_.data();
+  if (decoder && !ok) {
+    decoder->next_packet = -1;
   }
 
-  int i, j, k;
-  for (i = 0; i < f->height; i++) {
-    memcpy(y + f->width * i, f->data[0] + f->linesize[0] * i, f->width);
+  for (int i = 0; i < done.size(); i++) {
+    if (!done[i]) (*promises)[i].set_value(nullptr);
   }
-  for (j = 0; j < f->height / 2; j++) {
-    memcpy(y + f->width * i + f->width / 2 * j, f->data[1] + f->linesize[1] * j, f->width / 2);
+  if (decoder) {
+    std::unique_lock lk(mutex_);
+    decoders_.push_back(std::move(decoder));
   }
-  for (k = 0; k < f->height / 2; k++) {
-    memcpy(y + f->width * i + f->width / 2 * j + f->width / 2 * k, f->data[2] + f->linesize[2] * k, f->width / 2);
+}
+
+std::unique_ptr<FrameReader::Decoder> FrameReader::acquireDecoder(int start) {
+  {
+    std::unique_lock lk(mutex_);
+    if (!decoders_.empty()) {
+      // prefer the decoder that stopped right before this chunk
+      auto it = std::find_if(decoders_.begin(), decoders_.end(), [=](auto &d) { return d->next_frame == start; });
+      if (it == decoders_.end()) it = decoders_.end() - 1;
+      auto decoder = std::move(*it);
+      decoders_.erase(it);
+      return decoder;
+    }
   }
+  auto decoder = std::make_unique<Decoder>();
+  return decoder->open(url_) ? std::move(decoder) : nullptr;
+}
 
-  uint8_t *u = y + f->width * f->height;
-  uint8_t *v = u + (f->width / 2) * (f->height / 2);
-  libyuv::I420ToRGB24(y, f->width, u, f->width / 2, v, f->width / 2, rgb, f->width * 3, f->width, f->height);
-  return true;
+FrameReader::YUVFrame FrameReader::copyFrame(const AVFrame *f) const {
+  if (f->width != width || f->height != height) return nullptr;
+
+  auto yuv = std::make_shared<std::vector<uint8_t>>(getYUVSize());
+  uint8_t *y = yuv->data();
+  uint8_t *u = y + width * height;
+  uint8_t *v = u + (width / 2) * (height / 2);
+  libyuv::I420Copy(f->data[0], f->linesize[0], f->data[1], f->linesize[1], f->data[2], f->linesize[2],
+                   y, width, u, width / 2, v, width / 2, width, height);
+  return yuv;
 }
@@ -1,40 +1,70 @@
 #pragma once
 
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "selfdrive/common/threadpool.h"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 }
 
+// load() only indexes the packets of the stream, frames are decoded on demand.
+// the stream is split at its keyframes into chunks (long GOPs into several chunks, so a chunk
+// always fits in the cache). each chunk is decoded on its own decoder by a pool of worker threads
+// and its frames are kept as I420 in a bounded LRU cache. get() prefetches the chunks after the requested one.
 class FrameReader {
 public:
-  FrameReader();
+  // width * height * 3 / 2 bytes of I420, nullptr if the frame failed to decode
+  using YUVFrame = std::shared_ptr<const std::vector<uint8_t>>;
+
+  FrameReader(int cache_size = 60, int decoder_threads = 2);
   ~FrameReader();
   bool load(const std::string &url);
+  std::shared_future<YUVFrame> get(int idx);
+  // blocking, rgb and yuv may be null
   bool get(int idx, uint8_t *rgb, uint8_t *yuv);
   int getRGBSize() const { return width * height * 3; }
   int getYUVSize() const { return width * height * 3 / 2; }
-  size_t getFrameCount() const { return frames_.size(); }
+  size_t getFrameCount() const { return packets_.size(); }
   bool valid() const { return valid_; }
 
   int width = 0, height = 0;
 
 private:
-  bool decode(int idx, uint8_t *rgb, uint8_t *yuv);
-  bool decodeFrame(AVFrame *f, uint8_t *rgb, uint8_t *yuv);
-
-  struct Frame {
-    AVPacket pkt = {};
-    int decoded = false;
-    bool failed = false;
+  struct Packet {
+    int64_t pos;
+    int size;
   };
-  std::vector<Frame> frames_;
-  AVFrame *av_frame_ = nullptr;
-  AVFormatContext *pFormatCtx_ = nullptr;
-  AVCodecContext *pCodecCtx_ = nullptr;
-  int key_frames_count_ = 0;
-  std::vector<uint8_t> yuv_buf_;
+  struct Decoder;
+  using Promises = std::vector<std::promise<YUVFrame>>;
+
+  void schedule(int chunk);
+  void decodeChunk(int start, int end, std::shared_ptr<Promises> promises);
+  std::unique_ptr<Decoder> acquireDecoder(int start);
+  YUVFrame copyFrame(const AVFrame *f) const;
+
+  std::string url_;
+  std::vector<Packet> packets_;
+  std::vector<int> keyframes_;
+  std::vector<int> chunks_;  // first frame of every chunk
   bool valid_ = false;
+
+  const int decoder_threads_;
+  const int prefetch_chunks_;
+  int cache_size_;
+  std::atomic<bool> exit_ = false;
+
+  std::mutex mutex_;
+  std::list<int> lru_;  // most recently used first
+  std::unordered_map<int, std::pair<std::shared_future<YUVFrame>, std::list<int>::iterator>> cache_;
+  std::vector<std::unique_ptr<Decoder>> decoders_;  // idle decoders
+  std::unique_ptr<ThreadPool> pool_;
 };
@@ -0,0 +1,283 @@
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/ui/replay/framereader.h"
+
+// FrameReader against a fake demuxer and decoder, linked instead of libavformat and libavcodec.
+// the stream has fake_frames packets with a keyframe every fake_gop (none for 0), the decoder holds
+// one frame back like a real one and writes the index of the frame into its first pixels.
+// the decoder threads read the settings, so they're atomic
+static std::atomic<int> fake_frames = 300;
+static std::atomic<int> fake_gop = 20;
+static std::atomic<bool> fake_byte_seek = true;  // false makes the reader reopen the input to seek
+static std::atomic<int> fake_read_error = -1;    // packet that fails to read instead of the stream ending
+static std::atomic<int> fake_junk_decoded = 0;   // junk after a byte seek that made it into the decoder
+
+constexpr int FAKE_WIDTH = 16, FAKE_HEIGHT = 16;
+
+struct FakeFormat {
+  AVFormatContext fmt = {};
+  AVStream stream = {};
+  AVStream *streams[1] = {&stream};
+  AVCodecParameters par = {};
+  int next = 0;
+  bool junk = false;  // a byte seek lands in the middle of the previous packet
+};
+
+struct FakeCodec {
+  AVCodecContext ctx = {};
+  bool has_ref = false;
+  bool draining = false;
+  std::deque<int64_t> pending;
+  std::vector<uint8_t> buf = std::vector<uint8_t>(FAKE_WIDTH * FAKE_HEIGHT * 3 / 2);
+};
+
+extern "C" {
+
+int av_lockmgr_register(int (*cb)(void **mutex, enum AVLockOp op)) { return 0; }
+void av_register_all(void) {}
+int avformat_network_init(void) { return 0; }
+int avformat_network_deinit(void) { return 0; }
+
+AVFormatContext *avformat_alloc_context(void) {
+  auto f = new FakeFormat;
+  f->fmt.nb_streams = 1;
+  f->fmt.streams = f->streams;
+  f->stream.codecpar = &f->par;
+  return &f->fmt;
+}
+
+int avformat_open_input(AVFormatContext **ps, const char *url, AVInputFormat *fmt, AVDictionary **options) { return 0; }
+int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options) { return 0; }
+void avformat_close_input(AVFormatContext **s) {
+  delete (FakeFormat *)*s;
+  *s = nullptr;
+}
+
+int av_find_best_stream(AVFormatContext *ic, enum AVMediaType type, int wanted_stream_nb, int related_stream,
+                        AVCodec **decoder_ret, int flags) {
+  return 0;
+}
+
+int av_read_frame(AVFormatContext *s, AVPacket *pkt) {
+  auto f = (FakeFormat *)s;
+  pkt->stream_index = 0;
+  pkt->pts = pkt->dts = AV_NOPTS_VALUE;
+  if (f->junk) {
+    f->junk = false;
+    pkt->pos = -1;
+    pkt->size = 7;
+    pkt->flags = 0;
+    return 0;
+  }
+  if (f->next == fake_read_error) return AVERROR(EIO);
+  if (f->next >= fake_frames) return AVERROR_EOF;
+
+  const int i = f->next++;
+  pkt->pos = i * 1000;
+  pkt->size = 100 + i % 37;
+  pkt->flags = (fake_gop > 0 && i % fake_gop == 0) ? AV_PKT_FLAG_KEY : 0;
+  return 0;
+}
+
+int av_seek_frame(AVFormatContext *s, int stream_index, int64_t timestamp, int flags) {
+  if (!fake_byte_seek) return -1;
+  auto f = (FakeFormat *)s;
+  f->next = timestamp / 1000;
+  f->junk = true;
+  return 0;
+}
+
+AVCodec *avcodec_find_decoder(enum AVCodecID id) { return (AVCodec *)1; }
+
+AVCodecContext *avcodec_alloc_context3(const AVCodec *codec) {
+  auto c = new FakeCodec;
+  c->ctx.width = FAKE_WIDTH;
+  c->ctx.height = FAKE_HEIGHT;
+  return &c->ctx;
+}
+
+int avcodec_parameters_to_context(AVCodecContext *codec, const AVCodecParameters *par) { return 0; }
+int avcodec_open2(AVCodecContext *avctx, const AVCodec *codec, AVDictionary **options) { return 0; }
+void avcodec_free_context(AVCodecContext **avctx) {
+  delete (FakeCodec *)*avctx;
+  *avctx = nullptr;
+}
+
+void avcodec_flush_buffers(AVCodecContext *avctx) {
+  auto c = (FakeCodec *)avctx;
+  c->has_ref = c->draining = false;
+  c->pending.clear();
+}
+
+int avcodec_send_packet(AVCodecContext *avctx, const AVPacket *avpkt) {
+  auto c = (FakeCodec *)avctx;
+  if (!avpkt) {
+    c->draining = true;
+    return 0;
+  }
+  if (avpkt->size == 7) fake_junk_decoded++;
+  // streams without keyframes are only decoded from the start
+  c->has_ref |= (avpkt->flags & AV_PKT_FLAG_KEY) || avpkt->pts == 0;
+  if (!c->has_ref) return AVERROR_INVALIDDATA;
+  c->pending.push_back(avpkt->pts);
+  return 0;
+}
+
+int avcodec_receive_frame(AVCodecContext *avctx, AVFrame *frame) {
+  auto c = (FakeCodec *)avctx;
+  if (c->pending.empty()) return c->draining ? AVERROR_EOF : AVERROR(EAGAIN);
+  if (c->pending.size() < 2 && !c->draining) return AVERROR(EAGAIN);
+
+  frame->pts = c->pending.front();
+  c->pending.pop_front();
+  frame->width = FAKE_WIDTH;
+  frame->height = FAKE_HEIGHT;
+  std::fill(c->buf.begin(), c->buf.end(), 0);
+  memcpy(c->buf.data(), &frame->pts, sizeof(frame->pts));
+  frame->data[0] = c->buf.data();
+  frame->data[1] = frame->data[0] + FAKE_WIDTH * FAKE_HEIGHT;
+  frame->data[2] = frame->data[1] + FAKE_WIDTH * FAKE_HEIGHT / 4;
+  frame->linesize[0] = FAKE_WIDTH;
+  frame->linesize[1] = frame->linesize[2] = FAKE_WIDTH / 2;
+  return 0;
+}
+
+AVFrame *av_frame_alloc(void) { return new AVFrame(); }
+void av_frame_free(AVFrame **frame) {
+  delete *frame;
+  *frame = nullptr;
+}
+AVPacket *av_packet_alloc(void) { return new AVPacket(); }
+void av_packet_free(AVPacket **pkt) {
+  delete *pkt;
+  *pkt = nullptr;
+}
+void av_packet_unref(AVPacket *pkt) {}
+
+}  // extern "C"
+
+static int64_t frame_index(const FrameReader::YUVFrame &frame) {
+  int64_t idx = -1;
+  if (frame) memcpy(&idx, frame->data(), sizeof(idx));
+  return idx;
+}
+
+TEST_CASE("FrameReader decodes every frame") {
+  fake_junk_decoded = 0;
+  fake_gop = GENERATE(20, 7, 0, 300);
+  fake_byte_seek = GENERATE(true, false);
+  const int cache_size = GENERATE(60, 10, 3);
+  const int threads = GENERATE(1, 2, 4);
+  fake_frames = 300;
+  fake_read_error = -1;
+
+  FrameReader fr(cache_size, threads);
+  REQUIRE(fr.load("fake.hevc"));
+  REQUIRE(fr.getFrameCount() == fake_frames);
+  REQUIRE(fr.width == FAKE_WIDTH);
+  REQUIRE(fr.height == FAKE_HEIGHT);
+
+  SECTION("in order") {
+    for (int i = 0; i < fake_frames; i++) {
+      REQUIRE(frame_index(fr.get(i).get()) == i);
+    }
+  }
+  SECTION("random seeks") {
+    std::mt19937 rng(fake_gop);
+    for (int k = 0; k < 100; k++) {
+      const int i = rng() % fake_frames;
+      REQUIRE(frame_index(fr.get(i).get()) == i);
+    }
+  }
+  SECTION("backwards") {
+    for (int i = fake_frames - 1; i >= fake_frames - 50; i--) {
+      REQUIRE(frame_index(fr.get(i).get()) == i);
+    }
+  }
+  SECTION("blocking get") {
+    std::vector<uint8_t> yuv(fr.getYUVSize());
+    REQUIRE(fr.get(42, nullptr, yuv.data()));
+    int64_t idx;
+    memcpy(&idx, yuv.data(), sizeof(idx));
+    REQUIRE(idx == 42);
+  }
+  // the reader skips what's left of the previous packet after a byte seek
+  REQUIRE(fake_junk_decoded == 0);
+}
+
+TEST_CASE("FrameReader end of stream") {
+  fake_gop = 20;
+  fake_byte_seek = true;
+  fake_frames = 50;
+  fake_read_error = -1;
+
+  FrameReader fr(10, 2);
+  REQUIRE(fr.load("fake.hevc"));
+  // the last frames come out when the decoder is drained
+  REQUIRE(frame_index(fr.get(fake_frames - 1).get()) == fake_frames - 1);
+  REQUIRE(fr.get(fake_frames).get() == nullptr);
+  REQUIRE(fr.get(-1).get() == nullptr);
+  REQUIRE_FALSE(fr.get(fake_frames, nullptr, nullptr));
+  // and the decoder that was drained starts over for what comes before
+  REQUIRE(frame_index(fr.get(fake_frames - 2).get()) == fake_frames - 2);
+  REQUIRE(frame_index(fr.get(0).get()) == 0);
+}
+
+TEST_CASE("FrameReader read errors") {
+  fake_gop = 20;
+  fake_byte_seek = true;
+  fake_frames = 50;
+
+  SECTION("empty stream") {
+    fake_read_error = -1;
+    fake_frames = 0;
+    FrameReader fr;
+    REQUIRE_FALSE(fr.load("fake.hevc"));
+    REQUIRE_FALSE(fr.valid());
+    REQUIRE(fr.get(0).get() == nullptr);
+  }
+  SECTION("error before the end") {
+    fake_read_error = 30;
+    FrameReader fr;
+    REQUIRE_FALSE(fr.load("fake.hevc"));
+    REQUIRE(fr.get(0).get() == nullptr);
+  }
+  SECTION("error after loading") {
+    fake_read_error = -1;
+    FrameReader fr(10, 1);
+    REQUIRE(fr.load("fake.hevc"));
+    REQUIRE(frame_index(fr.get(5).get()) == 5);
+    // the decoder fails its chunk, the frames are null instead of hanging
+    fake_read_error = 25;
+    REQUIRE(fr.get(25).get() == nullptr);
+    // the chunks before it still decode
+    REQUIRE(frame_index(fr.get(15).get()) == 15);
+  }
+}
+
+TEST_CASE("FrameReader destroyed with chunks queued") {
+  fake_gop = 20;
+  fake_byte_seek = GENERATE(true, false);
+  fake_frames = 300;
+  fake_read_error = -1;
+
+  std::vector<std::shared_future<FrameReader::YUVFrame>> frames;
+  {
+    FrameReader fr(60, 2);
+    REQUIRE(fr.load("fake.hevc"));
+    for (int i : {5, 150, 280, 60, 200}) {
+      frames.push_back(fr.get(i));
+    }
+  }
+  // every frame was either decoded or failed, nothing is left waiting
+  for (auto &f : frames) {
+    REQUIRE(f.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    const FrameReader::YUVFrame frame = f.get();
+    REQUIRE((frame == nullptr || frame_index(frame) >= 0));
+  }
+}
@@ -15,20 +15,39 @@
 #define BACKLIGHT_OFFROAD 75
 
 
-// Projects a point in car to space to the corresponding point in full frame
-// image space.
-static bool calib_frame_to_full_frame(const UIState *s, float in_x, float in_y, float in_z, vertex_data *out) {
-  const float margin = 500.0f;
-  const vec3 pt = (vec3){{in_x, in_y, in_z}};
-  const vec3 Ep = matvecmul3(s->scene.view_from_calib, pt);
-  const vec3 KEp = matvecmul3(s->wide_camera ? ecam_intrinsic_matrix : fcam_intrinsic_matrix, Ep);
+static void update_projection(UIState *s) {
+  const mat3 &intrinsics = s->wide_camera ? ecam_intrinsic_matrix : fcam_intrinsic_matrix;
+  const float *t = s->car_space_transform;
+  const mat3 screen_from_full_frame = {{
+    t[0], t[2], t[4],
+    t[1], t[3], t[5],
+    0.0f, 0.0f, 1.0f,
+  }};
+  s->scene.screen_from_calib = matmul3(screen_from_full_frame, matmul3(intrinsics, s->scene.view_from_calib));
+}
 
-  // Project.
-  float x = KEp.v[0] / KEp.v[2];
-  float y = KEp.v[1] / KEp.v[2];
+// Projects n points in car space to the corresponding points in full frame
+// image space. Points too far outside of the frame are left out, returns the
+// number of vertices written to out.
+static int calib_frame_to_full_frame(const UIState *s, int n, const float *in_x, const float *in_y, const float *in_z, vertex_data *out) {
+  const float margin = 500.0f;
+  const float *m = s->scene.screen_from_calib.v;
+  assert(n <= TRAJECTORY_SIZE * 2);
+
+  // no branches, so this vectorizes
+  float px[TRAJECTORY_SIZE * 2], py[TRAJECTORY_SIZE * 2];
+  for (int i = 0; i < n; i++) {
+    const float w = m[6] * in_x[i] + m[7] * in_y[i] + m[8] * in_z[i];
+    px[i] = (m[0] * in_x[i] + m[1] * in_y[i] + m[2] * in_z[i]) / w;
+    py[i] = (m[3] * in_x[i] + m[4] * in_y[i] + m[5] * in_z[i]) / w;
+  }
 
-  nvgTransformPoint(&out->x, &out->y, s->car_space_transform, x, y);
-  return out->x >= -margin && out->x <= s->fb_w + margin && out->y >= -margin && out->y <= s->fb_h + margin;
+  int cnt = 0;
+  for (int i = 0; i < n; i++) {
+    out[cnt] = {px[i], py[i]};
+    cnt += px[i] >= -margin && px[i] <= s->fb_w + margin && py[i] >= -margin && py[i] <= s->fb_h + margin;
+  }
+  return cnt;
 }
 
 static int get_path_length_idx(const cereal::ModelDataV2::XYZTData::Reader &line, const float path_height) {
@@ -45,8 +64,10 @@ static void update_leads(UIState *s, const cereal::ModelDataV2::Reader &model) {
   auto model_position = model.getPosition();
   for (int i = 0; i < 2; ++i) {
     if (leads[i].getProb() > 0.5) {
-      float z = model_position.getZ()[get_path_length_idx(model_position, leads[i].getX()[0])];
-      calib_frame_to_full_frame(s, leads[i].getX()[0], leads[i].getY()[0], z + 1.22, &s->scene.lead_vertices[i]);
+      const float x = leads[i].getX()[0], y = leads[i].getY()[0];
+      const float z = model_position.getZ()[get_path_length_idx(model_position, x)] + 1.22;
+      // drawn even when outside of the frame, clamped to its edge
+      calib_frame_to_full_frame(s, 1, &x, &y, &z, &s->scene.lead_vertices[i]);
     }
   }
 }
@@ -54,15 +75,16 @@ static void update_leads(UIState *s, const cereal::ModelDataV2::Reader &model) {
 static void update_line_data(const UIState *s, const cereal::ModelDataV2::XYZTData::Reader &line,
                              float y_off, float z_off, line_vertices_data *pvd, int max_idx) {
   const auto line_x = line.getX(), line_y = line.getY(), line_z = line.getZ();
-  vertex_data *v = &pvd->v[0];
-  for (int i = 0; i <= max_idx; i++) {
-    v += calib_frame_to_full_frame(s, line_x[i], line_y[i] - y_off, line_z[i] + z_off, v);
+  // out along the left side of the line and back along the right side
+  const int n = max_idx + 1;
+  float x[TRAJECTORY_SIZE * 2], y[TRAJECTORY_SIZE * 2], z[TRAJECTORY_SIZE * 2];
+  for (int i = 0; i < n; i++) {
+    x[i] = x[2 * n - 1 - i] = line_x[i];
+    y[i] = line_y[i] - y_off;
+    y[2 * n - 1 - i] = line_y[i] + y_off;
+    z[i] = z[2 * n - 1 - i] = line_z[i] + z_off;
   }
-  for (int i = max_idx; i >= 0; i--) {
-    v += calib_frame_to_full_frame(s, line_x[i], line_y[i] + y_off, line_z[i] + z_off, v);
-  }
-  pvd->cnt = v - pvd->v;
-  assert(pvd->cnt <= std::size(pvd->v));
+  pvd->cnt = calib_frame_to_full_frame(s, 2 * n, x, y, z, pvd->v);
 }
 
 static void update_model(UIState *s, const cereal::ModelDataV2::Reader &model) {
@@ -112,13 +134,9 @@ static void update_state(UIState *s) {
     scene.engageable = cs.getEngageable() || cs.getEnabled();
     scene.dm_active = sm["driverMonitoringState"].getDriverMonitoringState().getIsActiveMode();
   }
-  if (sm.updated("modelV2") && s->vg) {
-    auto model = sm["modelV2"].getModelV2();
-    update_model(s, model);
-    update_leads(s, model);
-  }
   if (sm.updated("liveCalibration")) {
     scene.world_objects_visible = true;
+    s->projection_dirty = true;
     auto rpy_list = sm["liveCalibration"].getLiveCalibration().getRpyCalib();
     Eigen::Vector3d rpy;
     rpy << rpy_list[0], rpy_list[1], rpy_list[2];
@@ -134,6 +152,17 @@ static void update_state(UIState *s) {
       }
     }
   }
+  // the vertices are kept until the model, calibration or frame size changes
+  const bool projection_changed = s->projection_dirty && s->fb_w > 0;
+  if (projection_changed) {
+    update_projection(s);
+    s->projection_dirty = false;
+  }
+  if ((sm.updated("modelV2") || projection_changed) && sm.rcv_frame("modelV2") > 0 && s->fb_w > 0) {
+    auto model = sm["modelV2"].getModelV2();
+    update_model(s, model);
+    update_leads(s, model);
+  }
   if (sm.updated("pandaStates")) {
     auto pandaStates = sm["pandaStates"].getPandaStates();
     if (pandaStates.size() > 0) {
@@ -220,6 +249,7 @@ static void update_status(UIState *s) {
       s->scene.started_frame = s->sm->frame;
       s->scene.end_to_end = Params().getBool("EndToEndToggle");
       s->wide_camera = Hardware::TICI() ? Params().getBool("EnableWideCamera") : false;
+      s->projection_dirty = true;
     }
     // Invisible until we receive a calibration message.
     s->scene.world_objects_visible = false;
@@ -247,11 +277,19 @@ QUIState::QUIState(QObject *parent) : QObject(parent) {
 }
 
 void QUIState::update() {
+  const UIStatus prev_status = ui_state.status;
+  const bool prev_is_metric = ui_state.scene.is_metric;
+
   update_params(&ui_state);
   update_sockets(&ui_state);
   update_state(&ui_state);
   update_status(&ui_state);
 
+  ui_state.scene_changed = ui_state.status != prev_status || ui_state.scene.is_metric != prev_is_metric;
+  for (auto name : {"modelV2", "controlsState", "liveCalibration", "carState", "carParams", "driverMonitoringState", "jvePilotState"}) {
+    ui_state.scene_changed |= ui_state.sm->updated(name);
+  }
+
   if (ui_state.scene.started != started_prev || ui_state.sm->frame == 1) {
     started_prev = ui_state.scene.started;
     emit offroadTransition(!ui_state.scene.started);
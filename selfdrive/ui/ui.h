@@ -99,6 +99,8 @@ typedef struct {
 typedef struct UIScene {
 
   mat3 view_from_calib;
+  // view_from_calib, the camera intrinsics and car_space_transform in one
+  mat3 screen_from_calib;
   bool world_objects_visible;
 
   cereal::PandaState::PandaType pandaType;
@@ -146,6 +148,11 @@ typedef struct UIState {
 
   float car_space_transform[6];
   bool wide_camera;
+
+  // screen_from_calib needs updating, after a new calibration or a resize
+  bool projection_dirty;
+  // something ui_draw shows changed in the last update
+  bool scene_changed;
 } UIState;
 
 